@@ -10,13 +10,20 @@ typedef struct {
   char *wm_class;   // e.g., "gnome-terminal-server"
   char *exe_path;   // e.g., "/usr/bin/gnome-terminal-server"
   char *title;      // e.g., "Terminal"
+  char *toolkit;    // e.g., "GTK"; only known through AT-SPI
 } AppIdentity;
 
 void cheeter_app_identity_free(AppIdentity *id);
+AppIdentity *cheeter_app_identity_copy(const AppIdentity *id);
 
 // Declarations for hotkey callback
 typedef void (*CheeterHotkeyCallback)(void *user_data);
 
+// Called when the active application changes (focus or title), so callers
+// can do their own work ahead of the hotkey. id is owned by the backend.
+typedef void (*CheeterActiveAppCallback)(const AppIdentity *id,
+                                         void *user_data);
+
 typedef struct CheeterBackend CheeterBackend;
 
 struct CheeterBackend {
@@ -26,6 +33,10 @@ struct CheeterBackend {
   bool (*init)(CheeterBackend *self, const char *hotkey_str,
                CheeterHotkeyCallback cb, void *user_data);
   AppIdentity *(*get_active_app)(CheeterBackend *self);
+  // Optional. Invokes cb right away if an identity is already known.
+  void (*set_active_app_callback)(CheeterBackend *self,
+                                  CheeterActiveAppCallback cb,
+                                  void *user_data);
   void (*cleanup)(CheeterBackend *self);
 
   // Internal state
@@ -34,6 +45,6 @@ struct CheeterBackend {
 
 // Factory methods
 CheeterBackend *cheeter_backend_x11_new(void);
-// CheeterBackend *cheeter_backend_wayland_new(void);
+CheeterBackend *cheeter_backend_wayland_new(void);
 
 #endif
@@ -0,0 +1,63 @@
+#ifndef CHEETER_BUNDLE_H
+#define CHEETER_BUNDLE_H
+
+#include <glib.h>
+#include <stdbool.h>
+
+// A sheet bundle packs many sheets into one file: a header, a record per
+// sheet with its page count and first page size, a string table of names,
+// then the sheet files themselves, each on its own page. It is read
+// through one read-only mapping, so every cheeterd on a machine shares the
+// same page cache for it.
+//
+// A bundle in a sheet root indexes like a directory: the sheet named
+// "git/git.pdf" in /usr/share/cheeter/sheets/team.sheets has the path
+// /usr/share/cheeter/sheets/team.sheets/git/git.pdf.
+#define CHEETER_BUNDLE_EXT ".sheets"
+
+typedef struct SheetBundle SheetBundle;
+
+typedef struct {
+  const char *name; // Inside the bundle, '/' separated; points into it
+  goffset size;
+  guint n_pages; // 0 if unknown
+  double page_width;
+  double page_height;
+} BundleSheet;
+
+// Maps the bundle at path. Opening a bundle already open, and unchanged on
+// disk since, returns the same mapping. NULL with error if path isn't a
+// valid bundle. Thread-safe.
+SheetBundle *cheeter_bundle_open(const char *path, GError **error);
+SheetBundle *cheeter_bundle_ref(SheetBundle *bundle);
+void cheeter_bundle_unref(SheetBundle *bundle);
+
+// mtime of the bundle file when mapped, ns
+gint64 cheeter_bundle_get_mtime(SheetBundle *bundle);
+guint cheeter_bundle_get_n_sheets(SheetBundle *bundle);
+void cheeter_bundle_get_sheet(SheetBundle *bundle, guint i, BundleSheet *out);
+// The file of sheet i, without copying: the bytes point into the mapping
+// and keep it alive
+GBytes *cheeter_bundle_get_bytes(SheetBundle *bundle, guint i);
+
+// For a path of the form BUNDLE/NAME, the open bundle and NAME's index in
+// it. FALSE if path doesn't lie in a bundle, or the bundle has no NAME.
+bool cheeter_bundle_lookup(const char *path, SheetBundle **bundle,
+                           guint *index);
+
+// One sheet to pack: name inside the bundle, the file to copy in, and its
+// page metadata
+typedef struct {
+  const char *name;
+  const char *file;
+  guint n_pages;
+  double page_width;
+  double page_height;
+} BundleInput;
+
+// Writes sheets (BundleInput, any order) to a new bundle at path, replacing
+// it atomically
+bool cheeter_bundle_write(const char *path, const BundleInput *sheets,
+                          guint n_sheets, GError **error);
+
+#endif
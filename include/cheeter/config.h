@@ -5,7 +5,7 @@
 
 typedef struct {
   char *hotkey;
-  char *sheets_dir; // Custom path to cheat sheets directory (NULL = default)
+  char *sheets_dir; // Custom sheet directories, ':' separated (NULL = default)
   double zoom_level;
   bool debug_log;
 } CheeterConfig;
@@ -0,0 +1,21 @@
+#ifndef CHEETER_DESKTOP_H
+#define CHEETER_DESKTOP_H
+
+// Index of installed .desktop entries in the XDG applications directories,
+// mapping window classes and executables to desktop ids. Built on a worker
+// thread and rebuilt when the directories change; monitors run on the GLib
+// main loop, lookups are thread-safe and never wait for a build.
+typedef struct DesktopIndex DesktopIndex;
+
+DesktopIndex *cheeter_desktop_index_new(void);
+void cheeter_desktop_index_free(DesktopIndex *index);
+
+// Desktop id (file name without ".desktop") for a window of class wm_class
+// running exe_path; either may be NULL. StartupWMClass wins, then the Exec
+// line, then a class matching a desktop id or Icon name. Interpreters and
+// wrappers (python3, java, electron...) never match by Exec. Returns NULL if
+// nothing matches or the index isn't built yet. Caller frees.
+char *cheeter_desktop_index_lookup(DesktopIndex *index, const char *wm_class,
+                                   const char *exe_path);
+
+#endif
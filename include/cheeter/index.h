@@ -2,21 +2,89 @@
 #define CHEETER_INDEX_H
 
 #include <glib.h>
+#include <stdbool.h>
 
+// A sheet, by id in SheetIndex.entries. The strings live in the index's
+// arena or in the cache image, and move only when the arena is compacted,
+// which bumps the generation.
 typedef struct {
-  char *path;
-  char *basename; // Lowercase, no extension
+  const char *path;
+  const char *basename; // Lowercase, no extension; interned, so sheets of
+                        // the same name share the pointer
+  gint64 mtime;         // Nanoseconds since the epoch
+  goffset size;
+  guint16 root;  // Rank among sheets of the same name: earlier root, then
+  guint16 depth; // shallower directory, then path order wins
+  bool live;     // False for a freed slot, kept for reuse
+  bool visible;  // The sheet its basename resolves to
+  guint16 n_pages;   // 0 if the sheet couldn't be read; clamped
+  float page_width;  // First page, in PDF points or image pixels
+  float page_height;
 } SheetEntry;
 
+typedef struct SheetWatch SheetWatch;
+typedef struct FuzzyIndex FuzzyIndex;
+typedef struct SheetTable SheetTable;
+
 typedef struct {
-  GHashTable *sheets_by_basename; // char* -> SheetEntry*
-  GList *all_sheets;              // List of SheetEntry*
+  GArray *entries;       // SheetEntry, shadowed ones too
+  GArray *free_ids;      // guint32, dead slots of entries
+  guint n_visible;
+  GStringChunk *strings; // Paths and names of the entries not mapped
+  gsize strings_live;    // Bytes of strings in use, arena and image
+  gsize strings_dead;    // Bytes left behind by removed sheets
+  SheetTable *names;     // Interned basename -> visible entry
+  SheetTable *paths;     // Path -> entry
+  GPtrArray *roots;      // char*, indexed by SheetEntry.root
+  GRWLock lock;          // Guards the above against changes while watching
+  SheetWatch *watch;     // Directories scanned, and their monitors
+  char *cache_path;      // NULL if the index isn't persisted
+  GMappedFile *image;    // Cache loaded at startup, while strings point in
+  guint generation;      // Bumped whenever entries come, go or move
+  FuzzyIndex *fuzzy;     // Trigrams of the visible names, NULL until scanned
 } SheetIndex;
 
+// Called on the main loop after a batch of changes has been applied. paths
+// are sheets added, removed or rewritten; names are basenames now resolving
+// to a different sheet (or none). Both are NULL-terminated.
+typedef void (*SheetIndexChangedFunc)(const char *const *paths,
+                                      const char *const *names,
+                                      gpointer user_data);
+
 SheetIndex *cheeter_index_new(void);
 void cheeter_index_free(SheetIndex *index);
+// Persists the index to cache_path, and lets the next scan_roots for the
+// same roots start from it: the sheets are mapped in as they were, and only
+// directories whose mtime changed are read again, from the main loop once
+// it is idle. Call before scanning.
+void cheeter_index_set_cache(SheetIndex *index, const char *cache_path);
+// Indexes every sheet under roots (NULL-terminated, most important first),
+// recursing into subdirectories on a thread pool. A name already indexed,
+// from an earlier root, or from a shallower directory of the same root,
+// hides later sheets of that name.
+void cheeter_index_scan_roots(SheetIndex *index, const char *const *roots);
 void cheeter_index_scan_dir(SheetIndex *index, const char *dir_path);
-const SheetEntry *cheeter_index_find_by_basename(SheetIndex *index,
-                                                 const char *basename);
+// Keeps the index up to date with every directory scanned, from the GLib main
+// loop. Bursts of changes (copying in a folder of sheets) are applied as one
+// batch, and only the paths they touch are rescanned.
+void cheeter_index_watch(SheetIndex *index, SheetIndexChangedFunc func,
+                         gpointer user_data);
+// Path of the sheet named basename, or NULL. Safe from any thread, also
+// while the index is being updated. Caller frees.
+char *cheeter_index_lookup(SheetIndex *index, const char *basename);
+// Page count and first page size of the indexed sheet at path, read when it
+// was scanned, so the overlay can be sized before the sheet is loaded. FALSE
+// if path isn't indexed or couldn't be read. Thread-safe.
+bool cheeter_index_page_size(SheetIndex *index, const char *path,
+                             guint *n_pages, double *width, double *height);
+// The index's generation, for telling whether results derived from it are
+// still current. Thread-safe.
+guint cheeter_index_get_generation(SheetIndex *index);
+// Path of the sheet whose name is most like name by trigram similarity, or
+// NULL if none reaches the confidence threshold. *score (may be NULL) gets
+// the similarity, 0 to 1. Thread-safe, and only reads the trigram index,
+// which is rebuilt as the sheets change. Caller frees.
+char *cheeter_index_lookup_fuzzy(SheetIndex *index, const char *name,
+                                 double *score);
 
 #endif
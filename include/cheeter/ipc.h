@@ -1,10 +1,24 @@
 #ifndef CHEETER_IPC_H
 #define CHEETER_IPC_H
 
+#include <glib.h>
 #include <stdbool.h>
 
-// Server side
-typedef void (*CheeterIpcCallback)(const char *command, void *user_data);
+// A request is one command line, followed, for the commands the server was
+// told take one, by body lines up to a line holding only ".". Body lines
+// starting with "." are sent with another "." in front, so none is mistaken
+// for the end.
+typedef struct CheeterIpcBody CheeterIpcBody;
+
+// Next line of the request's body, without the newline, or NULL at its end.
+// The whole body has been read by the time the callback runs. Commands that
+// take no body can ignore it. Caller frees.
+char *cheeter_ipc_body_next_line(CheeterIpcBody *body);
+
+// Server side. Returns the reply to send back, newline-terminated, which the
+// server frees; NULL replies "OK".
+typedef char *(*CheeterIpcCallback)(const char *command, CheeterIpcBody *body,
+                                    void *user_data);
 
 typedef struct CheeterIpcServer CheeterIpcServer;
 
@@ -15,11 +29,19 @@ void cheeter_ipc_server_start(
     CheeterIpcServer *server); // Non-blocking if integrated with main loop, or
                                // blocking if simple
 void cheeter_ipc_server_free(CheeterIpcServer *server);
+// Requests for command carry a body, read before the callback is called
+void cheeter_ipc_server_add_body_command(CheeterIpcServer *server,
+                                         const char *command);
 // For now, let's assume we integrate with GMainLoop since we use glib heavily
 void cheeter_ipc_server_attach_to_mainloop(CheeterIpcServer *server);
 
 // Client side
 bool cheeter_ipc_client_send(const char *socket_path, const char *message,
                              char **response_out);
+// Sends message with lines (n of them, without newlines) as its body over
+// the one connection, and reads the reply
+bool cheeter_ipc_client_send_body(const char *socket_path, const char *message,
+                                  char *const *lines, guint n_lines,
+                                  char **response_out);
 
 #endif
@@ -1,20 +1,77 @@
 #ifndef CHEETER_MAPPING_H
 #define CHEETER_MAPPING_H
 
-#include <glib.h>
+#include <gio/gio.h>
+#include <stdbool.h>
+
+// A compiled, read-only app_key -> sheet_path table, for mapping sets too
+// large to parse at every start. It is a minimal perfect hash over the keys
+// with the strings behind it, used straight from a read-only mapping.
+// Written by `cheeter compile-mappings`.
+typedef struct MappingTable MappingTable;
+
+MappingTable *cheeter_mapping_table_open(const char *path, GError **error);
+void cheeter_mapping_table_free(MappingTable *table);
+guint cheeter_mapping_table_size(MappingTable *table);
+// The i-th mapping, in no particular order; both point into the mapping
+void cheeter_mapping_table_get(MappingTable *table, guint i, const char **key,
+                               const char **sheet_path);
+// Points into the mapping; valid until the table is freed
+const char *cheeter_mapping_table_lookup(MappingTable *table,
+                                         const char *app_key);
+// Compiles the TSV mappings at tsv_path into a table at out_path, replacing
+// it atomically. The number of mappings in it goes to *n_mappings.
+bool cheeter_mapping_table_compile(const char *tsv_path, const char *out_path,
+                                   guint *n_mappings, GError **error);
 
 // Simple key-value store: app_key -> sheet_path
+//
+// An optional compiled table sits behind the map: keys the map lacks are
+// looked up in it, and sets only ever go to the map.
+//
+// On disk it is a snapshot, file_path, plus a journal beside it that every
+// set appends one line to. Loading replays the journal over the snapshot;
+// a while after the last set the map is written out as a new snapshot in
+// the background and the journal emptied. Changes happen on the main thread
+// only; lookups are safe from any thread.
 typedef struct {
   GHashTable *map; // char* (key) -> char* (value)
+  GRWLock lock;    // Guards map and table against lookups off the main thread
   char *file_path;
+  char *journal_path;
+  int journal_fd;   // Open for appending, -1 if it can't be
+  guint64 appended; // Journal records written, ever
+  guint64 saved;    // How many of them the newest snapshot includes
+  guint compact_source;
+  GCancellable *compacting; // Set while a snapshot is being written
+  MappingTable *table;      // Compiled base, or NULL
+  gint generation;          // Bumped by every change; atomic
 } MappingStore;
 
 MappingStore *cheeter_mapping_load(const char *file_path);
+// Writes the snapshot now and empties the journal
 void cheeter_mapping_save(MappingStore *store);
 void cheeter_mapping_free(MappingStore *store);
+// Puts the table compiled at table_path behind the map, if there is one
+void cheeter_mapping_attach_table(MappingStore *store,
+                                  const char *table_path);
 
-const char *cheeter_mapping_get(MappingStore *store, const char *app_key);
+// Sheet app_key maps to, or NULL. Caller frees.
+char *cheeter_mapping_get(MappingStore *store, const char *app_key);
+// Changes whenever a mapping may have; safe from any thread
+guint cheeter_mapping_get_generation(MappingStore *store);
+// Calls func(key, sheet_path) for every mapping, compiled ones included
+// unless the map overrides them. Main thread only.
+void cheeter_mapping_foreach(MappingStore *store, GHFunc func,
+                             gpointer user_data);
 void cheeter_mapping_set(MappingStore *store, const char *app_key,
                          const char *sheet_path);
+// Sets n mappings as one change: lookups see none or all of them, and they
+// reach the journal in one write, replayed whole or not at all. Mappings
+// with an empty key or sheet, a tab in the key or a newline are skipped.
+// Returns how many were set.
+guint cheeter_mapping_set_many(MappingStore *store,
+                               const char *const *app_keys,
+                               const char *const *sheet_paths, guint n);
 
 #endif
@@ -7,6 +7,7 @@ void cheeter_set_data_dir_override(const char *path);
 
 char *cheeter_get_config_dir(void);
 char *cheeter_get_data_dir(void);
+char *cheeter_get_cache_dir(void);
 char *cheeter_get_runtime_dir(void);
 char *cheeter_get_socket_path(void);
 
@@ -0,0 +1,104 @@
+#ifndef CHEETER_PROC_H
+#define CHEETER_PROC_H
+
+#include <dirent.h>
+#include <glib.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+// All procfs access goes through these, so the resolver can be pointed at a
+// synthetic tree (tools/proc_bench) and its I/O counted.
+// Root of the tree, "/proc" by default. Set it before any lookups.
+void cheeter_proc_set_root(const char *root);
+const char *cheeter_proc_get_root(void);
+// snprintf of "<root>/" followed by fmt
+int cheeter_proc_path(char *buf, size_t size, const char *fmt, ...)
+    G_GNUC_PRINTF(3, 4);
+// Single read; procfs files like stat fit in one
+ssize_t cheeter_proc_read_file(const char *path, char *buf, size_t size);
+// Reads until EOF or buf is full; environ/children come a page at a time
+ssize_t cheeter_proc_read_file_full(const char *path, char *buf, size_t size);
+// Whole file, NUL-terminated, or NULL
+char *cheeter_proc_read_contents(const char *path, gsize *len);
+// Target of /proc/<pid>/exe, or NULL
+char *cheeter_proc_read_exe(pid_t pid);
+DIR *cheeter_proc_opendir(const char *path);
+
+// Syscalls made through the functions above since the last reset
+typedef struct {
+  guint opens;
+  guint reads;
+  guint readlinks;
+  guint opendirs;
+} ProcIoStats;
+
+void cheeter_proc_get_io_stats(ProcIoStats *out);
+void cheeter_proc_reset_io_stats(void);
+
+// Fields of interest from /proc/<pid>/stat
+typedef struct {
+  pid_t pid;
+  pid_t ppid;
+  pid_t pgrp;
+  int tty_nr;
+  pid_t tpgid;
+  unsigned long long starttime; // Clock ticks after boot, fixed for a pid's
+                                // lifetime, so (pid, starttime) is unique
+} ProcStat;
+
+bool cheeter_proc_read_stat(pid_t pid, ProcStat *out);
+
+// Direct children of pid, read from /proc/<pid>/task/<tid>/children.
+// Returns NULL if the kernel does not provide children files
+// (CONFIG_PROC_CHILDREN unset) or the process is gone.
+GArray *cheeter_proc_list_children(pid_t pid); // GArray of pid_t
+bool cheeter_proc_children_files_supported(void);
+
+// If pid sits on a terminal, the leader of that terminal's foreground process
+// group, and its pgrp in *fg_pgrp (may be NULL). That is pid itself when its
+// own group is in the foreground (a shell at its prompt, whatever runs in the
+// background). Returns 0 if the terminal says nothing useful.
+pid_t cheeter_proc_foreground_job(pid_t pid, pid_t *fg_pgrp);
+
+// Application id (desktop file name without ".desktop") of the systemd scope
+// or service pid was launched in, read from /proc/<pid>/cgroup, or from
+// .flatpak-info for Flatpak apps without one. Sets *sandboxed for Flatpak and
+// Snap apps, whose exe is a sandbox helper and whose children live in their
+// own pid namespace. Returns NULL if pid wasn't launched as an app.
+char *cheeter_proc_read_app_id(pid_t pid, bool *sandboxed);
+
+// In-memory process tree kept current from fork/exit events delivered by the
+// netlink proc connector, so descending it costs no I/O. The connector needs
+// CAP_NET_ADMIN; without it the tree falls back to periodic /proc rescans,
+// but only on kernels lacking children files (those are cheaper and fresher).
+// Event handling runs on the GLib main loop; lookups are thread-safe.
+typedef struct ProcTree ProcTree;
+
+ProcTree *cheeter_proc_tree_new(void);
+void cheeter_proc_tree_free(ProcTree *tree);
+// True if the tree is being kept up to date by either mechanism
+bool cheeter_proc_tree_is_tracking(ProcTree *tree);
+// Children of pid (possibly empty), or NULL if pid is not in the tree
+GArray *cheeter_proc_tree_get_children(ProcTree *tree, pid_t pid);
+
+// Resolves "which process inside this window is the user looking at".
+// Keeps a cache of WINDOWID environ lookups keyed by (pid, starttime) across
+// calls, so repeated hotkey presses don't re-read environ files.
+// Not thread-safe: callers serialize use of a resolver.
+typedef struct ProcResolver ProcResolver;
+
+ProcResolver *cheeter_proc_resolver_new(void);
+void cheeter_proc_resolver_free(ProcResolver *resolver);
+// Descend through tree instead of /proc while it is tracking (may be NULL)
+void cheeter_proc_resolver_set_tree(ProcResolver *resolver, ProcTree *tree);
+
+// Returns the deepest descendant of start_pid, descending the branch whose
+// WINDOWID matches window_id if there is one (0 = no preference). Once the
+// walk reaches a process on a terminal (a shell), it jumps to that terminal's
+// foreground job via tpgid and stays inside its process group.
+// Returns 0 if start_pid has no children.
+pid_t cheeter_proc_resolver_deepest_child(ProcResolver *resolver,
+                                          pid_t start_pid,
+                                          unsigned long window_id);
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef CHEETER_RESOLVE_H
+#define CHEETER_RESOLVE_H
+
+#include "cheeter/index.h"
+#include "cheeter/mapping.h"
+#include <glib.h>
+#include <stdbool.h>
+
+// Sheet explicitly mapped to app_key ("exe:vim",
+// "desktop:org.gnome.Terminal"), or NULL. Caller frees.
+char *cheeter_resolve_mapped(MappingStore *store, const char *app_key);
+// The indexed sheet named after app_key, or NULL. A guess, so callers try
+// every key's mapping first. Caller frees.
+char *cheeter_resolve_indexed(SheetIndex *index, const char *app_key);
+// Last resort once no key resolved exactly: the sheet named most like one
+// of app_key's names. Caller frees.
+char *cheeter_resolve_sheet_fuzzy(SheetIndex *index, const char *app_key,
+                                  double *score);
+
+// Results of whole resolutions, found and not found, by identity. Each is
+// tagged with the index and mapping generations it was computed under, so
+// a rescan or a mapping edit makes the results before it miss without
+// anything being flushed. Thread-safe.
+typedef struct ResolveCache ResolveCache;
+
+typedef struct {
+  char *sheet;        // NULL if nothing matched
+  char *fallback_key; // Exe or class key tried after a desktop id
+  bool fuzzy;         // sheet only resembles the app's names
+} ResolveResult;
+
+ResolveCache *cheeter_resolve_cache_new(void);
+void cheeter_resolve_cache_free(ResolveCache *cache);
+// Fills out (caller frees with cheeter_resolve_result_clear) if key has a
+// result computed under these generations
+bool cheeter_resolve_cache_lookup(ResolveCache *cache, const char *key,
+                                  guint index_generation,
+                                  guint store_generation,
+                                  ResolveResult *out);
+// Records result, which took probe_us to work out
+void cheeter_resolve_cache_insert(ResolveCache *cache, const char *key,
+                                  guint index_generation,
+                                  guint store_generation,
+                                  const ResolveResult *result,
+                                  gint64 probe_us);
+// Hit rate and probe cost, as lines for the daemon's status
+void cheeter_resolve_cache_format_stats(ResolveCache *cache, GString *out);
+void cheeter_resolve_result_clear(ResolveResult *result);
+
+#endif
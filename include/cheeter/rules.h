@@ -0,0 +1,29 @@
+#ifndef CHEETER_RULES_H
+#define CHEETER_RULES_H
+
+#include "cheeter/backend.h"
+
+// Sheet rules read from a TSV file, one per line:
+//
+//   FIELD  MATCH  PATTERN  SHEET  [PRIORITY]
+//
+// FIELD is desktop, class, exe (basename) or title; MATCH is exact, glob
+// ('*' and '?') or contains. Matching ignores ASCII case. The highest
+// PRIORITY (default 0) wins, then exact over glob over contains, then the
+// earlier line.
+//
+// All patterns are compiled once per file version: a hash table per field
+// for exact keys, an Aho-Corasick automaton for substrings and one lazily
+// built DFA for all globs, so evaluating an identity is one pass over each
+// field whatever the number of rules. The file is watched from the GLib main
+// loop and recompiled when it changes; matching is thread-safe.
+typedef struct RuleEngine RuleEngine;
+
+// path need not exist yet
+RuleEngine *cheeter_rules_new(const char *path);
+void cheeter_rules_free(RuleEngine *engine);
+
+// SHEET of the best rule matching id, or NULL. Caller frees.
+char *cheeter_rules_match(RuleEngine *engine, const AppIdentity *id);
+
+#endif
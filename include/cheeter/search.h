@@ -0,0 +1,36 @@
+#ifndef CHEETER_SEARCH_H
+#define CHEETER_SEARCH_H
+
+#include "cheeter/index.h"
+#include <glib.h>
+
+// Full-text index over the PDF sheets of a SheetIndex, page by page. Text is
+// pulled with poppler on low-priority worker threads into an inverted index
+// that is saved to cache_path; at startup only sheets whose mtime or size
+// changed since are read again. Searching is thread-safe and answers from
+// whatever has been read so far.
+typedef struct TextIndex TextIndex;
+
+typedef struct {
+  char *path;
+  int page; // 0-based
+  double score;
+} SearchHit;
+
+TextIndex *cheeter_text_index_new(SheetIndex *sheets, const char *cache_path);
+void cheeter_text_index_free(TextIndex *index);
+
+// Reads paths again, or forgets those no longer sheets. Takes the paths of
+// a SheetIndexChangedFunc batch. Main thread only.
+void cheeter_text_index_update(TextIndex *index, const char *const *paths);
+
+// Up to max_hits pages mentioning the words of query, best first: pages
+// with every word ahead of those with only some, then by BM25 score.
+// SearchHit*; free with g_ptr_array_unref.
+GPtrArray *cheeter_text_index_search(TextIndex *index, const char *query,
+                                     guint max_hits);
+
+// Sheets queued or being read
+guint cheeter_text_index_pending(TextIndex *index);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef CHEETER_TMUX_H
+#define CHEETER_TMUX_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+// Keeps one tmux control-mode connection (tmux -C) per server socket and
+// follows its pane/window/session change notifications, so the pane each
+// tmux client is showing is known without spawning tmux per hotkey.
+// Connections are started and serviced on the GLib main loop; lookups are
+// thread-safe.
+typedef struct TmuxTracker TmuxTracker;
+
+TmuxTracker *cheeter_tmux_tracker_new(void);
+void cheeter_tmux_tracker_free(TmuxTracker *tracker);
+
+// True if pid is a tmux client (as opposed to the server or anything else)
+bool cheeter_tmux_is_client(pid_t pid);
+
+// pane_pid of the active pane in the session tmux client client_pid is
+// attached to. Returns 0 if that isn't known yet; the first lookup for a
+// server starts tracking it in the background.
+pid_t cheeter_tmux_tracker_active_pane(TmuxTracker *tracker, pid_t client_pid);
+
+#endif
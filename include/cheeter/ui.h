@@ -11,12 +11,28 @@ void cheeter_ui_quit(void);
 // If sheet_path is NULL, and currently hidden, show empty or default state.
 void cheeter_ui_toggle(const char *sheet_path);
 
+void cheeter_ui_show(const char *sheet_path);
+// Like cheeter_ui_show, for a sheet whose first page is known to measure
+// page_width x page_height (points or pixels): the window is sized and
+// mapped at once, and the sheet is drawn once it has loaded in the
+// background. Falls back to cheeter_ui_show if the size is unknown (<= 0).
+void cheeter_ui_show_sized(const char *sheet_path, double page_width,
+                           double page_height);
+void cheeter_ui_hide(void);
+gboolean cheeter_ui_is_visible(void);
+// The sheet file at sheet_path was added, removed or rewritten; reloads it
+// if it is on screen
+void cheeter_ui_sheet_changed(const char *sheet_path);
+
 // Set the base zoom level (config preference)
 void cheeter_ui_set_zoom_level(double zoom);
 
 // Helper to create the viewer widget
 GtkWidget *cheeter_viewer_new(void);
 void cheeter_viewer_load_file(GtkWidget *viewer, const char *path);
+// Loads path on a worker thread and shows it when done. Replaces what was
+// loaded, and cancels an earlier load still running.
+void cheeter_viewer_load_file_async(GtkWidget *viewer, const char *path);
 
 // Get the dimensions of the currently loaded page (returns FALSE if no page)
 gboolean cheeter_viewer_get_page_size(GtkWidget *viewer, double *width,
@@ -8,5 +8,18 @@ void cheeter_app_identity_free(AppIdentity *id) {
   g_free(id->wm_class);
   g_free(id->exe_path);
   g_free(id->title);
+  g_free(id->toolkit);
   g_free(id);
 }
+
+AppIdentity *cheeter_app_identity_copy(const AppIdentity *id) {
+  if (!id)
+    return NULL;
+  AppIdentity *copy = g_new0(AppIdentity, 1);
+  copy->desktop_id = g_strdup(id->desktop_id);
+  copy->wm_class = g_strdup(id->wm_class);
+  copy->exe_path = g_strdup(id->exe_path);
+  copy->title = g_strdup(id->title);
+  copy->toolkit = g_strdup(id->toolkit);
+  return copy;
+}
@@ -1,65 +1,745 @@
 #ifdef CHEETER_HAVE_ATSPI
-// This whole backend is conditional on AT-SPI support usually,
-// as pure Wayland protocols don't expose 'active window' trivially.
+// Pure Wayland protocols don't expose the 'active window', so this backend
+// follows focus through AT-SPI events instead. It speaks the AT-SPI D-Bus
+// protocol directly with GIO rather than through libatspi, whose getters are
+// synchronous: every lookup here is async on the main loop, and the hotkey
+// only ever reads what the last focus change left behind.
+//
+// Honours AT_SPI_BUS_ADDRESS like libatspi does, so it can be pointed at a
+// private bus with a stub application; see tools/atspi_check.c.
 
 #include "cheeter/backend.h"
+#include "cheeter/desktop.h"
 #include "cheeter/log.h"
+#include "cheeter/proc.h"
+#include <gio/gio.h>
 #include <glib.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// Delay before resolving after a focus change, so focus hopping between
+// widgets of one app, or across several apps, costs one refresh
+#define REFRESH_DELAY_MS 50
+
+#define ATSPI_ROOT_PATH "/org/a11y/atspi/accessible/root"
+#define ATSPI_REGISTRY_NAME "org.a11y.atspi.Registry"
+#define ATSPI_REGISTRY_PATH "/org/a11y/atspi/registry"
+
+// Events that say the user is now working in the sending application
+typedef struct {
+  const char *name; // As given to the registry
+  const char *interface;
+  const char *member;
+} AtspiEventSpec;
+
+static const AtspiEventSpec atspi_events[] = {
+    {"window:activate", "org.a11y.atspi.Event.Window", "Activate"},
+    {"focus:", "org.a11y.atspi.Event.Focus", "Focus"},
+    // What GTK 4 and Qt send instead of focus:
+    {"object:state-changed:focused", "org.a11y.atspi.Event.Object",
+     "StateChanged"},
+};
+
+#define ATSPI_EVENT_COUNT G_N_ELEMENTS(atspi_events)
+
+// What AT-SPI told us about one application. Main thread only.
+typedef struct {
+  char *name;    // Accessible name of the application, e.g. "gedit"
+  char *toolkit; // e.g. "GTK", "Qt", "Chromium"
+  pid_t pid;     // 0 until known
+  guint pending; // Lookups still in flight
+} AtspiApp;
+
+// The application in front, as handed to identity resolution
+typedef struct {
+  pid_t pid;
+  char *name;
+  char *toolkit;
+  char *title; // Name of the window last activated in it, if any
+} ActiveApp;
+
+typedef struct {
+  GDBusConnection *bus; // The accessibility bus, not the session bus
+  GCancellable *cancellable; // Cancelled on cleanup
+  guint event_subs[ATSPI_EVENT_COUNT];
+  guint owner_changed_sub;
+
+  // Main thread only
+  GHashTable *apps;     // unique bus name -> AtspiApp*
+  char *focus_bus_name; // Sender of the last focus event
+  char *focus_title;
+  guint refresh_source;
+
+  // Identity queries run on worker threads, like the hotkey's
+  GMutex query_lock; // Serializes proc
+  ProcTree *proc_tree;
+  ProcResolver *proc;
+  DesktopIndex *desktop;
+
+  GMutex lock; // Guards the fields below
+  ActiveApp active;     // pid 0 and no name: nothing focused yet
+  bool refresh_pending; // A refresh is scheduled or running
+  AppIdentity *cached_id;
+  pid_t cached_pid; // Process the identity was resolved to
+  bool cached_sandboxed;
+  unsigned long long cached_starttime;
+  guint n_refreshing; // Refresh tasks not yet done with priv
+  GCond refreshed;    // Signalled when n_refreshing drops to 0
+
+  CheeterActiveAppCallback active_app_cb;
+  void *active_app_user_data;
+} WaylandPrivate;
 
 // Forward declaration of factory function
 CheeterBackend *cheeter_backend_wayland_new(void);
 
+static void wayland_cleanup(CheeterBackend *self);
+static void wayland_schedule_refresh(WaylandPrivate *priv);
+
+static void active_app_clear(ActiveApp *app) {
+  g_free(app->name);
+  g_free(app->toolkit);
+  g_free(app->title);
+  memset(app, 0, sizeof(*app));
+}
+
+static void active_app_copy(ActiveApp *dst, const ActiveApp *src) {
+  dst->pid = src->pid;
+  dst->name = g_strdup(src->name);
+  dst->toolkit = g_strdup(src->toolkit);
+  dst->title = g_strdup(src->title);
+}
+
+static bool active_app_equal(const ActiveApp *a, const ActiveApp *b) {
+  return a->pid == b->pid && g_strcmp0(a->name, b->name) == 0 &&
+         g_strcmp0(a->title, b->title) == 0;
+}
+
+static void atspi_app_free(gpointer data) {
+  AtspiApp *app = (AtspiApp *)data;
+  g_free(app->name);
+  g_free(app->toolkit);
+  g_free(app);
+}
+
+// ---- Connecting ----
+
+// at-spi-bus-launcher hands out the accessibility bus address on the session
+// bus, unless AT_SPI_BUS_ADDRESS already names one
+static char *atspi_bus_address(void) {
+  const char *env = g_getenv("AT_SPI_BUS_ADDRESS");
+  if (env && *env)
+    return g_strdup(env);
+
+  GError *error = NULL;
+  GDBusConnection *session = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &error);
+  if (!session) {
+    LOG_ERROR("Could not connect to the session bus: %s", error->message);
+    g_error_free(error);
+    return NULL;
+  }
+
+  GVariant *reply = g_dbus_connection_call_sync(
+      session, "org.a11y.Bus", "/org/a11y/bus", "org.a11y.Bus", "GetAddress",
+      NULL, G_VARIANT_TYPE("(s)"), G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
+  g_object_unref(session);
+  if (!reply) {
+    LOG_ERROR("Could not get the AT-SPI bus address: %s", error->message);
+    g_error_free(error);
+    return NULL;
+  }
+  char *address = NULL;
+  g_variant_get(reply, "(s)", &address);
+  g_variant_unref(reply);
+  return address;
+}
+
+static void on_register_event_done(GObject *source, GAsyncResult *res,
+                                   gpointer user_data) {
+  char *event = (char *)user_data;
+  GError *error = NULL;
+  GVariant *reply =
+      g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+  if (reply) {
+    g_variant_unref(reply);
+  } else {
+    if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+      LOG_WARN("AT-SPI registry refused %s: %s", event, error->message);
+    g_error_free(error);
+  }
+  g_free(event);
+}
+
+// Toolkit bridges only send events somebody has registered for
+static void atspi_register_event(WaylandPrivate *priv, const char *event) {
+  g_dbus_connection_call(priv->bus, ATSPI_REGISTRY_NAME, ATSPI_REGISTRY_PATH,
+                         "org.a11y.atspi.Registry", "RegisterEvent",
+                         g_variant_new("(s)", event), NULL,
+                         G_DBUS_CALL_FLAGS_NONE, -1, priv->cancellable,
+                         on_register_event_done, g_strdup(event));
+}
+
+// ---- Application lookups ----
+
+typedef enum { LOOKUP_PID, LOOKUP_NAME, LOOKUP_TOOLKIT } LookupKind;
+
 typedef struct {
-  // DBus connection for AT-SPI
-  // GDBusConnection *bus;
+  WaylandPrivate *priv;
+  char *bus_name;
+  LookupKind kind;
+} AppLookup;
 
-  // AT-SPI specific state
-  // AtspiDeviceListener *listener;
+static void wayland_activate(WaylandPrivate *priv, const AtspiApp *app);
 
-  // Layer Shell state
-  // struct zwlr_layer_shell_v1 *layer_shell;
-} WaylandPrivate;
+static void on_app_lookup_done(GObject *source, GAsyncResult *res,
+                               gpointer user_data) {
+  AppLookup *lookup = (AppLookup *)user_data;
+  GError *error = NULL;
+  GVariant *reply =
+      g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res, &error);
+  if (!reply && g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+    // The backend is being torn down, priv may be gone
+    g_error_free(error);
+    g_free(lookup->bus_name);
+    g_free(lookup);
+    return;
+  }
+
+  WaylandPrivate *priv = lookup->priv;
+  // Gone if the application left the bus meanwhile
+  AtspiApp *app = g_hash_table_lookup(priv->apps, lookup->bus_name);
+  if (reply && app) {
+    if (lookup->kind == LOOKUP_PID) {
+      guint32 pid = 0;
+      g_variant_get(reply, "(u)", &pid);
+      app->pid = pid;
+    } else {
+      GVariant *value = NULL;
+      g_variant_get(reply, "(v)", &value);
+      if (g_variant_is_of_type(value, G_VARIANT_TYPE_STRING)) {
+        const char *str = g_variant_get_string(value, NULL);
+        if (*str && lookup->kind == LOOKUP_NAME)
+          app->name = g_strdup(str);
+        else if (*str)
+          app->toolkit = g_strdup(str);
+      }
+      g_variant_unref(value);
+    }
+  } else if (!reply) {
+    LOG_DEBUG("AT-SPI lookup on %s failed: %s", lookup->bus_name,
+              error->message);
+  }
+  g_clear_error(&error);
+  if (reply)
+    g_variant_unref(reply);
+
+  if (app && --app->pending == 0) {
+    LOG_DEBUG("AT-SPI app %s: name=%s, toolkit=%s, pid=%d", lookup->bus_name,
+              app->name, app->toolkit, app->pid);
+    if (g_strcmp0(lookup->bus_name, priv->focus_bus_name) == 0)
+      wayland_activate(priv, app);
+  }
+  g_free(lookup->bus_name);
+  g_free(lookup);
+}
+
+static void app_lookup_start(WaylandPrivate *priv, const char *bus_name,
+                             AtspiApp *app, LookupKind kind) {
+  AppLookup *lookup = g_new0(AppLookup, 1);
+  lookup->priv = priv;
+  lookup->bus_name = g_strdup(bus_name);
+  lookup->kind = kind;
+  app->pending++;
+
+  if (kind == LOOKUP_PID) {
+    // Applications connect to the accessibility bus themselves, so the
+    // connection's pid is the app's
+    g_dbus_connection_call(
+        priv->bus, "org.freedesktop.DBus", "/org/freedesktop/DBus",
+        "org.freedesktop.DBus", "GetConnectionUnixProcessID",
+        g_variant_new("(s)", bus_name), G_VARIANT_TYPE("(u)"),
+        G_DBUS_CALL_FLAGS_NONE, -1, priv->cancellable, on_app_lookup_done,
+        lookup);
+    return;
+  }
+  g_dbus_connection_call(
+      priv->bus, bus_name, ATSPI_ROOT_PATH, "org.freedesktop.DBus.Properties",
+      "Get",
+      g_variant_new("(ss)",
+                    kind == LOOKUP_NAME ? "org.a11y.atspi.Accessible"
+                                        : "org.a11y.atspi.Application",
+                    kind == LOOKUP_NAME ? "Name" : "ToolkitName"),
+      G_VARIANT_TYPE("(v)"), G_DBUS_CALL_FLAGS_NONE, -1, priv->cancellable,
+      on_app_lookup_done, lookup);
+}
+
+// Entry for bus_name, starting its lookups if this is the first event from it
+static AtspiApp *wayland_get_app(WaylandPrivate *priv, const char *bus_name) {
+  AtspiApp *app = g_hash_table_lookup(priv->apps, bus_name);
+  if (app)
+    return app;
+
+  app = g_new0(AtspiApp, 1);
+  g_hash_table_insert(priv->apps, g_strdup(bus_name), app);
+  app_lookup_start(priv, bus_name, app, LOOKUP_PID);
+  app_lookup_start(priv, bus_name, app, LOOKUP_NAME);
+  app_lookup_start(priv, bus_name, app, LOOKUP_TOOLKIT);
+  return app;
+}
+
+// ---- Events ----
+
+static void wayland_activate(WaylandPrivate *priv, const AtspiApp *app) {
+  // Our overlay taking focus says nothing about what the user is working in
+  if (app->pid == getpid())
+    return;
+
+  ActiveApp next = {app->pid, app->name, app->toolkit, priv->focus_title};
+  g_mutex_lock(&priv->lock);
+  bool changed = !active_app_equal(&priv->active, &next);
+  if (changed) {
+    active_app_clear(&priv->active);
+    active_app_copy(&priv->active, &next);
+  }
+  g_mutex_unlock(&priv->lock);
+
+  if (changed)
+    wayland_schedule_refresh(priv);
+}
+
+static void on_atspi_event(GDBusConnection *conn, const char *sender,
+                           const char *path, const char *interface,
+                           const char *member, GVariant *params,
+                           gpointer user_data) {
+  (void)conn;
+  (void)path;
+  (void)interface;
+  WaylandPrivate *priv = (WaylandPrivate *)user_data;
+  // Current bridges end the body with a property dict, older ones with the
+  // (bus name, path) of the application; neither is needed here
+  if (!sender ||
+      (!g_variant_is_of_type(params, G_VARIANT_TYPE("(siiva{sv})")) &&
+       !g_variant_is_of_type(params, G_VARIANT_TYPE("(siiv(so))"))))
+    return;
+
+  const char *detail = NULL;
+  gint32 detail1 = 0;
+  GVariant *any_data = NULL;
+  g_variant_get(params, "(&siiv*)", &detail, &detail1, NULL, &any_data, NULL);
+
+  bool is_window = strcmp(member, "Activate") == 0;
+  // Focus lost, or some other state
+  if (strcmp(member, "StateChanged") == 0 &&
+      (strcmp(detail, "focused") != 0 || detail1 != 1)) {
+    g_variant_unref(any_data);
+    return;
+  }
+
+  // Window events carry the window's name
+  char *title = NULL;
+  if (is_window && g_variant_is_of_type(any_data, G_VARIANT_TYPE_STRING))
+    title = g_variant_dup_string(any_data, NULL);
+  g_variant_unref(any_data);
+
+  bool same_app = g_strcmp0(sender, priv->focus_bus_name) == 0;
+  if (!same_app) {
+    g_free(priv->focus_bus_name);
+    priv->focus_bus_name = g_strdup(sender);
+  }
+  // Focus moving between widgets keeps the window's title
+  if (title || !same_app) {
+    g_free(priv->focus_title);
+    priv->focus_title = title;
+  }
+
+  AtspiApp *app = wayland_get_app(priv, sender);
+  if (app->pending == 0)
+    wayland_activate(priv, app);
+}
+
+static void on_name_owner_changed(GDBusConnection *conn, const char *sender,
+                                  const char *path, const char *interface,
+                                  const char *member, GVariant *params,
+                                  gpointer user_data) {
+  (void)conn;
+  (void)sender;
+  (void)path;
+  (void)interface;
+  (void)member;
+  WaylandPrivate *priv = (WaylandPrivate *)user_data;
+  const char *name = NULL;
+  const char *new_owner = NULL;
+  g_variant_get(params, "(&s&s&s)", &name, NULL, &new_owner);
+  // Unique names are never reused, so a departed app's entry is dead weight
+  if (name[0] == ':' && !*new_owner)
+    g_hash_table_remove(priv->apps, name);
+}
+
+// ---- Identity resolution ----
+
+// Result of resolving one active app off the main thread
+typedef struct {
+  ActiveApp app;
+  AppIdentity *id;
+  pid_t pid;      // Process the exe was read from
+  bool sandboxed; // Resolution stopped at app.pid
+  unsigned long long starttime;
+} IdentityQuery;
+
+static void identity_query_free(gpointer data) {
+  IdentityQuery *query = (IdentityQuery *)data;
+  active_app_clear(&query->app);
+  cheeter_app_identity_free(query->id);
+  g_free(query);
+}
+
+// 0 once cleanup has started
+static pid_t wayland_deepest_child(WaylandPrivate *priv, pid_t pid) {
+  g_mutex_lock(&priv->query_lock);
+  pid_t child =
+      priv->proc ? cheeter_proc_resolver_deepest_child(priv->proc, pid, 0) : 0;
+  g_mutex_unlock(&priv->query_lock);
+  return child;
+}
+
+// Everything AT-SPI had to say is in query->app already; this only reads
+// /proc, so it is safe on the hotkey's path too.
+static void wayland_run_query(WaylandPrivate *priv, IdentityQuery *query) {
+  AppIdentity *id = g_new0(AppIdentity, 1);
+  id->wm_class = g_strdup(query->app.name);
+  id->title = g_strdup(query->app.title);
+  id->toolkit = g_strdup(query->app.toolkit);
+  pid_t pid = query->app.pid;
+  bool inner_program = false;
+
+  if (pid > 0) {
+    bool sandboxed = false;
+    id->desktop_id = cheeter_proc_read_app_id(pid, &sandboxed);
+    query->sandboxed = sandboxed;
+
+    // A terminal's window says nothing about what runs inside it
+    pid_t child_pid = sandboxed ? 0 : wayland_deepest_child(priv, pid);
+    char *app_exe = NULL;
+    if (child_pid > 0) {
+      LOG_DEBUG("App PID %d resolved to child PID %d", pid, child_pid);
+      app_exe = cheeter_proc_read_exe(pid);
+      pid = child_pid;
+    }
+
+    id->exe_path = cheeter_proc_read_exe(pid);
+    // A different program running inside the app (vim in a terminal) shares
+    // the app's scope and name but isn't that app
+    inner_program = app_exe && g_strcmp0(app_exe, id->exe_path) != 0;
+    if (inner_program) {
+      g_free(id->desktop_id);
+      id->desktop_id = NULL;
+    }
+    g_free(app_exe);
+
+    ProcStat st;
+    if (cheeter_proc_read_stat(pid, &st))
+      query->starttime = st.starttime;
+    query->pid = pid;
+  } else {
+    LOG_WARN("No PID known for AT-SPI app %s", query->app.name);
+  }
+
+  if (!id->desktop_id)
+    id->desktop_id = cheeter_desktop_index_lookup(
+        priv->desktop, inner_program ? NULL : id->wm_class, id->exe_path);
+  query->id = id;
+}
+
+// Stale if the process is gone (pid reuse is caught by starttime) or
+// resolving from the app again lands elsewhere, e.g. on vim launched in a
+// terminal. Background jobs of a shell don't change where it lands.
+static bool wayland_process_still_current(WaylandPrivate *priv,
+                                          pid_t app_pid, bool sandboxed,
+                                          pid_t pid,
+                                          unsigned long long starttime) {
+  if (pid <= 0)
+    return true;
+  ProcStat st;
+  if (!cheeter_proc_read_stat(pid, &st) || st.starttime != starttime)
+    return false;
+  if (sandboxed)
+    return true;
+  pid_t child = wayland_deepest_child(priv, app_pid);
+  return (child > 0 ? child : app_pid) == pid;
+}
+
+// Stores query as the cached identity if focus hasn't moved on meanwhile.
+// Takes ownership of query->id on success.
+static bool wayland_store_identity(WaylandPrivate *priv,
+                                   IdentityQuery *query) {
+  bool stored = false;
+  g_mutex_lock(&priv->lock);
+  if (query->id && active_app_equal(&query->app, &priv->active)) {
+    cheeter_app_identity_free(priv->cached_id);
+    priv->cached_id = query->id;
+    priv->cached_pid = query->pid;
+    priv->cached_sandboxed = query->sandboxed;
+    priv->cached_starttime = query->starttime;
+    query->id = NULL;
+    stored = true;
+  }
+  g_mutex_unlock(&priv->lock);
+  return stored;
+}
+
+// Last touch of priv by a refresh task; cleanup frees it once all are done
+static void wayland_refresh_finished(WaylandPrivate *priv) {
+  g_mutex_lock(&priv->lock);
+  if (--priv->n_refreshing == 0)
+    g_cond_broadcast(&priv->refreshed);
+  g_mutex_unlock(&priv->lock);
+}
+
+static void refresh_thread(GTask *task, gpointer source_object,
+                           gpointer task_data, GCancellable *cancellable) {
+  (void)source_object;
+  WaylandPrivate *priv = (WaylandPrivate *)task_data;
+  if (g_cancellable_is_cancelled(cancellable)) {
+    wayland_refresh_finished(priv);
+    g_task_return_error_if_cancelled(task);
+    return;
+  }
+
+  IdentityQuery *query = g_new0(IdentityQuery, 1);
+  g_mutex_lock(&priv->lock);
+  active_app_copy(&query->app, &priv->active);
+  g_mutex_unlock(&priv->lock);
+
+  if (!g_cancellable_is_cancelled(cancellable))
+    wayland_run_query(priv, query);
+  wayland_refresh_finished(priv);
+  g_task_return_pointer(task, query, identity_query_free);
+}
+
+static void on_refresh_done(GObject *source_object, GAsyncResult *res,
+                            gpointer user_data) {
+  (void)source_object;
+  (void)user_data;
+  GError *error = NULL;
+  IdentityQuery *query = g_task_propagate_pointer(G_TASK(res), &error);
+  if (!query) {
+    // Cancelled: the backend is being torn down, priv may be gone
+    g_clear_error(&error);
+    return;
+  }
+
+  WaylandPrivate *priv = (WaylandPrivate *)g_task_get_task_data(G_TASK(res));
+  LOG_DEBUG("Active AT-SPI app: name=%s, toolkit=%s, pid=%d", query->app.name,
+            query->app.toolkit, query->app.pid);
+  bool stored = wayland_store_identity(priv, query);
+  identity_query_free(query);
+
+  g_mutex_lock(&priv->lock);
+  // Another change may have been scheduled while we were querying
+  if (!priv->refresh_source)
+    priv->refresh_pending = false;
+  AppIdentity *id = stored ? cheeter_app_identity_copy(priv->cached_id) : NULL;
+  g_mutex_unlock(&priv->lock);
+
+  if (id) {
+    LOG_DEBUG("Active app refreshed: class=%s, exe=%s", id->wm_class,
+              id->exe_path);
+    if (priv->active_app_cb)
+      priv->active_app_cb(id, priv->active_app_user_data);
+    cheeter_app_identity_free(id);
+  }
+}
+
+static gboolean on_refresh_timeout(gpointer user_data) {
+  WaylandPrivate *priv = (WaylandPrivate *)user_data;
+  priv->refresh_source = 0;
+
+  g_mutex_lock(&priv->lock);
+  priv->n_refreshing++;
+  g_mutex_unlock(&priv->lock);
+  GTask *task = g_task_new(NULL, priv->cancellable, on_refresh_done, NULL);
+  g_task_set_task_data(task, priv, NULL);
+  g_task_run_in_thread(task, refresh_thread);
+  g_object_unref(task);
+  return G_SOURCE_REMOVE;
+}
+
+static void wayland_schedule_refresh(WaylandPrivate *priv) {
+  g_mutex_lock(&priv->lock);
+  priv->refresh_pending = true;
+  g_mutex_unlock(&priv->lock);
+
+  if (!priv->refresh_source)
+    priv->refresh_source =
+        g_timeout_add(REFRESH_DELAY_MS, on_refresh_timeout, priv);
+}
+
+// ---- Backend Interface Implementation ----
 
 static bool wayland_init(CheeterBackend *self, const char *hotkey_str,
                          CheeterHotkeyCallback cb, void *user_data) {
-  (void)hotkey_str;
   (void)cb;
   (void)user_data;
 
   WaylandPrivate *priv = g_new0(WaylandPrivate, 1);
   self->priv = priv;
+  g_mutex_init(&priv->lock);
+  g_mutex_init(&priv->query_lock);
+  g_cond_init(&priv->refreshed);
+  priv->cancellable = g_cancellable_new();
+  priv->apps = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                     atspi_app_free);
+
+  char *address = atspi_bus_address();
+  if (!address) {
+    wayland_cleanup(self);
+    return false;
+  }
+  GError *error = NULL;
+  priv->bus = g_dbus_connection_new_for_address_sync(
+      address,
+      G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+          G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+      NULL, NULL, &error);
+  if (!priv->bus) {
+    LOG_ERROR("Could not connect to the AT-SPI bus at %s: %s", address,
+              error->message);
+    g_error_free(error);
+    g_free(address);
+    wayland_cleanup(self);
+    return false;
+  }
+  LOG_INFO("Connected to the AT-SPI bus at %s", address);
+  g_free(address);
+
+  priv->proc_tree = cheeter_proc_tree_new();
+  priv->proc = cheeter_proc_resolver_new();
+  cheeter_proc_resolver_set_tree(priv->proc, priv->proc_tree);
+  priv->desktop = cheeter_desktop_index_new();
 
-  LOG_WARN("Wayland backend initialized (MOCK). Real implementation would:");
-  LOG_WARN("  1. Connect to AT-SPI registry to listen for 'window:activate' "
-           "events.");
-  LOG_WARN("  2. Use XDG Desktop Portal (GlobalShortcuts) or Compositor "
-           "shortcuts for hotkeys.");
-  LOG_WARN("  3. Use wlr-layer-shell for overlay window positioning.");
+  for (guint i = 0; i < ATSPI_EVENT_COUNT; i++) {
+    priv->event_subs[i] = g_dbus_connection_signal_subscribe(
+        priv->bus, NULL, atspi_events[i].interface, atspi_events[i].member,
+        NULL, NULL, G_DBUS_SIGNAL_FLAGS_NONE, on_atspi_event, priv, NULL);
+    atspi_register_event(priv, atspi_events[i].name);
+  }
+  priv->owner_changed_sub = g_dbus_connection_signal_subscribe(
+      priv->bus, "org.freedesktop.DBus", "org.freedesktop.DBus",
+      "NameOwnerChanged", "/org/freedesktop/DBus", NULL,
+      G_DBUS_SIGNAL_FLAGS_NONE, on_name_owner_changed, priv, NULL);
 
+  // Wayland clients can't grab keys
+  LOG_INFO("Hotkey %s is not grabbed on Wayland; bind it to `cheeter toggle` "
+           "in your compositor",
+           hotkey_str ? hotkey_str : "(none)");
   return true;
 }
 
+// May block on /proc, never on AT-SPI; called from worker threads.
 static AppIdentity *wayland_get_active_app(CheeterBackend *self) {
-  (void)self;
-  LOG_INFO("Wayland: get_active_app called (MOCK).");
+  WaylandPrivate *priv = (WaylandPrivate *)self->priv;
+  if (!priv || !priv->bus)
+    return NULL;
+
+  IdentityQuery query = {0};
+  AppIdentity *cached = NULL;
+  pid_t cached_pid = 0;
+  bool cached_sandboxed = false;
+  unsigned long long cached_starttime = 0;
+
+  g_mutex_lock(&priv->lock);
+  active_app_copy(&query.app, &priv->active);
+  if (priv->cached_id && !priv->refresh_pending) {
+    cached = cheeter_app_identity_copy(priv->cached_id);
+    cached_pid = priv->cached_pid;
+    cached_sandboxed = priv->cached_sandboxed;
+    cached_starttime = priv->cached_starttime;
+  }
+  g_mutex_unlock(&priv->lock);
+
+  if (cached && wayland_process_still_current(priv, query.app.pid,
+                                              cached_sandboxed, cached_pid,
+                                              cached_starttime)) {
+    active_app_clear(&query.app);
+    return cached;
+  }
+  cheeter_app_identity_free(cached);
 
-  /*
-     Implementation logic:
-     1. Query AT-SPI for current focused object.
-     2. Walk up tree to find 'Application' role.
-     3. Retrieve 'Toolkit', 'Name', and try to map to .desktop file.
-  */
+  if (!query.app.pid && !query.app.name) {
+    LOG_WARN("No AT-SPI focus event seen yet.");
+    active_app_clear(&query.app);
+    return g_new0(AppIdentity, 1); // empty
+  }
 
-  // Return dummy for testing if this backend were active
-  // return NULL;
-  return NULL;
+  LOG_DEBUG("Cached active app is stale, resolving now");
+  wayland_run_query(priv, &query);
+  AppIdentity *id = cheeter_app_identity_copy(query.id);
+  if (!wayland_store_identity(priv, &query))
+    cheeter_app_identity_free(query.id);
+  active_app_clear(&query.app);
+  return id;
+}
+
+static void wayland_set_active_app_callback(CheeterBackend *self,
+                                            CheeterActiveAppCallback cb,
+                                            void *user_data) {
+  WaylandPrivate *priv = (WaylandPrivate *)self->priv;
+  if (!priv)
+    return;
+  priv->active_app_cb = cb;
+  priv->active_app_user_data = user_data;
+
+  g_mutex_lock(&priv->lock);
+  AppIdentity *id = cheeter_app_identity_copy(priv->cached_id);
+  g_mutex_unlock(&priv->lock);
+  if (cb && id)
+    cb(id, user_data);
+  cheeter_app_identity_free(id);
 }
 
 static void wayland_cleanup(CheeterBackend *self) {
-  if (!self->priv)
+  if (!self || !self->priv)
     return;
-  g_free(self->priv);
+
+  WaylandPrivate *priv = (WaylandPrivate *)self->priv;
+  if (priv->refresh_source)
+    g_source_remove(priv->refresh_source);
+  if (priv->bus) {
+    for (guint i = 0; i < ATSPI_EVENT_COUNT; i++)
+      if (priv->event_subs[i])
+        g_dbus_connection_signal_unsubscribe(priv->bus, priv->event_subs[i]);
+    if (priv->owner_changed_sub)
+      g_dbus_connection_signal_unsubscribe(priv->bus,
+                                           priv->owner_changed_sub);
+  }
+
+  // Pending D-Bus calls see this and leave priv alone. Refresh tasks, queued
+  // ones included, still read priv, so every one started is waited out.
+  if (priv->cancellable)
+    g_cancellable_cancel(priv->cancellable);
+  g_mutex_lock(&priv->lock);
+  while (priv->n_refreshing > 0)
+    g_cond_wait(&priv->refreshed, &priv->lock);
+  g_mutex_unlock(&priv->lock);
+  g_mutex_lock(&priv->query_lock);
+  cheeter_proc_resolver_free(priv->proc);
+  priv->proc = NULL;
+  g_mutex_unlock(&priv->query_lock);
+  g_clear_object(&priv->cancellable);
+  g_clear_object(&priv->bus);
+
+  cheeter_proc_tree_free(priv->proc_tree);
+  cheeter_desktop_index_free(priv->desktop);
+  g_hash_table_destroy(priv->apps);
+  g_free(priv->focus_bus_name);
+  g_free(priv->focus_title);
+  active_app_clear(&priv->active);
+  cheeter_app_identity_free(priv->cached_id);
+  g_mutex_clear(&priv->lock);
+  g_mutex_clear(&priv->query_lock);
+  g_cond_clear(&priv->refreshed);
+  g_free(priv);
   self->priv = NULL;
 }
 
@@ -68,6 +748,7 @@ CheeterBackend *cheeter_backend_wayland_new(void) {
   b->name = "wayland";
   b->init = wayland_init;
   b->get_active_app = wayland_get_active_app;
+  b->set_active_app_callback = wayland_set_active_app_callback;
   b->cleanup = wayland_cleanup;
   return b;
 }
@@ -4,9 +4,6 @@
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/keysym.h>
-#include <ctype.h>
-#include <dirent.h>
-#include <errno.h>
 #include <glib.h>
 #include <stdio.h>
 #include <string.h>
@@ -14,9 +11,29 @@
 
 #include <gdk/gdk.h>
 #include <gdk/gdkx.h>
+#include <gio/gio.h>
+
+#ifdef CHEETER_HAVE_XCB
+#include <X11/Xlib-xcb.h>
+#include <stdlib.h>
+#include <xcb/res.h>
+#include <xcb/xcb.h>
+#endif
 
 #include "cheeter/backend.h"
+#include "cheeter/desktop.h"
 #include "cheeter/log.h"
+#include "cheeter/proc.h"
+#include "cheeter/tmux.h"
+
+// Delay before re-resolving after a focus or title change, so bursts (a
+// shell updating its title per command, focus flicker) cost one refresh
+#define REFRESH_DELAY_MS 50
+
+#ifdef CHEETER_HAVE_XCB
+// Longest WM_CLASS/title fetched, in 32-bit units
+#define PROP_MAX_WORDS 256
+#endif
 
 typedef struct {
   Display *dpy;
@@ -25,15 +42,56 @@ typedef struct {
   Atom net_wm_pid;
   Atom net_wm_name;
   Atom wm_class;
+  Atom utf8_string;
 
   CheeterHotkeyCallback hotkey_cb;
   void *hotkey_user_data;
 
   KeyCode hotkey_keycode;
   unsigned int hotkey_modifiers;
+
+  // Identity queries run on worker threads. They get their own X connection,
+  // since GDK's must only be used from the main thread.
+  GMutex query_lock; // Serializes query_dpy and proc
+  Display *query_dpy;
+#ifdef CHEETER_HAVE_XCB
+  bool have_xres; // X-Resource >= 1.2 on query_dpy, for client PIDs
+#endif
+  ProcTree *proc_tree;
+  ProcResolver *proc;
+  TmuxTracker *tmux;
+  DesktopIndex *desktop;
+  GCancellable *cancellable; // Cancelled on cleanup
+
+  Window watched_win; // Main thread only: window with our PropertyChangeMask
+  guint refresh_source;
+
+  // Focus tracking: the identity is recomputed when the active window or its
+  // title changes, so the hotkey only has to check the cache is still valid.
+  GMutex lock; // Guards the fields below
+  Window active_win;   // Last _NET_ACTIVE_WINDOW seen
+  bool refresh_pending; // A refresh is scheduled or running
+  AppIdentity *cached_id;
+  Window cached_win;
+  pid_t cached_pid; // Process the identity was resolved to
+  pid_t cached_window_pid; // ...starting from this one, the window's
+  bool cached_sandboxed;
+  unsigned long long cached_starttime;
+  pid_t cached_tmux_client; // tmux client passed through on the way, if any
+  pid_t cached_tmux_pane;
+  guint n_refreshing; // Refresh tasks not yet done with priv
+  GCond refreshed;    // Signalled when n_refreshing drops to 0
+
+  CheeterActiveAppCallback active_app_cb;
+  void *active_app_user_data;
 } X11Private;
 
 static void x11_cleanup(CheeterBackend *self);
+static void x11_on_active_window_changed(X11Private *priv);
+static void x11_schedule_refresh(X11Private *priv);
+#ifdef CHEETER_HAVE_XCB
+static bool x11_query_xres(xcb_connection_t *conn);
+#endif
 
 // Global pointer for the GDK filter callback
 static CheeterBackend *g_x11_backend = NULL;
@@ -77,6 +135,15 @@ static GdkFilterReturn x11_event_filter(GdkXEvent *xevent, GdkEvent *event,
       }
       return GDK_FILTER_REMOVE; // Consume the event
     }
+  } else if (ev->type == PropertyNotify) {
+    XPropertyEvent *pev = &ev->xproperty;
+    if (pev->window == priv->root && pev->atom == priv->net_active_window) {
+      x11_on_active_window_changed(priv);
+    } else if (pev->window == priv->watched_win &&
+               (pev->atom == priv->net_wm_name || pev->atom == XA_WM_NAME)) {
+      x11_schedule_refresh(priv);
+    }
+    // GDK watches root properties too; never consume these
   }
   return GDK_FILTER_CONTINUE;
 }
@@ -145,6 +212,27 @@ static bool x11_init(CheeterBackend *self, const char *hotkey_str,
   priv->net_wm_pid = XInternAtom(priv->dpy, "_NET_WM_PID", False);
   priv->net_wm_name = XInternAtom(priv->dpy, "_NET_WM_NAME", False);
   priv->wm_class = XInternAtom(priv->dpy, "WM_CLASS", False);
+  priv->utf8_string = XInternAtom(priv->dpy, "UTF8_STRING", False);
+
+  g_mutex_init(&priv->lock);
+  g_mutex_init(&priv->query_lock);
+  g_cond_init(&priv->refreshed);
+  priv->cancellable = g_cancellable_new();
+  priv->query_dpy = XOpenDisplay(DisplayString(priv->dpy));
+  if (!priv->query_dpy) {
+    LOG_ERROR("Could not open X11 query connection.");
+    x11_cleanup(self);
+    return false;
+  }
+#ifdef CHEETER_HAVE_XCB
+  priv->have_xres = x11_query_xres(XGetXCBConnection(priv->query_dpy));
+#endif
+
+  priv->proc_tree = cheeter_proc_tree_new();
+  priv->proc = cheeter_proc_resolver_new();
+  cheeter_proc_resolver_set_tree(priv->proc, priv->proc_tree);
+  priv->tmux = cheeter_tmux_tracker_new();
+  priv->desktop = cheeter_desktop_index_new();
 
   // Setup Hotkey
   priv->hotkey_cb = cb;
@@ -172,149 +260,19 @@ static bool x11_init(CheeterBackend *self, const char *hotkey_str,
   g_x11_backend = self;
   gdk_window_add_filter(NULL, x11_event_filter, NULL);
 
-  return true;
-}
-
-// Helper to check if a process has WINDOWID environment variable matching
-// target
-static gboolean match_window_id(pid_t pid, Window target_win) {
-  if (target_win == 0)
-    return FALSE;
-
-  char path[64];
-  snprintf(path, sizeof(path), "/proc/%d/environ", pid);
-  FILE *f = fopen(path, "rb");
-  if (!f)
-    return FALSE;
-
-  gboolean found = FALSE;
-  char buf[4096];
-  size_t bytes = fread(buf, 1, sizeof(buf), f);
-  fclose(f);
-
-  if (bytes > 0) {
-    char needle[64];
-    snprintf(needle, sizeof(needle), "WINDOWID=%lu", target_win);
-
-    // Environ entries are separated by \0.
-    // We can scan the buffer.
-    size_t pos = 0;
-    while (pos < bytes) {
-      if (strncmp(buf + pos, needle, strlen(needle)) == 0) {
-        // Ensure partial match safety (e.g. WINDOWID=123 vs WINDOWID=1234)
-        // The next char must be \0 or end of buffer if strictly matching
-        // "VAR=VAL" but we constructed needle as VAR=VAL. Wait, snprintf
-        // creates "WINDOWID=12345". In environ: "WINDOWID=12345\0" So we check
-        // if buf[pos+strlen(needle)] == '\0'
-        if (pos + strlen(needle) >= bytes ||
-            buf[pos + strlen(needle)] == '\0') {
-          found = TRUE;
-        }
-        break;
-      }
-      // Advance to next \0
-      while (pos < bytes && buf[pos] != '\0')
-        pos++;
-      pos++; // Skip \0
-    }
+  // Track focus so the identity is ready before the hotkey is pressed.
+  // GDK selects on the root window too, so add to its mask.
+  XWindowAttributes root_attrs;
+  if (XGetWindowAttributes(priv->dpy, priv->root, &root_attrs)) {
+    XSelectInput(priv->dpy, priv->root,
+                 root_attrs.your_event_mask | PropertyChangeMask);
   }
-  return found;
-}
-
-// Helper to find the deepest child process of a given PID
-static pid_t get_deepest_child(pid_t start_pid, Window match_window) {
-  pid_t current_pid = start_pid;
-  gboolean branch_locked =
-      FALSE; // Set to TRUE once we find a child claiming the window
-
-  while (1) {
-    DIR *proc = opendir("/proc");
-    if (!proc) {
-      LOG_WARN("Could not open /proc (errno: %d)", errno);
-      break;
-    }
-
-    struct dirent *ent;
-    pid_t found_child = 0;
-
-    // We iterate all children.
-    // If not locked yet, pick the one matching match_window.
-    // If locked (or match_window is 0), pick any (or newest).
-
-    // To handle "multiple children", we'd ideally scan all then decide.
-    // Optimization: First pass check for window_id match?
-    // Or just check each as we go?
-
-    while ((ent = readdir(proc))) {
-      if (!isdigit(*ent->d_name))
-        continue;
-      pid_t pid = atoi(ent->d_name);
-      if (pid == current_pid || pid == getpid())
-        continue;
-
-      char path[64];
-      snprintf(path, sizeof(path), "/proc/%d/stat", pid);
-      FILE *f = fopen(path, "r");
-      if (f) {
-        char buf[1024];
-        if (fgets(buf, sizeof(buf), f)) {
-          char *rparen = strrchr(buf, ')');
-          if (rparen) {
-            char state;
-            pid_t ppid;
-            if (sscanf(rparen + 2, "%c %d", &state, &ppid) == 2) {
-              if (ppid == current_pid) {
-                // It is a child.
-                // If we haven't locked onto a branch yet, and we have a target
-                // window:
-                if (!branch_locked && match_window != 0) {
-                  if (match_window_id(pid, match_window)) {
-                    LOG_DEBUG("Child %d matches WINDOWID %lu", pid,
-                              match_window);
-                    found_child = pid;
-                    branch_locked = TRUE; // Descend only this branch now
-                    // Don't need to scan others for this level?
-                    // Assuming unique WINDOWID per process tree usually.
-                    break; // Stop readdir, take this one
-                  }
-                }
-
-                // If we didn't match (or don't care), populate found_child if
-                // empty But if we later find a match, we prefer that. So
-                // current logic of 'break' on first found is bad if we are
-                // looking for a specific one. We should scan ALL children at
-                // this level.
-                if (!found_child)
-                  found_child = pid;
-              }
-            }
-          }
-        }
-        fclose(f);
-      }
-      if (branch_locked && found_child)
-        break;
-    }
-    closedir(proc);
+  x11_on_active_window_changed(priv);
 
-    if (found_child) {
-      // LOG_DEBUG("Descend: %d -> %d", current_pid, found_child);
-      current_pid = found_child;
-    } else {
-      break; // No more children
-    }
-  }
-  return (current_pid == start_pid) ? 0 : current_pid;
+  return true;
 }
 
-static AppIdentity *x11_get_active_app(CheeterBackend *self) {
-  X11Private *priv = (X11Private *)self->priv;
-  if (!priv || !priv->dpy)
-    return NULL;
-
-  AppIdentity *id = g_new0(AppIdentity, 1);
-
-  // Get Active Window
+static Window x11_read_active_window(X11Private *priv) {
   Atom actual_type;
   int actual_format;
   unsigned long nitems, bytes_after;
@@ -330,17 +288,150 @@ static AppIdentity *x11_get_active_app(CheeterBackend *self) {
     if (prop)
       XFree(prop);
   }
+  return active_win;
+}
 
-  if (!active_win) {
-    LOG_WARN("No active X11 window found.");
-    return id; // empty
+// Raw properties of a window, before any /proc resolution
+typedef struct {
+  char *wm_class;
+  char *title;
+  pid_t pid; // 0 if neither _NET_WM_PID nor X-Resource knew it
+} WindowProps;
+
+#ifdef CHEETER_HAVE_XCB
+
+// Client PID lookups (QueryClientIds) arrived in X-Resource 1.2
+static bool x11_query_xres(xcb_connection_t *conn) {
+  const xcb_query_extension_reply_t *ext =
+      xcb_get_extension_data(conn, &xcb_res_id);
+  if (!ext || !ext->present) {
+    LOG_DEBUG("X-Resource extension not available");
+    return false;
+  }
+  xcb_res_query_version_reply_t *ver = xcb_res_query_version_reply(
+      conn, xcb_res_query_version(conn, 1, 2), NULL);
+  bool ok = ver && (ver->server_major > 1 ||
+                    (ver->server_major == 1 && ver->server_minor >= 2));
+  free(ver);
+  if (!ok)
+    LOG_DEBUG("X-Resource too old for client PID lookups");
+  return ok;
+}
+
+// Takes ownership of reply. Returns NULL if the property was unset or the
+// window is gone.
+static xcb_get_property_reply_t *
+x11_property_reply(xcb_connection_t *conn, xcb_get_property_cookie_t cookie) {
+  xcb_generic_error_t *err = NULL;
+  xcb_get_property_reply_t *reply = xcb_get_property_reply(conn, cookie, &err);
+  free(err);
+  if (reply && xcb_get_property_value_length(reply) <= 0) {
+    free(reply);
+    return NULL;
+  }
+  return reply;
+}
+
+static char *x11_property_string(xcb_connection_t *conn,
+                                 xcb_get_property_cookie_t cookie) {
+  xcb_get_property_reply_t *reply = x11_property_reply(conn, cookie);
+  if (!reply)
+    return NULL;
+  char *str = g_strndup(xcb_get_property_value(reply),
+                        xcb_get_property_value_length(reply));
+  free(reply);
+  return str;
+}
+
+// Every request is queued before any reply is waited on, so the whole
+// lookup costs one round trip to the server, however far away it is.
+static void x11_fetch_props(X11Private *priv, Display *dpy, Window win,
+                            WindowProps *out) {
+  xcb_connection_t *conn = XGetXCBConnection(dpy);
+  xcb_window_t w = (xcb_window_t)win;
+
+  xcb_get_property_cookie_t class_cookie =
+      xcb_get_property(conn, 0, w, XCB_ATOM_WM_CLASS, XCB_ATOM_STRING, 0,
+                       PROP_MAX_WORDS);
+  xcb_get_property_cookie_t pid_cookie = xcb_get_property(
+      conn, 0, w, priv->net_wm_pid, XCB_ATOM_CARDINAL, 0, 1);
+  xcb_get_property_cookie_t net_name_cookie = xcb_get_property(
+      conn, 0, w, priv->net_wm_name, priv->utf8_string, 0, PROP_MAX_WORDS);
+  xcb_get_property_cookie_t name_cookie =
+      xcb_get_property(conn, 0, w, XCB_ATOM_WM_NAME,
+                       XCB_GET_PROPERTY_TYPE_ANY, 0, PROP_MAX_WORDS);
+  // Asked for up front even though _NET_WM_PID usually answers, so a
+  // missing PID doesn't cost a second round trip
+  xcb_res_query_client_ids_cookie_t res_cookie = {0};
+  if (priv->have_xres) {
+    xcb_res_client_id_spec_t spec = {
+        .client = w, .mask = XCB_RES_CLIENT_ID_MASK_LOCAL_CLIENT_PID};
+    res_cookie = xcb_res_query_client_ids(conn, 1, &spec);
+  }
+
+  // WM_CLASS is "instance\0class\0"
+  xcb_get_property_reply_t *reply = x11_property_reply(conn, class_cookie);
+  if (reply) {
+    const char *val = xcb_get_property_value(reply);
+    int len = xcb_get_property_value_length(reply);
+    int instance_len = strnlen(val, len);
+    if (instance_len + 1 < len)
+      out->wm_class =
+          g_strndup(val + instance_len + 1, len - instance_len - 1);
+    free(reply);
   }
 
+  reply = x11_property_reply(conn, pid_cookie);
+  if (reply) {
+    if (reply->format == 32)
+      out->pid = *(uint32_t *)xcb_get_property_value(reply);
+    free(reply);
+  }
+
+  out->title = x11_property_string(conn, net_name_cookie);
+  char *wm_name = x11_property_string(conn, name_cookie);
+  if (!out->title)
+    out->title = wm_name;
+  else
+    g_free(wm_name);
+
+  if (priv->have_xres) {
+    xcb_generic_error_t *err = NULL;
+    xcb_res_query_client_ids_reply_t *ids =
+        xcb_res_query_client_ids_reply(conn, res_cookie, &err);
+    free(err);
+    if (ids) {
+      xcb_res_client_id_value_iterator_t it =
+          xcb_res_query_client_ids_ids_iterator(ids);
+      for (; it.rem; xcb_res_client_id_value_next(&it)) {
+        if (!(it.data->spec.mask & XCB_RES_CLIENT_ID_MASK_LOCAL_CLIENT_PID))
+          continue;
+        pid_t res_pid = *xcb_res_client_id_value_value(it.data);
+        if (!out->pid && res_pid > 0) {
+          LOG_DEBUG("No _NET_WM_PID, X-Resource reports PID %d", res_pid);
+          out->pid = res_pid;
+        }
+        break;
+      }
+      free(ids);
+    }
+  }
+}
+
+#else
+
+static void x11_fetch_props(X11Private *priv, Display *dpy, Window win,
+                            WindowProps *out) {
+  Atom actual_type;
+  int actual_format;
+  unsigned long nitems, bytes_after;
+  unsigned char *prop = NULL;
+
   // Get WM_CLASS
   XClassHint class_hint;
-  if (XGetClassHint(priv->dpy, active_win, &class_hint)) {
+  if (XGetClassHint(dpy, win, &class_hint)) {
     if (class_hint.res_class)
-      id->wm_class = g_strdup(class_hint.res_class);
+      out->wm_class = g_strdup(class_hint.res_class);
     // Could also use res_name
     if (class_hint.res_name)
       XFree(class_hint.res_name);
@@ -349,56 +440,372 @@ static AppIdentity *x11_get_active_app(CheeterBackend *self) {
   }
 
   // Get _NET_WM_PID
-  pid_t pid = 0;
-  if (XGetWindowProperty(priv->dpy, active_win, priv->net_wm_pid, 0, 1, False,
+  if (XGetWindowProperty(dpy, win, priv->net_wm_pid, 0, 1, False,
                          XA_CARDINAL, &actual_type, &actual_format, &nitems,
                          &bytes_after, &prop) == Success) {
     if (prop && nitems > 0) {
-      pid = *((unsigned long *)prop);
+      out->pid = *((unsigned long *)prop);
     }
     if (prop)
       XFree(prop);
   }
 
+  // Get Window Title (WM_NAME)
+  char *name = NULL;
+  if (XFetchName(dpy, win, &name) > 0) {
+    out->title = g_strdup(name);
+    XFree(name);
+  }
+}
+
+#endif
+
+// A tmux client shows a pane of a server that isn't its descendant; carry on
+// from that pane's foreground job. Returns pid unchanged if it isn't a tmux
+// client or its pane isn't known yet.
+static pid_t x11_follow_tmux(X11Private *priv, pid_t pid, pid_t *tmux_client,
+                             pid_t *tmux_pane) {
+  if (!cheeter_tmux_is_client(pid))
+    return pid;
+  *tmux_client = pid;
+  *tmux_pane = cheeter_tmux_tracker_active_pane(priv->tmux, pid);
+  if (*tmux_pane <= 0)
+    return pid;
+
+  pid_t job = cheeter_proc_foreground_job(*tmux_pane, NULL);
+  if (job <= 0)
+    job = *tmux_pane;
+  pid_t child = cheeter_proc_resolver_deepest_child(priv->proc, job, 0);
+  LOG_DEBUG("tmux client %d shows pane %d, resolved to %d", pid, *tmux_pane,
+            child > 0 ? child : job);
+  return child > 0 ? child : job;
+}
+
+// Result of querying one window's identity off the main thread
+typedef struct {
+  Window win;
+  AppIdentity *id;
+  pid_t pid;        // Process the exe was read from, 0 if none
+  pid_t window_pid; // The window's own, where resolution started
+  bool sandboxed;   // Resolution stopped at window_pid
+  unsigned long long starttime;
+  pid_t tmux_client; // tmux client and pane passed through, 0 if none
+  pid_t tmux_pane;
+} IdentityQuery;
+
+// Work out the identity of query->win using dpy, filling in query->id and
+// the processes it was resolved through. Caller holds query_lock.
+static void x11_query_identity(X11Private *priv, Display *dpy,
+                               IdentityQuery *query) {
+  AppIdentity *id = g_new0(AppIdentity, 1);
+  query->pid = 0;
+  query->tmux_client = 0;
+  query->tmux_pane = 0;
+
+  WindowProps props = {0};
+  x11_fetch_props(priv, dpy, query->win, &props);
+  id->wm_class = props.wm_class;
+  id->title = props.title;
+  pid_t pid = props.pid;
+  query->window_pid = pid;
+  bool inner_program = false;
+
   // Get Exe path from /proc
   if (pid > 0) {
+    // The app's scope names it outright. Sandboxed apps stop there: their
+    // exe is bwrap or similar and their children aren't ours to walk.
+    bool sandboxed = false;
+    id->desktop_id = cheeter_proc_read_app_id(pid, &sandboxed);
+    query->sandboxed = sandboxed;
+
     // Check for child process (e.g. vim inside xterm)
-    // Pass active_win to ensure we follow the process that owns this window (if
+    // Pass win to ensure we follow the process that owns this window (if
     // defined)
-    pid_t child_pid = get_deepest_child(pid, active_win);
+    pid_t child_pid = sandboxed ? 0
+                                : cheeter_proc_resolver_deepest_child(
+                                      priv->proc, pid, query->win);
+    char *window_exe = NULL;
     if (child_pid > 0) {
       LOG_DEBUG("Window PID %d resolved to child PID %d", pid, child_pid);
-      pid = child_pid;
+      window_exe = cheeter_proc_read_exe(pid);
+      pid = x11_follow_tmux(priv, child_pid, &query->tmux_client,
+                            &query->tmux_pane);
     }
+    query->pid = pid;
 
-    char proc_path[64];
-    snprintf(proc_path, sizeof(proc_path), "/proc/%d/exe", pid);
-    char exe_buf[1024];
-    ssize_t len = readlink(proc_path, exe_buf, sizeof(exe_buf) - 1);
-    if (len != -1) {
-      exe_buf[len] = '\0';
-      id->exe_path = g_strdup(exe_buf);
+    id->exe_path = cheeter_proc_read_exe(pid);
+    if (id->exe_path)
       LOG_DEBUG("Resolved Exe: %s", id->exe_path);
-    } else {
-      LOG_WARN("readlink failed for %s", proc_path);
+
+    // A different program running inside the window (vim in konsole) shares
+    // the window's scope and class but isn't that app
+    inner_program = window_exe && g_strcmp0(window_exe, id->exe_path) != 0;
+    if (inner_program) {
+      g_free(id->desktop_id);
+      id->desktop_id = NULL;
     }
+    g_free(window_exe);
   } else {
     LOG_WARN("No PID found for window");
   }
 
-  // Get Window Title (_NET_WM_NAME or WM_NAME)
-  // Simplified: try retrieving raw name
-  // Correct way handles utf8 types, but for MVP XFetchName is fallback or
-  // manual request Let's try XFetchName for simplicity, or _NET_WM_NAME
-  char *name = NULL;
-  if (XFetchName(priv->dpy, active_win, &name) > 0) {
-    id->title = g_strdup(name);
-    XFree(name);
+  if (!id->desktop_id)
+    id->desktop_id = cheeter_desktop_index_lookup(
+        priv->desktop, inner_program ? NULL : id->wm_class, id->exe_path);
+  query->id = id;
+}
+
+static bool x11_is_own_window(Window win) {
+  return gdk_x11_window_lookup_for_display(gdk_display_get_default(), win) !=
+         NULL;
+}
+
+// Follow title changes on the focused window. Our own windows are left alone:
+// their event mask belongs to GDK.
+static void x11_watch_window(X11Private *priv, Window win) {
+  if (priv->watched_win == win)
+    return;
+  if (priv->watched_win)
+    XSelectInput(priv->dpy, priv->watched_win, NoEventMask);
+  priv->watched_win = 0;
+  if (win && !x11_is_own_window(win)) {
+    XSelectInput(priv->dpy, win, PropertyChangeMask);
+    priv->watched_win = win;
+  }
+}
+
+static void identity_query_free(gpointer data) {
+  IdentityQuery *query = (IdentityQuery *)data;
+  cheeter_app_identity_free(query->id);
+  g_free(query);
+}
+
+static void x11_run_query(X11Private *priv, IdentityQuery *query) {
+  g_mutex_lock(&priv->query_lock);
+  if (priv->query_dpy)
+    x11_query_identity(priv, priv->query_dpy, query);
+  g_mutex_unlock(&priv->query_lock);
+
+  ProcStat st;
+  if (query->pid > 0 && cheeter_proc_read_stat(query->pid, &st))
+    query->starttime = st.starttime;
+}
+
+// The process an identity was resolved to is stale if it is gone (pid reuse
+// is caught by starttime), tmux switched panes, or resolving from the window
+// again lands elsewhere, e.g. on vim launched from a shell that doesn't set
+// titles. Background jobs of the shell don't change where it lands.
+static bool x11_process_still_current(X11Private *priv,
+                                      const IdentityQuery *cached) {
+  pid_t pid = cached->pid;
+  if (pid <= 0)
+    return true;
+  if (cached->tmux_client &&
+      cheeter_tmux_tracker_active_pane(priv->tmux, cached->tmux_client) !=
+          cached->tmux_pane)
+    return false;
+  ProcStat st;
+  if (!cheeter_proc_read_stat(pid, &st) || st.starttime != cached->starttime)
+    return false;
+  if (cached->sandboxed)
+    return true;
+
+  // The same walk as x11_query_identity, minus X
+  pid_t tmux_client = 0, tmux_pane = 0;
+  g_mutex_lock(&priv->query_lock);
+  pid_t resolved = cheeter_proc_resolver_deepest_child(
+      priv->proc, cached->window_pid, cached->win);
+  if (resolved > 0)
+    resolved = x11_follow_tmux(priv, resolved, &tmux_client, &tmux_pane);
+  g_mutex_unlock(&priv->query_lock);
+  return (resolved > 0 ? resolved : cached->window_pid) == pid;
+}
+
+// Stores query as the cached identity if focus hasn't moved on meanwhile.
+// Takes ownership of query->id on success.
+static bool x11_store_identity(X11Private *priv, IdentityQuery *query) {
+  bool stored = false;
+  g_mutex_lock(&priv->lock);
+  if (query->win == priv->active_win && query->id) {
+    cheeter_app_identity_free(priv->cached_id);
+    priv->cached_id = query->id;
+    priv->cached_win = query->win;
+    priv->cached_pid = query->pid;
+    priv->cached_window_pid = query->window_pid;
+    priv->cached_sandboxed = query->sandboxed;
+    priv->cached_starttime = query->starttime;
+    priv->cached_tmux_client = query->tmux_client;
+    priv->cached_tmux_pane = query->tmux_pane;
+    query->id = NULL;
+    stored = true;
+  }
+  g_mutex_unlock(&priv->lock);
+  return stored;
+}
+
+// Last touch of priv by a refresh task; cleanup frees it once all are done
+static void x11_refresh_finished(X11Private *priv) {
+  g_mutex_lock(&priv->lock);
+  if (--priv->n_refreshing == 0)
+    g_cond_broadcast(&priv->refreshed);
+  g_mutex_unlock(&priv->lock);
+}
+
+static void refresh_thread(GTask *task, gpointer source_object,
+                           gpointer task_data, GCancellable *cancellable) {
+  (void)source_object;
+  X11Private *priv = (X11Private *)task_data;
+  if (g_cancellable_is_cancelled(cancellable)) {
+    x11_refresh_finished(priv);
+    g_task_return_error_if_cancelled(task);
+    return;
   }
 
+  IdentityQuery *query = g_new0(IdentityQuery, 1);
+  g_mutex_lock(&priv->lock);
+  query->win = priv->active_win;
+  g_mutex_unlock(&priv->lock);
+
+  if (query->win && !g_cancellable_is_cancelled(cancellable))
+    x11_run_query(priv, query);
+  x11_refresh_finished(priv);
+  g_task_return_pointer(task, query, identity_query_free);
+}
+
+static void on_refresh_done(GObject *source_object, GAsyncResult *res,
+                            gpointer user_data) {
+  (void)source_object;
+  (void)user_data;
+  GError *error = NULL;
+  IdentityQuery *query = g_task_propagate_pointer(G_TASK(res), &error);
+  if (!query) {
+    // Cancelled: the backend is being torn down, priv may be gone
+    g_clear_error(&error);
+    return;
+  }
+
+  X11Private *priv = (X11Private *)g_task_get_task_data(G_TASK(res));
+  bool stored = x11_store_identity(priv, query);
+  identity_query_free(query);
+
+  g_mutex_lock(&priv->lock);
+  // Another change may have been scheduled while we were querying
+  if (!priv->refresh_source)
+    priv->refresh_pending = false;
+  AppIdentity *id = stored ? cheeter_app_identity_copy(priv->cached_id) : NULL;
+  g_mutex_unlock(&priv->lock);
+
+  if (id) {
+    LOG_DEBUG("Active app refreshed: class=%s, exe=%s", id->wm_class,
+              id->exe_path);
+    if (priv->active_app_cb)
+      priv->active_app_cb(id, priv->active_app_user_data);
+    cheeter_app_identity_free(id);
+  }
+}
+
+static gboolean on_refresh_timeout(gpointer user_data) {
+  X11Private *priv = (X11Private *)user_data;
+  priv->refresh_source = 0;
+
+  g_mutex_lock(&priv->lock);
+  priv->n_refreshing++;
+  g_mutex_unlock(&priv->lock);
+  GTask *task = g_task_new(NULL, priv->cancellable, on_refresh_done, NULL);
+  g_task_set_task_data(task, priv, NULL);
+  g_task_run_in_thread(task, refresh_thread);
+  g_object_unref(task);
+  return G_SOURCE_REMOVE;
+}
+
+static void x11_schedule_refresh(X11Private *priv) {
+  g_mutex_lock(&priv->lock);
+  priv->refresh_pending = true;
+  g_mutex_unlock(&priv->lock);
+
+  if (!priv->refresh_source)
+    priv->refresh_source =
+        g_timeout_add(REFRESH_DELAY_MS, on_refresh_timeout, priv);
+}
+
+static void x11_on_active_window_changed(X11Private *priv) {
+  Window win = x11_read_active_window(priv);
+  // Our overlay taking focus says nothing about what the user is working in
+  if (win && x11_is_own_window(win))
+    return;
+
+  g_mutex_lock(&priv->lock);
+  bool changed = win != priv->active_win;
+  priv->active_win = win;
+  g_mutex_unlock(&priv->lock);
+
+  if (!changed)
+    return;
+  x11_watch_window(priv, win);
+  x11_schedule_refresh(priv);
+}
+
+// May block on X and /proc; called from worker threads.
+static AppIdentity *x11_get_active_app(CheeterBackend *self) {
+  X11Private *priv = (X11Private *)self->priv;
+  if (!priv || !priv->query_dpy)
+    return NULL;
+
+  IdentityQuery query = {0};
+  IdentityQuery cached = {0};
+
+  g_mutex_lock(&priv->lock);
+  query.win = priv->active_win;
+  if (priv->cached_id && !priv->refresh_pending &&
+      priv->cached_win == priv->active_win) {
+    cached.id = cheeter_app_identity_copy(priv->cached_id);
+    cached.win = priv->cached_win;
+    cached.pid = priv->cached_pid;
+    cached.window_pid = priv->cached_window_pid;
+    cached.sandboxed = priv->cached_sandboxed;
+    cached.starttime = priv->cached_starttime;
+    cached.tmux_client = priv->cached_tmux_client;
+    cached.tmux_pane = priv->cached_tmux_pane;
+  }
+  g_mutex_unlock(&priv->lock);
+
+  if (cached.id && x11_process_still_current(priv, &cached))
+    return cached.id;
+  cheeter_app_identity_free(cached.id);
+
+  if (!query.win) {
+    LOG_WARN("No active X11 window found.");
+    return g_new0(AppIdentity, 1); // empty
+  }
+
+  LOG_DEBUG("Cached active app is stale, resolving now");
+  x11_run_query(priv, &query);
+  if (!query.id)
+    return g_new0(AppIdentity, 1);
+
+  AppIdentity *id = cheeter_app_identity_copy(query.id);
+  if (!x11_store_identity(priv, &query))
+    cheeter_app_identity_free(query.id);
   return id;
 }
 
+static void x11_set_active_app_callback(CheeterBackend *self,
+                                        CheeterActiveAppCallback cb,
+                                        void *user_data) {
+  X11Private *priv = (X11Private *)self->priv;
+  if (!priv)
+    return;
+  priv->active_app_cb = cb;
+  priv->active_app_user_data = user_data;
+
+  g_mutex_lock(&priv->lock);
+  AppIdentity *id = cheeter_app_identity_copy(priv->cached_id);
+  g_mutex_unlock(&priv->lock);
+  if (cb && id)
+    cb(id, user_data);
+  cheeter_app_identity_free(id);
+}
+
 static void x11_cleanup(CheeterBackend *self) {
   if (!self || !self->priv)
     return;
@@ -410,8 +817,36 @@ static void x11_cleanup(CheeterBackend *self) {
   }
 
   X11Private *priv = (X11Private *)self->priv;
+  if (priv->refresh_source)
+    g_source_remove(priv->refresh_source);
+  if (priv->dpy)
+    x11_watch_window(priv, 0);
+
+  // Wait out every refresh task started, queued ones included: each still
+  // reads priv, even if only to see it was cancelled
+  if (priv->cancellable)
+    g_cancellable_cancel(priv->cancellable);
+  g_mutex_lock(&priv->lock);
+  while (priv->n_refreshing > 0)
+    g_cond_wait(&priv->refreshed, &priv->lock);
+  g_mutex_unlock(&priv->lock);
+  g_mutex_lock(&priv->query_lock);
+  if (priv->query_dpy)
+    XCloseDisplay(priv->query_dpy);
+  priv->query_dpy = NULL;
+  g_mutex_unlock(&priv->query_lock);
+  g_clear_object(&priv->cancellable);
+
+  cheeter_app_identity_free(priv->cached_id);
   // Don't close the display - it's owned by GDK
   priv->dpy = NULL;
+  cheeter_proc_resolver_free(priv->proc);
+  cheeter_proc_tree_free(priv->proc_tree);
+  cheeter_tmux_tracker_free(priv->tmux);
+  cheeter_desktop_index_free(priv->desktop);
+  g_mutex_clear(&priv->lock);
+  g_mutex_clear(&priv->query_lock);
+  g_cond_clear(&priv->refreshed);
   g_free(priv);
   self->priv = NULL;
 }
@@ -421,6 +856,7 @@ CheeterBackend *cheeter_backend_x11_new(void) {
   b->name = "x11";
   b->init = x11_init;
   b->get_active_app = x11_get_active_app;
+  b->set_active_app_callback = x11_set_active_app_callback;
   b->cleanup = x11_cleanup;
   return b;
 }
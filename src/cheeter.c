@@ -1,16 +1,84 @@
 #include "cheeter/ipc.h"
 #include "cheeter/log.h"
+#include "cheeter/mapping.h"
 #include "cheeter/paths.h"
 #include <glib.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+// FILE's contents, or stdin's for "-"
+static char *read_input(const char *file, GError **error) {
+  if (strcmp(file, "-") != 0) {
+    char *contents;
+    return g_file_get_contents(file, &contents, NULL, error) ? contents
+                                                             : NULL;
+  }
+  GString *contents = g_string_new(NULL);
+  char buffer[65536];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), stdin)) > 0)
+    g_string_append_len(contents, buffer, n);
+  return g_string_free(contents, FALSE);
+}
+
+// Streams FILE's mappings to the daemon over one connection
+static int map_import(const char *file) {
+  GError *error = NULL;
+  char *contents = read_input(file, &error);
+  if (!contents) {
+    fprintf(stderr, "Error: %s\n", error->message);
+    g_error_free(error);
+    return 1;
+  }
+  char **lines = g_strsplit(contents, "\n", -1);
+  g_free(contents);
+  // Blank lines would only be counted as skipped
+  guint n = 0;
+  for (guint i = 0; lines[i]; i++) {
+    g_strchomp(lines[i]);
+    if (*lines[i])
+      lines[n++] = lines[i];
+    else
+      g_free(lines[i]);
+  }
+  lines[n] = NULL;
+
+  char *socket_path = cheeter_get_socket_path();
+  char *response = NULL;
+  gint64 start = g_get_monotonic_time();
+  bool sent = cheeter_ipc_client_send_body(socket_path, "MAP-IMPORT", lines,
+                                           n, &response);
+  gint64 us = MAX(g_get_monotonic_time() - start, 1);
+  if (sent) {
+    printf("%s", response);
+    printf("Sent %u lines in %.1f ms, %.0f/s end to end\n", n, us / 1000.0,
+           n * 1e6 / us);
+  } else {
+    fprintf(stderr,
+            "Error: Could not send mappings to cheeterd at %s. Is it "
+            "running?\n",
+            socket_path);
+  }
+  g_free(response);
+  g_free(socket_path);
+  g_strfreev(lines);
+  return sent ? 0 : 1;
+}
+
 static void print_usage(const char *prog) {
   printf("Usage: %s <command>\n", prog);
   printf("Commands:\n");
   printf("  toggle       Toggle the cheatsheet overlay\n");
-  printf("  search       Open search UI\n");
+  printf("  search WORDS List sheet pages mentioning WORDS\n");
+  printf("  map import FILE\n");
+  printf("               Add the KEY<TAB>SHEET lines of FILE (- for stdin)\n");
+  printf("               to the daemon's mappings, all at once\n");
+  printf("  map export   Print the daemon's mappings in the same form\n");
+  printf("  compile-mappings TSV [OUT]\n");
+  printf("               Compile TSV mappings into a table cheeterd loads\n");
+  printf("               at start (default OUT: mappings.tbl in the config\n");
+  printf("               directory)\n");
   printf("  status       Check daemon status\n");
   printf("  quit         Stop the daemon\n");
 }
@@ -24,10 +92,48 @@ int main(int argc, char *argv[]) {
   const char *cmd = argv[1];
   char *ipc_cmd = NULL;
 
+  if (strcmp(cmd, "map") == 0 && argc == 4 &&
+      strcmp(argv[2], "import") == 0)
+    return map_import(argv[3]);
+
+  // Local: the daemon picks the table up at its next start
+  if (strcmp(cmd, "compile-mappings") == 0) {
+    if (argc < 3 || argc > 4) {
+      print_usage(argv[0]);
+      return 1;
+    }
+    char *out;
+    if (argc == 4) {
+      out = g_strdup(argv[3]);
+    } else {
+      char *config_dir = cheeter_get_config_dir();
+      out = g_build_filename(config_dir, "mappings.tbl", NULL);
+      g_free(config_dir);
+    }
+    GError *error = NULL;
+    guint n = 0;
+    bool ok = cheeter_mapping_table_compile(argv[2], out, &n, &error);
+    if (ok) {
+      printf("Compiled %u mappings into %s\n", n, out);
+    } else {
+      fprintf(stderr, "Error: %s\n", error->message);
+      g_error_free(error);
+    }
+    g_free(out);
+    return ok ? 0 : 1;
+  }
+
   if (strcmp(cmd, "toggle") == 0) {
     ipc_cmd = g_strdup("TOGGLE");
   } else if (strcmp(cmd, "search") == 0) {
-    ipc_cmd = g_strdup("SEARCH");
+    // One line on the wire: the words joined by spaces
+    char *query = g_strjoinv(" ", argv + 2);
+    g_strdelimit(query, "\r\n", ' ');
+    ipc_cmd = g_strdup_printf("SEARCH %s", query);
+    g_free(query);
+  } else if (strcmp(cmd, "map") == 0 && argc == 3 &&
+             strcmp(argv[2], "export") == 0) {
+    ipc_cmd = g_strdup("MAP-EXPORT");
   } else if (strcmp(cmd, "status") == 0) {
     ipc_cmd = g_strdup("STATUS");
   } else if (strcmp(cmd, "quit") == 0) {
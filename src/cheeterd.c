@@ -2,24 +2,25 @@
 #include "cheeter/ipc.h"
 #include "cheeter/log.h"
 #include "cheeter/paths.h"
+#include <gio/gio.h>
 #include <glib.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "cheeter/backend.h"
 #include "cheeter/index.h"
 #include "cheeter/mapping.h"
+#include "cheeter/resolve.h"
+#include "cheeter/rules.h"
+#include "cheeter/search.h"
 #include "cheeter/ui.h"
 
 // Forward factory decls
 CheeterBackend *cheeter_backend_x11_new(void);
 CheeterBackend *cheeter_backend_wayland_new(void);
 
-// Forward decl
-const char *cheeter_resolve_sheet(SheetIndex *index, MappingStore *store,
-                                  const char *app_key);
-
 // Internal logic to handle toggle request (simulated or real)
 void handle_toggle(void);
 
@@ -37,21 +38,142 @@ static GOptionEntry cli_entries[] = {
 // static GMainLoop *mainloop = NULL; // Removed, using GTK loop
 static SheetIndex *g_index = NULL;
 static MappingStore *g_store = NULL;
+static RuleEngine *g_rules = NULL;
 static CheeterBackend *g_backend = NULL;
+static TextIndex *g_text = NULL;
+
+// Pages listed for one SEARCH
+#define SEARCH_MAX_HITS 20
+
+// Sheets resolved per app, filled in as focus changes so the hotkey
+// usually finds its answer there
+static ResolveCache *g_resolve_cache = NULL;
+
+// Resolution runs on worker threads so the main loop keeps drawing and
+// serving IPC. These are non-NULL while a job of that kind is in flight.
+static GCancellable *g_toggle_cancellable = NULL;
+static GCancellable *g_precompute_cancellable = NULL;
+// Jobs whose worker may still be reading the globals above. Only touched on
+// the main thread: counted up when submitted, down when they report back.
+static guint g_resolve_running = 0;
+
+static char *build_app_key(const AppIdentity *id);
+static void on_active_app_changed(const AppIdentity *id, void *user_data);
+static void on_sheets_changed(const char *const *paths,
+                              const char *const *names, gpointer user_data);
+
+// One "path<TAB>page" line per hit, pages counted from 1
+static char *handle_search(const char *query) {
+  query = query + strspn(query, " \t");
+  if (!*query)
+    return g_strdup("Usage: cheeter search WORDS...\n");
+  if (!g_text)
+    return g_strdup("Search is not available\n");
+
+  GString *reply = g_string_new(NULL);
+  GPtrArray *hits = cheeter_text_index_search(g_text, query, SEARCH_MAX_HITS);
+  for (guint i = 0; i < hits->len; i++) {
+    const SearchHit *hit = g_ptr_array_index(hits, i);
+    g_string_append_printf(reply, "%s\t%d\n", hit->path, hit->page + 1);
+  }
+  if (hits->len == 0)
+    g_string_append(reply, "No matches\n");
+  guint pending = cheeter_text_index_pending(g_text);
+  if (pending)
+    g_string_append_printf(reply, "(%u sheets still being indexed)\n",
+                           pending);
+  LOG_INFO("IPC: SEARCH '%s': %u hits", query, hits->len);
+  g_ptr_array_unref(hits);
+  return g_string_free(reply, FALSE);
+}
+
+// Body lines are "KEY<TAB>SHEET", applied as one change once all are read
+static char *handle_map_import(CheeterIpcBody *body) {
+  gint64 start = g_get_monotonic_time();
+  GPtrArray *keys = g_ptr_array_new_with_free_func(g_free);
+  GPtrArray *sheets = g_ptr_array_new();
+  guint malformed = 0;
+  char *line;
+  while ((line = cheeter_ipc_body_next_line(body)) != NULL) {
+    // Columns past the sheet are ignored, as in mappings.tsv
+    char *tab = strchr(line, '\t');
+    if (!tab || tab == line || !tab[1] || tab[1] == '\t') {
+      malformed++;
+      g_free(line);
+      continue;
+    }
+    *tab = '\0';
+    char *end = strchr(tab + 1, '\t');
+    if (end)
+      *end = '\0';
+    // Both point into line, which keys owns
+    g_ptr_array_add(keys, line);
+    g_ptr_array_add(sheets, tab + 1);
+  }
+
+  guint set = cheeter_mapping_set_many(
+      g_store, (const char *const *)keys->pdata,
+      (const char *const *)sheets->pdata, keys->len);
+  gint64 us = MAX(g_get_monotonic_time() - start, 1);
+  LOG_INFO("IPC: MAP-IMPORT: %u mappings set in %" G_GINT64_FORMAT " us",
+           set, us);
+  char *reply = g_strdup_printf(
+      "Imported %u mappings (%u skipped) in %.1f ms, %.0f/s\n", set,
+      keys->len - set + malformed, us / 1000.0, set * 1e6 / us);
+  g_ptr_array_unref(sheets);
+  g_ptr_array_unref(keys);
+  return reply;
+}
+
+static void append_mapping(gpointer key, gpointer value, gpointer user_data) {
+  g_string_append_printf((GString *)user_data, "%s\t%s\n", (char *)key,
+                         (char *)value);
+}
+
+// Every mapping as "KEY<TAB>SHEET" lines, ready to import elsewhere
+static char *handle_map_export(void) {
+  GString *reply = g_string_new(NULL);
+  cheeter_mapping_foreach(g_store, append_mapping, reply);
+  return g_string_free(reply, FALSE);
+}
 
-static void on_ipc_command(const char *command, void *user_data) {
+static char *on_ipc_command(const char *command, CheeterIpcBody *body,
+                            void *user_data) {
   (void)user_data;
   if (g_str_has_prefix(command, "TOGGLE")) {
     LOG_INFO("IPC: TOGGLE request");
     handle_toggle();
   } else if (g_str_has_prefix(command, "STATUS")) {
-    LOG_INFO("Executing STATUS action...");
-    // Re-scan for verification
-    // cheeter_index_scan_dir(g_index, ...);
+    LOG_INFO("IPC: STATUS request");
+    GString *reply = g_string_new("OK\n");
+    cheeter_resolve_cache_format_stats(g_resolve_cache, reply);
+    return g_string_free(reply, FALSE);
   } else if (g_str_has_prefix(command, "QUIT")) {
     LOG_INFO("Quitting daemon...");
     cheeter_ui_quit();
+  } else if (g_str_has_prefix(command, "SEARCH")) {
+    return handle_search(command + strlen("SEARCH"));
+  } else if (strcmp(command, "MAP-IMPORT") == 0) {
+    return handle_map_import(body);
+  } else if (strcmp(command, "MAP-EXPORT") == 0) {
+    return handle_map_export();
   }
+  return NULL;
+}
+
+// Returns backend initialized, or NULL (and frees it) if it couldn't start
+static CheeterBackend *start_backend(CheeterBackend *backend,
+                                     const char *hotkey) {
+  if (!backend->init(backend, hotkey, (CheeterHotkeyCallback)handle_toggle,
+                     NULL)) {
+    LOG_ERROR("%s backend failed to initialize.", backend->name);
+    backend->cleanup(backend);
+    g_free(backend);
+    return NULL;
+  }
+  if (backend->set_active_app_callback)
+    backend->set_active_app_callback(backend, on_active_app_changed, NULL);
+  return backend;
 }
 
 static void handle_sigterm(int signum) {
@@ -146,58 +268,89 @@ int main(int argc, char *argv[]) {
 
   // Initialize Index & Store
   g_index = cheeter_index_new();
-  char *sheet_dir;
+  // The user's sheets first, then any installed system-wide
+  GPtrArray *sheet_roots = g_ptr_array_new_with_free_func(g_free);
   if (config->sheets_dir) {
-    sheet_dir = g_strdup(config->sheets_dir);
-    LOG_INFO("Sheets directory (config): %s", sheet_dir);
+    LOG_INFO("Sheets directory (config): %s", config->sheets_dir);
+    char **dirs = g_strsplit(config->sheets_dir, ":", -1);
+    for (int i = 0; dirs[i]; i++)
+      if (*dirs[i])
+        g_ptr_array_add(sheet_roots, g_strdup(dirs[i]));
+    g_strfreev(dirs);
   } else {
     char *data_dir = cheeter_get_data_dir();
-    sheet_dir = g_build_filename(data_dir, "sheets", NULL);
+    char *sheet_dir = g_build_filename(data_dir, "sheets", NULL);
     g_free(data_dir);
+    g_mkdir_with_parents(sheet_dir, 0755);
+    g_ptr_array_add(sheet_roots, sheet_dir);
   }
-  g_mkdir_with_parents(sheet_dir, 0755);
-
-  cheeter_index_scan_dir(g_index, sheet_dir);
+  const char *const *system_dirs = g_get_system_data_dirs();
+  for (int i = 0; system_dirs[i]; i++) {
+    char *root = g_build_filename(system_dirs[i], "cheeter", "sheets", NULL);
+    if (g_file_test(root, G_FILE_TEST_IS_DIR))
+      g_ptr_array_add(sheet_roots, root);
+    else
+      g_free(root);
+  }
+  g_ptr_array_add(sheet_roots, NULL);
+
+  char *cache_dir = cheeter_get_cache_dir();
+  char *index_cache = g_build_filename(cache_dir, "sheets.idx", NULL);
+  cheeter_index_set_cache(g_index, index_cache);
+  g_free(index_cache);
+  cheeter_index_scan_roots(g_index, (const char *const *)sheet_roots->pdata);
+  g_ptr_array_unref(sheet_roots);
+  cheeter_index_watch(g_index, on_sheets_changed, NULL);
+
+  // Sheet text for search, read in the background
+  char *text_cache = g_build_filename(cache_dir, "text.idx", NULL);
+  g_text = cheeter_text_index_new(g_index, text_cache);
+  g_free(text_cache);
+  g_free(cache_dir);
 
   // Mappings
   char *map_file =
       g_build_filename(cheeter_get_config_dir(), "mappings.tsv", NULL);
   g_store = cheeter_mapping_load(map_file);
+  g_resolve_cache = cheeter_resolve_cache_new();
+  // Large provisioned sets, from `cheeter compile-mappings`
+  char *table_file =
+      g_build_filename(cheeter_get_config_dir(), "mappings.tbl", NULL);
+  cheeter_mapping_attach_table(g_store, table_file);
+  g_free(table_file);
+
+  char *rules_file =
+      g_build_filename(cheeter_get_config_dir(), "rules.tsv", NULL);
+  g_rules = cheeter_rules_new(rules_file);
 
-  g_free(sheet_dir);
   g_free(map_file);
+  g_free(rules_file);
 
   // Setup IPC
   char *ipc_socket_path = cheeter_get_socket_path();
   CheeterIpcServer *ipc =
       cheeter_ipc_server_new(ipc_socket_path, on_ipc_command, NULL);
+  cheeter_ipc_server_add_body_command(ipc, "MAP-IMPORT");
   cheeter_ipc_server_attach_to_mainloop(ipc);
 
   // Backend Init
-  // TODO: better selection logic (check WAYLAND_DISPLAY etc)
+  // X11 first: under XWayland GDK still picks Wayland, so x11 init fails
+  // there and we fall through to AT-SPI.
 #ifdef CHEETER_HAVE_X11
   if (!g_backend) {
-    // Priority: X11 for now in this env
     LOG_INFO("Initializing X11 Backend...");
-    g_backend = cheeter_backend_x11_new();
+    g_backend = start_backend(cheeter_backend_x11_new(), config->hotkey);
   }
 #endif
 
 #ifdef CHEETER_HAVE_ATSPI
-  // If X11 failed or not present, try Wayland (Mock)
   if (!g_backend && g_getenv("WAYLAND_DISPLAY")) {
-    LOG_INFO("Initializing Wayland Backend (Mock)...");
-    g_backend = cheeter_backend_wayland_new();
+    LOG_INFO("Initializing Wayland (AT-SPI) Backend...");
+    g_backend = start_backend(cheeter_backend_wayland_new(), config->hotkey);
   }
 #endif
 
-  if (g_backend) {
-    if (!g_backend->init(g_backend, config->hotkey,
-                         (CheeterHotkeyCallback)handle_toggle, NULL)) {
-      LOG_ERROR("Backend failed to initialize.");
-      // Non-fatal? Or exit? Let's keep running for IPC.
-    }
-  } else {
+  if (!g_backend) {
     LOG_WARN("No backend available (or X11 not compiled). Hotkeys/ActiveApp "
              "won't work.");
   }
@@ -207,16 +360,29 @@ int main(int argc, char *argv[]) {
   cheeter_ui_run();
 
   // Cleanup
+  if (g_toggle_cancellable)
+    g_cancellable_cancel(g_toggle_cancellable);
+  if (g_precompute_cancellable)
+    g_cancellable_cancel(g_precompute_cancellable);
+  // Workers use the backend, index, store, rules and cache, so they must be
+  // done before any of those go. Cancelled, they report back promptly.
+  while (g_resolve_running > 0)
+    g_main_context_iteration(NULL, TRUE);
+  g_clear_object(&g_toggle_cancellable);
+  g_clear_object(&g_precompute_cancellable);
   cheeter_ipc_server_free(ipc);
   if (g_backend) {
     g_backend->cleanup(g_backend);
     g_free(g_backend);
   }
+  cheeter_text_index_free(g_text);
   if (g_index)
     cheeter_index_free(g_index);
   if (g_store)
     cheeter_mapping_free(g_store);
+  cheeter_rules_free(g_rules);
   cheeter_config_free(config);
+  cheeter_resolve_cache_free(g_resolve_cache);
   g_free(config_path);
   g_free(config_dir);
   g_free(ipc_socket_path);
@@ -226,48 +392,268 @@ int main(int argc, char *argv[]) {
   return 0;
 }
 
-void handle_toggle(void) {
-  LOG_INFO("Action: Toggle/Show Cheatsheet");
+// Build a primary key for resolution.
+// Priority: Desktop ID > Exe > WM_CLASS (simple MVP)
+// Ideally we check all candidates.
+static char *build_app_key(const AppIdentity *id) {
+  if (id && id->desktop_id) {
+    return g_strdup_printf("desktop:%s", id->desktop_id);
+  } else if (id && id->exe_path) {
+    char *base = g_path_get_basename(id->exe_path);
+    char *app_key = g_strdup_printf("exe:%s", base);
+    g_free(base);
+    return app_key;
+  } else if (id && id->wm_class) {
+    return g_strdup_printf("class:%s", id->wm_class);
+  }
+  return g_strdup("unknown");
+}
+
+// ---- Resolution pipeline ----
+
+// A rule's sheet is a path, or the name of a sheet in the index ("vim" or
+// "vim.pdf")
+static char *rule_sheet_path(const char *sheet) {
+  if (g_path_is_absolute(sheet))
+    return g_strdup(sheet);
+  const char *dot = strrchr(sheet, '.');
+  char *name = g_ascii_strdown(sheet, dot ? dot - sheet : -1);
+  char *path = cheeter_index_lookup(g_index, name);
+  g_free(name);
+  if (!path)
+    LOG_WARN("Rule names sheet '%s', which is not in the index", sheet);
+  return path;
+}
 
-  AppIdentity *id = NULL;
-  char *app_key = NULL;
+// One resolution, run on a worker thread. g_index, g_store, g_rules and
+// g_resolve_cache are thread-safe.
+typedef struct {
+  AppIdentity *id;      // Input, or NULL to ask the backend
+  char *app_key;        // Output
+  char *fallback_key;   // Output, the exe or class key behind a desktop id
+  char *sheet;          // Output, NULL if nothing matched
+  bool fuzzy;           // Output, sheet only resembles the app's names
+  double page_width;    // Output, of the sheet's first page; 0 if unknown
+  double page_height;
+  bool show;     // Hotkey job: show the overlay when done
+  bool from_rule; // sheet came from a rule, not from app_key
+} ResolveJob;
+
+static void resolve_job_free(gpointer data) {
+  ResolveJob *job = (ResolveJob *)data;
+  cheeter_app_identity_free(job->id);
+  g_free(job->app_key);
+  g_free(job->fallback_key);
+  g_free(job->sheet);
+  g_free(job);
+}
 
-  if (g_backend && g_backend->get_active_app) {
-    id = g_backend->get_active_app(g_backend);
-  }
+// What resolution looks at besides rules: the identity's desktop id, exe
+// and class, as the app keys take them
+static char *resolve_cache_key(const AppIdentity *id) {
+  char *exe = id && id->exe_path ? g_path_get_basename(id->exe_path) : NULL;
+  char *key = g_strdup_printf("%s\t%s\t%s",
+                              id && id->desktop_id ? id->desktop_id : "",
+                              exe ? exe : "",
+                              id && id->wm_class ? id->wm_class : "");
+  g_free(exe);
+  return key;
+}
 
-  if (id) {
-    LOG_INFO("Active App: Title='%s', WM_CLASS='%s', Exe='%s'", id->title,
-             id->wm_class, id->exe_path);
-
-    // Build a primary key for resolution.
-    // Priority: Exe > WM_CLASS > Title (simple MVP)
-    // Ideally we check all candidates.
-    if (id->exe_path) {
-      char *base = g_path_get_basename(id->exe_path);
-      app_key = g_strdup_printf("exe:%s", base);
-      g_free(base);
-    } else if (id->wm_class) {
-      app_key = g_strdup_printf("class:%s", id->wm_class);
+// Mappings for the desktop id, then for the exe or class, then sheet names
+// in the same order, then fuzzy names. An explicit mapping always beats a
+// sheet that merely shares a key's name.
+static void resolve_uncached(ResolveJob *job) {
+  // Sheets are mostly named after programs, not desktop ids
+  if (job->id && job->id->desktop_id) {
+    AppIdentity fallback = *job->id;
+    fallback.desktop_id = NULL;
+    job->fallback_key = build_app_key(&fallback);
+  }
+  job->sheet = cheeter_resolve_mapped(g_store, job->app_key);
+  if (!job->sheet)
+    job->sheet = cheeter_resolve_mapped(g_store, job->fallback_key);
+  if (!job->sheet)
+    job->sheet = cheeter_resolve_indexed(g_index, job->app_key);
+  if (!job->sheet)
+    job->sheet = cheeter_resolve_indexed(g_index, job->fallback_key);
+  // Only when nothing resolved exactly, so an exact exe match beats a
+  // desktop id that merely looks like some sheet
+  if (!job->sheet) {
+    double score, fallback_score = 0;
+    job->sheet = cheeter_resolve_sheet_fuzzy(g_index, job->app_key, &score);
+    char *fallback = job->fallback_key
+                         ? cheeter_resolve_sheet_fuzzy(
+                               g_index, job->fallback_key, &fallback_score)
+                         : NULL;
+    if (fallback && fallback_score > score) {
+      g_free(job->sheet);
+      job->sheet = fallback;
+      score = fallback_score;
     } else {
-      app_key = g_strdup("unknown");
+      g_free(fallback);
     }
+    job->fuzzy = job->sheet != NULL;
+    if (job->fuzzy)
+      LOG_INFO("Found fuzzy match for %s -> %s (%.2f)", job->app_key,
+               job->sheet, score);
+  }
+}
+
+static void resolve_thread(GTask *task, gpointer source_object,
+                           gpointer task_data, GCancellable *cancellable) {
+  (void)source_object;
+  (void)cancellable;
+  ResolveJob *job = (ResolveJob *)task_data;
+
+  if (!job->id && g_backend && g_backend->get_active_app) {
+    job->id = g_backend->get_active_app(g_backend);
+  }
+  if (g_task_return_error_if_cancelled(task))
+    return;
+
+  if (job->id) {
+    LOG_INFO("Active App: Title='%s', WM_CLASS='%s', Exe='%s'", job->id->title,
+             job->id->wm_class, job->id->exe_path);
   } else {
     LOG_WARN("Could not determine active app.");
-    app_key = g_strdup("unknown");
   }
 
-  const char *sheet = cheeter_resolve_sheet(g_index, g_store, app_key);
-  if (sheet) {
-    LOG_INFO(">>> SHOW SHEET: %s <<<", sheet);
+  job->app_key = build_app_key(job->id);
+  // Rules can look at the title, which the app key doesn't cover, so they
+  // run before the cache is consulted
+  char *rule_sheet = cheeter_rules_match(g_rules, job->id);
+  if (rule_sheet)
+    job->sheet = rule_sheet_path(rule_sheet);
+  job->from_rule = job->sheet != NULL;
+  g_free(rule_sheet);
+
+  if (job->from_rule) {
+    LOG_DEBUG("Sheet for %s chosen by rule: %s", job->app_key, job->sheet);
   } else {
-    LOG_INFO(">>> NO SHEET FOUND for %s <<<", app_key);
+    // Taken before resolving, so a result that raced a change is filed
+    // under the generation before it and never served
+    guint index_generation = cheeter_index_get_generation(g_index);
+    guint store_generation = cheeter_mapping_get_generation(g_store);
+    char *key = resolve_cache_key(job->id);
+    ResolveResult result = {0};
+    if (cheeter_resolve_cache_lookup(g_resolve_cache, key, index_generation,
+                                     store_generation, &result)) {
+      job->sheet = result.sheet;
+      job->fallback_key = result.fallback_key;
+      job->fuzzy = result.fuzzy;
+    } else {
+      gint64 start = g_get_monotonic_time();
+      resolve_uncached(job);
+      result.sheet = job->sheet;
+      result.fallback_key = job->fallback_key;
+      result.fuzzy = job->fuzzy;
+      cheeter_resolve_cache_insert(g_resolve_cache, key, index_generation,
+                                   store_generation, &result,
+                                   g_get_monotonic_time() - start);
+    }
+    g_free(key);
+  }
+
+  // Lets the overlay be sized before the sheet is parsed
+  guint n_pages;
+  if (job->show && job->sheet)
+    cheeter_index_page_size(g_index, job->sheet, &n_pages, &job->page_width,
+                            &job->page_height);
+  g_task_return_boolean(task, TRUE);
+}
+
+static void on_resolve_done(GObject *source_object, GAsyncResult *res,
+                            gpointer user_data) {
+  (void)source_object;
+  (void)user_data;
+  GTask *task = G_TASK(res);
+  ResolveJob *job = (ResolveJob *)g_task_get_task_data(task);
+  GCancellable *cancellable = g_task_get_cancellable(task);
+  GError *error = NULL;
+
+  g_resolve_running--;
+  if (!g_task_propagate_boolean(task, &error)) {
+    LOG_DEBUG("Resolution cancelled: %s", error->message);
+    g_error_free(error);
+    return;
+  }
+
+  if (!job->show) {
+    // A newer focus change supersedes this one
+    if (cancellable != g_precompute_cancellable)
+      return;
+    g_clear_object(&g_precompute_cancellable);
+  } else if (cancellable == g_toggle_cancellable) {
+    g_clear_object(&g_toggle_cancellable);
   }
 
-  // Toggle UI
-  cheeter_ui_toggle(sheet);
+  if (!job->show) {
+    LOG_DEBUG("Precomputed sheet for %s: %s", job->app_key,
+              job->sheet ? job->sheet : "(none)");
+    return;
+  }
+
+  if (job->sheet) {
+    LOG_INFO(">>> SHOW SHEET: %s <<<", job->sheet);
+  } else {
+    LOG_INFO(">>> NO SHEET FOUND for %s <<<", job->app_key);
+  }
+  cheeter_ui_show_sized(job->sheet, job->page_width, job->page_height);
+}
+
+static void submit_resolve_job(ResolveJob *job, GCancellable *cancellable) {
+  GTask *task = g_task_new(NULL, cancellable, on_resolve_done, NULL);
+  g_task_set_task_data(task, job, resolve_job_free);
+  g_resolve_running++;
+  g_task_run_in_thread(task, resolve_thread);
+  g_object_unref(task);
+}
+
+static void on_active_app_changed(const AppIdentity *id, void *user_data) {
+  (void)user_data;
+  if (g_precompute_cancellable)
+    g_cancellable_cancel(g_precompute_cancellable);
+  g_clear_object(&g_precompute_cancellable);
+  g_precompute_cancellable = g_cancellable_new();
+
+  ResolveJob *job = g_new0(ResolveJob, 1);
+  job->id = cheeter_app_identity_copy(id);
+  submit_resolve_job(job, g_precompute_cancellable);
+}
+
+void handle_toggle(void) {
+  LOG_INFO("Action: Toggle/Show Cheatsheet");
+
+  // Hiding never waits on a resolution
+  if (cheeter_ui_is_visible()) {
+    cheeter_ui_hide();
+    return;
+  }
+
+  // Pressed again before the first press resolved: that toggles it back off
+  if (g_toggle_cancellable) {
+    LOG_INFO("Hotkey pressed again, cancelling pending resolution");
+    g_cancellable_cancel(g_toggle_cancellable);
+    g_clear_object(&g_toggle_cancellable);
+    return;
+  }
+
+  g_toggle_cancellable = g_cancellable_new();
+  ResolveJob *job = g_new0(ResolveJob, 1);
+  job->show = true;
+  submit_resolve_job(job, g_toggle_cancellable);
+}
+
+// Cached resolutions need nothing here: the index's generation moved, so
+// they miss from now on
+static void on_sheets_changed(const char *const *paths,
+                              const char *const *names, gpointer user_data) {
+  (void)names;
+  (void)user_data;
+  if (g_text)
+    cheeter_text_index_update(g_text, paths);
 
-  if (id)
-    cheeter_app_identity_free(id);
-  g_free(app_key);
+  for (int i = 0; paths[i]; i++)
+    cheeter_ui_sheet_changed(paths[i]);
 }
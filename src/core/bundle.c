@@ -0,0 +1,367 @@
+#include "cheeter/bundle.h"
+#include "cheeter/log.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Layout, in native byte order like the index cache:
+//
+//   BundleHeader
+//   BundleRecord records[n_sheets]  sorted by name
+//   char strings[strings_size]      NUL-terminated names
+//   sheet files                     each starting on a BUNDLE_ALIGN boundary
+#define BUNDLE_MAGIC "CHTRBDL1"
+#define BUNDLE_VERSION 1
+// Page aligned, so each sheet maps onto pages of its own
+#define BUNDLE_ALIGN 4096
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t n_sheets;
+  uint32_t strings_size;
+  uint32_t reserved;
+  uint64_t reserved2;
+} BundleHeader;
+
+typedef struct {
+  uint32_t name;
+  uint32_t n_pages;
+  float page_width;
+  float page_height;
+  uint64_t offset;
+  uint64_t size;
+} BundleRecord;
+
+struct SheetBundle {
+  gint refs;
+  char *path;
+  GMappedFile *file;
+  const BundleRecord *records;
+  const char *strings;
+  guint n_sheets;
+  // Identity of the file mapped, to tell when it was replaced
+  dev_t dev;
+  ino_t ino;
+  gint64 mtime;
+  goffset size;
+};
+
+// Open bundles by path, each holding a reference
+static GMutex g_open_lock;
+static GHashTable *g_open = NULL;
+
+static gint64 stat_mtime(const struct stat *st) {
+  return (gint64)st->st_mtim.tv_sec * G_GINT64_CONSTANT(1000000000) +
+         st->st_mtim.tv_nsec;
+}
+
+static guint64 align_up(guint64 offset) {
+  return (offset + BUNDLE_ALIGN - 1) & ~(guint64)(BUNDLE_ALIGN - 1);
+}
+
+// Checks every offset before anything is trusted; the file may be truncated
+// or from another build
+static bool bundle_validate(SheetBundle *bundle, GError **error) {
+  const char *data = g_mapped_file_get_contents(bundle->file);
+  gsize len = g_mapped_file_get_length(bundle->file);
+  const BundleHeader *header = (const BundleHeader *)data;
+  if (len < sizeof(*header) ||
+      memcmp(header->magic, BUNDLE_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version != BUNDLE_VERSION)
+    goto invalid;
+
+  gsize records_size = (gsize)header->n_sheets * sizeof(BundleRecord);
+  gsize strings_off = sizeof(*header) + records_size;
+  if (header->n_sheets > len / sizeof(BundleRecord) ||
+      strings_off + header->strings_size > len ||
+      (header->strings_size > 0 &&
+       data[strings_off + header->strings_size - 1] != '\0'))
+    goto invalid;
+
+  bundle->records = (const BundleRecord *)(data + sizeof(*header));
+  bundle->strings = data + strings_off;
+  bundle->n_sheets = header->n_sheets;
+  for (guint i = 0; i < bundle->n_sheets; i++) {
+    const BundleRecord *rec = &bundle->records[i];
+    if (rec->name >= header->strings_size || rec->offset > len ||
+        rec->size > len - rec->offset)
+      goto invalid;
+    // Sorted, for lookups by name
+    if (i > 0 && strcmp(bundle->strings + bundle->records[i - 1].name,
+                        bundle->strings + rec->name) >= 0)
+      goto invalid;
+  }
+  return true;
+
+invalid:
+  g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+              "%s is not a valid sheet bundle", bundle->path);
+  return false;
+}
+
+static void bundle_free(SheetBundle *bundle) {
+  if (bundle->file)
+    g_mapped_file_unref(bundle->file);
+  g_free(bundle->path);
+  g_free(bundle);
+}
+
+SheetBundle *cheeter_bundle_ref(SheetBundle *bundle) {
+  g_atomic_int_inc(&bundle->refs);
+  return bundle;
+}
+
+void cheeter_bundle_unref(SheetBundle *bundle) {
+  if (bundle && g_atomic_int_dec_and_test(&bundle->refs))
+    bundle_free(bundle);
+}
+
+SheetBundle *cheeter_bundle_open(const char *path, GError **error) {
+  struct stat st;
+  if (stat(path, &st) < 0) {
+    int saved = errno;
+    g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(saved),
+                "%s: %s", path, g_strerror(saved));
+    return NULL;
+  }
+
+  g_mutex_lock(&g_open_lock);
+  if (!g_open)
+    g_open = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                   (GDestroyNotify)cheeter_bundle_unref);
+  SheetBundle *bundle = g_hash_table_lookup(g_open, path);
+  if (bundle && bundle->dev == st.st_dev && bundle->ino == st.st_ino &&
+      bundle->mtime == stat_mtime(&st) && bundle->size == st.st_size) {
+    cheeter_bundle_ref(bundle);
+    g_mutex_unlock(&g_open_lock);
+    return bundle;
+  }
+  g_mutex_unlock(&g_open_lock);
+
+  // Mapped outside the lock; a race at worst maps the file twice
+  bundle = g_new0(SheetBundle, 1);
+  bundle->refs = 1;
+  bundle->path = g_strdup(path);
+  bundle->dev = st.st_dev;
+  bundle->ino = st.st_ino;
+  bundle->mtime = stat_mtime(&st);
+  bundle->size = st.st_size;
+  bundle->file = g_mapped_file_new(path, FALSE, error);
+  if (!bundle->file || !bundle_validate(bundle, error)) {
+    bundle_free(bundle);
+    return NULL;
+  }
+
+  // Replaces a stale mapping; sheets loaded from it keep it alive
+  g_mutex_lock(&g_open_lock);
+  g_hash_table_replace(g_open, bundle->path, cheeter_bundle_ref(bundle));
+  g_mutex_unlock(&g_open_lock);
+  LOG_DEBUG("Mapped sheet bundle %s: %u sheets", path, bundle->n_sheets);
+  return bundle;
+}
+
+gint64 cheeter_bundle_get_mtime(SheetBundle *bundle) { return bundle->mtime; }
+
+guint cheeter_bundle_get_n_sheets(SheetBundle *bundle) {
+  return bundle->n_sheets;
+}
+
+void cheeter_bundle_get_sheet(SheetBundle *bundle, guint i,
+                              BundleSheet *out) {
+  const BundleRecord *rec = &bundle->records[i];
+  out->name = bundle->strings + rec->name;
+  out->size = rec->size;
+  out->n_pages = rec->n_pages;
+  out->page_width = rec->page_width;
+  out->page_height = rec->page_height;
+}
+
+GBytes *cheeter_bundle_get_bytes(SheetBundle *bundle, guint i) {
+  const BundleRecord *rec = &bundle->records[i];
+  GBytes *all = g_mapped_file_get_bytes(bundle->file);
+  GBytes *bytes = g_bytes_new_from_bytes(all, rec->offset, rec->size);
+  g_bytes_unref(all);
+  return bytes;
+}
+
+bool cheeter_bundle_lookup(const char *path, SheetBundle **bundle_out,
+                           guint *index) {
+  // The first component ending in the extension that is a bundle file
+  const char *p = path;
+  while ((p = strstr(p, CHEETER_BUNDLE_EXT "/")) != NULL) {
+    p += strlen(CHEETER_BUNDLE_EXT);
+    char *file = g_strndup(path, p - path);
+    SheetBundle *bundle = cheeter_bundle_open(file, NULL);
+    g_free(file);
+    if (!bundle)
+      continue;
+
+    const char *name = p + 1;
+    guint lo = 0, hi = bundle->n_sheets;
+    while (lo < hi) {
+      guint mid = lo + (hi - lo) / 2;
+      int cmp = strcmp(name, bundle->strings + bundle->records[mid].name);
+      if (cmp == 0) {
+        *bundle_out = bundle;
+        *index = mid;
+        return true;
+      }
+      if (cmp < 0)
+        hi = mid;
+      else
+        lo = mid + 1;
+    }
+    cheeter_bundle_unref(bundle);
+    return false;
+  }
+  return false;
+}
+
+static bool write_all(int fd, const void *data, gsize len, GError **error) {
+  const char *p = (const char *)data;
+  while (len > 0) {
+    gssize n = write(fd, p, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      int saved = errno;
+      g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(saved),
+                  "Could not write bundle: %s", g_strerror(saved));
+      return false;
+    }
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+static bool write_padding(int fd, guint64 *offset, GError **error) {
+  static const char zeros[BUNDLE_ALIGN];
+  guint64 aligned = align_up(*offset);
+  if (!write_all(fd, zeros, aligned - *offset, error))
+    return false;
+  *offset = aligned;
+  return true;
+}
+
+static gint compare_inputs(gconstpointer a, gconstpointer b) {
+  return strcmp((*(const BundleInput *const *)a)->name,
+                (*(const BundleInput *const *)b)->name);
+}
+
+bool cheeter_bundle_write(const char *path, const BundleInput *sheets,
+                          guint n_sheets, GError **error) {
+  GPtrArray *sorted = g_ptr_array_sized_new(n_sheets);
+  for (guint i = 0; i < n_sheets; i++)
+    g_ptr_array_add(sorted, (gpointer)&sheets[i]);
+  g_ptr_array_sort(sorted, compare_inputs);
+
+  // Everything but the sheet files is known up front: names, and sizes
+  // from stat
+  GString *strings = g_string_new(NULL);
+  BundleRecord *records = g_new0(BundleRecord, MAX(n_sheets, 1));
+  bool ok = true;
+  for (guint i = 0; i < n_sheets && ok; i++) {
+    const BundleInput *in = g_ptr_array_index(sorted, i);
+    struct stat st;
+    if (i > 0 && strcmp(in->name, ((const BundleInput *)g_ptr_array_index(
+                                       sorted, i - 1))->name) == 0) {
+      g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                  "Two sheets named %s", in->name);
+      ok = false;
+    } else if (stat(in->file, &st) < 0 || !S_ISREG(st.st_mode)) {
+      g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_NOENT,
+                  "%s is not a readable file", in->file);
+      ok = false;
+    }
+    if (!ok)
+      break;
+    records[i].name = strings->len;
+    g_string_append_len(strings, in->name, strlen(in->name) + 1);
+    records[i].n_pages = in->n_pages;
+    records[i].page_width = in->page_width;
+    records[i].page_height = in->page_height;
+    records[i].size = st.st_size;
+  }
+
+  BundleHeader header = {0};
+  memcpy(header.magic, BUNDLE_MAGIC, sizeof(header.magic));
+  header.version = BUNDLE_VERSION;
+  header.n_sheets = n_sheets;
+  header.strings_size = strings->len;
+  guint64 offset = align_up(sizeof(header) + (guint64)n_sheets * sizeof(*records) +
+                    strings->len);
+  for (guint i = 0; i < n_sheets; i++) {
+    records[i].offset = offset;
+    offset = align_up(offset + records[i].size);
+  }
+
+  // Written beside the target and renamed over it, so a cheeterd mapping
+  // the old bundle keeps a consistent view
+  char *tmp = g_strdup_printf("%s.XXXXXX", path);
+  int fd = ok ? g_mkstemp(tmp) : -1;
+  if (ok && fd < 0) {
+    int saved = errno;
+    g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(saved),
+                "Could not create %s: %s", tmp, g_strerror(saved));
+    ok = false;
+  }
+
+  if (ok)
+    ok = write_all(fd, &header, sizeof(header), error) &&
+         write_all(fd, records, (gsize)n_sheets * sizeof(*records), error) &&
+         write_all(fd, strings->str, strings->len, error);
+  offset = sizeof(header) + (guint64)n_sheets * sizeof(*records) +
+           strings->len;
+  for (guint i = 0; i < n_sheets && ok; i++) {
+    const BundleInput *in = g_ptr_array_index(sorted, i);
+    GMappedFile *src = g_mapped_file_new(in->file, FALSE, error);
+    ok = src && write_padding(fd, &offset, error);
+    // A file that changed size since it was measured would shift the rest
+    if (ok && g_mapped_file_get_length(src) != records[i].size) {
+      g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_AGAIN,
+                  "%s changed while packing", in->file);
+      ok = false;
+    }
+    if (ok)
+      ok = write_all(fd, g_mapped_file_get_contents(src), records[i].size,
+                     error);
+    offset += records[i].size;
+    if (src)
+      g_mapped_file_unref(src);
+  }
+
+  if (fd >= 0) {
+    if (ok && fsync(fd) < 0) {
+      int saved = errno;
+      g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(saved),
+                  "Could not write %s: %s", tmp, g_strerror(saved));
+      ok = false;
+    }
+    close(fd);
+    if (ok) {
+      // mkstemp's 0600 would hide a system-wide bundle from other users
+      g_chmod(tmp, 0644);
+      if (g_rename(tmp, path) < 0) {
+        int saved = errno;
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(saved),
+                    "Could not replace %s: %s", path, g_strerror(saved));
+        ok = false;
+      }
+    }
+    if (!ok)
+      g_unlink(tmp);
+  }
+
+  g_free(tmp);
+  g_free(records);
+  g_string_free(strings, TRUE);
+  g_ptr_array_unref(sorted);
+  return ok;
+}
@@ -33,6 +33,10 @@ static const char *DEFAULT_CONFIG_TEMPLATE =
     "#\n"
     "# If not set, defaults to ~/.local/share/cheeter/sheets\n"
     "# Use an absolute path. Environment variables are NOT expanded.\n"
+    "# Subdirectories are searched too. Several directories can be given,\n"
+    "# separated by ':'; a sheet in an earlier one hides a sheet of the same\n"
+    "# name in a later one. Sheets installed under\n"
+    "# /usr/share/cheeter/sheets come after all of them.\n"
     "#\n"
     "# Example:\n"
     "#   sheets_dir = /home/user/Documents/cheatsheets\n"
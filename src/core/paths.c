@@ -39,6 +39,10 @@ char *cheeter_get_data_dir(void) {
   return ensure_dir(g_get_user_data_dir(), "cheeter");
 }
 
+char *cheeter_get_cache_dir(void) {
+  return ensure_dir(g_get_user_cache_dir(), "cheeter");
+}
+
 char *cheeter_get_runtime_dir(void) {
   // XDG_RUNTIME_DIR is best for sockets
   const char *runtime = g_get_user_runtime_dir();
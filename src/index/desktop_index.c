@@ -0,0 +1,354 @@
+#include "cheeter/desktop.h"
+#include "cheeter/log.h"
+#include <gio/gio.h>
+#include <glib.h>
+#include <stdbool.h>
+#include <string.h>
+
+// Wait for a burst of changes (a package install touching many entries) to
+// settle before rebuilding
+#define REBUILD_DELAY_MS 500
+
+// Launchers and interpreters: an Exec line naming one of these says nothing
+// about which app a process running it belongs to
+static const char *const exec_wrappers[] = {
+    "env",  "sh",   "bash", "flatpak", "snap", "python",   "python2",
+    "python3", "perl", "ruby", "node", "java", "mono", "electron",
+    "wine", NULL};
+
+// One build of the index. Values are desktop ids, or "" once two entries
+// disagree about a key, so neither wins.
+typedef struct {
+  GHashTable *by_wm_class; // Lowercase StartupWMClass -> id
+  GHashTable *by_exec;     // Exec basename -> id
+  GHashTable *by_name;     // Lowercase id, its last component, Icon -> id
+  guint count;
+} DesktopTable;
+
+struct DesktopIndex {
+  char **dirs; // applications directories, most important first
+  GPtrArray *monitors; // GFileMonitor*
+  GCancellable *cancellable; // Cancelled on free
+  guint rebuild_source;
+  bool building;       // Main thread only
+  bool rebuild_wanted; // A change arrived during a build
+
+  GMutex lock;         // Guards table
+  DesktopTable *table; // NULL until the first build finishes
+};
+
+static void desktop_index_start_build(DesktopIndex *index);
+
+// ---- Building ----
+
+static DesktopTable *desktop_table_new(void) {
+  DesktopTable *table = g_new0(DesktopTable, 1);
+  table->by_wm_class =
+      g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  table->by_exec =
+      g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  table->by_name =
+      g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  return table;
+}
+
+static void desktop_table_free(gpointer data) {
+  DesktopTable *table = (DesktopTable *)data;
+  if (!table)
+    return;
+  g_hash_table_destroy(table->by_wm_class);
+  g_hash_table_destroy(table->by_exec);
+  g_hash_table_destroy(table->by_name);
+  g_free(table);
+}
+
+static void table_add(GHashTable *map, char *key, const char *id) {
+  const char *existing = g_hash_table_lookup(map, key);
+  if (!existing)
+    g_hash_table_insert(map, key, g_strdup(id));
+  else if (*existing && strcmp(existing, id) != 0)
+    g_hash_table_replace(map, key, g_strdup(""));
+  else
+    g_free(key);
+}
+
+static const char *table_get(GHashTable *map, const char *key) {
+  const char *id = g_hash_table_lookup(map, key);
+  return id && *id ? id : NULL;
+}
+
+static bool is_exec_wrapper(const char *name) {
+  for (const char *const *w = exec_wrappers; *w; w++)
+    if (strcmp(name, *w) == 0)
+      return true;
+  return false;
+}
+
+// Basename of the program an Exec line runs, past any "env VAR=value"
+static char *exec_program(const char *exec) {
+  char **argv = NULL;
+  if (!g_shell_parse_argv(exec, NULL, &argv, NULL))
+    return NULL;
+
+  char *program = NULL;
+  for (int i = 0; argv[i]; i++) {
+    if (strcmp(argv[i], "env") == 0 || strchr(argv[i], '='))
+      continue;
+    program = g_path_get_basename(argv[i]);
+    break;
+  }
+  g_strfreev(argv);
+  if (program && is_exec_wrapper(program)) {
+    g_free(program);
+    return NULL;
+  }
+  return program;
+}
+
+static void desktop_table_add_entry(DesktopTable *table, const char *path,
+                                    const char *id) {
+  GKeyFile *kf = g_key_file_new();
+  if (!g_key_file_load_from_file(kf, path, G_KEY_FILE_NONE, NULL)) {
+    g_key_file_free(kf);
+    return;
+  }
+
+  const char *group = G_KEY_FILE_DESKTOP_GROUP;
+  char *type = g_key_file_get_string(kf, group, G_KEY_FILE_DESKTOP_KEY_TYPE,
+                                     NULL);
+  if (g_strcmp0(type, G_KEY_FILE_DESKTOP_TYPE_APPLICATION) != 0) {
+    g_free(type);
+    g_key_file_free(kf);
+    return;
+  }
+  g_free(type);
+  if (g_key_file_get_boolean(kf, group, G_KEY_FILE_DESKTOP_KEY_HIDDEN,
+                             NULL)) {
+    g_key_file_free(kf);
+    return;
+  }
+
+  char *wm_class = g_key_file_get_string(
+      kf, group, G_KEY_FILE_DESKTOP_KEY_STARTUP_WM_CLASS, NULL);
+  if (wm_class && *wm_class)
+    table_add(table->by_wm_class, g_ascii_strdown(wm_class, -1), id);
+  g_free(wm_class);
+
+  char *exec =
+      g_key_file_get_string(kf, group, G_KEY_FILE_DESKTOP_KEY_EXEC, NULL);
+  char *program = exec ? exec_program(exec) : NULL;
+  if (program)
+    table_add(table->by_exec, program, id);
+  g_free(exec);
+
+  // Toolkits commonly set the class to the reverse-DNS id, its last
+  // component, or the icon name
+  table_add(table->by_name, g_ascii_strdown(id, -1), id);
+  const char *last_dot = strrchr(id, '.');
+  if (last_dot && last_dot[1])
+    table_add(table->by_name, g_ascii_strdown(last_dot + 1, -1), id);
+  char *icon =
+      g_key_file_get_string(kf, group, G_KEY_FILE_DESKTOP_KEY_ICON, NULL);
+  if (icon && *icon && !g_path_is_absolute(icon))
+    table_add(table->by_name, g_ascii_strdown(icon, -1), id);
+  g_free(icon);
+
+  table->count++;
+  g_key_file_free(kf);
+}
+
+// Ids of entries in subdirectories join the path with '-' ("kde4-foo").
+// seen holds every id already taken by a more important directory, hidden
+// ones included, so a user's Hidden=true entry masks the system one.
+static void desktop_table_scan(DesktopTable *table, GHashTable *seen,
+                               const char *dir_path, const char *prefix) {
+  GDir *dir = g_dir_open(dir_path, 0, NULL);
+  if (!dir)
+    return;
+
+  const char *name;
+  while ((name = g_dir_read_name(dir))) {
+    char *path = g_build_filename(dir_path, name, NULL);
+    if (g_str_has_suffix(name, ".desktop")) {
+      char *id = g_strdup_printf("%s%.*s", prefix,
+                                 (int)(strlen(name) - strlen(".desktop")),
+                                 name);
+      if (!g_hash_table_contains(seen, id)) {
+        g_hash_table_add(seen, g_strdup(id));
+        desktop_table_add_entry(table, path, id);
+      }
+      g_free(id);
+    } else if (g_file_test(path, G_FILE_TEST_IS_DIR)) {
+      char *sub_prefix = g_strdup_printf("%s%s-", prefix, name);
+      desktop_table_scan(table, seen, path, sub_prefix);
+      g_free(sub_prefix);
+    }
+    g_free(path);
+  }
+  g_dir_close(dir);
+}
+
+static void build_thread(GTask *task, gpointer source_object,
+                         gpointer task_data, GCancellable *cancellable) {
+  (void)source_object;
+  (void)cancellable;
+  char **dirs = (char **)task_data;
+  gint64 start = g_get_monotonic_time();
+
+  DesktopTable *table = desktop_table_new();
+  GHashTable *seen = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                           NULL);
+  for (int i = 0; dirs[i]; i++)
+    desktop_table_scan(table, seen, dirs[i], "");
+  g_hash_table_destroy(seen);
+
+  LOG_DEBUG("Indexed %u desktop entries in %" G_GINT64_FORMAT " us",
+            table->count, g_get_monotonic_time() - start);
+  g_task_return_pointer(task, table, desktop_table_free);
+}
+
+static void on_build_done(GObject *source_object, GAsyncResult *res,
+                          gpointer user_data) {
+  (void)source_object;
+  GError *error = NULL;
+  DesktopTable *table = g_task_propagate_pointer(G_TASK(res), &error);
+  if (!table) {
+    // Cancelled: the index is being freed
+    g_clear_error(&error);
+    return;
+  }
+
+  DesktopIndex *index = (DesktopIndex *)user_data;
+  g_mutex_lock(&index->lock);
+  DesktopTable *old = index->table;
+  index->table = table;
+  g_mutex_unlock(&index->lock);
+  desktop_table_free(old);
+
+  LOG_INFO("Desktop entry index ready: %u applications", table->count);
+  index->building = false;
+  if (index->rebuild_wanted) {
+    index->rebuild_wanted = false;
+    desktop_index_start_build(index);
+  }
+}
+
+static void desktop_index_start_build(DesktopIndex *index) {
+  if (index->building) {
+    index->rebuild_wanted = true;
+    return;
+  }
+  index->building = true;
+
+  GTask *task = g_task_new(NULL, index->cancellable, on_build_done, index);
+  g_task_set_task_data(task, g_strdupv(index->dirs),
+                       (GDestroyNotify)g_strfreev);
+  g_task_run_in_thread(task, build_thread);
+  g_object_unref(task);
+}
+
+// ---- Monitoring ----
+
+static gboolean on_rebuild_timeout(gpointer user_data) {
+  DesktopIndex *index = (DesktopIndex *)user_data;
+  index->rebuild_source = 0;
+  desktop_index_start_build(index);
+  return G_SOURCE_REMOVE;
+}
+
+// Entries are few and cheap to parse, so any change rebuilds the lot
+static void on_dir_changed(GFileMonitor *monitor, GFile *file,
+                           GFile *other_file, GFileMonitorEvent event,
+                           gpointer user_data) {
+  (void)monitor;
+  (void)file;
+  (void)other_file;
+  DesktopIndex *index = (DesktopIndex *)user_data;
+  if (event == G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED)
+    return;
+  if (index->rebuild_source)
+    g_source_remove(index->rebuild_source);
+  index->rebuild_source =
+      g_timeout_add(REBUILD_DELAY_MS, on_rebuild_timeout, index);
+}
+
+// ---- Public API ----
+
+DesktopIndex *cheeter_desktop_index_new(void) {
+  DesktopIndex *index = g_new0(DesktopIndex, 1);
+  g_mutex_init(&index->lock);
+  index->cancellable = g_cancellable_new();
+  index->monitors = g_ptr_array_new_with_free_func(g_object_unref);
+
+  // XDG_DATA_HOME first, so user entries override system ones
+  GPtrArray *dirs = g_ptr_array_new();
+  g_ptr_array_add(dirs, g_build_filename(g_get_user_data_dir(),
+                                         "applications", NULL));
+  const char *const *system_dirs = g_get_system_data_dirs();
+  for (int i = 0; system_dirs[i]; i++)
+    g_ptr_array_add(dirs,
+                    g_build_filename(system_dirs[i], "applications", NULL));
+  g_ptr_array_add(dirs, NULL);
+  index->dirs = (char **)g_ptr_array_free(dirs, FALSE);
+
+  // A monitor on a missing directory starts reporting once it appears
+  for (int i = 0; index->dirs[i]; i++) {
+    GFile *dir = g_file_new_for_path(index->dirs[i]);
+    GFileMonitor *monitor = g_file_monitor_directory(
+        dir, G_FILE_MONITOR_WATCH_MOVES, index->cancellable, NULL);
+    g_object_unref(dir);
+    if (!monitor)
+      continue;
+    g_signal_connect(monitor, "changed", G_CALLBACK(on_dir_changed), index);
+    g_ptr_array_add(index->monitors, monitor);
+  }
+
+  desktop_index_start_build(index);
+  return index;
+}
+
+void cheeter_desktop_index_free(DesktopIndex *index) {
+  if (!index)
+    return;
+  if (index->rebuild_source)
+    g_source_remove(index->rebuild_source);
+  // A build still running finishes into a cancelled task and is dropped
+  g_cancellable_cancel(index->cancellable);
+  for (guint i = 0; i < index->monitors->len; i++)
+    g_signal_handlers_disconnect_by_data(g_ptr_array_index(index->monitors, i),
+                                         index);
+  g_ptr_array_unref(index->monitors);
+  g_object_unref(index->cancellable);
+  desktop_table_free(index->table);
+  g_strfreev(index->dirs);
+  g_mutex_clear(&index->lock);
+  g_free(index);
+}
+
+char *cheeter_desktop_index_lookup(DesktopIndex *index, const char *wm_class,
+                                   const char *exe_path) {
+  if (!index)
+    return NULL;
+  char *class_key = wm_class ? g_ascii_strdown(wm_class, -1) : NULL;
+  char *exe_key = exe_path ? g_path_get_basename(exe_path) : NULL;
+
+  char *id = NULL;
+  g_mutex_lock(&index->lock);
+  if (index->table) {
+    const char *found = NULL;
+    if (class_key)
+      found = table_get(index->table->by_wm_class, class_key);
+    if (!found && exe_key)
+      found = table_get(index->table->by_exec, exe_key);
+    if (!found && class_key)
+      found = table_get(index->table->by_name, class_key);
+    id = g_strdup(found);
+  }
+  g_mutex_unlock(&index->lock);
+
+  if (id)
+    LOG_DEBUG("Desktop entry for class=%s, exe=%s: %s", wm_class, exe_key, id);
+  g_free(class_key);
+  g_free(exe_key);
+  return id;
+}
@@ -0,0 +1,216 @@
+#include "cheeter/index.h"
+#include "cheeter/log.h"
+#include <glib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// Names are compared on their first FUZZY_MAX_LEN bytes, padded with two
+// markers in front and one behind, so "vim" gives "^^v", "^vi", "vim", "im^"
+#define FUZZY_MAX_LEN 64
+#define FUZZY_MAX_TRIGRAMS (FUZZY_MAX_LEN + 1)
+#define FUZZY_PAD '\x01'
+// Shorter names share too few trigrams with anything to score reliably
+#define FUZZY_MIN_LEN 3
+// Dice coefficient a match needs: "nvim" ~ "neovim" scores 0.5,
+// "gnome-terminal-server" ~ "gnome-terminal" 0.76, "bash" ~ "bat" 0.44
+#define FUZZY_MIN_SCORE 0.5
+
+// Inverted index from trigram to the visible sheets containing it, as one
+// array of postings sliced by starts. counts and touched are scratch space
+// for a lookup, sized to the sheets, so lookups don't allocate; the mutex
+// makes them one at a time. Rebuilt whenever the visible sheets change and
+// swapped in under the index's write lock, so it never lags the entries.
+struct FuzzyIndex {
+  GMutex lock;
+
+  guint n_sheets;
+  guint32 *sheets;    // Entry ids of the visible sheets, by fuzzy id
+  guint8 *n_trigrams;        // Distinct trigrams per sheet
+
+  GHashTable *keys;   // Trigram -> slot + 1
+  guint32 *starts;    // Slot -> first posting; n_keys + 1 of them
+  guint32 *postings;  // Sheet ids
+
+  guint16 *counts;   // Per sheet, trigrams shared with the query
+  guint32 *touched;  // Sheets with a non-zero count
+};
+
+// Distinct trigrams of name, lowercased, into out; returns how many
+static guint name_trigrams(const char *name, guint32 out[FUZZY_MAX_TRIGRAMS]) {
+  guint8 padded[FUZZY_MAX_LEN + 3];
+  size_t len = strlen(name);
+  if (len > FUZZY_MAX_LEN)
+    len = FUZZY_MAX_LEN;
+  padded[0] = padded[1] = FUZZY_PAD;
+  for (size_t i = 0; i < len; i++)
+    padded[i + 2] = (guint8)g_ascii_tolower(name[i]);
+  padded[len + 2] = FUZZY_PAD;
+
+  guint n = 0;
+  for (size_t i = 0; i + 3 <= len + 3; i++)
+    out[n++] = (guint32)padded[i] << 16 | (guint32)padded[i + 1] << 8 |
+               padded[i + 2];
+  // Insertion sort: a few dozen values, and nothing to allocate
+  for (guint i = 1; i < n; i++) {
+    guint32 t = out[i];
+    guint j = i;
+    for (; j > 0 && out[j - 1] > t; j--)
+      out[j] = out[j - 1];
+    out[j] = t;
+  }
+  guint distinct = 0;
+  for (guint i = 0; i < n; i++)
+    if (distinct == 0 || out[distinct - 1] != out[i])
+      out[distinct++] = out[i];
+  return distinct;
+}
+
+// Builds from the visible sheets in two passes: count each trigram's
+// postings, then fill them in. Called with the index locked.
+FuzzyIndex *cheeter_fuzzy_index_new(SheetIndex *index) {
+  gint64 start = g_get_monotonic_time();
+  FuzzyIndex *fuzzy = g_new0(FuzzyIndex, 1);
+  g_mutex_init(&fuzzy->lock);
+
+  guint n = index->n_visible;
+  fuzzy->n_sheets = n;
+  fuzzy->sheets = g_new(guint32, MAX(n, 1));
+  fuzzy->n_trigrams = g_new(guint8, MAX(n, 1));
+  fuzzy->counts = g_new0(guint16, MAX(n, 1));
+  fuzzy->touched = g_new(guint32, MAX(n, 1));
+  fuzzy->keys = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+  GArray *key_counts = g_array_new(FALSE, TRUE, sizeof(guint32));
+  guint32 trigrams[FUZZY_MAX_TRIGRAMS];
+  guint id = 0;
+  for (guint32 e = 0; e < index->entries->len && id < n; e++) {
+    const SheetEntry *entry = &g_array_index(index->entries, SheetEntry, e);
+    if (!entry->visible)
+      continue;
+    fuzzy->sheets[id] = e;
+    guint count = name_trigrams(entry->basename, trigrams);
+    fuzzy->n_trigrams[id] = count;
+    for (guint i = 0; i < count; i++) {
+      gpointer key = GUINT_TO_POINTER(trigrams[i]);
+      guint slot = GPOINTER_TO_UINT(g_hash_table_lookup(fuzzy->keys, key));
+      if (!slot) {
+        g_array_set_size(key_counts, key_counts->len + 1);
+        slot = key_counts->len;
+        g_hash_table_insert(fuzzy->keys, key, GUINT_TO_POINTER(slot));
+      }
+      g_array_index(key_counts, guint32, slot - 1)++;
+    }
+    id++;
+  }
+
+  guint n_keys = key_counts->len;
+  fuzzy->starts = g_new(guint32, n_keys + 1);
+  guint32 total = 0;
+  for (guint k = 0; k < n_keys; k++) {
+    fuzzy->starts[k] = total;
+    total += g_array_index(key_counts, guint32, k);
+  }
+  fuzzy->starts[n_keys] = total;
+  fuzzy->postings = g_new(guint32, MAX(total, 1));
+
+  // key_counts becomes the fill position of each slot
+  for (guint k = 0; k < n_keys; k++)
+    g_array_index(key_counts, guint32, k) = fuzzy->starts[k];
+  for (id = 0; id < n; id++) {
+    const SheetEntry *entry =
+        &g_array_index(index->entries, SheetEntry, fuzzy->sheets[id]);
+    guint count = name_trigrams(entry->basename, trigrams);
+    for (guint i = 0; i < count; i++) {
+      guint slot = GPOINTER_TO_UINT(g_hash_table_lookup(
+          fuzzy->keys, GUINT_TO_POINTER(trigrams[i])));
+      fuzzy->postings[g_array_index(key_counts, guint32, slot - 1)++] = id;
+    }
+  }
+  g_array_unref(key_counts);
+
+  LOG_DEBUG("Built trigram index of %u sheets, %u trigrams, in %"
+            G_GINT64_FORMAT " us",
+            n, n_keys, g_get_monotonic_time() - start);
+  return fuzzy;
+}
+
+void cheeter_fuzzy_index_free(FuzzyIndex *fuzzy) {
+  if (!fuzzy)
+    return;
+  g_free(fuzzy->sheets);
+  g_free(fuzzy->n_trigrams);
+  g_hash_table_destroy(fuzzy->keys);
+  g_free(fuzzy->starts);
+  g_free(fuzzy->postings);
+  g_free(fuzzy->counts);
+  g_free(fuzzy->touched);
+  g_mutex_clear(&fuzzy->lock);
+  g_free(fuzzy);
+}
+
+char *cheeter_index_lookup_fuzzy(SheetIndex *index, const char *name,
+                                 double *score) {
+  if (score)
+    *score = 0;
+  if (!name || strlen(name) < FUZZY_MIN_LEN)
+    return NULL;
+
+  g_rw_lock_reader_lock(&index->lock);
+  // NULL until the first scan
+  FuzzyIndex *fuzzy = index->fuzzy;
+  if (!fuzzy) {
+    g_rw_lock_reader_unlock(&index->lock);
+    return NULL;
+  }
+
+  g_mutex_lock(&fuzzy->lock);
+  guint32 trigrams[FUZZY_MAX_TRIGRAMS];
+  guint n_query = name_trigrams(name, trigrams);
+  guint n_touched = 0;
+  for (guint i = 0; i < n_query; i++) {
+    guint slot = GPOINTER_TO_UINT(
+        g_hash_table_lookup(fuzzy->keys, GUINT_TO_POINTER(trigrams[i])));
+    if (!slot)
+      continue;
+    for (guint32 p = fuzzy->starts[slot - 1]; p < fuzzy->starts[slot]; p++) {
+      guint32 id = fuzzy->postings[p];
+      if (fuzzy->counts[id]++ == 0)
+        fuzzy->touched[n_touched++] = id;
+    }
+  }
+
+  // Dice coefficient; ties go to the name closest in length, then the
+  // alphabetically first, so the answer doesn't depend on build order
+  const SheetEntry *best = NULL;
+  double best_score = 0;
+  guint best_diff = 0;
+  for (guint i = 0; i < n_touched; i++) {
+    guint32 id = fuzzy->touched[i];
+    double s = 2.0 * fuzzy->counts[id] / (n_query + fuzzy->n_trigrams[id]);
+    guint diff = (guint)ABS((int)n_query - (int)fuzzy->n_trigrams[id]);
+    fuzzy->counts[id] = 0;
+    const SheetEntry *entry =
+        &g_array_index(index->entries, SheetEntry, fuzzy->sheets[id]);
+    bool better = !best || s > best_score;
+    if (!better && s == best_score)
+      better = diff < best_diff ||
+               (diff == best_diff &&
+                strcmp(entry->basename, best->basename) < 0);
+    if (better) {
+      best = entry;
+      best_score = s;
+      best_diff = diff;
+    }
+  }
+
+  char *path = NULL;
+  if (best && best_score >= FUZZY_MIN_SCORE) {
+    path = g_strdup(best->path);
+    if (score)
+      *score = best_score;
+  }
+  g_mutex_unlock(&fuzzy->lock);
+  g_rw_lock_reader_unlock(&index->lock);
+  return path;
+}
@@ -1,79 +1,1612 @@
+#define _GNU_SOURCE
+#include "cheeter/bundle.h"
 #include "cheeter/index.h"
 #include "cheeter/log.h"
+#include <fcntl.h>
+#include <gio/gio.h>
 #include <glib.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
-static void sheet_entry_free(gpointer data) {
-  SheetEntry *entry = (SheetEntry *)data;
-  if (entry) {
-    g_free(entry->path);
-    g_free(entry->basename);
-    g_free(entry);
+// Upper bound on scanner threads; directory reads are mostly I/O wait
+#define SCAN_THREADS_MAX 8
+#define DENTS_BUF_SIZE (64 * 1024)
+
+// Arena blocks; a few thousand paths each
+#define STRINGS_CHUNK_SIZE (64 * 1024)
+// The arena is rebuilt once removed sheets have left this much behind, and
+// as much as is still in use
+#define STRINGS_COMPACT_MIN (256 * 1024)
+// Tables grow past 3/4 full, counting deleted slots
+#define TABLE_MIN_CAPACITY 64
+
+// Changes are applied once the tree has been quiet this long, so copying in
+// a folder of sheets is one update, but no later than FLUSH_MAX_DELAY_MS
+// after the first of them
+#define FLUSH_DELAY_MS 250
+#define FLUSH_MAX_DELAY_MS 2000
+
+// Record layout returned by getdents64
+struct linux_dirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+// A directory of the index, monitored once watching starts
+typedef struct {
+  SheetIndex *index;
+  char *path;
+  guint root;
+  guint depth;
+  gint64 mtime; // When it was last read, ns
+  GFileMonitor *monitor;
+} WatchedDir;
+
+// Where a changed path sits, for rescanning it
+typedef struct {
+  guint root;
+  guint depth;  // Its depth as a directory
+  bool shallow; // Only its own entries changed, not its known subdirectories
+} PendingPath;
+
+struct SheetWatch {
+  GHashTable *dirs; // char* -> WatchedDir*, every directory scanned
+  SheetIndexChangedFunc func; // NULL until watching
+  gpointer user_data;
+  GHashTable *pending; // char* -> PendingPath*, changed since the last flush
+  guint flush_source;
+  gint64 first_pending; // Monotonic time of the oldest pending change
+  guint validate_source; // Checking the cache against the disk
+  // The batch being probed off the main loop, referenced until it has been
+  // applied, so free can wait on it. Changes meanwhile wait in pending.
+  GTask *flushing;
+  bool closing; // Set by free: the batch is dropped, not applied
+};
+
+static void cache_save(SheetIndex *index);
+
+// Forward decls, from index_fuzzy.c and sheet_probe.c
+FuzzyIndex *cheeter_fuzzy_index_new(SheetIndex *index);
+void cheeter_fuzzy_index_free(FuzzyIndex *fuzzy);
+bool cheeter_sheet_probe(const char *path, guint *n_pages, double *width,
+                         double *height);
+
+// ---- Tables ----
+
+// Open addressing with linear probing. Keys are borrowed: entry paths, or
+// the interned names. Slots keep the hash, so probes rarely compare strings.
+typedef struct {
+  const char *key; // NULL if never used, table_deleted once removed
+  guint32 hash;
+  guint32 value;
+} TableSlot;
+
+struct SheetTable {
+  TableSlot *slots;
+  guint32 mask;   // Capacity - 1; capacity is a power of two
+  guint32 shift;  // 32 - log2(capacity)
+  guint32 used;   // Keys present
+  guint32 filled; // Keys present or deleted
+};
+
+static const char table_deleted[] = "";
+
+static guint32 table_hash(const char *key) {
+  return g_str_hash(key);
+}
+
+// Fibonacci hashing spreads g_str_hash's low-entropy bits
+static guint32 table_start(const SheetTable *table, guint32 hash) {
+  return (guint32)(hash * 2654435769u) >> table->shift;
+}
+
+static void table_alloc(SheetTable *table, guint32 capacity) {
+  guint32 bits = g_bit_storage(capacity - 1);
+  table->slots = g_new0(TableSlot, (gsize)1 << bits);
+  table->mask = ((guint32)1 << bits) - 1;
+  table->shift = 32 - bits;
+  table->used = 0;
+  table->filled = 0;
+}
+
+static SheetTable *table_new(void) {
+  SheetTable *table = g_new0(SheetTable, 1);
+  table_alloc(table, TABLE_MIN_CAPACITY);
+  return table;
+}
+
+static void table_free(SheetTable *table) {
+  if (!table)
+    return;
+  g_free(table->slots);
+  g_free(table);
+}
+
+static TableSlot *table_find(const SheetTable *table, const char *key,
+                             guint32 hash) {
+  for (guint32 i = table_start(table, hash);; i = (i + 1) & table->mask) {
+    TableSlot *slot = &table->slots[i];
+    if (!slot->key)
+      return NULL;
+    if (slot->key != table_deleted && slot->hash == hash &&
+        (slot->key == key || strcmp(slot->key, key) == 0))
+      return slot;
+  }
+}
+
+static TableSlot *table_insert(SheetTable *table, const char *key,
+                               guint32 hash, guint32 value);
+
+// Rehashes to fit the keys present with room to spare, dropping deleted slots
+static void table_resize(SheetTable *table) {
+  TableSlot *old = table->slots;
+  guint32 old_capacity = table->mask + 1;
+  table_alloc(table, MAX(table->used * 2 + 2, TABLE_MIN_CAPACITY));
+  for (guint32 i = 0; i < old_capacity; i++)
+    if (old[i].key && old[i].key != table_deleted)
+      table_insert(table, old[i].key, old[i].hash, old[i].value);
+  g_free(old);
+}
+
+// key must not be present
+static TableSlot *table_insert(SheetTable *table, const char *key,
+                               guint32 hash, guint32 value) {
+  if ((table->filled + 1) * 4 > (table->mask + 1) * 3)
+    table_resize(table);
+  guint32 i = table_start(table, hash);
+  while (table->slots[i].key && table->slots[i].key != table_deleted)
+    i = (i + 1) & table->mask;
+  TableSlot *slot = &table->slots[i];
+  if (!slot->key)
+    table->filled++;
+  table->used++;
+  slot->key = key;
+  slot->hash = hash;
+  slot->value = value;
+  return slot;
+}
+
+static void table_remove(SheetTable *table, TableSlot *slot) {
+  slot->key = table_deleted;
+  table->used--;
+}
+
+// ---- Entries ----
+
+#define ENTRY(index, id) (&g_array_index((index)->entries, SheetEntry, (id)))
+// Table values are ids + 1, so 0 can mean none
+#define NO_ENTRY 0
+
+static const char *strings_add(SheetIndex *index, const char *str) {
+  index->strings_live += strlen(str) + 1;
+  return g_string_chunk_insert(index->strings, str);
+}
+
+static void strings_drop(SheetIndex *index, const char *str) {
+  gsize len = strlen(str) + 1;
+  index->strings_live -= len;
+  index->strings_dead += len;
+}
+
+// The interned copy of name, added with no visible sheet if new. A mapped
+// name is interned in place rather than copied.
+static const char *name_intern(SheetIndex *index, const char *name,
+                               bool mapped) {
+  guint32 hash = table_hash(name);
+  TableSlot *slot = table_find(index->names, name, hash);
+  if (slot)
+    return slot->key;
+  const char *key = name;
+  if (mapped)
+    index->strings_live += strlen(name) + 1;
+  else
+    key = strings_add(index, name);
+  return table_insert(index->names, key, hash, NO_ENTRY)->key;
+}
+
+static TableSlot *name_slot(SheetIndex *index, const char *name) {
+  return table_find(index->names, name, table_hash(name));
+}
+
+// Adds a sheet that isn't indexed yet, in a free slot if there is one.
+// path and basename are copied unless mapped, when they already live in the
+// cache image. Returns its id.
+static guint32 entry_add(SheetIndex *index, const char *path,
+                         const char *basename, guint root, guint depth,
+                         gint64 mtime, goffset size, bool mapped) {
+  guint32 id;
+  if (index->free_ids->len > 0) {
+    id = g_array_index(index->free_ids, guint32, index->free_ids->len - 1);
+    g_array_set_size(index->free_ids, index->free_ids->len - 1);
+  } else {
+    id = index->entries->len;
+    g_array_set_size(index->entries, id + 1);
+  }
+  SheetEntry *entry = ENTRY(index, id);
+  memset(entry, 0, sizeof(*entry));
+  if (mapped) {
+    index->strings_live += strlen(path) + 1;
+    entry->path = path;
+  } else {
+    entry->path = strings_add(index, path);
+  }
+  entry->basename = name_intern(index, basename, mapped);
+  entry->root = root;
+  entry->depth = depth;
+  entry->mtime = mtime;
+  entry->size = size;
+  entry->live = true;
+  table_insert(index->paths, entry->path, table_hash(entry->path), id + 1);
+  return id;
+}
+
+// Frees the slot of id. Its name stays interned until the next election,
+// which drops names no sheet has any more.
+static void entry_remove(SheetIndex *index, guint32 id) {
+  SheetEntry *entry = ENTRY(index, id);
+  TableSlot *slot = table_find(index->paths, entry->path,
+                               table_hash(entry->path));
+  if (slot)
+    table_remove(index->paths, slot);
+  if (entry->visible) {
+    // Cleared now, so the id can't be taken for the name's sheet once reused
+    name_slot(index, entry->basename)->value = NO_ENTRY;
+    entry->visible = false;
+    index->n_visible--;
+  }
+  strings_drop(index, entry->path);
+  entry->live = false;
+  g_array_append_val(index->free_ids, id);
+}
+
+// Replaces the trigram index once the visible sheets have changed, so
+// fuzzy lookups only ever score. Called with the index write-locked, which
+// keeps readers off the old one while it is freed.
+static void fuzzy_refresh(SheetIndex *index) {
+  FuzzyIndex *old = index->fuzzy;
+  index->fuzzy = cheeter_fuzzy_index_new(index);
+  cheeter_fuzzy_index_free(old);
+}
+
+static guint32 entry_by_path(SheetIndex *index, const char *path) {
+  TableSlot *slot = table_find(index->paths, path, table_hash(path));
+  return slot ? slot->value : NO_ENTRY;
+}
+
+// Copies the strings still in use into a fresh arena and lets the old one,
+// and the cache image, go. Called with the write lock held.
+static void strings_compact(SheetIndex *index) {
+  if (index->strings_dead < STRINGS_COMPACT_MIN ||
+      index->strings_dead < index->strings_live)
+    return;
+  gint64 start = g_get_monotonic_time();
+  gsize dead = index->strings_dead;
+  GStringChunk *old = index->strings;
+  index->strings = g_string_chunk_new(STRINGS_CHUNK_SIZE);
+  index->strings_live = 0;
+  index->strings_dead = 0;
+
+  // Old interned pointer -> new one
+  GHashTable *moved = g_hash_table_new(g_direct_hash, g_direct_equal);
+  SheetTable *names = index->names;
+  for (guint32 i = 0; i <= names->mask; i++) {
+    TableSlot *slot = &names->slots[i];
+    if (!slot->key || slot->key == table_deleted)
+      continue;
+    const char *copy = strings_add(index, slot->key);
+    g_hash_table_insert(moved, (gpointer)slot->key, (gpointer)copy);
+    slot->key = copy;
+  }
+
+  table_free(index->paths);
+  index->paths = table_new();
+  for (guint32 id = 0; id < index->entries->len; id++) {
+    SheetEntry *entry = ENTRY(index, id);
+    if (!entry->live)
+      continue;
+    entry->path = strings_add(index, entry->path);
+    entry->basename = g_hash_table_lookup(moved, entry->basename);
+    table_insert(index->paths, entry->path, table_hash(entry->path), id + 1);
+  }
+
+  g_hash_table_destroy(moved);
+  g_string_chunk_free(old);
+  if (index->image) {
+    g_mapped_file_unref(index->image);
+    index->image = NULL;
+  }
+  index->generation++;
+  LOG_DEBUG("Compacted sheet strings: %" G_GSIZE_FORMAT " bytes freed, %"
+            G_GSIZE_FORMAT " kept, in %" G_GINT64_FORMAT " us",
+            dead, index->strings_live, g_get_monotonic_time() - start);
+}
+
+static void watched_dir_free(gpointer data) {
+  WatchedDir *dir = (WatchedDir *)data;
+  if (dir->monitor) {
+    g_signal_handlers_disconnect_by_data(dir->monitor, dir);
+    g_file_monitor_cancel(dir->monitor);
+    g_object_unref(dir->monitor);
   }
+  g_free(dir->path);
+  g_free(dir);
+}
+
+static GHashTable *pending_new(void) {
+  return g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
 }
 
 SheetIndex *cheeter_index_new(void) {
   SheetIndex *index = g_new0(SheetIndex, 1);
-  index->sheets_by_basename =
-      g_hash_table_new_full(g_str_hash, g_str_equal, NULL, NULL);
-  // Note: We manage memory of SheetEntries in the all_sheets list (or just one
-  // of them), but the hash table keys/values point to the same data. For
-  // simplicity, let's treat `all_sheets` as the owner for freeing, or do a
-  // custom free.
+  index->entries = g_array_new(FALSE, FALSE, sizeof(SheetEntry));
+  index->free_ids = g_array_new(FALSE, FALSE, sizeof(guint32));
+  index->strings = g_string_chunk_new(STRINGS_CHUNK_SIZE);
+  index->names = table_new();
+  index->paths = table_new();
+  index->roots = g_ptr_array_new_with_free_func(g_free);
+  g_rw_lock_init(&index->lock);
+
+  index->watch = g_new0(SheetWatch, 1);
+  index->watch->dirs =
+      g_hash_table_new_full(g_str_hash, g_str_equal, NULL, watched_dir_free);
+  index->watch->pending = pending_new();
   return index;
 }
 
 void cheeter_index_free(SheetIndex *index) {
   if (!index)
     return;
-  g_hash_table_destroy(index->sheets_by_basename);
-  g_list_free_full(index->all_sheets, sheet_entry_free);
+  if (index->watch->flush_source)
+    g_source_remove(index->watch->flush_source);
+  if (index->watch->validate_source)
+    g_source_remove(index->watch->validate_source);
+  index->watch->closing = true;
+  while (index->watch->flushing)
+    g_main_context_iteration(NULL, TRUE);
+  g_hash_table_destroy(index->watch->dirs);
+  g_hash_table_destroy(index->watch->pending);
+  g_free(index->watch);
+
+  table_free(index->paths);
+  table_free(index->names);
+  g_string_chunk_free(index->strings);
+  g_array_unref(index->free_ids);
+  g_array_unref(index->entries);
+  g_ptr_array_unref(index->roots);
+  cheeter_fuzzy_index_free(index->fuzzy);
+  if (index->image)
+    g_mapped_file_unref(index->image);
+  g_free(index->cache_path);
+  g_rw_lock_clear(&index->lock);
   g_free(index);
 }
 
-void cheeter_index_scan_dir(SheetIndex *index, const char *dir_path) {
-  GDir *dir = g_dir_open(dir_path, 0, NULL);
-  if (!dir) {
-    LOG_WARN("Could not open sheet directory: %s", dir_path);
-    return;
-  }
-
-  const char *filename;
-  int count = 0;
-  while ((filename = g_dir_read_name(dir))) {
-    int ext_len = 0;
-    if (g_str_has_suffix(filename, ".pdf"))
-      ext_len = 4;
-    else if (g_str_has_suffix(filename, ".png"))
-      ext_len = 4;
-    else if (g_str_has_suffix(filename, ".jpg"))
-      ext_len = 4;
-    else if (g_str_has_suffix(filename, ".jpeg"))
-      ext_len = 5;
-
-    if (ext_len > 0) {
-      SheetEntry *entry = g_new0(SheetEntry, 1);
-      entry->path = g_build_filename(dir_path, filename, NULL);
-
-      // Basename = lowercase, no extension
-      char *no_ext = g_strndup(filename, strlen(filename) - ext_len);
-      entry->basename = g_ascii_strdown(no_ext, -1);
-      g_free(no_ext);
-
-      index->all_sheets = g_list_prepend(index->all_sheets, entry);
-      g_hash_table_insert(index->sheets_by_basename, entry->basename, entry);
-
-      LOG_DEBUG("Indexed sheet: %s -> %s", entry->basename, entry->path);
-      count++;
+// Length of the sheet extension filename ends with, 0 if it isn't a sheet
+static size_t sheet_ext_len(const char *filename) {
+  if (g_str_has_suffix(filename, ".pdf") ||
+      g_str_has_suffix(filename, ".png") ||
+      g_str_has_suffix(filename, ".jpg"))
+    return 4;
+  if (g_str_has_suffix(filename, ".jpeg"))
+    return 5;
+  return 0;
+}
+
+static gint64 stat_mtime(const struct stat *st) {
+  return (gint64)st->st_mtim.tv_sec * G_GINT64_CONSTANT(1000000000) +
+         st->st_mtim.tv_nsec;
+}
+
+// Earlier roots first, then shallower paths, then by path so the winner of
+// a name clash doesn't depend on thread or event timing
+static gint compare_rank(guint root_a, guint depth_a, const char *path_a,
+                         guint root_b, guint depth_b, const char *path_b) {
+  if (root_a != root_b)
+    return root_a < root_b ? -1 : 1;
+  if (depth_a != depth_b)
+    return depth_a < depth_b ? -1 : 1;
+  return strcmp(path_a, path_b);
+}
+
+// Whether path is one of dirs, or lies under one
+static bool path_under_any(const char *path, GHashTable *dirs) {
+  if (!dirs || g_hash_table_size(dirs) == 0)
+    return false;
+  char *prefix = g_strdup(path);
+  bool found = false;
+  for (;;) {
+    if (g_hash_table_contains(dirs, prefix)) {
+      found = true;
+      break;
     }
+    char *slash = strrchr(prefix, '/');
+    if (!slash || slash == prefix)
+      break;
+    *slash = '\0';
+  }
+  g_free(prefix);
+  return found;
+}
+
+// Whether the directory holding path is one of dirs
+static bool parent_in(const char *path, GHashTable *dirs) {
+  if (!dirs || g_hash_table_size(dirs) == 0)
+    return false;
+  const char *slash = strrchr(path, '/');
+  if (!slash)
+    return false;
+  char *parent = g_strndup(path, slash - path);
+  bool found = g_hash_table_contains(dirs, parent);
+  g_free(parent);
+  return found;
+}
+
+// ---- Parallel scan ----
+
+// A sheet found by the scan, before layering
+typedef struct {
+  guint root; // Index into the roots, lower wins
+  guint depth;
+  gint64 mtime;
+  goffset size;
+  char *path;
+  char *basename;
+  guint n_pages; // Filled in by probe_run; 0 if unreadable
+  double page_width;
+  double page_height;
+  bool probed; // Pages already known, from a bundle
+} ScanHit;
+
+typedef struct {
+  guint root;
+  guint depth;
+  bool shallow; // Don't descend into subdirectories already known
+  gint64 mtime; // Set once read
+  char *path;
+} ScanDir;
+
+typedef struct {
+  GThreadPool *pool;
+  GMutex lock; // Guards hits and read, and wakes the waiter
+  GCond done;
+  GPtrArray *hits;   // ScanHit*
+  GPtrArray *read;   // ScanDir*, directories that could be read
+  GHashTable *known; // Directories shallow scans leave alone, read-only
+  gint pending;      // Directories queued or being read
+} ScanContext;
+
+static ScanHit *scan_hit_new(guint root, guint depth, const struct stat *st,
+                             char *path, const char *filename,
+                             size_t ext_len) {
+  ScanHit *hit = g_new0(ScanHit, 1);
+  hit->root = root;
+  hit->depth = depth;
+  hit->mtime = stat_mtime(st);
+  hit->size = st->st_size;
+  hit->path = path;
+  // Basename = lowercase, no extension
+  hit->basename = g_ascii_strdown(filename, strlen(filename) - ext_len);
+  return hit;
+}
+
+// Adds the sheets packed in the bundle at path, as if it were a directory
+// at depth. Their pages come from the bundle's records.
+static void scan_bundle(guint root, guint depth, const char *path,
+                        GPtrArray *hits) {
+  GError *error = NULL;
+  SheetBundle *bundle = cheeter_bundle_open(path, &error);
+  if (!bundle) {
+    LOG_WARN("Skipping sheet bundle: %s", error->message);
+    g_error_free(error);
+    return;
+  }
+  for (guint i = 0; i < cheeter_bundle_get_n_sheets(bundle); i++) {
+    BundleSheet sheet;
+    cheeter_bundle_get_sheet(bundle, i, &sheet);
+    const char *filename = strrchr(sheet.name, '/');
+    filename = filename ? filename + 1 : sheet.name;
+    size_t ext_len = sheet_ext_len(filename);
+    if (ext_len == 0 || filename[0] == '.')
+      continue;
+
+    guint sub = 0;
+    for (const char *p = sheet.name; *p; p++)
+      sub += *p == '/';
+    ScanHit *hit = g_new0(ScanHit, 1);
+    hit->root = root;
+    hit->depth = depth + 1 + sub;
+    hit->mtime = cheeter_bundle_get_mtime(bundle);
+    hit->size = sheet.size;
+    hit->path = g_build_filename(path, sheet.name, NULL);
+    hit->basename = g_ascii_strdown(filename, strlen(filename) - ext_len);
+    hit->n_pages = sheet.n_pages;
+    hit->page_width = sheet.page_width;
+    hit->page_height = sheet.page_height;
+    hit->probed = true;
+    g_ptr_array_add(hits, hit);
+  }
+  cheeter_bundle_unref(bundle);
+}
+
+static void scan_hit_free(gpointer data) {
+  ScanHit *hit = (ScanHit *)data;
+  g_free(hit->path);
+  g_free(hit->basename);
+  g_free(hit);
+}
+
+static ScanDir *scan_dir_new(guint root, guint depth, char *path) {
+  ScanDir *dir = g_new0(ScanDir, 1);
+  dir->root = root;
+  dir->depth = depth;
+  dir->path = path;
+  return dir;
+}
+
+static void scan_dir_free(gpointer data) {
+  ScanDir *dir = (ScanDir *)data;
+  g_free(dir->path);
+  g_free(dir);
+}
+
+static void scan_queue(ScanContext *ctx, ScanDir *dir) {
+  g_atomic_int_inc(&ctx->pending);
+  g_thread_pool_push(ctx->pool, dir, NULL);
+}
+
+// d_type is DT_UNKNOWN on some filesystems, and symlinks need resolving to
+// tell sheets from the rest. Symlinked directories are not descended, so a
+// link loop can't run the scan away.
+static unsigned char scan_entry_type(int dir_fd,
+                                     const struct linux_dirent64 *d) {
+  struct stat st;
+  if (d->d_type == DT_UNKNOWN) {
+    if (fstatat(dir_fd, d->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+      return DT_UNKNOWN;
+    if (S_ISDIR(st.st_mode))
+      return DT_DIR;
+    if (S_ISLNK(st.st_mode))
+      return DT_LNK;
+    return S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
   }
-  g_dir_close(dir);
-  LOG_INFO("Indexed %d sheets in %s", count, dir_path);
+  if (d->d_type == DT_LNK)
+    return fstatat(dir_fd, d->d_name, &st, 0) == 0 && S_ISREG(st.st_mode)
+               ? DT_REG
+               : DT_UNKNOWN;
+  return d->d_type;
 }
 
-const SheetEntry *cheeter_index_find_by_basename(SheetIndex *index,
-                                                 const char *basename) {
-  return (const SheetEntry *)g_hash_table_lookup(index->sheets_by_basename,
-                                                 basename);
+// Reads one directory with getdents64, queueing its subdirectories for
+// other workers and collecting its sheets
+static void scan_worker(gpointer data, gpointer user_data) {
+  ScanDir *dir = (ScanDir *)data;
+  ScanContext *ctx = (ScanContext *)user_data;
+  GPtrArray *hits = g_ptr_array_new();
+  struct stat st;
+
+  int fd = openat(AT_FDCWD, dir->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    if (dir->depth == 0)
+      LOG_WARN("Could not open sheet directory: %s", dir->path);
+  } else {
+    // Taken before reading, so a change made meanwhile shows as newer
+    if (fstat(fd, &st) == 0)
+      dir->mtime = stat_mtime(&st);
+    char *buf = g_malloc(DENTS_BUF_SIZE);
+    long n;
+    while ((n = syscall(SYS_getdents64, fd, buf, DENTS_BUF_SIZE)) > 0) {
+      for (long pos = 0; pos < n;) {
+        struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + pos);
+        pos += d->d_reclen;
+        // Skips ".", ".." and hidden entries such as .git
+        if (d->d_name[0] == '.')
+          continue;
+
+        unsigned char type = scan_entry_type(fd, d);
+        if (type == DT_DIR) {
+          char *path = g_build_filename(dir->path, d->d_name, NULL);
+          if (dir->shallow && ctx->known &&
+              g_hash_table_contains(ctx->known, path)) {
+            g_free(path);
+            continue;
+          }
+          scan_queue(ctx, scan_dir_new(dir->root, dir->depth + 1, path));
+          continue;
+        }
+        if (type == DT_REG &&
+            g_str_has_suffix(d->d_name, CHEETER_BUNDLE_EXT)) {
+          char *path = g_build_filename(dir->path, d->d_name, NULL);
+          scan_bundle(dir->root, dir->depth, path, hits);
+          g_free(path);
+          continue;
+        }
+        size_t ext_len = sheet_ext_len(d->d_name);
+        if (type != DT_REG || ext_len == 0 ||
+            fstatat(fd, d->d_name, &st, 0) < 0)
+          continue;
+
+        g_ptr_array_add(
+            hits, scan_hit_new(dir->root, dir->depth, &st,
+                               g_build_filename(dir->path, d->d_name, NULL),
+                               d->d_name, ext_len));
+      }
+    }
+    g_free(buf);
+    close(fd);
+  }
+
+  g_mutex_lock(&ctx->lock);
+  for (guint i = 0; i < hits->len; i++)
+    g_ptr_array_add(ctx->hits, g_ptr_array_index(hits, i));
+  if (fd >= 0)
+    g_ptr_array_add(ctx->read, dir);
+  else
+    scan_dir_free(dir);
+  if (g_atomic_int_dec_and_test(&ctx->pending))
+    g_cond_signal(&ctx->done);
+  g_mutex_unlock(&ctx->lock);
+
+  g_ptr_array_unref(hits);
+}
+
+// Scans dirs (ScanDir*, taken over) and everything below them, adding the
+// sheets found to hits and the directories read to read. Shallow dirs skip
+// subdirectories in known.
+static void scan_run(GPtrArray *dirs, GPtrArray *hits, GPtrArray *read,
+                     GHashTable *known) {
+  if (dirs->len == 0)
+    return;
+  ScanContext ctx = {0};
+  g_mutex_init(&ctx.lock);
+  g_cond_init(&ctx.done);
+  ctx.hits = hits;
+  ctx.read = read;
+  ctx.known = known;
+  ctx.pool = g_thread_pool_new(scan_worker, &ctx,
+                               MIN(g_get_num_processors(), SCAN_THREADS_MAX),
+                               FALSE, NULL);
+
+  for (guint i = 0; i < dirs->len; i++)
+    scan_queue(&ctx, g_ptr_array_index(dirs, i));
+
+  g_mutex_lock(&ctx.lock);
+  while (g_atomic_int_get(&ctx.pending) > 0)
+    g_cond_wait(&ctx.done, &ctx.lock);
+  g_mutex_unlock(&ctx.lock);
+  g_thread_pool_free(ctx.pool, FALSE, TRUE);
+  g_cond_clear(&ctx.done);
+  g_mutex_clear(&ctx.lock);
+}
+
+// ---- Probing ----
+
+// Fills in hit's pages, copied from the index if the sheet is unchanged
+// since it was last read
+static void probe_worker(gpointer data, gpointer user_data) {
+  ScanHit *hit = (ScanHit *)data;
+  SheetIndex *index = (SheetIndex *)user_data;
+  if (hit->probed)
+    return;
+
+  g_rw_lock_reader_lock(&index->lock);
+  guint32 known = entry_by_path(index, hit->path);
+  const SheetEntry *entry = known ? ENTRY(index, known - 1) : NULL;
+  bool same = entry && entry->mtime == hit->mtime && entry->size == hit->size;
+  if (same) {
+    hit->n_pages = entry->n_pages;
+    hit->page_width = entry->page_width;
+    hit->page_height = entry->page_height;
+  }
+  g_rw_lock_reader_unlock(&index->lock);
+
+  if (!same && !cheeter_sheet_probe(hit->path, &hit->n_pages,
+                                    &hit->page_width, &hit->page_height))
+    hit->n_pages = 0;
+}
+
+// Reads the page count and size of every hit (ScanHit*) in parallel. PDFs
+// only have their page tree parsed and images their header read, but that
+// is still a file open each, so it is kept off a single thread.
+static void probe_run(SheetIndex *index, GPtrArray *hits) {
+  if (hits->len == 0)
+    return;
+  gint64 start = g_get_monotonic_time();
+  GThreadPool *pool = g_thread_pool_new(
+      probe_worker, index, MIN(g_get_num_processors(), SCAN_THREADS_MAX),
+      FALSE, NULL);
+  for (guint i = 0; i < hits->len; i++)
+    g_thread_pool_push(pool, g_ptr_array_index(hits, i), NULL);
+  // Returns once every hit has been handled
+  g_thread_pool_free(pool, FALSE, TRUE);
+  LOG_DEBUG("Read page sizes of %u sheets in %" G_GINT64_FORMAT " us",
+            hits->len, g_get_monotonic_time() - start);
+}
+
+// ---- Applying changes ----
+
+static void entry_set_pages(SheetEntry *entry, const ScanHit *hit) {
+  entry->n_pages = MIN(hit->n_pages, G_MAXUINT16);
+  entry->page_width = hit->page_width;
+  entry->page_height = hit->page_height;
+}
+
+// Remembers the sheet name resolved to before this batch touched it. name
+// is interned.
+static void touch_name(SheetIndex *index, GHashTable *touched,
+                       const char *name) {
+  if (g_hash_table_contains(touched, name))
+    return;
+  guint32 visible = name_slot(index, name)->value;
+  g_hash_table_insert(touched, (gpointer)name,
+                      visible ? g_strdup(ENTRY(index, visible - 1)->path)
+                              : NULL);
+}
+
+// Applies one batch under the write lock. Indexed sheets that hits doesn't
+// contain are dropped if they lie under a path of cleared, or directly in a
+// directory of shallow. hits (ScanHit*) are added, and every name touched
+// gets its visible sheet chosen again. Sheets of rewritten that were
+// already indexed count as changed. Changes go to changed_paths and
+// changed_names when they are non-NULL.
+static void index_apply(SheetIndex *index, GPtrArray *hits,
+                        GHashTable *cleared, GHashTable *shallow,
+                        GHashTable *rewritten, GPtrArray *changed_paths,
+                        GPtrArray *changed_names) {
+  // Interned names, so compared by pointer
+  GHashTable *touched =
+      g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+  GArray *added = g_array_new(FALSE, FALSE, sizeof(guint32));
+
+  g_rw_lock_writer_lock(&index->lock);
+
+  if ((cleared && g_hash_table_size(cleared) > 0) ||
+      (shallow && g_hash_table_size(shallow) > 0)) {
+    GHashTable *found = g_hash_table_new(g_str_hash, g_str_equal);
+    for (guint i = 0; i < hits->len; i++)
+      g_hash_table_add(found, ((ScanHit *)g_ptr_array_index(hits, i))->path);
+
+    for (guint32 id = 0; id < index->entries->len; id++) {
+      SheetEntry *entry = ENTRY(index, id);
+      if (!entry->live || g_hash_table_contains(found, entry->path) ||
+          !(path_under_any(entry->path, cleared) ||
+            parent_in(entry->path, shallow)))
+        continue;
+      touch_name(index, touched, entry->basename);
+      if (changed_paths)
+        g_ptr_array_add(changed_paths, g_strdup(entry->path));
+      entry_remove(index, id);
+    }
+    g_hash_table_destroy(found);
+  }
+
+  for (guint i = 0; i < hits->len; i++) {
+    ScanHit *hit = g_ptr_array_index(hits, i);
+    guint32 known = entry_by_path(index, hit->path);
+    if (known) {
+      SheetEntry *entry = ENTRY(index, known - 1);
+      if (entry->mtime == hit->mtime && entry->size == hit->size)
+        continue;
+      entry->mtime = hit->mtime;
+      entry->size = hit->size;
+      entry_set_pages(entry, hit);
+      if (changed_paths && rewritten &&
+          g_hash_table_contains(rewritten, hit->path))
+        g_ptr_array_add(changed_paths, g_strdup(hit->path));
+      continue;
+    }
+    guint32 id = entry_add(index, hit->path, hit->basename, hit->root,
+                           hit->depth, hit->mtime, hit->size, false);
+    SheetEntry *entry = ENTRY(index, id);
+    entry_set_pages(entry, hit);
+    touch_name(index, touched, entry->basename);
+    g_array_append_val(added, id);
+    if (changed_paths)
+      g_ptr_array_add(changed_paths, g_strdup(entry->path));
+  }
+
+  // One pass over every sheet elects the best of each touched name
+  if (g_hash_table_size(touched) > 0) {
+    index->generation++;
+    // Name -> winning id + 1
+    GHashTable *best = g_hash_table_new(g_direct_hash, g_direct_equal);
+    for (guint32 id = 0; id < index->entries->len; id++) {
+      const SheetEntry *entry = ENTRY(index, id);
+      if (!entry->live || !g_hash_table_contains(touched, entry->basename))
+        continue;
+      guint32 cur = GPOINTER_TO_UINT(g_hash_table_lookup(best,
+                                                         entry->basename));
+      const SheetEntry *rival = cur ? ENTRY(index, cur - 1) : NULL;
+      if (!rival || compare_rank(entry->root, entry->depth, entry->path,
+                                 rival->root, rival->depth, rival->path) < 0)
+        g_hash_table_insert(best, (gpointer)entry->basename,
+                            GUINT_TO_POINTER(id + 1));
+    }
+
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, touched);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+      const char *name = (const char *)key;
+      guint32 winner = GPOINTER_TO_UINT(g_hash_table_lookup(best, name));
+      TableSlot *slot = name_slot(index, name);
+      if (slot->value != winner) {
+        if (slot->value) {
+          ENTRY(index, slot->value - 1)->visible = false;
+          index->n_visible--;
+        }
+        if (winner) {
+          ENTRY(index, winner - 1)->visible = true;
+          index->n_visible++;
+        }
+        slot->value = winner;
+      }
+      const char *path = winner ? ENTRY(index, winner - 1)->path : NULL;
+      if (changed_names && g_strcmp0((const char *)value, path) != 0)
+        g_ptr_array_add(changed_names, g_strdup(name));
+      // No sheet has the name any more. Its string stays in the arena
+      // until compaction.
+      if (!winner) {
+        strings_drop(index, name);
+        table_remove(index->names, slot);
+      }
+    }
+
+    for (guint i = 0; i < added->len; i++) {
+      guint32 id = g_array_index(added, guint32, i);
+      const SheetEntry *entry = ENTRY(index, id);
+      guint32 winner = GPOINTER_TO_UINT(g_hash_table_lookup(best,
+                                                            entry->basename));
+      if (winner != id + 1)
+        LOG_DEBUG("Sheet %s is shadowed by %s", entry->path,
+                  ENTRY(index, winner - 1)->path);
+    }
+    g_hash_table_destroy(best);
+    fuzzy_refresh(index);
+  }
+  strings_compact(index);
+
+  g_rw_lock_writer_unlock(&index->lock);
+  g_array_unref(added);
+  g_hash_table_destroy(touched);
+}
+
+// ---- Watching ----
+
+static void watch_mark(WatchedDir *dir, GFile *file);
+
+static void on_dir_changed(GFileMonitor *monitor, GFile *file,
+                           GFile *other_file, GFileMonitorEvent event,
+                           gpointer user_data) {
+  (void)monitor;
+  WatchedDir *dir = (WatchedDir *)user_data;
+  switch (event) {
+  case G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED:
+  case G_FILE_MONITOR_EVENT_PRE_UNMOUNT:
+  case G_FILE_MONITOR_EVENT_UNMOUNTED:
+    return;
+  case G_FILE_MONITOR_EVENT_RENAMED:
+    // Both names are in this directory; an editor saving over a sheet
+    // through a temporary file ends up here
+    watch_mark(dir, other_file);
+    break;
+  default:
+    break;
+  }
+  watch_mark(dir, file);
+}
+
+static void watch_start_monitor(WatchedDir *dir) {
+  GError *error = NULL;
+  GFile *file = g_file_new_for_path(dir->path);
+  // A monitor on a missing root starts reporting once it appears
+  dir->monitor = g_file_monitor_directory(file, G_FILE_MONITOR_WATCH_MOVES,
+                                          NULL, &error);
+  g_object_unref(file);
+  if (!dir->monitor) {
+    LOG_WARN("Could not watch sheet directory %s: %s", dir->path,
+             error->message);
+    g_error_free(error);
+    return;
+  }
+  g_signal_connect(dir->monitor, "changed", G_CALLBACK(on_dir_changed), dir);
+}
+
+// Takes over path. A directory already known only has its mtime updated.
+static void watch_add_dir(SheetIndex *index, guint root, guint depth,
+                          gint64 mtime, char *path) {
+  SheetWatch *watch = index->watch;
+  WatchedDir *dir = g_hash_table_lookup(watch->dirs, path);
+  if (dir) {
+    if (mtime)
+      dir->mtime = mtime;
+    g_free(path);
+    return;
+  }
+  dir = g_new0(WatchedDir, 1);
+  dir->index = index;
+  dir->root = root;
+  dir->depth = depth;
+  dir->mtime = mtime;
+  dir->path = path;
+  g_hash_table_insert(watch->dirs, dir->path, dir);
+  if (watch->func)
+    watch_start_monitor(dir);
+}
+
+// Forgets directories under cleared that the rescan didn't read, then
+// registers those it did (ScanDir*, taken over). Roots stay watched, so
+// they are picked up again if they come back.
+static void watch_update_dirs(SheetIndex *index, GPtrArray *read,
+                              GHashTable *cleared) {
+  SheetWatch *watch = index->watch;
+  if (cleared && g_hash_table_size(cleared) > 0) {
+    GHashTable *still = g_hash_table_new(g_str_hash, g_str_equal);
+    for (guint i = 0; i < read->len; i++)
+      g_hash_table_add(still, ((ScanDir *)g_ptr_array_index(read, i))->path);
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, watch->dirs);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+      WatchedDir *dir = (WatchedDir *)value;
+      if (dir->depth > 0 && !g_hash_table_contains(still, dir->path) &&
+          path_under_any(dir->path, cleared))
+        g_hash_table_iter_remove(&iter);
+    }
+    g_hash_table_destroy(still);
+  }
+
+  for (guint i = 0; i < read->len; i++) {
+    ScanDir *dir = g_ptr_array_index(read, i);
+    watch_add_dir(index, dir->root, dir->depth, dir->mtime, dir->path);
+    dir->path = NULL;
+    scan_dir_free(dir);
+  }
+  g_ptr_array_set_size(read, 0);
+}
+
+// One flush: rescanned on the main loop, probed on a worker thread, then
+// applied back on the main loop
+typedef struct {
+  SheetIndex *index;
+  GHashTable *pending; // What was flushed; the tables below point into it
+  GHashTable *cleared;
+  GHashTable *shallow;
+  GHashTable *rewritten;
+  GPtrArray *dirs;
+  GPtrArray *hits;
+  GPtrArray *read;
+} FlushBatch;
+
+static void flush_batch_free(gpointer data) {
+  FlushBatch *batch = (FlushBatch *)data;
+  g_ptr_array_unref(batch->read);
+  g_ptr_array_unref(batch->hits);
+  g_ptr_array_unref(batch->dirs);
+  g_hash_table_destroy(batch->rewritten);
+  g_hash_table_destroy(batch->shallow);
+  g_hash_table_destroy(batch->cleared);
+  g_hash_table_destroy(batch->pending);
+  g_free(batch);
+}
+
+static void watch_flush(SheetIndex *index);
+
+// Opening every new or changed sheet can take seconds for a large batch,
+// which the main loop, drawing the overlay and answering IPC, can't wait out
+static void flush_probe_thread(GTask *task, gpointer source_object,
+                               gpointer task_data,
+                               GCancellable *cancellable) {
+  (void)source_object;
+  (void)cancellable;
+  FlushBatch *batch = (FlushBatch *)task_data;
+  probe_run(batch->index, batch->hits);
+  g_task_return_boolean(task, TRUE);
+}
+
+static void on_flush_probed(GObject *source_object, GAsyncResult *res,
+                            gpointer user_data) {
+  (void)source_object;
+  SheetIndex *index = (SheetIndex *)user_data;
+  SheetWatch *watch = index->watch;
+  FlushBatch *batch = g_task_get_task_data(G_TASK(res));
+  if (watch->closing) {
+    g_clear_object(&watch->flushing);
+    return;
+  }
+
+  GPtrArray *paths = g_ptr_array_new_with_free_func(g_free);
+  GPtrArray *names = g_ptr_array_new_with_free_func(g_free);
+  index_apply(index, batch->hits, batch->cleared, batch->shallow,
+              batch->rewritten, paths, names);
+  watch_update_dirs(index, batch->read, batch->cleared);
+  cache_save(index);
+
+  LOG_DEBUG("Applied %u sheet directory changes: %u sheets, %u names",
+            g_hash_table_size(batch->pending), paths->len, names->len);
+  if (watch->func && (paths->len > 0 || names->len > 0)) {
+    g_ptr_array_add(paths, NULL);
+    g_ptr_array_add(names, NULL);
+    watch->func((const char *const *)paths->pdata,
+                (const char *const *)names->pdata, watch->user_data);
+  }
+  g_ptr_array_unref(paths);
+  g_ptr_array_unref(names);
+  g_clear_object(&watch->flushing);
+
+  // Changes that came in while this batch was probed
+  if (g_hash_table_size(watch->pending) > 0 && !watch->flush_source)
+    watch_flush(index);
+}
+
+// Rescans everything pending and applies the result as one batch, once its
+// sheets have been probed. Only one batch is in flight; a flush while one
+// is leaves the changes pending until it has been applied.
+static void watch_flush(SheetIndex *index) {
+  SheetWatch *watch = index->watch;
+  if (watch->flush_source) {
+    g_source_remove(watch->flush_source);
+    watch->flush_source = 0;
+  }
+  if (watch->flushing)
+    return;
+  GHashTable *pending = watch->pending;
+  watch->pending = pending_new();
+
+  // Keys point into pending
+  GHashTable *cleared = g_hash_table_new(g_str_hash, g_str_equal);
+  GHashTable *shallow = g_hash_table_new(g_str_hash, g_str_equal);
+  GHashTable *rewritten = g_hash_table_new(g_str_hash, g_str_equal);
+  GPtrArray *dirs = g_ptr_array_new();
+  GPtrArray *hits = g_ptr_array_new_with_free_func(scan_hit_free);
+  GPtrArray *read = g_ptr_array_new();
+
+  GHashTableIter iter;
+  gpointer key, value;
+  g_hash_table_iter_init(&iter, pending);
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    const char *path = (const char *)key;
+    const PendingPath *where = (const PendingPath *)value;
+    const char *filename = strrchr(path, '/');
+    filename = filename ? filename + 1 : path;
+    size_t ext_len = sheet_ext_len(filename);
+    struct stat st;
+
+    if (lstat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+      // Whatever was indexed under it and isn't found again is gone. A
+      // shallow rescan only answers for the directory's own entries.
+      g_hash_table_add(where->shallow ? shallow : cleared, key);
+      ScanDir *dir = scan_dir_new(where->root, where->depth, g_strdup(path));
+      dir->shallow = where->shallow;
+      g_ptr_array_add(dirs, dir);
+    } else if (where->depth > 0 &&
+               g_str_has_suffix(filename, CHEETER_BUNDLE_EXT) &&
+               stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+      // Repacked: sheets it no longer holds are dropped, and those it still
+      // does are reloaded
+      g_hash_table_add(cleared, key);
+      guint first = hits->len;
+      scan_bundle(where->root, where->depth - 1, path, hits);
+      for (guint i = first; i < hits->len; i++)
+        g_hash_table_add(rewritten,
+                         ((ScanHit *)g_ptr_array_index(hits, i))->path);
+    } else if (where->depth > 0 && ext_len > 0 && stat(path, &st) == 0 &&
+               S_ISREG(st.st_mode)) {
+      g_hash_table_add(rewritten, key);
+      g_ptr_array_add(hits, scan_hit_new(where->root, where->depth - 1, &st,
+                                         g_strdup(path), filename, ext_len));
+    } else {
+      g_hash_table_add(cleared, key);
+    }
+  }
+
+  // Directory reads need watch->dirs, so they stay on the main loop
+  scan_run(dirs, hits, read, watch->dirs);
+
+  FlushBatch *batch = g_new0(FlushBatch, 1);
+  batch->index = index;
+  batch->pending = pending;
+  batch->cleared = cleared;
+  batch->shallow = shallow;
+  batch->rewritten = rewritten;
+  batch->dirs = dirs;
+  batch->hits = hits;
+  batch->read = read;
+  watch->flushing = g_task_new(NULL, NULL, on_flush_probed, index);
+  g_task_set_task_data(watch->flushing, batch, flush_batch_free);
+  g_task_run_in_thread(watch->flushing, flush_probe_thread);
+}
+
+static gboolean on_flush_timeout(gpointer user_data) {
+  SheetIndex *index = (SheetIndex *)user_data;
+  index->watch->flush_source = 0;
+  watch_flush(index);
+  return G_SOURCE_REMOVE;
+}
+
+// Queues path for the next flush. A full rescan queued for a path isn't
+// downgraded to a shallow one.
+static void watch_pend(SheetIndex *index, char *path, guint root,
+                       guint depth, bool shallow) {
+  PendingPath *where = g_hash_table_lookup(index->watch->pending, path);
+  if (where) {
+    where->shallow = where->shallow && shallow;
+    g_free(path);
+    return;
+  }
+  where = g_new0(PendingPath, 1);
+  where->root = root;
+  where->depth = depth;
+  where->shallow = shallow;
+  g_hash_table_insert(index->watch->pending, path, where);
+}
+
+// Queues file, reported by dir's monitor, for the next flush
+static void watch_mark(WatchedDir *dir, GFile *file) {
+  char *path = file ? g_file_get_path(file) : NULL;
+  if (!path)
+    return;
+  guint depth = dir->depth;
+  if (strcmp(path, dir->path) != 0) {
+    const char *filename = strrchr(path, '/');
+    if (filename && filename[1] == '.') {
+      // Hidden: editor swap files and the like
+      g_free(path);
+      return;
+    }
+    depth++;
+  }
+
+  SheetWatch *watch = dir->index->watch;
+  watch_pend(dir->index, path, dir->root, depth, false);
+
+  gint64 now = g_get_monotonic_time();
+  if (!watch->flush_source) {
+    watch->first_pending = now;
+  } else if (now - watch->first_pending >= FLUSH_MAX_DELAY_MS * 1000) {
+    return; // Long burst: let the timer already set run
+  } else {
+    g_source_remove(watch->flush_source);
+  }
+  watch->flush_source =
+      g_timeout_add(FLUSH_DELAY_MS, on_flush_timeout, dir->index);
+}
+
+// ---- Cache ----
+
+// The index as saved in the cache directory, in native byte order (it is
+// never shared between machines):
+//
+//   CacheHeader
+//   uint32_t roots[n_roots]        string offsets, padded to 8 bytes
+//   CacheDir dirs[n_dirs]
+//   CacheEntry entries[n_entries]  the n_visible visible sheets first
+//   char strings[strings_size]     NUL-terminated, the last byte is NUL
+//
+// Strings are referenced by offset into the string table, and mapped
+// entries point straight into it.
+#define CACHE_MAGIC "CHTRIDX1"
+#define CACHE_VERSION 2
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t n_roots;
+  uint32_t n_dirs;
+  uint32_t n_entries;
+  uint32_t n_visible;
+  uint32_t strings_size;
+} CacheHeader;
+
+typedef struct {
+  uint32_t path;
+  uint32_t root;
+  uint32_t depth;
+  uint32_t reserved;
+  int64_t mtime;
+} CacheDir;
+
+typedef struct {
+  uint32_t path;
+  uint32_t basename;
+  uint32_t root;
+  uint32_t depth;
+  int64_t mtime;
+  int64_t size;
+  uint32_t n_pages;
+  float page_width;
+  float page_height;
+  uint32_t reserved;
+} CacheEntry;
+
+static size_t cache_roots_size(uint32_t n_roots) {
+  return (n_roots * sizeof(uint32_t) + 7) & ~(size_t)7;
+}
+
+static uint32_t cache_add_string(GString *strings, const char *str) {
+  uint32_t offset = strings->len;
+  g_string_append_len(strings, str, strlen(str) + 1);
+  return offset;
+}
+
+// names maps interned names to their offset, so each is written once
+static void cache_add_entry(GByteArray *entries, GString *strings,
+                            GHashTable *names, const SheetEntry *entry) {
+  CacheEntry rec = {0};
+  rec.path = cache_add_string(strings, entry->path);
+  gpointer offset;
+  if (g_hash_table_lookup_extended(names, entry->basename, NULL, &offset)) {
+    rec.basename = GPOINTER_TO_UINT(offset);
+  } else {
+    rec.basename = cache_add_string(strings, entry->basename);
+    g_hash_table_insert(names, (gpointer)entry->basename,
+                        GUINT_TO_POINTER(rec.basename));
+  }
+  rec.root = entry->root;
+  rec.depth = entry->depth;
+  rec.mtime = entry->mtime;
+  rec.size = entry->size;
+  rec.n_pages = entry->n_pages;
+  rec.page_width = entry->page_width;
+  rec.page_height = entry->page_height;
+  g_byte_array_append(entries, (const guint8 *)&rec, sizeof(rec));
+}
+
+// Writes the index to its cache file, atomically. Main thread only, like
+// every other change to the tables.
+static void cache_save(SheetIndex *index) {
+  if (!index->cache_path)
+    return;
+  gint64 start = g_get_monotonic_time();
+  SheetWatch *watch = index->watch;
+  CacheHeader header = {0};
+  memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+  header.version = CACHE_VERSION;
+  header.n_roots = index->roots->len;
+  header.n_dirs = g_hash_table_size(watch->dirs);
+  header.n_entries = index->entries->len - index->free_ids->len;
+  header.n_visible = index->n_visible;
+
+  GString *strings = g_string_new(NULL);
+  GByteArray *roots = g_byte_array_new();
+  for (guint i = 0; i < index->roots->len; i++) {
+    uint32_t offset =
+        cache_add_string(strings, g_ptr_array_index(index->roots, i));
+    g_byte_array_append(roots, (const guint8 *)&offset, sizeof(offset));
+  }
+  g_byte_array_set_size(roots, cache_roots_size(header.n_roots));
+
+  GByteArray *dirs = g_byte_array_new();
+  GHashTableIter iter;
+  gpointer value;
+  g_hash_table_iter_init(&iter, watch->dirs);
+  while (g_hash_table_iter_next(&iter, NULL, &value)) {
+    const WatchedDir *dir = (const WatchedDir *)value;
+    CacheDir rec = {0};
+    rec.path = cache_add_string(strings, dir->path);
+    rec.root = dir->root;
+    rec.depth = dir->depth;
+    rec.mtime = dir->mtime;
+    g_byte_array_append(dirs, (const guint8 *)&rec, sizeof(rec));
+  }
+
+  GByteArray *entries = g_byte_array_sized_new(header.n_entries *
+                                               sizeof(CacheEntry));
+  GHashTable *names = g_hash_table_new(g_direct_hash, g_direct_equal);
+  for (int pass = 0; pass < 2; pass++) {
+    bool visible = pass == 0;
+    for (guint32 id = 0; id < index->entries->len; id++) {
+      const SheetEntry *entry = ENTRY(index, id);
+      if (entry->live && entry->visible == visible)
+        cache_add_entry(entries, strings, names, entry);
+    }
+  }
+  g_hash_table_destroy(names);
+
+  if (strings->len > G_MAXUINT32) {
+    LOG_WARN("Sheet index too large to cache");
+  } else {
+    header.strings_size = strings->len;
+    GByteArray *out = g_byte_array_sized_new(
+        sizeof(header) + roots->len + dirs->len + entries->len +
+        strings->len);
+    g_byte_array_append(out, (const guint8 *)&header, sizeof(header));
+    g_byte_array_append(out, roots->data, roots->len);
+    g_byte_array_append(out, dirs->data, dirs->len);
+    g_byte_array_append(out, entries->data, entries->len);
+    g_byte_array_append(out, (const guint8 *)strings->str, strings->len);
+
+    // Replaced by rename, so the image mapped at startup stays intact
+    GError *error = NULL;
+    if (!g_file_set_contents(index->cache_path, (const char *)out->data,
+                             out->len, &error)) {
+      LOG_WARN("Could not write sheet index cache %s: %s", index->cache_path,
+               error->message);
+      g_error_free(error);
+    } else {
+      LOG_DEBUG("Saved %u sheets to %s in %" G_GINT64_FORMAT " us",
+                header.n_entries, index->cache_path,
+                g_get_monotonic_time() - start);
+    }
+    g_byte_array_unref(out);
+  }
+
+  g_byte_array_unref(entries);
+  g_byte_array_unref(dirs);
+  g_byte_array_unref(roots);
+  g_string_free(strings, TRUE);
+}
+
+// Stats every known directory and queues those changed since they were
+// last read, then applies the lot
+static gboolean on_validate_idle(gpointer user_data) {
+  SheetIndex *index = (SheetIndex *)user_data;
+  SheetWatch *watch = index->watch;
+  watch->validate_source = 0;
+  gint64 start = g_get_monotonic_time();
+  guint stale = 0;
+
+  GHashTableIter iter;
+  gpointer value;
+  g_hash_table_iter_init(&iter, watch->dirs);
+  while (g_hash_table_iter_next(&iter, NULL, &value)) {
+    const WatchedDir *dir = (const WatchedDir *)value;
+    struct stat st;
+    bool exists = stat(dir->path, &st) == 0 && S_ISDIR(st.st_mode);
+    if (exists && stat_mtime(&st) == dir->mtime)
+      continue;
+    // A vanished directory is cleared whole; a changed one only has its
+    // own entries read again, its subdirectories answer for themselves
+    watch_pend(index, g_strdup(dir->path), dir->root, dir->depth, exists);
+    stale++;
+  }
+  LOG_INFO("Sheet index cache checked in %" G_GINT64_FORMAT
+           " us, %u of %u directories changed",
+           g_get_monotonic_time() - start, stale,
+           g_hash_table_size(watch->dirs));
+
+  if (stale > 0)
+    watch_flush(index);
+  return G_SOURCE_REMOVE;
+}
+
+static bool cache_string(const char *strings, uint32_t size, uint32_t offset,
+                         const char **out) {
+  if (offset >= size)
+    return false;
+  *out = strings + offset;
+  return true;
+}
+
+// Maps the cache in if it was written for exactly these roots. Offsets are
+// checked, since the file may be truncated or from another build.
+static bool cache_load(SheetIndex *index, const char *const *roots) {
+  gint64 start = g_get_monotonic_time();
+  GError *error = NULL;
+  GMappedFile *image = g_mapped_file_new(index->cache_path, FALSE, &error);
+  if (!image) {
+    if (!g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+      LOG_WARN("Could not open sheet index cache %s: %s", index->cache_path,
+               error->message);
+    g_error_free(error);
+    return false;
+  }
+
+  const char *data = g_mapped_file_get_contents(image);
+  gsize len = g_mapped_file_get_length(image);
+  const CacheHeader *header = (const CacheHeader *)data;
+  if (len < sizeof(*header) ||
+      memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version != CACHE_VERSION)
+    goto invalid;
+
+  size_t roots_off = sizeof(*header);
+  size_t dirs_off = roots_off + cache_roots_size(header->n_roots);
+  size_t entries_off = dirs_off + (size_t)header->n_dirs * sizeof(CacheDir);
+  size_t strings_off =
+      entries_off + (size_t)header->n_entries * sizeof(CacheEntry);
+  if (strings_off + header->strings_size != len ||
+      header->n_visible > header->n_entries || header->strings_size == 0 ||
+      data[len - 1] != '\0')
+    goto invalid;
+
+  const uint32_t *root_recs = (const uint32_t *)(data + roots_off);
+  const CacheDir *dir_recs = (const CacheDir *)(data + dirs_off);
+  const CacheEntry *entry_recs = (const CacheEntry *)(data + entries_off);
+  const char *strings = data + strings_off;
+  uint32_t size = header->strings_size;
+
+  guint n_roots = 0;
+  for (; roots[n_roots]; n_roots++) {
+    const char *root;
+    if (n_roots >= header->n_roots ||
+        !cache_string(strings, size, root_recs[n_roots], &root) ||
+        strcmp(root, roots[n_roots]) != 0)
+      goto stale;
+  }
+  if (n_roots != header->n_roots)
+    goto stale;
+
+  for (uint32_t i = 0; i < header->n_dirs; i++) {
+    const char *path;
+    if (!cache_string(strings, size, dir_recs[i].path, &path) ||
+        dir_recs[i].root >= n_roots)
+      goto invalid;
+  }
+  for (uint32_t i = 0; i < header->n_entries; i++) {
+    const char *path, *basename;
+    if (!cache_string(strings, size, entry_recs[i].path, &path) ||
+        !cache_string(strings, size, entry_recs[i].basename, &basename) ||
+        entry_recs[i].root >= n_roots)
+      goto invalid;
+  }
+
+  for (guint i = 0; i < n_roots; i++)
+    g_ptr_array_add(index->roots, g_strdup(roots[i]));
+  for (uint32_t i = 0; i < header->n_dirs; i++)
+    watch_add_dir(index, dir_recs[i].root, dir_recs[i].depth,
+                  dir_recs[i].mtime, g_strdup(strings + dir_recs[i].path));
+
+  // The strings stay in the image; only the tables are built
+  g_rw_lock_writer_lock(&index->lock);
+  for (uint32_t i = 0; i < header->n_entries; i++) {
+    const char *path = strings + entry_recs[i].path;
+    if (entry_by_path(index, path))
+      continue;
+    guint32 id = entry_add(index, path, strings + entry_recs[i].basename,
+                           entry_recs[i].root, entry_recs[i].depth,
+                           entry_recs[i].mtime, entry_recs[i].size, true);
+    SheetEntry *entry = ENTRY(index, id);
+    entry->n_pages = MIN(entry_recs[i].n_pages, G_MAXUINT16);
+    entry->page_width = entry_recs[i].page_width;
+    entry->page_height = entry_recs[i].page_height;
+    TableSlot *slot = name_slot(index, entry->basename);
+    if (i < header->n_visible && !slot->value) {
+      slot->value = id + 1;
+      entry->visible = true;
+      index->n_visible++;
+    }
+  }
+  index->generation++;
+  fuzzy_refresh(index);
+  g_rw_lock_writer_unlock(&index->lock);
+
+  index->image = image;
+  LOG_INFO("Loaded %u sheets from %s in %" G_GINT64_FORMAT " us",
+           header->n_visible, index->cache_path,
+           g_get_monotonic_time() - start);
+  return true;
+
+invalid:
+  LOG_WARN("Sheet index cache %s is damaged, rescanning", index->cache_path);
+  g_mapped_file_unref(image);
+  return false;
+stale:
+  LOG_INFO("Sheet roots changed, rescanning");
+  g_mapped_file_unref(image);
+  return false;
+}
+
+// ---- Public API ----
+
+void cheeter_index_set_cache(SheetIndex *index, const char *cache_path) {
+  g_free(index->cache_path);
+  index->cache_path = g_strdup(cache_path);
+}
+
+void cheeter_index_scan_roots(SheetIndex *index,
+                              const char *const *root_args) {
+  // Absolute and without trailing slashes, to compare with monitor paths
+  GPtrArray *canonical = g_ptr_array_new_with_free_func(g_free);
+  for (guint i = 0; root_args[i]; i++)
+    g_ptr_array_add(canonical, g_canonicalize_filename(root_args[i], NULL));
+  g_ptr_array_add(canonical, NULL);
+  const char *const *roots = (const char *const *)canonical->pdata;
+
+  // The cache only describes a whole index
+  if (index->cache_path && index->roots->len == 0 &&
+      cache_load(index, roots)) {
+    index->watch->validate_source = g_idle_add(on_validate_idle, index);
+    g_ptr_array_unref(canonical);
+    return;
+  }
+
+  gint64 start = g_get_monotonic_time();
+  guint first_root = index->roots->len;
+  GPtrArray *dirs = g_ptr_array_new();
+  GPtrArray *hits = g_ptr_array_new_with_free_func(scan_hit_free);
+  GPtrArray *read = g_ptr_array_new();
+
+  for (guint i = 0; roots[i]; i++) {
+    guint root = first_root + i;
+    g_ptr_array_add(index->roots, g_strdup(roots[i]));
+    g_ptr_array_add(dirs, scan_dir_new(root, 0, g_strdup(roots[i])));
+    watch_add_dir(index, root, 0, 0, g_strdup(roots[i]));
+  }
+  scan_run(dirs, hits, read, NULL);
+  probe_run(index, hits);
+
+  // Sheets already indexed, and earlier hits, shadow later ones
+  index_apply(index, hits, NULL, NULL, NULL, NULL, NULL);
+  watch_update_dirs(index, read, NULL);
+
+  guint n_roots = index->roots->len - first_root;
+  guint *counts = g_new0(guint, MAX(n_roots, 1));
+  for (guint32 id = 0; id < index->entries->len; id++) {
+    const SheetEntry *entry = ENTRY(index, id);
+    if (entry->visible && entry->root >= first_root)
+      counts[entry->root - first_root]++;
+  }
+  for (guint i = 0; i < n_roots; i++)
+    LOG_INFO("Indexed %u sheets in %s", counts[i], roots[i]);
+  LOG_DEBUG("Scanned %u sheet roots in %" G_GINT64_FORMAT " us", n_roots,
+            g_get_monotonic_time() - start);
+  cache_save(index);
+
+  g_free(counts);
+  g_ptr_array_unref(read);
+  g_ptr_array_unref(hits);
+  g_ptr_array_unref(dirs);
+  g_ptr_array_unref(canonical);
+}
+
+void cheeter_index_scan_dir(SheetIndex *index, const char *dir_path) {
+  const char *roots[] = {dir_path, NULL};
+  cheeter_index_scan_roots(index, roots);
+}
+
+void cheeter_index_watch(SheetIndex *index, SheetIndexChangedFunc func,
+                         gpointer user_data) {
+  SheetWatch *watch = index->watch;
+  if (watch->func)
+    return;
+  watch->func = func;
+  watch->user_data = user_data;
+
+  GHashTableIter iter;
+  gpointer value;
+  g_hash_table_iter_init(&iter, watch->dirs);
+  while (g_hash_table_iter_next(&iter, NULL, &value))
+    watch_start_monitor((WatchedDir *)value);
+  LOG_INFO("Watching %u sheet directories",
+           g_hash_table_size(watch->dirs));
+}
+
+char *cheeter_index_lookup(SheetIndex *index, const char *basename) {
+  g_rw_lock_reader_lock(&index->lock);
+  TableSlot *slot = name_slot(index, basename);
+  char *path = slot && slot->value
+                   ? g_strdup(ENTRY(index, slot->value - 1)->path)
+                   : NULL;
+  g_rw_lock_reader_unlock(&index->lock);
+  return path;
+}
+
+guint cheeter_index_get_generation(SheetIndex *index) {
+  g_rw_lock_reader_lock(&index->lock);
+  guint generation = index->generation;
+  g_rw_lock_reader_unlock(&index->lock);
+  return generation;
+}
+
+bool cheeter_index_page_size(SheetIndex *index, const char *path,
+                             guint *n_pages, double *width, double *height) {
+  g_rw_lock_reader_lock(&index->lock);
+  guint32 known = entry_by_path(index, path);
+  const SheetEntry *entry = known ? ENTRY(index, known - 1) : NULL;
+  bool found = entry && entry->n_pages > 0;
+  if (found) {
+    *n_pages = entry->n_pages;
+    *width = entry->page_width;
+    *height = entry->page_height;
+  }
+  g_rw_lock_reader_unlock(&index->lock);
+  return found;
 }
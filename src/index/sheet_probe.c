@@ -0,0 +1,46 @@
+#include "cheeter/log.h"
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <glib.h>
+#include <poppler.h>
+#include <stdbool.h>
+
+// Page count and first page size of the sheet at path, without rendering
+// it: the PDF's page tree, or an image's header. Sizes are in PDF points or
+// image pixels, as the viewer takes them. Safe from any thread.
+bool cheeter_sheet_probe(const char *path, guint *n_pages, double *width,
+                         double *height) {
+  if (g_str_has_suffix(path, ".pdf")) {
+    GError *error = NULL;
+    char *uri = g_filename_to_uri(path, NULL, &error);
+    PopplerDocument *doc =
+        uri ? poppler_document_new_from_file(uri, NULL, &error) : NULL;
+    g_free(uri);
+    PopplerPage *page = doc && poppler_document_get_n_pages(doc) > 0
+                            ? poppler_document_get_page(doc, 0)
+                            : NULL;
+    if (!page) {
+      LOG_DEBUG("Could not read pages of %s: %s", path,
+                error ? error->message : "no pages");
+      g_clear_error(&error);
+      if (doc)
+        g_object_unref(doc);
+      return false;
+    }
+    *n_pages = poppler_document_get_n_pages(doc);
+    poppler_page_get_size(page, width, height);
+    g_object_unref(page);
+    g_object_unref(doc);
+    return true;
+  }
+
+  // Stops reading once the header has given the size
+  int w, h;
+  if (!gdk_pixbuf_get_file_info(path, &w, &h) || w <= 0 || h <= 0) {
+    LOG_DEBUG("Could not read image size of %s", path);
+    return false;
+  }
+  *n_pages = 1;
+  *width = w;
+  *height = h;
+  return true;
+}
@@ -0,0 +1,689 @@
+#define _GNU_SOURCE
+#include "cheeter/bundle.h"
+#include "cheeter/log.h"
+#include "cheeter/search.h"
+#include <math.h>
+#include <poppler.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Reading PDFs is CPU-bound, and the UI comes first
+#define TEXT_THREADS_MAX 2
+#define TEXT_NICE 19
+// Words outside this many bytes aren't indexed
+#define TEXT_MIN_TERM 2
+#define TEXT_MAX_TERM 40
+// Save this long after the last sheet was read
+#define SAVE_DELAY_S 5
+// BM25 parameters
+#define BM25_K1 1.2
+#define BM25_B 0.75
+
+// On-disk form: version, then per sheet its path, mtime, size, the number
+// of words on each page and its (term, page, count) postings
+#define CACHE_VERSION 1
+#define CACHE_TYPE "(ua(sxxaqa(sqq)))"
+
+// A word on a page of a sheet. term is owned by the doc until the doc is
+// merged, then points at the index's interned copy.
+typedef struct {
+  char *term;
+  guint16 page;
+  guint16 count;
+} DocTerm;
+
+typedef struct {
+  char *path;
+  gint64 mtime;
+  goffset size;
+  GArray *page_lengths; // guint16, words per page
+  GArray *terms;        // DocTerm
+  bool merged;
+} TextDoc;
+
+typedef struct {
+  TextDoc *doc;
+  guint16 page;
+  guint16 count;
+} Posting;
+
+typedef struct {
+  char *path;
+  gint64 mtime;
+  goffset size;
+} TextJob;
+
+struct TextIndex {
+  SheetIndex *sheets;
+  char *cache_path;
+  GThreadPool *pool;
+  gint stopping;
+  gint pending; // Jobs queued or running
+  guint save_source; // Main thread only
+  GTask *load_task;
+  GCancellable *cancellable;
+
+  GMutex lock;         // Guards everything below
+  GHashTable *docs;    // path -> TextDoc*
+  GHashTable *terms;   // term -> GArray of Posting; owns the term strings
+  guint64 n_pages;     // Over all docs
+  guint64 n_words;
+  bool dirty;          // Changed since saved
+};
+
+static void text_doc_free(gpointer data) {
+  TextDoc *doc = (TextDoc *)data;
+  if (!doc)
+    return;
+  if (!doc->merged)
+    for (guint i = 0; i < doc->terms->len; i++)
+      g_free(g_array_index(doc->terms, DocTerm, i).term);
+  g_array_unref(doc->terms);
+  g_array_unref(doc->page_lengths);
+  g_free(doc->path);
+  g_free(doc);
+}
+
+static TextDoc *text_doc_new(const char *path, gint64 mtime, goffset size) {
+  TextDoc *doc = g_new0(TextDoc, 1);
+  doc->path = g_strdup(path);
+  doc->mtime = mtime;
+  doc->size = size;
+  doc->page_lengths = g_array_new(FALSE, FALSE, sizeof(guint16));
+  doc->terms = g_array_new(FALSE, FALSE, sizeof(DocTerm));
+  return doc;
+}
+
+static void text_job_free(gpointer data) {
+  TextJob *job = (TextJob *)data;
+  g_free(job->path);
+  g_free(job);
+}
+
+static gint64 stat_mtime(const struct stat *st) {
+  return (gint64)st->st_mtim.tv_sec * G_GINT64_CONSTANT(1000000000) +
+         st->st_mtim.tv_nsec;
+}
+
+// The mtime and size the sheet index records for path, which for a sheet in
+// a bundle are the bundle's mtime and the sheet's size
+static bool sheet_stat(const char *path, gint64 *mtime, goffset *size) {
+  SheetBundle *bundle;
+  guint i;
+  if (cheeter_bundle_lookup(path, &bundle, &i)) {
+    BundleSheet sheet;
+    cheeter_bundle_get_sheet(bundle, i, &sheet);
+    *mtime = cheeter_bundle_get_mtime(bundle);
+    *size = sheet.size;
+    cheeter_bundle_unref(bundle);
+    return true;
+  }
+  struct stat st;
+  if (stat(path, &st) < 0 || !S_ISREG(st.st_mode))
+    return false;
+  *mtime = stat_mtime(&st);
+  *size = st.st_size;
+  return true;
+}
+
+// ---- Tokenizing ----
+
+// Calls func on each lowercased word of text: runs of letters and digits
+static void tokenize(const char *text,
+                     void (*func)(const char *term, gpointer data),
+                     gpointer data) {
+  char *valid = g_utf8_make_valid(text, -1);
+  GString *term = g_string_sized_new(TEXT_MAX_TERM);
+  for (const char *p = valid;; p = g_utf8_next_char(p)) {
+    gunichar c = g_utf8_get_char(p);
+    if (c && g_unichar_isalnum(c)) {
+      g_string_append_unichar(term, g_unichar_tolower(c));
+      continue;
+    }
+    if (term->len >= TEXT_MIN_TERM && term->len <= TEXT_MAX_TERM)
+      func(term->str, data);
+    g_string_truncate(term, 0);
+    if (!*p)
+      break;
+  }
+  g_string_free(term, TRUE);
+  g_free(valid);
+}
+
+static void count_term(const char *term, gpointer data) {
+  GHashTable *counts = (GHashTable *)data;
+  gpointer count;
+  if (g_hash_table_lookup_extended(counts, term, NULL, &count))
+    g_hash_table_insert(counts, g_strdup(term),
+                        GUINT_TO_POINTER(GPOINTER_TO_UINT(count) + 1));
+  else
+    g_hash_table_insert(counts, g_strdup(term), GUINT_TO_POINTER(1));
+}
+
+// ---- Merging ----
+
+// Drops doc's postings. Called with the lock held.
+static void index_unmerge(TextIndex *index, TextDoc *doc) {
+  for (guint i = 0; i < doc->terms->len; i++) {
+    const DocTerm *dt = &g_array_index(doc->terms, DocTerm, i);
+    GArray *postings = g_hash_table_lookup(index->terms, dt->term);
+    if (!postings)
+      continue;
+    // One posting per DocTerm; the term string goes with the last of them
+    for (guint p = 0; p < postings->len; p++) {
+      const Posting *posting = &g_array_index(postings, Posting, p);
+      if (posting->doc == doc && posting->page == dt->page) {
+        g_array_remove_index_fast(postings, p);
+        break;
+      }
+    }
+    if (postings->len == 0)
+      g_hash_table_remove(index->terms, dt->term);
+  }
+  index->n_pages -= doc->page_lengths->len;
+  for (guint i = 0; i < doc->page_lengths->len; i++)
+    index->n_words -= g_array_index(doc->page_lengths, guint16, i);
+}
+
+// Removes the doc of path, if any. Called with the lock held.
+static void index_forget(TextIndex *index, const char *path) {
+  TextDoc *doc = g_hash_table_lookup(index->docs, path);
+  if (!doc)
+    return;
+  index_unmerge(index, doc);
+  g_hash_table_remove(index->docs, path);
+  index->dirty = true;
+}
+
+// Adds doc, replacing any earlier version, and interns its terms. Called
+// with the lock held.
+static void index_merge(TextIndex *index, TextDoc *doc) {
+  index_forget(index, doc->path);
+  for (guint i = 0; i < doc->terms->len; i++) {
+    DocTerm *dt = &g_array_index(doc->terms, DocTerm, i);
+    gpointer key, value;
+    if (g_hash_table_lookup_extended(index->terms, dt->term, &key, &value)) {
+      g_free(dt->term);
+      dt->term = key;
+    } else {
+      value = g_array_new(FALSE, FALSE, sizeof(Posting));
+      g_hash_table_insert(index->terms, dt->term, value);
+    }
+    Posting posting = {doc, dt->page, dt->count};
+    g_array_append_val((GArray *)value, posting);
+  }
+  doc->merged = true;
+  index->n_pages += doc->page_lengths->len;
+  for (guint i = 0; i < doc->page_lengths->len; i++)
+    index->n_words += g_array_index(doc->page_lengths, guint16, i);
+  g_hash_table_insert(index->docs, doc->path, doc);
+  index->dirty = true;
+}
+
+// ---- Saving ----
+
+static void index_save(TextIndex *index) {
+  gint64 start = g_get_monotonic_time();
+  g_mutex_lock(&index->lock);
+  if (!index->dirty) {
+    g_mutex_unlock(&index->lock);
+    return;
+  }
+  GVariantBuilder docs;
+  g_variant_builder_init(&docs, G_VARIANT_TYPE("a(sxxaqa(sqq))"));
+  GHashTableIter iter;
+  gpointer value;
+  g_hash_table_iter_init(&iter, index->docs);
+  while (g_hash_table_iter_next(&iter, NULL, &value)) {
+    const TextDoc *doc = (const TextDoc *)value;
+    GVariant *lengths = g_variant_new_fixed_array(
+        G_VARIANT_TYPE_UINT16, doc->page_lengths->data,
+        doc->page_lengths->len, sizeof(guint16));
+    GVariantBuilder terms;
+    g_variant_builder_init(&terms, G_VARIANT_TYPE("a(sqq)"));
+    for (guint i = 0; i < doc->terms->len; i++) {
+      const DocTerm *dt = &g_array_index(doc->terms, DocTerm, i);
+      g_variant_builder_add(&terms, "(sqq)", dt->term, dt->page, dt->count);
+    }
+    g_variant_builder_add(&docs, "(sxx@aqa(sqq))", doc->path, doc->mtime,
+                          (gint64)doc->size, lengths, &terms);
+  }
+  guint n_docs = g_hash_table_size(index->docs);
+  index->dirty = false;
+  g_mutex_unlock(&index->lock);
+
+  GVariant *root = g_variant_ref_sink(
+      g_variant_new("(ua(sxxaqa(sqq)))", CACHE_VERSION, &docs));
+  GError *error = NULL;
+  if (!g_file_set_contents(index->cache_path, g_variant_get_data(root),
+                           g_variant_get_size(root), &error)) {
+    LOG_WARN("Could not write text index %s: %s", index->cache_path,
+             error->message);
+    g_error_free(error);
+  } else {
+    LOG_DEBUG("Saved text of %u sheets in %" G_GINT64_FORMAT " us", n_docs,
+              g_get_monotonic_time() - start);
+  }
+  g_variant_unref(root);
+}
+
+static gboolean on_save_timeout(gpointer user_data) {
+  TextIndex *index = (TextIndex *)user_data;
+  index->save_source = 0;
+  index_save(index);
+  return G_SOURCE_REMOVE;
+}
+
+// Main thread: saves once reading has been quiet for a while
+static gboolean on_changed_idle(gpointer user_data) {
+  TextIndex *index = (TextIndex *)user_data;
+  if (index->save_source)
+    g_source_remove(index->save_source);
+  index->save_source =
+      g_timeout_add_seconds(SAVE_DELAY_S, on_save_timeout, index);
+  return G_SOURCE_REMOVE;
+}
+
+// ---- Reading ----
+
+// Renice the calling pool thread, once; Linux nice values are per thread
+static void lower_priority(void) {
+  static __thread bool lowered = false;
+  if (lowered)
+    return;
+  lowered = true;
+  if (setpriority(PRIO_PROCESS, syscall(SYS_gettid), TEXT_NICE) < 0)
+    LOG_DEBUG("Could not lower text indexing priority");
+}
+
+static TextDoc *read_pdf(const TextJob *job) {
+  GError *error = NULL;
+  PopplerDocument *pdf = NULL;
+  SheetBundle *bundle;
+  guint member;
+  if (cheeter_bundle_lookup(job->path, &bundle, &member)) {
+    GBytes *bytes = cheeter_bundle_get_bytes(bundle, member);
+    pdf = poppler_document_new_from_bytes(bytes, NULL, &error);
+    g_bytes_unref(bytes);
+    cheeter_bundle_unref(bundle);
+  } else {
+    char *uri = g_filename_to_uri(job->path, NULL, &error);
+    pdf = uri ? poppler_document_new_from_file(uri, NULL, &error) : NULL;
+    g_free(uri);
+  }
+  // Unreadable sheets are kept, empty, so they aren't retried every start
+  TextDoc *doc = text_doc_new(job->path, job->mtime, job->size);
+  if (!pdf) {
+    LOG_DEBUG("No text from %s: %s", job->path,
+              error ? error->message : "unknown");
+    g_clear_error(&error);
+    return doc;
+  }
+
+  int n_pages = MIN(poppler_document_get_n_pages(pdf), G_MAXUINT16);
+  GHashTable *counts =
+      g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  for (int i = 0; i < n_pages; i++) {
+    PopplerPage *page = poppler_document_get_page(pdf, i);
+    char *text = page ? poppler_page_get_text(page) : NULL;
+    if (text)
+      tokenize(text, count_term, counts);
+
+    guint words = 0;
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, counts);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+      guint count = MIN(GPOINTER_TO_UINT(value), G_MAXUINT16);
+      DocTerm dt = {key, (guint16)i, (guint16)count};
+      g_array_append_val(doc->terms, dt);
+      words += count;
+      g_hash_table_iter_steal(&iter);
+    }
+    guint16 length = MIN(words, G_MAXUINT16);
+    g_array_append_val(doc->page_lengths, length);
+
+    g_free(text);
+    if (page)
+      g_object_unref(page);
+  }
+  g_hash_table_destroy(counts);
+  g_object_unref(pdf);
+  return doc;
+}
+
+static void text_worker(gpointer data, gpointer user_data) {
+  TextJob *job = (TextJob *)data;
+  TextIndex *index = (TextIndex *)user_data;
+  lower_priority();
+
+  if (!g_atomic_int_get(&index->stopping)) {
+    gint64 start = g_get_monotonic_time();
+    TextDoc *doc = read_pdf(job);
+    guint n_pages = doc->page_lengths->len;
+    g_mutex_lock(&index->lock);
+    index_merge(index, doc);
+    g_mutex_unlock(&index->lock);
+    LOG_DEBUG("Read text of %s (%u pages) in %" G_GINT64_FORMAT " us",
+              job->path, n_pages, g_get_monotonic_time() - start);
+  }
+  text_job_free(job);
+
+  if (g_atomic_int_dec_and_test(&index->pending) &&
+      !g_atomic_int_get(&index->stopping))
+    g_idle_add(on_changed_idle, index);
+}
+
+static void text_queue(TextIndex *index, const char *path, gint64 mtime,
+                       goffset size) {
+  TextJob *job = g_new0(TextJob, 1);
+  job->path = g_strdup(path);
+  job->mtime = mtime;
+  job->size = size;
+  g_atomic_int_inc(&index->pending);
+  g_thread_pool_push(index->pool, job, NULL);
+}
+
+static bool is_pdf(const char *path) {
+  return g_str_has_suffix(path, ".pdf");
+}
+
+// ---- Loading ----
+
+// Rebuilds the docs saved in data. Runs on the load thread.
+static guint load_saved(TextIndex *index, GVariant *saved) {
+  guint32 version;
+  GVariantIter *docs;
+  g_variant_get(saved, "(ua(sxxaqa(sqq)))", &version, &docs);
+  if (version != CACHE_VERSION) {
+    g_variant_iter_free(docs);
+    return 0;
+  }
+
+  guint n_docs = 0;
+  const char *path;
+  gint64 mtime, size;
+  GVariant *lengths;
+  GVariantIter *terms;
+  while (g_variant_iter_next(docs, "(&sxx@aqa(sqq))", &path, &mtime, &size,
+                             &lengths, &terms)) {
+    TextDoc *doc = text_doc_new(path, mtime, size);
+    gsize n_lengths;
+    const guint16 *data = g_variant_get_fixed_array(lengths, &n_lengths,
+                                                    sizeof(guint16));
+    g_array_append_vals(doc->page_lengths, data, n_lengths);
+
+    const char *term;
+    guint16 page, count;
+    while (g_variant_iter_next(terms, "(&sqq)", &term, &page, &count)) {
+      if (page >= n_lengths)
+        continue;
+      DocTerm dt = {g_strdup(term), page, count};
+      g_array_append_val(doc->terms, dt);
+    }
+    g_variant_iter_free(terms);
+    g_variant_unref(lengths);
+
+    g_mutex_lock(&index->lock);
+    index_merge(index, doc);
+    g_mutex_unlock(&index->lock);
+    n_docs++;
+  }
+  g_variant_iter_free(docs);
+  return n_docs;
+}
+
+// Loads the saved index, drops sheets that are gone and queues those new or
+// changed since
+static void load_thread(GTask *task, gpointer source_object,
+                        gpointer task_data, GCancellable *cancellable) {
+  (void)source_object;
+  (void)task_data;
+  TextIndex *index = (TextIndex *)g_task_get_task_data(task);
+  gint64 start = g_get_monotonic_time();
+
+  GMappedFile *file = g_mapped_file_new(index->cache_path, FALSE, NULL);
+  guint n_loaded = 0;
+  if (file) {
+    GBytes *bytes = g_mapped_file_get_bytes(file);
+    GVariant *saved = g_variant_ref_sink(g_variant_new_from_bytes(
+        G_VARIANT_TYPE(CACHE_TYPE), bytes, FALSE));
+    n_loaded = load_saved(index, saved);
+    g_variant_unref(saved);
+    g_bytes_unref(bytes);
+    g_mapped_file_unref(file);
+  }
+
+  // What the sheet index holds now
+  GHashTable *current =
+      g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  g_rw_lock_reader_lock(&index->sheets->lock);
+  GArray *entries = index->sheets->entries;
+  for (guint32 id = 0; id < entries->len; id++) {
+    const SheetEntry *entry = &g_array_index(entries, SheetEntry, id);
+    if (!entry->live || !is_pdf(entry->path))
+      continue;
+    gint64 *stamp = g_new(gint64, 2);
+    stamp[0] = entry->mtime;
+    stamp[1] = entry->size;
+    g_hash_table_insert(current, g_strdup(entry->path), stamp);
+  }
+  g_rw_lock_reader_unlock(&index->sheets->lock);
+
+  GHashTableIter iter;
+  gpointer key, value;
+  guint n_queued = 0, n_dropped = 0;
+  g_mutex_lock(&index->lock);
+  GPtrArray *gone = g_ptr_array_new_with_free_func(g_free);
+  g_hash_table_iter_init(&iter, index->docs);
+  while (g_hash_table_iter_next(&iter, &key, &value))
+    if (!g_hash_table_contains(current, key))
+      g_ptr_array_add(gone, g_strdup(key));
+  for (guint i = 0; i < gone->len; i++)
+    index_forget(index, g_ptr_array_index(gone, i));
+  n_dropped = gone->len;
+  g_ptr_array_unref(gone);
+
+  g_hash_table_iter_init(&iter, current);
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    const gint64 *stamp = (const gint64 *)value;
+    const TextDoc *doc = g_hash_table_lookup(index->docs, key);
+    if (doc && doc->mtime == stamp[0] && doc->size == stamp[1])
+      continue;
+    if (g_cancellable_is_cancelled(cancellable))
+      break;
+    text_queue(index, key, stamp[0], stamp[1]);
+    n_queued++;
+  }
+  g_mutex_unlock(&index->lock);
+  g_hash_table_destroy(current);
+
+  LOG_INFO("Text index: %u sheets loaded in %" G_GINT64_FORMAT
+           " us, %u to read, %u dropped",
+           n_loaded, g_get_monotonic_time() - start, n_queued, n_dropped);
+  g_task_return_boolean(task, TRUE);
+}
+
+static void on_load_done(GObject *source_object, GAsyncResult *res,
+                         gpointer user_data) {
+  (void)source_object;
+  (void)res;
+  TextIndex *index = (TextIndex *)user_data;
+  g_clear_object(&index->load_task);
+}
+
+// ---- Public API ----
+
+TextIndex *cheeter_text_index_new(SheetIndex *sheets, const char *cache_path) {
+  TextIndex *index = g_new0(TextIndex, 1);
+  index->sheets = sheets;
+  index->cache_path = g_strdup(cache_path);
+  g_mutex_init(&index->lock);
+  index->docs = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                      text_doc_free);
+  index->terms = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                       (GDestroyNotify)g_array_unref);
+  index->pool = g_thread_pool_new(
+      text_worker, index, MIN(g_get_num_processors(), TEXT_THREADS_MAX),
+      FALSE, NULL);
+  index->cancellable = g_cancellable_new();
+
+  // The load task stays referenced here until done, so free can wait on it
+  index->load_task =
+      g_task_new(NULL, index->cancellable, on_load_done, index);
+  g_task_set_task_data(index->load_task, index, NULL);
+  g_task_run_in_thread(index->load_task, load_thread);
+  return index;
+}
+
+void cheeter_text_index_free(TextIndex *index) {
+  if (!index)
+    return;
+  g_atomic_int_set(&index->stopping, 1);
+  g_cancellable_cancel(index->cancellable);
+  // Let the load finish queueing, so the pool is complete when freed
+  while (index->load_task)
+    g_main_context_iteration(NULL, TRUE);
+  // Queued jobs still run, but see stopping and only free themselves
+  g_thread_pool_free(index->pool, FALSE, TRUE);
+  while (g_source_remove_by_user_data(index))
+    ;
+  index_save(index);
+
+  g_hash_table_destroy(index->terms);
+  g_hash_table_destroy(index->docs);
+  g_object_unref(index->cancellable);
+  g_mutex_clear(&index->lock);
+  g_free(index->cache_path);
+  g_free(index);
+}
+
+void cheeter_text_index_update(TextIndex *index, const char *const *paths) {
+  bool forgot = false;
+  for (int i = 0; paths[i]; i++) {
+    gint64 mtime;
+    goffset size;
+    if (is_pdf(paths[i]) && sheet_stat(paths[i], &mtime, &size)) {
+      text_queue(index, paths[i], mtime, size);
+      continue;
+    }
+    g_mutex_lock(&index->lock);
+    forgot = forgot || g_hash_table_contains(index->docs, paths[i]);
+    index_forget(index, paths[i]);
+    g_mutex_unlock(&index->lock);
+  }
+  if (forgot)
+    on_changed_idle(index);
+}
+
+typedef struct {
+  TextDoc *doc;
+  guint page;
+  guint matched; // Query words on the page
+  double score;
+} PageHit;
+
+static guint page_hit_hash(gconstpointer key) {
+  const PageHit *hit = (const PageHit *)key;
+  return g_direct_hash(hit->doc) ^ (hit->page * 2654435761u);
+}
+
+static gboolean page_hit_equal(gconstpointer a, gconstpointer b) {
+  const PageHit *ha = (const PageHit *)a, *hb = (const PageHit *)b;
+  return ha->doc == hb->doc && ha->page == hb->page;
+}
+
+static gint compare_page_hits(gconstpointer a, gconstpointer b) {
+  const PageHit *ha = *(PageHit *const *)a, *hb = *(PageHit *const *)b;
+  if (ha->matched != hb->matched)
+    return ha->matched > hb->matched ? -1 : 1;
+  if (ha->score != hb->score)
+    return ha->score > hb->score ? -1 : 1;
+  int cmp = strcmp(ha->doc->path, hb->doc->path);
+  return cmp ? cmp : (int)ha->page - (int)hb->page;
+}
+
+static void search_hit_free(gpointer data) {
+  SearchHit *hit = (SearchHit *)data;
+  g_free(hit->path);
+  g_free(hit);
+}
+
+static void add_unique_term(const char *term, gpointer data) {
+  GPtrArray *words = (GPtrArray *)data;
+  for (guint i = 0; i < words->len; i++)
+    if (strcmp(g_ptr_array_index(words, i), term) == 0)
+      return;
+  g_ptr_array_add(words, g_strdup(term));
+}
+
+GPtrArray *cheeter_text_index_search(TextIndex *index, const char *query,
+                                     guint max_hits) {
+  gint64 start = g_get_monotonic_time();
+  GPtrArray *results = g_ptr_array_new_with_free_func(search_hit_free);
+  GPtrArray *words = g_ptr_array_new_with_free_func(g_free);
+  tokenize(query, add_unique_term, words);
+  GHashTable *pages =
+      g_hash_table_new_full(page_hit_hash, page_hit_equal, g_free, NULL);
+
+  g_mutex_lock(&index->lock);
+  double n_pages = MAX(index->n_pages, 1);
+  double avg_length = MAX((double)index->n_words / n_pages, 1);
+  for (guint w = 0; w < words->len; w++) {
+    GArray *postings = g_hash_table_lookup(index->terms,
+                                           g_ptr_array_index(words, w));
+    if (!postings)
+      continue;
+    double df = postings->len;
+    double idf = log(1 + (n_pages - df + 0.5) / (df + 0.5));
+    for (guint p = 0; p < postings->len; p++) {
+      const Posting *posting = &g_array_index(postings, Posting, p);
+      PageHit probe = {posting->doc, posting->page, 0, 0};
+      PageHit *hit = g_hash_table_lookup(pages, &probe);
+      if (!hit) {
+        hit = g_new(PageHit, 1);
+        *hit = probe;
+        g_hash_table_add(pages, hit);
+      }
+      double length = g_array_index(posting->doc->page_lengths, guint16,
+                                    posting->page);
+      double tf = posting->count;
+      hit->score += idf * tf * (BM25_K1 + 1) /
+                    (tf + BM25_K1 * (1 - BM25_B + BM25_B * length /
+                                                      avg_length));
+      hit->matched++;
+    }
+  }
+
+  GPtrArray *ranked = g_ptr_array_sized_new(g_hash_table_size(pages));
+  GHashTableIter iter;
+  gpointer key;
+  g_hash_table_iter_init(&iter, pages);
+  while (g_hash_table_iter_next(&iter, &key, NULL))
+    g_ptr_array_add(ranked, key);
+  g_ptr_array_sort(ranked, compare_page_hits);
+  for (guint i = 0; i < ranked->len && i < max_hits; i++) {
+    const PageHit *page = g_ptr_array_index(ranked, i);
+    SearchHit *hit = g_new0(SearchHit, 1);
+    hit->path = g_strdup(page->doc->path);
+    hit->page = page->page;
+    hit->score = page->score;
+    g_ptr_array_add(results, hit);
+  }
+  g_mutex_unlock(&index->lock);
+
+  LOG_DEBUG("Search '%s': %u pages matched in %" G_GINT64_FORMAT " us", query,
+            ranked->len, g_get_monotonic_time() - start);
+  g_ptr_array_unref(ranked);
+  g_hash_table_destroy(pages);
+  g_ptr_array_unref(words);
+  return results;
+}
+
+guint cheeter_text_index_pending(TextIndex *index) {
+  return g_atomic_int_get(&index->pending);
+}
@@ -3,9 +3,9 @@
 #include <gio/gio.h>
 #include <gio/gunixsocketaddress.h>
 #include <glib.h>
+#include <string.h>
 
-bool cheeter_ipc_client_send(const char *socket_path, const char *message,
-                             char **response_out) {
+static GSocketConnection *client_connect(const char *socket_path) {
   GSocketClient *client = g_socket_client_new();
   GSocketAddress *addr = g_unix_socket_address_new(socket_path);
   GError *error = NULL;
@@ -22,10 +22,38 @@ bool cheeter_ipc_client_send(const char *socket_path, const char *message,
       // It's expected to fail if daemon is not running.
       g_error_free(error);
     }
-    return false;
   }
+  return conn;
+}
+
+// Reads the response until the server closes; search results can be long
+static void client_read_response(GSocketConnection *conn,
+                                 char **response_out) {
+  GError *error = NULL;
+  GInputStream *in = g_io_stream_get_input_stream(G_IO_STREAM(conn));
+  GString *response = g_string_new(NULL);
+  char buffer[4096];
+  gssize n_read;
+  while ((n_read = g_input_stream_read(in, buffer, sizeof(buffer), NULL,
+                                       &error)) > 0)
+    g_string_append_len(response, buffer, n_read);
+
+  if (n_read < 0 && error)
+    g_error_free(error);
+  if (response_out)
+    *response_out = g_string_free(response, FALSE);
+  else
+    g_string_free(response, TRUE);
+}
+
+bool cheeter_ipc_client_send(const char *socket_path, const char *message,
+                             char **response_out) {
+  GSocketConnection *conn = client_connect(socket_path);
+  if (!conn)
+    return false;
 
   GOutputStream *out = g_io_stream_get_output_stream(G_IO_STREAM(conn));
+  GError *error = NULL;
 
   // Send message + newline
   char *msg_nl = g_strdup_printf("%s\n", message);
@@ -38,22 +66,41 @@ bool cheeter_ipc_client_send(const char *socket_path, const char *message,
   }
   g_free(msg_nl);
 
-  // Read response
-  GInputStream *in = g_io_stream_get_input_stream(G_IO_STREAM(conn));
-  char buffer[1024];
-  gssize n_read =
-      g_input_stream_read(in, buffer, sizeof(buffer) - 1, NULL, &error);
-
-  if (n_read >= 0) {
-    buffer[n_read] = '\0';
-    if (response_out) {
-      *response_out = g_strdup(buffer);
-    }
-  } else {
-    if (error)
-      g_error_free(error);
+  client_read_response(conn, response_out);
+  g_object_unref(conn);
+  return true;
+}
+
+bool cheeter_ipc_client_send_body(const char *socket_path, const char *message,
+                                  char *const *lines, guint n_lines,
+                                  char **response_out) {
+  GSocketConnection *conn = client_connect(socket_path);
+  if (!conn)
+    return false;
+
+  // Sent in one go rather than a write per line
+  GString *request = g_string_new(message);
+  g_string_append_c(request, '\n');
+  for (guint i = 0; i < n_lines; i++) {
+    if (lines[i][0] == '.')
+      g_string_append_c(request, '.');
+    g_string_append(request, lines[i]);
+    g_string_append_c(request, '\n');
+  }
+  g_string_append(request, ".\n");
+
+  GOutputStream *out = g_io_stream_get_output_stream(G_IO_STREAM(conn));
+  GError *error = NULL;
+  bool sent = g_output_stream_write_all(out, request->str, request->len, NULL,
+                                        NULL, &error);
+  g_string_free(request, TRUE);
+  if (!sent) {
+    g_error_free(error);
+    g_object_unref(conn);
+    return false;
   }
 
+  client_read_response(conn, response_out);
   g_object_unref(conn);
   return true;
 }
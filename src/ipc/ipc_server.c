@@ -2,55 +2,161 @@
 #include "cheeter/log.h"
 #include <gio/gio.h>
 #include <glib.h>
+#include <string.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <unistd.h>
 
+// A client that stops sending or reading is dropped after this long, rather
+// than holding its connection open forever
+#define IPC_TIMEOUT_S 10
+
+// The body, read in full before the callback runs
+struct CheeterIpcBody {
+  GPtrArray *lines; // char*, un-stuffed; NULL if the command takes none
+  guint next;
+};
+
+char *cheeter_ipc_body_next_line(CheeterIpcBody *body) {
+  if (!body->lines || body->next >= body->lines->len)
+    return NULL;
+  return g_steal_pointer(&body->lines->pdata[body->next++]);
+}
+
 struct CheeterIpcServer {
   char *socket_path;
   CheeterIpcCallback callback;
   void *user_data;
   GSocketService *service;
+  GHashTable *body_commands; // Commands followed by a body
+  GCancellable *cancellable; // Cancelled when freed, ending every request
 };
 
-static gboolean on_incoming_connection(GSocketService *service,
-                                       GSocketConnection *connection,
-                                       GObject *source_object,
-                                       gpointer user_data) {
-  CheeterIpcServer *server = (CheeterIpcServer *)user_data;
-
-  // Simple line-based or size-prefixed protocol.
-  // For MVP CLI, just read all until close or use GDataInputStream.
+// One connection, from its command line to the reply. Everything is read
+// and written asynchronously, so a slow client never stalls the main loop.
+typedef struct {
+  CheeterIpcServer *server; // Only used while not cancelled
+  GSocketConnection *connection;
+  GDataInputStream *in;
+  char *command;
+  CheeterIpcBody body;
+  char *reply;
+} IpcRequest;
+
+static void ipc_request_free(IpcRequest *request) {
+  g_io_stream_close(G_IO_STREAM(request->connection), NULL, NULL);
+  g_object_unref(request->in);
+  g_object_unref(request->connection);
+  g_free(request->command);
+  if (request->body.lines)
+    g_ptr_array_unref(request->body.lines);
+  g_free(request->reply);
+  g_free(request);
+}
 
-  GInputStream *input = g_io_stream_get_input_stream(G_IO_STREAM(connection));
-  GDataInputStream *data_in = g_data_input_stream_new(input);
+static void on_reply_written(GObject *source_object, GAsyncResult *res,
+                             gpointer user_data) {
+  IpcRequest *request = (IpcRequest *)user_data;
   GError *error = NULL;
-  char *line;
-  gsize len;
+  if (!g_output_stream_write_all_finish(G_OUTPUT_STREAM(source_object), res,
+                                        NULL, &error)) {
+    if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+      LOG_ERROR("IPC write error: %s", error->message);
+    g_error_free(error);
+  }
+  // The client reads until we close
+  ipc_request_free(request);
+}
 
-  // Read a single line command
-  line = g_data_input_stream_read_line(data_in, &len, NULL, &error);
+static void ipc_request_dispatch(IpcRequest *request) {
+  CheeterIpcServer *server = request->server;
+  if (server->callback)
+    request->reply =
+        server->callback(request->command, &request->body, server->user_data);
+  if (!request->reply)
+    request->reply = g_strdup("OK\n");
+
+  GOutputStream *output =
+      g_io_stream_get_output_stream(G_IO_STREAM(request->connection));
+  g_output_stream_write_all_async(output, request->reply,
+                                  strlen(request->reply), G_PRIORITY_DEFAULT,
+                                  server->cancellable, on_reply_written,
+                                  request);
+}
 
-  if (line) {
-    LOG_DEBUG("IPC Received: %s", line);
-    if (server->callback) {
-      server->callback(line, server->user_data);
-    }
+static void on_body_line(GObject *source_object, GAsyncResult *res,
+                         gpointer user_data) {
+  IpcRequest *request = (IpcRequest *)user_data;
+  GError *error = NULL;
+  char *line = g_data_input_stream_read_line_finish(
+      G_DATA_INPUT_STREAM(source_object), res, NULL, &error);
+  if (error) {
+    // A body cut short is not applied
+    if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+      LOG_ERROR("IPC read error: %s", error->message);
+    g_error_free(error);
+    ipc_request_free(request);
+    return;
+  }
+  // The "." line, or EOF from a client that didn't send one
+  if (!line || strcmp(line, ".") == 0) {
+    g_free(line);
+    ipc_request_dispatch(request);
+    return;
+  }
+  if (line[0] == '.')
+    memmove(line, line + 1, strlen(line));
+  g_ptr_array_add(request->body.lines, line);
+  g_data_input_stream_read_line_async(request->in, G_PRIORITY_DEFAULT,
+                                      request->server->cancellable,
+                                      on_body_line, request);
+}
 
-    // Simple response
-    GOutputStream *output =
-        g_io_stream_get_output_stream(G_IO_STREAM(connection));
-    g_output_stream_write_all(output, "OK\n", 3, NULL, NULL, NULL);
+static void on_command_line(GObject *source_object, GAsyncResult *res,
+                            gpointer user_data) {
+  IpcRequest *request = (IpcRequest *)user_data;
+  GError *error = NULL;
+  request->command = g_data_input_stream_read_line_finish(
+      G_DATA_INPUT_STREAM(source_object), res, NULL, &error);
+  if (!request->command) {
+    if (error && !g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+      LOG_ERROR("IPC read error: %s", error->message);
+    g_clear_error(&error);
+    ipc_request_free(request);
+    return;
+  }
 
-    g_free(line);
-  } else if (error) {
-    LOG_ERROR("IPC read error: %s", error->message);
-    g_error_free(error);
+  LOG_DEBUG("IPC Received: %s", request->command);
+  CheeterIpcServer *server = request->server;
+  if (!g_hash_table_contains(server->body_commands, request->command)) {
+    ipc_request_dispatch(request);
+    return;
   }
+  request->body.lines = g_ptr_array_new_with_free_func(g_free);
+  g_data_input_stream_read_line_async(request->in, G_PRIORITY_DEFAULT,
+                                      server->cancellable, on_body_line,
+                                      request);
+}
 
-  g_object_unref(data_in);
-  return FALSE; // Don't keep the connection object alive, strictly one-shot for
-                // now (or handle differently)
+static gboolean on_incoming_connection(GSocketService *service,
+                                       GSocketConnection *connection,
+                                       GObject *source_object,
+                                       gpointer user_data) {
+  (void)service;
+  (void)source_object;
+  CheeterIpcServer *server = (CheeterIpcServer *)user_data;
+
+  g_socket_set_timeout(g_socket_connection_get_socket(connection),
+                       IPC_TIMEOUT_S);
+  IpcRequest *request = g_new0(IpcRequest, 1);
+  request->server = server;
+  request->connection = g_object_ref(connection);
+  request->in = g_data_input_stream_new(
+      g_io_stream_get_input_stream(G_IO_STREAM(connection)));
+  g_data_input_stream_read_line_async(request->in, G_PRIORITY_DEFAULT,
+                                      server->cancellable, on_command_line,
+                                      request);
+  return FALSE;
 }
 
 CheeterIpcServer *cheeter_ipc_server_new(const char *socket_path,
@@ -60,9 +166,17 @@ CheeterIpcServer *cheeter_ipc_server_new(const char *socket_path,
   server->socket_path = g_strdup(socket_path);
   server->callback = callback;
   server->user_data = user_data;
+  server->body_commands =
+      g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  server->cancellable = g_cancellable_new();
   return server;
 }
 
+void cheeter_ipc_server_add_body_command(CheeterIpcServer *server,
+                                         const char *command) {
+  g_hash_table_add(server->body_commands, g_strdup(command));
+}
+
 void cheeter_ipc_server_attach_to_mainloop(CheeterIpcServer *server) {
   server->service = g_socket_service_new();
   GError *error = NULL;
@@ -93,10 +207,14 @@ void cheeter_ipc_server_attach_to_mainloop(CheeterIpcServer *server) {
 void cheeter_ipc_server_free(CheeterIpcServer *server) {
   if (!server)
     return;
+  // Requests still in flight finish on their own, without the server
+  g_cancellable_cancel(server->cancellable);
+  g_object_unref(server->cancellable);
   if (server->service) {
     g_socket_service_stop(server->service);
     g_object_unref(server->service);
   }
+  g_hash_table_destroy(server->body_commands);
   g_free(server->socket_path);
   g_free(server);
 }
@@ -0,0 +1,326 @@
+#include "cheeter/mapping.h"
+#include <glib.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Layout, in native byte order like the other caches:
+//
+//   TableHeader
+//   int32_t disp[n_entries]      per hash bucket, how its keys were placed
+//   TableSlot slots[n_entries]   one per key, no empty slots
+//   char strings[strings_size]   NUL-terminated keys and sheets
+//
+// A key hashes with seed 0 to a bucket. A positive displacement d places
+// every key of that bucket at hash(d, key) % n; a negative one is the slot
+// of its only key, -d - 1. Keys not in the table land on some slot too, so
+// the slot's key is always compared.
+#define TABLE_MAGIC "CHTRMAP1"
+#define TABLE_VERSION 1
+// Gives up on a bucket after this many seeds; only reached by broken input
+#define TABLE_MAX_SEED (1 << 24)
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t n_entries;
+  uint32_t strings_size;
+  uint32_t reserved;
+} TableHeader;
+
+typedef struct {
+  uint32_t key;
+  uint32_t value;
+} TableSlot;
+
+struct MappingTable {
+  GMappedFile *file;
+  guint32 n;
+  const int32_t *disp;
+  const TableSlot *slots;
+  const char *strings;
+};
+
+// FNV-1a from a seed
+static guint32 table_hash(guint32 seed, const char *key) {
+  guint32 h = seed ? seed : 0x811c9dc5u;
+  for (const guchar *p = (const guchar *)key; *p; p++)
+    h = (h ^ *p) * 0x01000193u;
+  return h;
+}
+
+static guint32 table_slot(const int32_t *disp, guint32 n, const char *key) {
+  int32_t d = disp[table_hash(0, key) % n];
+  return d < 0 ? (guint32)(-d - 1) : table_hash(d, key) % n;
+}
+
+MappingTable *cheeter_mapping_table_open(const char *path, GError **error) {
+  GMappedFile *file = g_mapped_file_new(path, FALSE, error);
+  if (!file)
+    return NULL;
+
+  const char *data = g_mapped_file_get_contents(file);
+  gsize len = g_mapped_file_get_length(file);
+  const TableHeader *header = (const TableHeader *)data;
+  MappingTable *table = NULL;
+  if (len < sizeof(*header) ||
+      memcmp(header->magic, TABLE_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version != TABLE_VERSION)
+    goto invalid;
+
+  guint64 strings_off =
+      sizeof(*header) + (guint64)header->n_entries *
+                            (sizeof(int32_t) + sizeof(TableSlot));
+  if (strings_off + header->strings_size != len ||
+      (header->strings_size > 0 && data[len - 1] != '\0'))
+    goto invalid;
+
+  table = g_new0(MappingTable, 1);
+  table->file = file;
+  table->n = header->n_entries;
+  table->disp = (const int32_t *)(data + sizeof(*header));
+  table->slots = (const TableSlot *)(table->disp + table->n);
+  table->strings = data + strings_off;
+  // Checked once here, so lookups can trust every offset
+  for (guint32 i = 0; i < table->n; i++) {
+    int32_t d = table->disp[i];
+    if (table->slots[i].key >= header->strings_size ||
+        table->slots[i].value >= header->strings_size ||
+        (d < 0 && (guint32)(-(d + 1)) >= table->n))
+      goto invalid;
+  }
+  return table;
+
+invalid:
+  g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+              "%s is not a compiled mapping table", path);
+  g_free(table);
+  g_mapped_file_unref(file);
+  return NULL;
+}
+
+void cheeter_mapping_table_free(MappingTable *table) {
+  if (!table)
+    return;
+  g_mapped_file_unref(table->file);
+  g_free(table);
+}
+
+guint cheeter_mapping_table_size(MappingTable *table) { return table->n; }
+
+void cheeter_mapping_table_get(MappingTable *table, guint i, const char **key,
+                               const char **sheet_path) {
+  *key = table->strings + table->slots[i].key;
+  *sheet_path = table->strings + table->slots[i].value;
+}
+
+const char *cheeter_mapping_table_lookup(MappingTable *table,
+                                         const char *app_key) {
+  if (table->n == 0)
+    return NULL;
+  const TableSlot *slot = &table->slots[table_slot(table->disp, table->n,
+                                                   app_key)];
+  if (strcmp(table->strings + slot->key, app_key) != 0)
+    return NULL;
+  return table->strings + slot->value;
+}
+
+// ---- Compiling ----
+
+typedef struct {
+  guint32 bucket;
+  guint32 entry;
+} BucketKey;
+
+static gint compare_bucket_keys(gconstpointer a, gconstpointer b) {
+  const BucketKey *ka = (const BucketKey *)a;
+  const BucketKey *kb = (const BucketKey *)b;
+  if (ka->bucket != kb->bucket)
+    return ka->bucket < kb->bucket ? -1 : 1;
+  return 0;
+}
+
+typedef struct {
+  guint32 start; // Into the sorted BucketKeys
+  guint32 size;
+} Bucket;
+
+// Largest buckets first, while most slots are free
+static gint compare_buckets(gconstpointer a, gconstpointer b) {
+  const Bucket *ba = (const Bucket *)a;
+  const Bucket *bb = (const Bucket *)b;
+  if (ba->size != bb->size)
+    return ba->size > bb->size ? -1 : 1;
+  return ba->start < bb->start ? -1 : ba->start > bb->start;
+}
+
+static guint32 add_string(GString *strings, GHashTable *offsets,
+                          const char *str) {
+  gpointer offset;
+  if (g_hash_table_lookup_extended(offsets, str, NULL, &offset))
+    return GPOINTER_TO_UINT(offset);
+  guint32 at = strings->len;
+  g_string_append_len(strings, str, strlen(str) + 1);
+  g_hash_table_insert(offsets, (gpointer)str, GUINT_TO_POINTER(at));
+  return at;
+}
+
+// Places keys[i] at slot_of[i], filling disp. False if some bucket can't be
+// placed, which takes keys that hash alike under every seed.
+static bool table_place(char **keys, guint32 n, int32_t *disp,
+                        guint32 *slot_of) {
+  BucketKey *bkeys = g_new(BucketKey, n);
+  for (guint32 i = 0; i < n; i++) {
+    bkeys[i].bucket = table_hash(0, keys[i]) % n;
+    bkeys[i].entry = i;
+  }
+  qsort(bkeys, n, sizeof(*bkeys), compare_bucket_keys);
+
+  GArray *buckets = g_array_new(FALSE, FALSE, sizeof(Bucket));
+  for (guint32 i = 0; i < n;) {
+    Bucket b = {i, 0};
+    while (i < n && bkeys[i].bucket == bkeys[b.start].bucket) {
+      b.size++;
+      i++;
+    }
+    g_array_append_val(buckets, b);
+  }
+  g_array_sort(buckets, compare_buckets);
+
+  bool *used = g_new0(bool, n);
+  guint32 *trial = g_new(guint32, n);
+  bool ok = true;
+  guint32 next_free = 0;
+  for (guint i = 0; i < buckets->len && ok; i++) {
+    const Bucket *b = &g_array_index(buckets, Bucket, i);
+    const BucketKey *bk = &bkeys[b->start];
+    if (b->size == 1) {
+      // Single keys take whatever is left, no search needed
+      while (used[next_free])
+        next_free++;
+      used[next_free] = true;
+      slot_of[bk->entry] = next_free;
+      disp[bk->bucket] = -(int32_t)next_free - 1;
+      continue;
+    }
+
+    guint32 seed = 1;
+    for (;; seed++) {
+      if (seed >= TABLE_MAX_SEED) {
+        ok = false;
+        break;
+      }
+      guint32 k = 0;
+      for (; k < b->size; k++) {
+        guint32 slot = table_hash(seed, keys[bk[k].entry]) % n;
+        if (used[slot])
+          break;
+        used[slot] = true;
+        trial[k] = slot;
+      }
+      if (k == b->size)
+        break;
+      // Collided: undo this seed's picks
+      while (k > 0)
+        used[trial[--k]] = false;
+    }
+    if (!ok)
+      break;
+    for (guint32 k = 0; k < b->size; k++)
+      slot_of[bk[k].entry] = trial[k];
+    disp[bk->bucket] = seed;
+  }
+
+  g_free(trial);
+  g_free(used);
+  g_array_unref(buckets);
+  g_free(bkeys);
+  return ok;
+}
+
+bool cheeter_mapping_table_compile(const char *tsv_path, const char *out_path,
+                                   guint *n_mappings, GError **error) {
+  char *contents;
+  gsize len;
+  if (!g_file_get_contents(tsv_path, &contents, &len, error))
+    return false;
+
+  // Key, TAB, sheet per line, the last of a repeated key winning as when
+  // mappings.tsv is loaded. Both point into contents.
+  GHashTable *map = g_hash_table_new(g_str_hash, g_str_equal);
+  char *line = contents;
+  char *end = contents + len;
+  while (line < end) {
+    char *newline = memchr(line, '\n', end - line);
+    char *next = newline ? newline + 1 : end;
+    if (newline)
+      *newline = '\0';
+    char *tab = memchr(line, '\t', (newline ? newline : end) - line);
+    if (tab && tab > line) {
+      *tab = '\0';
+      char *val = tab + 1;
+      char *val_end = strpbrk(val, "\t\r");
+      if (val_end)
+        *val_end = '\0';
+      g_hash_table_replace(map, line, val);
+    }
+    line = next;
+  }
+
+  guint32 n = g_hash_table_size(map);
+  char **keys = g_new(char *, MAX(n, 1));
+  GHashTableIter iter;
+  gpointer key, value;
+  guint32 i = 0;
+  g_hash_table_iter_init(&iter, map);
+  while (g_hash_table_iter_next(&iter, &key, &value))
+    keys[i++] = key;
+
+  int32_t *disp = g_new0(int32_t, MAX(n, 1));
+  guint32 *slot_of = g_new0(guint32, MAX(n, 1));
+  bool ok = table_place(keys, n, disp, slot_of);
+  if (!ok)
+    g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                "Could not build a perfect hash over %s", tsv_path);
+
+  if (ok) {
+    // Sheets repeat across keys, so equal strings are stored once
+    GString *strings = g_string_new(NULL);
+    GHashTable *offsets = g_hash_table_new(g_str_hash, g_str_equal);
+    TableSlot *slots = g_new0(TableSlot, MAX(n, 1));
+    for (i = 0; i < n; i++) {
+      TableSlot *slot = &slots[slot_of[i]];
+      slot->key = add_string(strings, offsets, keys[i]);
+      slot->value = add_string(strings, offsets,
+                               g_hash_table_lookup(map, keys[i]));
+    }
+
+    TableHeader header = {0};
+    memcpy(header.magic, TABLE_MAGIC, sizeof(header.magic));
+    header.version = TABLE_VERSION;
+    header.n_entries = n;
+    header.strings_size = strings->len;
+    GString *out = g_string_sized_new(sizeof(header) +
+                                      n * (sizeof(*disp) + sizeof(*slots)) +
+                                      strings->len);
+    g_string_append_len(out, (const char *)&header, sizeof(header));
+    g_string_append_len(out, (const char *)disp, n * sizeof(*disp));
+    g_string_append_len(out, (const char *)slots, n * sizeof(*slots));
+    g_string_append_len(out, strings->str, strings->len);
+    ok = g_file_set_contents(out_path, out->str, out->len, error);
+
+    g_string_free(out, TRUE);
+    g_free(slots);
+    g_hash_table_destroy(offsets);
+    g_string_free(strings, TRUE);
+  }
+
+  if (ok && n_mappings)
+    *n_mappings = n;
+  g_free(slot_of);
+  g_free(disp);
+  g_free(keys);
+  g_hash_table_destroy(map);
+  g_free(contents);
+  return ok;
+}
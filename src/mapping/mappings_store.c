@@ -1,85 +1,356 @@
 #include "cheeter/log.h"
 #include "cheeter/mapping.h"
+#include <errno.h>
+#include <fcntl.h>
 #include <glib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
-MappingStore *cheeter_mapping_load(const char *file_path) {
-  MappingStore *store = g_new0(MappingStore, 1);
-  store->file_path = g_strdup(file_path);
-  store->map = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+// The snapshot is rewritten once sets have stopped for this long
+#define COMPACT_DELAY_MS 2000
+// Journal line opening a batch of mappings set together, followed by the
+// count; an empty key, which no mapping has
+#define BATCH_MARK "\tbatch\t"
 
-  if (!file_path)
-    return store;
+// A snapshot being written off the main thread
+typedef struct {
+  char *path;
+  GString *contents;
+  guint64 appended; // Journal lines it includes
+} CompactJob;
 
-  // Load simple K=V or TSV lines
-  FILE *f = fopen(file_path, "r");
-  if (!f) {
-    // Not an error, just new
-    return store;
-  }
+// Whether the count lines after the batch mark at line all made it to disk
+static bool batch_complete(const char *line, const char *end) {
+  guint64 count = g_ascii_strtoull(line + strlen(BATCH_MARK), NULL, 10);
+  const char *p = memchr(line, '\n', end - line);
+  for (; p && count > 0; count--)
+    p = memchr(p + 1, '\n', end - (p + 1));
+  return p && count == 0;
+}
 
-  char line[1024];
-  while (fgets(line, sizeof(line), f)) {
-    // Strip newline
-    size_t len = strlen(line);
-    if (len > 0 && line[len - 1] == '\n')
-      line[len - 1] = '\0';
+// Adds the TSV lines of contents to map, returning how many, and in *used
+// the length of the lines read. In a journal (!partial_ok), a line without
+// its newline, or a batch missing some of its lines, was cut short by a
+// crash and ends the replay.
+static guint parse_lines(GHashTable *map, char *contents, gsize len,
+                         bool partial_ok, gsize *used) {
+  guint n = 0;
+  char *line = contents;
+  char *end = contents + len;
+  while (line < end) {
+    char *newline = memchr(line, '\n', end - line);
+    if (!newline && !partial_ok)
+      break;
+    if (!partial_ok && g_str_has_prefix(line, BATCH_MARK) &&
+        !batch_complete(line, end))
+      break;
+    if (newline)
+      *newline = '\0';
 
-    // Simple parsing: first whitespace/cmp is separator
-    // Or if TSV, strictly TAB. Let's support TAB or Space for leniency, or just
-    // TAB as plan says. Plan says TSV.
+    // Key, TAB, sheet; columns past that came from older versions
     char *tab = strchr(line, '\t');
-    if (tab) {
+    if (tab && tab > line) {
       *tab = '\0';
-      char *key = g_strdup(line);
-      char *val = g_strdup(tab + 1);
-      // strip extra columns if we had them in older version
+      char *val = tab + 1;
       char *next_tab = strchr(val, '\t');
       if (next_tab)
         *next_tab = '\0';
-
-      g_hash_table_replace(store->map, key, val);
+      g_hash_table_replace(map, g_strdup(line), g_strdup(val));
+      n++;
     }
+    if (!newline) {
+      line = end;
+      break;
+    }
+    line = newline + 1;
   }
-  fclose(f);
-  return store;
+  *used = line - contents;
+  return n;
 }
 
-void cheeter_mapping_save(MappingStore *store) {
-  if (!store->file_path)
-    return;
-
-  FILE *f = fopen(store->file_path, "w");
-  if (!f) {
-    LOG_WARN("Could not write mappings to %s", store->file_path);
-    return;
-  }
+static guint load_file(GHashTable *map, const char *path, bool partial_ok,
+                       gsize *used) {
+  char *contents;
+  gsize len;
+  *used = 0;
+  // Missing is not an error, just new
+  if (!g_file_get_contents(path, &contents, &len, NULL))
+    return 0;
+  guint n = parse_lines(map, contents, len, partial_ok, used);
+  g_free(contents);
+  return n;
+}
 
+static GString *snapshot_format(GHashTable *map) {
+  GString *out = g_string_new(NULL);
   GHashTableIter iter;
   gpointer key, value;
-  g_hash_table_iter_init(&iter, store->map);
-  while (g_hash_table_iter_next(&iter, &key, &value)) {
-    fprintf(f, "%s\t%s\n", (char *)key, (char *)value);
+  g_hash_table_iter_init(&iter, map);
+  while (g_hash_table_iter_next(&iter, &key, &value))
+    g_string_append_printf(out, "%s\t%s\n", (char *)key, (char *)value);
+  return out;
+}
+
+// Atomically: a reader sees the old snapshot or the new one, never part
+static bool snapshot_write(const char *path, const GString *contents) {
+  GError *error = NULL;
+  if (!g_file_set_contents(path, contents->str, contents->len, &error)) {
+    LOG_WARN("Could not write mappings: %s", error->message);
+    g_error_free(error);
+    return false;
   }
-  fclose(f);
+  return true;
+}
+
+// Empties the journal if the snapshot just written has everything in it.
+// Replaying lines the snapshot already has is harmless, so a journal that
+// grew meanwhile is just left for the next compaction.
+static void journal_trim(MappingStore *store, guint64 appended) {
+  store->saved = MAX(store->saved, appended);
+  if (store->journal_fd >= 0 && store->saved == store->appended &&
+      ftruncate(store->journal_fd, 0) < 0)
+    LOG_WARN("Could not empty %s: %s", store->journal_path,
+             g_strerror(errno));
+}
+
+static void compact_job_free(gpointer data) {
+  CompactJob *job = (CompactJob *)data;
+  g_free(job->path);
+  g_string_free(job->contents, TRUE);
+  g_free(job);
+}
+
+static void compact_thread(GTask *task, gpointer source_object,
+                           gpointer task_data, GCancellable *cancellable) {
+  (void)source_object;
+  (void)cancellable;
+  CompactJob *job = (CompactJob *)task_data;
+  g_task_return_boolean(task, snapshot_write(job->path, job->contents));
+}
+
+static gboolean on_compact_timeout(gpointer user_data);
+
+static void compact_schedule(MappingStore *store) {
+  if (store->compact_source)
+    g_source_remove(store->compact_source);
+  store->compact_source =
+      g_timeout_add(COMPACT_DELAY_MS, on_compact_timeout, store);
+}
+
+static void on_compact_done(GObject *source_object, GAsyncResult *res,
+                            gpointer user_data) {
+  (void)source_object;
+  GTask *task = G_TASK(res);
+  // Cancelled once the store is freed; user_data is gone then
+  if (g_cancellable_is_cancelled(g_task_get_cancellable(task)))
+    return;
+  MappingStore *store = (MappingStore *)user_data;
+  CompactJob *job = g_task_get_task_data(task);
+  g_clear_object(&store->compacting);
+  if (g_task_propagate_boolean(task, NULL))
+    journal_trim(store, job->appended);
+  if (store->saved < store->appended && !store->compact_source)
+    compact_schedule(store);
+}
+
+static gboolean on_compact_timeout(gpointer user_data) {
+  MappingStore *store = (MappingStore *)user_data;
+  store->compact_source = 0;
+  // One writer at a time, so an older snapshot can't land last
+  if (store->compacting || store->saved == store->appended)
+    return G_SOURCE_REMOVE;
+
+  CompactJob *job = g_new0(CompactJob, 1);
+  job->path = g_strdup(store->file_path);
+  job->contents = snapshot_format(store->map);
+  job->appended = store->appended;
+  store->compacting = g_cancellable_new();
+  GTask *task =
+      g_task_new(NULL, store->compacting, on_compact_done, store);
+  g_task_set_task_data(task, job, compact_job_free);
+  g_task_run_in_thread(task, compact_thread);
+  g_object_unref(task);
+  return G_SOURCE_REMOVE;
+}
+
+MappingStore *cheeter_mapping_load(const char *file_path) {
+  MappingStore *store = g_new0(MappingStore, 1);
+  store->file_path = g_strdup(file_path);
+  store->map = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  g_rw_lock_init(&store->lock);
+  store->journal_fd = -1;
+
+  if (!file_path)
+    return store;
+
+  gsize used;
+  load_file(store->map, file_path, true, &used);
+  store->journal_path = g_strconcat(file_path, ".journal", NULL);
+  guint replayed = load_file(store->map, store->journal_path, false, &used);
+
+  store->journal_fd =
+      open(store->journal_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+           0644);
+  // A line cut short goes, or the next one appended would run into it
+  if (store->journal_fd < 0)
+    LOG_WARN("Could not open %s: %s", store->journal_path,
+             g_strerror(errno));
+  else if (ftruncate(store->journal_fd, used) < 0)
+    LOG_WARN("Could not repair %s: %s", store->journal_path,
+             g_strerror(errno));
+  if (replayed > 0) {
+    // Folded into the snapshot soon, so the journal doesn't grow forever
+    LOG_DEBUG("Replayed %u mapping changes from %s", replayed,
+              store->journal_path);
+    store->appended = replayed;
+    compact_schedule(store);
+  }
+  return store;
+}
+
+void cheeter_mapping_save(MappingStore *store) {
+  if (!store->file_path)
+    return;
+  GString *contents = snapshot_format(store->map);
+  // With a compaction still writing, the journal is kept: whichever
+  // snapshot lands last, replaying it over that one gives this state
+  if (snapshot_write(store->file_path, contents) && !store->compacting)
+    journal_trim(store, store->appended);
+  g_string_free(contents, TRUE);
 }
 
 void cheeter_mapping_free(MappingStore *store) {
   if (!store)
     return;
+  if (store->compact_source)
+    g_source_remove(store->compact_source);
+  if (store->saved < store->appended)
+    cheeter_mapping_save(store);
+  if (store->compacting) {
+    g_cancellable_cancel(store->compacting);
+    g_object_unref(store->compacting);
+  }
+  if (store->journal_fd >= 0)
+    close(store->journal_fd);
+  cheeter_mapping_table_free(store->table);
   g_hash_table_destroy(store->map);
+  g_rw_lock_clear(&store->lock);
+  g_free(store->journal_path);
   g_free(store->file_path);
   g_free(store);
 }
 
-const char *cheeter_mapping_get(MappingStore *store, const char *app_key) {
-  return (const char *)g_hash_table_lookup(store->map, app_key);
+void cheeter_mapping_attach_table(MappingStore *store,
+                                  const char *table_path) {
+  GError *error = NULL;
+  MappingTable *table = cheeter_mapping_table_open(table_path, &error);
+  if (!table) {
+    // Most installs have none
+    if (!g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+      LOG_WARN("Ignoring compiled mappings: %s", error->message);
+    g_error_free(error);
+    return;
+  }
+  g_rw_lock_writer_lock(&store->lock);
+  MappingTable *old = store->table;
+  store->table = table;
+  g_rw_lock_writer_unlock(&store->lock);
+  cheeter_mapping_table_free(old);
+  g_atomic_int_inc(&store->generation);
+  LOG_INFO("Loaded %u compiled mappings from %s",
+           cheeter_mapping_table_size(table), table_path);
+}
+
+char *cheeter_mapping_get(MappingStore *store, const char *app_key) {
+  g_rw_lock_reader_lock(&store->lock);
+  const char *sheet = g_hash_table_lookup(store->map, app_key);
+  if (!sheet && store->table)
+    sheet = cheeter_mapping_table_lookup(store->table, app_key);
+  char *copy = g_strdup(sheet);
+  g_rw_lock_reader_unlock(&store->lock);
+  return copy;
+}
+
+guint cheeter_mapping_get_generation(MappingStore *store) {
+  return (guint)g_atomic_int_get(&store->generation);
+}
+
+void cheeter_mapping_foreach(MappingStore *store, GHFunc func,
+                             gpointer user_data) {
+  g_hash_table_foreach(store->map, func, user_data);
+  guint n = store->table ? cheeter_mapping_table_size(store->table) : 0;
+  for (guint i = 0; i < n; i++) {
+    const char *key, *sheet;
+    cheeter_mapping_table_get(store->table, i, &key, &sheet);
+    if (!g_hash_table_contains(store->map, key))
+      func((gpointer)key, (gpointer)sheet, user_data);
+  }
+}
+
+// Either would break the line format
+static bool mapping_valid(const char *app_key, const char *sheet_path) {
+  return *app_key && *sheet_path && !strpbrk(app_key, "\t\n") &&
+         !strchr(sheet_path, '\n');
+}
+
+// Appends records to the journal in one write. One that fails is cut back
+// off, so the next starts on a line of its own; the snapshot due soon has
+// the mappings either way.
+static void journal_append(MappingStore *store, const GString *records) {
+  off_t before = lseek(store->journal_fd, 0, SEEK_END);
+  gssize n;
+  do
+    n = write(store->journal_fd, records->str, records->len);
+  while (n < 0 && errno == EINTR);
+  if (n != (gssize)records->len) {
+    LOG_WARN("Could not append to %s: %s", store->journal_path,
+             n < 0 ? g_strerror(errno) : "short write");
+    if (n > 0 && before >= 0 && ftruncate(store->journal_fd, before) < 0)
+      LOG_DEBUG("Could not cut back %s", store->journal_path);
+  }
+  store->appended++;
+}
+
+guint cheeter_mapping_set_many(MappingStore *store,
+                               const char *const *app_keys,
+                               const char *const *sheet_paths, guint n) {
+  GString *records = g_string_new(NULL);
+  guint applied = 0;
+  g_rw_lock_writer_lock(&store->lock);
+  for (guint i = 0; i < n; i++) {
+    if (!mapping_valid(app_keys[i], sheet_paths[i])) {
+      LOG_WARN("Not mapping '%s': empty, or tab or newline in mapping",
+               app_keys[i]);
+      continue;
+    }
+    g_hash_table_replace(store->map, g_strdup(app_keys[i]),
+                         g_strdup(sheet_paths[i]));
+    g_string_append_printf(records, "%s\t%s\n", app_keys[i],
+                           sheet_paths[i]);
+    applied++;
+  }
+  g_rw_lock_writer_unlock(&store->lock);
+  // Batches go to the journal behind a count, so a crash part way through
+  // one drops all of it on replay
+  if (applied > 1) {
+    char *mark = g_strdup_printf(BATCH_MARK "%u\n", applied);
+    g_string_prepend(records, mark);
+    g_free(mark);
+  }
+
+  if (applied > 0) {
+    g_atomic_int_inc(&store->generation);
+    if (store->journal_fd >= 0) {
+      journal_append(store, records);
+      compact_schedule(store);
+    }
+  }
+  g_string_free(records, TRUE);
+  return applied;
 }
 
 void cheeter_mapping_set(MappingStore *store, const char *app_key,
                          const char *sheet_path) {
-  g_hash_table_replace(store->map, g_strdup(app_key), g_strdup(sheet_path));
-  // Save on set
-  cheeter_mapping_save(store);
+  cheeter_mapping_set_many(store, &app_key, &sheet_path, 1);
 }
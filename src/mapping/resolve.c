@@ -1,31 +1,17 @@
-#include "cheeter/index.h"
 #include "cheeter/log.h"
-#include "cheeter/mapping.h"
+#include "cheeter/resolve.h"
 #include <glib.h>
+#include <stdbool.h>
 #include <string.h>
 
 // For now, app identity is just a string (app_key).
 // In Phase 2, we will have a struct AppIdentity.
 // But the resolver interface can take the calculated key for now.
 
-const char *cheeter_resolve_sheet(SheetIndex *index, MappingStore *store,
-                                  const char *app_key) {
-  if (!app_key)
-    return NULL;
-
-  LOG_DEBUG("Resolving sheet for key: %s", app_key);
-
-  // 1. Check mapping store (exact match)
-  const char *mapped = cheeter_mapping_get(store, app_key);
-  if (mapped) {
-    LOG_INFO("Found explicit mapping for %s -> %s", app_key, mapped);
-    // Verify it exists? If not, maybe fall through?
-    // For MVP, assume if mapped, return it. If file missing, UI will handle.
-    return mapped;
-  }
-
-  // 2. Heuristic match
-  // app_key might be "desktop:org.gnome.Terminal" or "exe:bash"
+// Sheet names app_key is looked up under, most specific first; names[] has
+// room for two. "exe:vim" -> "vim"; desktop ids are usually reverse DNS, so
+// "desktop:org.mozilla.firefox" also tries "firefox".
+static int lookup_names(const char *app_key, char *names[2]) {
   // Extract the "name" part
   const char *name_part = strchr(app_key, ':');
   if (name_part) {
@@ -34,17 +20,202 @@ const char *cheeter_resolve_sheet(SheetIndex *index, MappingStore *store,
     name_part = app_key;
   }
 
-  // Normalized lookup in index
-  char *normalized = g_ascii_strdown(name_part, -1);
-  const SheetEntry *entry = cheeter_index_find_by_basename(index, normalized);
-  g_free(normalized);
+  int n = 0;
+  names[n++] = g_ascii_strdown(name_part, -1);
+  const char *last_dot = strrchr(name_part, '.');
+  if (g_str_has_prefix(app_key, "desktop:") && last_dot && last_dot[1])
+    names[n++] = g_ascii_strdown(last_dot + 1, -1);
+  return n;
+}
+
+char *cheeter_resolve_mapped(MappingStore *store, const char *app_key) {
+  if (!app_key)
+    return NULL;
+  char *mapped = cheeter_mapping_get(store, app_key);
+  if (mapped) {
+    LOG_INFO("Found explicit mapping for %s -> %s", app_key, mapped);
+    // If the file is missing, the UI says so
+  }
+  return mapped;
+}
+
+char *cheeter_resolve_indexed(SheetIndex *index, const char *app_key) {
+  if (!app_key)
+    return NULL;
 
-  if (entry) {
-    LOG_INFO("Found heuristic match for %s -> %s", app_key, entry->path);
+  LOG_DEBUG("Resolving sheet by name for key: %s", app_key);
+
+  // app_key might be "desktop:org.gnome.Terminal" or "exe:bash"
+  char *names[2];
+  int n_names = lookup_names(app_key, names);
+  char *path = NULL;
+  for (int i = 0; i < n_names; i++) {
+    if (!path)
+      path = cheeter_index_lookup(index, names[i]);
+    g_free(names[i]);
+  }
+
+  if (path) {
+    LOG_INFO("Found heuristic match for %s -> %s", app_key, path);
     // We could auto-save this mapping, but maybe safer to let user confirm.
     // For MVP "fast workflow", let's just return it without saving.
-    return entry->path;
   }
+  return path;
+}
+
+// Last resort once no key resolved exactly: the sheet named most like one
+// of app_key's names ("gnome-terminal-server" -> gnome-terminal.pdf)
+char *cheeter_resolve_sheet_fuzzy(SheetIndex *index, const char *app_key,
+                                  double *score) {
+  *score = 0;
+  if (!app_key)
+    return NULL;
+  char *names[2];
+  int n_names = lookup_names(app_key, names);
+  char *path = NULL;
+  for (int i = 0; i < n_names; i++) {
+    double s;
+    char *candidate = cheeter_index_lookup_fuzzy(index, names[i], &s);
+    if (candidate && s > *score) {
+      g_free(path);
+      path = candidate;
+      *score = s;
+    } else {
+      g_free(candidate);
+    }
+    g_free(names[i]);
+  }
+  return path;
+}
+
+// ---- Result cache ----
+
+// Entries kept; past this the stale ones go, then all if none were stale
+#define RESOLVE_CACHE_MAX 256
+
+typedef struct {
+  ResolveResult result;
+  guint index_generation;
+  guint store_generation;
+} CachedResolve;
+
+struct ResolveCache {
+  GMutex lock;
+  GHashTable *entries; // char* key -> CachedResolve*
+  guint64 hits;
+  guint64 misses;
+  guint64 stale; // Misses on an entry left from older generations
+  guint64 probes;
+  gint64 probe_us; // Total over probes
+  gint64 probe_max_us;
+};
+
+void cheeter_resolve_result_clear(ResolveResult *result) {
+  g_clear_pointer(&result->sheet, g_free);
+  g_clear_pointer(&result->fallback_key, g_free);
+  result->fuzzy = false;
+}
+
+static void cached_resolve_free(gpointer data) {
+  CachedResolve *cached = (CachedResolve *)data;
+  cheeter_resolve_result_clear(&cached->result);
+  g_free(cached);
+}
+
+ResolveCache *cheeter_resolve_cache_new(void) {
+  ResolveCache *cache = g_new0(ResolveCache, 1);
+  g_mutex_init(&cache->lock);
+  cache->entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                         cached_resolve_free);
+  return cache;
+}
+
+void cheeter_resolve_cache_free(ResolveCache *cache) {
+  if (!cache)
+    return;
+  g_hash_table_destroy(cache->entries);
+  g_mutex_clear(&cache->lock);
+  g_free(cache);
+}
+
+bool cheeter_resolve_cache_lookup(ResolveCache *cache, const char *key,
+                                  guint index_generation,
+                                  guint store_generation,
+                                  ResolveResult *out) {
+  g_mutex_lock(&cache->lock);
+  CachedResolve *cached = g_hash_table_lookup(cache->entries, key);
+  bool hit = cached && cached->index_generation == index_generation &&
+             cached->store_generation == store_generation;
+  if (hit) {
+    cache->hits++;
+    out->sheet = g_strdup(cached->result.sheet);
+    out->fallback_key = g_strdup(cached->result.fallback_key);
+    out->fuzzy = cached->result.fuzzy;
+  } else {
+    cache->misses++;
+    if (cached)
+      cache->stale++;
+  }
+  g_mutex_unlock(&cache->lock);
+  return hit;
+}
+
+// Drops entries from generations other than these, or everything if they
+// all are current
+static void cache_evict(ResolveCache *cache, guint index_generation,
+                        guint store_generation) {
+  GHashTableIter iter;
+  gpointer value;
+  g_hash_table_iter_init(&iter, cache->entries);
+  while (g_hash_table_iter_next(&iter, NULL, &value)) {
+    const CachedResolve *cached = (const CachedResolve *)value;
+    if (cached->index_generation != index_generation ||
+        cached->store_generation != store_generation)
+      g_hash_table_iter_remove(&iter);
+  }
+  if (g_hash_table_size(cache->entries) >= RESOLVE_CACHE_MAX)
+    g_hash_table_remove_all(cache->entries);
+}
+
+void cheeter_resolve_cache_insert(ResolveCache *cache, const char *key,
+                                  guint index_generation,
+                                  guint store_generation,
+                                  const ResolveResult *result,
+                                  gint64 probe_us) {
+  CachedResolve *cached = g_new0(CachedResolve, 1);
+  cached->result.sheet = g_strdup(result->sheet);
+  cached->result.fallback_key = g_strdup(result->fallback_key);
+  cached->result.fuzzy = result->fuzzy;
+  cached->index_generation = index_generation;
+  cached->store_generation = store_generation;
+
+  g_mutex_lock(&cache->lock);
+  cache->probes++;
+  cache->probe_us += probe_us;
+  cache->probe_max_us = MAX(cache->probe_max_us, probe_us);
+  if (g_hash_table_size(cache->entries) >= RESOLVE_CACHE_MAX &&
+      !g_hash_table_contains(cache->entries, key))
+    cache_evict(cache, index_generation, store_generation);
+  g_hash_table_replace(cache->entries, g_strdup(key), cached);
+  g_mutex_unlock(&cache->lock);
+}
 
-  return NULL;
+void cheeter_resolve_cache_format_stats(ResolveCache *cache, GString *out) {
+  g_mutex_lock(&cache->lock);
+  guint64 lookups = cache->hits + cache->misses;
+  g_string_append_printf(out,
+                         "resolve cache: %u entries, %" G_GUINT64_FORMAT
+                         " hits, %" G_GUINT64_FORMAT
+                         " misses (%" G_GUINT64_FORMAT
+                         " stale), %.1f%% hit rate\n",
+                         g_hash_table_size(cache->entries), cache->hits,
+                         cache->misses, cache->stale,
+                         lookups ? 100.0 * cache->hits / lookups : 0.0);
+  gint64 mean_us = cache->probes ? cache->probe_us / (gint64)cache->probes : 0;
+  g_string_append_printf(out,
+                         "resolve probes: %" G_GUINT64_FORMAT
+                         " uncached, mean %" G_GINT64_FORMAT
+                         " us, max %" G_GINT64_FORMAT " us\n",
+                         cache->probes, mean_us, cache->probe_max_us);
+  g_mutex_unlock(&cache->lock);
 }
@@ -0,0 +1,564 @@
+#include "cheeter/log.h"
+#include "cheeter/rules.h"
+#include <gio/gio.h>
+#include <glib.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Wait for an editor's save (write, rename, chmod) to settle
+#define RELOAD_DELAY_MS 200
+
+// The glob DFA is built lazily; past this many states it starts over rather
+// than grow without bound on pathological patterns
+#define GLOB_DFA_MAX_STATES 4096
+
+// Ranks are rule indices after sorting by precedence; lower wins
+#define NO_RULE G_MAXINT
+
+typedef enum {
+  FIELD_DESKTOP,
+  FIELD_CLASS,
+  FIELD_EXE,
+  FIELD_TITLE,
+  FIELD_COUNT
+} RuleField;
+
+// In order of precedence at equal priority
+typedef enum { MATCH_EXACT, MATCH_GLOB, MATCH_CONTAINS } RuleMatch;
+
+static const char *const field_names[FIELD_COUNT] = {"desktop", "class", "exe",
+                                                     "title"};
+static const char *const match_names[] = {"exact", "glob", "contains"};
+
+typedef struct {
+  RuleField field;
+  RuleMatch match;
+  char *pattern; // Lowercase
+  char *sheet;
+  int priority;
+  guint line;
+} Rule;
+
+static void rule_free(gpointer data) {
+  Rule *rule = (Rule *)data;
+  g_free(rule->pattern);
+  g_free(rule->sheet);
+  g_free(rule);
+}
+
+// ---- Aho-Corasick (contains) ----
+
+typedef struct {
+  guint32 next[256]; // Complete goto function once built
+  guint32 fail;
+  int best; // Lowest rank ending here or at any suffix
+} AcNode;
+
+typedef struct {
+  GArray *nodes; // AcNode, root first
+} AhoCorasick;
+
+static guint32 ac_add_node(AhoCorasick *ac) {
+  AcNode node;
+  memset(&node, 0, sizeof(node));
+  node.best = NO_RULE;
+  g_array_append_val(ac->nodes, node);
+  return ac->nodes->len - 1;
+}
+
+static AhoCorasick *ac_new(void) {
+  AhoCorasick *ac = g_new0(AhoCorasick, 1);
+  ac->nodes = g_array_new(FALSE, FALSE, sizeof(AcNode));
+  ac_add_node(ac);
+  return ac;
+}
+
+static void ac_free(AhoCorasick *ac) {
+  if (!ac)
+    return;
+  g_array_unref(ac->nodes);
+  g_free(ac);
+}
+
+// While inserting, next[c] == 0 means no edge: nothing points back to root
+static void ac_insert(AhoCorasick *ac, const char *pattern, int rank) {
+  guint32 state = 0;
+  for (const guchar *p = (const guchar *)pattern; *p; p++) {
+    guint32 next = g_array_index(ac->nodes, AcNode, state).next[*p];
+    if (!next) {
+      next = ac_add_node(ac);
+      g_array_index(ac->nodes, AcNode, state).next[*p] = next;
+    }
+    state = next;
+  }
+  AcNode *node = &g_array_index(ac->nodes, AcNode, state);
+  node->best = MIN(node->best, rank);
+}
+
+// Breadth-first fail links, folding each node's fail chain into best and
+// filling missing edges, so matching is one table lookup per byte
+static void ac_build(AhoCorasick *ac) {
+  GQueue queue = G_QUEUE_INIT;
+  AcNode *root = &g_array_index(ac->nodes, AcNode, 0);
+  for (int c = 0; c < 256; c++) {
+    if (root->next[c])
+      g_queue_push_tail(&queue, GUINT_TO_POINTER(root->next[c]));
+  }
+
+  while (!g_queue_is_empty(&queue)) {
+    guint32 u = GPOINTER_TO_UINT(g_queue_pop_head(&queue));
+    AcNode *node = &g_array_index(ac->nodes, AcNode, u);
+    AcNode *fail = &g_array_index(ac->nodes, AcNode, node->fail);
+    node->best = MIN(node->best, fail->best);
+    for (int c = 0; c < 256; c++) {
+      guint32 v = node->next[c];
+      if (v) {
+        g_array_index(ac->nodes, AcNode, v).fail = fail->next[c];
+        g_queue_push_tail(&queue, GUINT_TO_POINTER(v));
+      } else {
+        node->next[c] = fail->next[c];
+      }
+    }
+  }
+}
+
+static int ac_match(const AhoCorasick *ac, const char *text) {
+  const AcNode *nodes = (const AcNode *)ac->nodes->data;
+  guint32 state = 0;
+  int best = nodes[0].best;
+  for (const guchar *p = (const guchar *)text; *p; p++) {
+    state = nodes[state].next[*p];
+    best = MIN(best, nodes[state].best);
+  }
+  return best;
+}
+
+// ---- Glob DFA ----
+
+// Every glob is laid out in one program; a DFA state is the set of program
+// positions the input could be at
+#define GLOB_ANY 0x100
+#define GLOB_STAR 0x101
+#define GLOB_END 0x102
+
+typedef struct {
+  guint16 op; // A literal byte or one of the above
+  int rank;   // For GLOB_END
+} GlobOp;
+
+typedef struct GlobState {
+  GArray *positions; // guint32, sorted
+  int accept;        // Lowest rank among GLOB_END positions
+  struct GlobState *next[256];
+} GlobState;
+
+typedef struct {
+  GArray *prog;      // GlobOp
+  GArray *starts;    // guint32: first position of each glob
+  GMutex lock;       // Guards the states, which are built while matching
+  GHashTable *states; // GBytes* (positions) -> GlobState*
+  GlobState *start;
+  guint32 *marks; // Per position, for deduplicating a set being built
+  guint32 generation;
+} GlobDfa;
+
+static void glob_state_free(gpointer data) {
+  GlobState *state = (GlobState *)data;
+  g_array_unref(state->positions);
+  g_free(state);
+}
+
+static GlobDfa *glob_new(void) {
+  GlobDfa *dfa = g_new0(GlobDfa, 1);
+  dfa->prog = g_array_new(FALSE, FALSE, sizeof(GlobOp));
+  dfa->starts = g_array_new(FALSE, FALSE, sizeof(guint32));
+  g_mutex_init(&dfa->lock);
+  dfa->states = g_hash_table_new_full(g_bytes_hash, g_bytes_equal,
+                                      (GDestroyNotify)g_bytes_unref,
+                                      glob_state_free);
+  return dfa;
+}
+
+static void glob_free(GlobDfa *dfa) {
+  if (!dfa)
+    return;
+  g_hash_table_destroy(dfa->states);
+  g_array_unref(dfa->prog);
+  g_array_unref(dfa->starts);
+  g_free(dfa->marks);
+  g_mutex_clear(&dfa->lock);
+  g_free(dfa);
+}
+
+static void glob_insert(GlobDfa *dfa, const char *pattern, int rank) {
+  guint32 start = dfa->prog->len;
+  g_array_append_val(dfa->starts, start);
+  for (const guchar *p = (const guchar *)pattern; *p; p++) {
+    GlobOp op = {*p, 0};
+    if (*p == '*')
+      op.op = GLOB_STAR;
+    else if (*p == '?')
+      op.op = GLOB_ANY;
+    g_array_append_val(dfa->prog, op);
+  }
+  GlobOp end = {GLOB_END, rank};
+  g_array_append_val(dfa->prog, end);
+}
+
+static void glob_build(GlobDfa *dfa) {
+  dfa->marks = g_new0(guint32, dfa->prog->len);
+}
+
+// Adds pos and, through any stars (which may match nothing), what follows
+static void glob_add(GlobDfa *dfa, GArray *set, guint32 pos) {
+  const GlobOp *prog = (const GlobOp *)dfa->prog->data;
+  for (;;) {
+    if (dfa->marks[pos] == dfa->generation)
+      return;
+    dfa->marks[pos] = dfa->generation;
+    g_array_append_val(set, pos);
+    if (prog[pos].op != GLOB_STAR)
+      return;
+    pos++;
+  }
+}
+
+static gint compare_positions(gconstpointer a, gconstpointer b) {
+  guint32 pa = *(const guint32 *)a, pb = *(const guint32 *)b;
+  return pa < pb ? -1 : pa > pb;
+}
+
+// Takes ownership of set. Sets *flushed if every earlier state was dropped
+// to make room.
+static GlobState *glob_intern(GlobDfa *dfa, GArray *set, bool *flushed) {
+  g_array_sort(set, compare_positions);
+  GBytes *key = g_bytes_new(set->data, set->len * sizeof(guint32));
+  GlobState *state = g_hash_table_lookup(dfa->states, key);
+  if (state) {
+    g_bytes_unref(key);
+    g_array_unref(set);
+    return state;
+  }
+
+  if (g_hash_table_size(dfa->states) >= GLOB_DFA_MAX_STATES) {
+    g_hash_table_remove_all(dfa->states);
+    dfa->start = NULL;
+    *flushed = true;
+  }
+
+  const GlobOp *prog = (const GlobOp *)dfa->prog->data;
+  state = g_new0(GlobState, 1);
+  state->positions = set;
+  state->accept = NO_RULE;
+  for (guint i = 0; i < set->len; i++) {
+    const GlobOp *op = &prog[g_array_index(set, guint32, i)];
+    if (op->op == GLOB_END)
+      state->accept = MIN(state->accept, op->rank);
+  }
+  g_hash_table_insert(dfa->states, key, state);
+  return state;
+}
+
+static GlobState *glob_start(GlobDfa *dfa) {
+  if (!dfa->start) {
+    GArray *set = g_array_new(FALSE, FALSE, sizeof(guint32));
+    dfa->generation++;
+    for (guint i = 0; i < dfa->starts->len; i++)
+      glob_add(dfa, set, g_array_index(dfa->starts, guint32, i));
+    bool flushed = false;
+    dfa->start = glob_intern(dfa, set, &flushed);
+  }
+  return dfa->start;
+}
+
+static GlobState *glob_step(GlobDfa *dfa, GlobState *state, guchar c) {
+  if (state->next[c])
+    return state->next[c];
+
+  const GlobOp *prog = (const GlobOp *)dfa->prog->data;
+  GArray *set = g_array_new(FALSE, FALSE, sizeof(guint32));
+  dfa->generation++;
+  for (guint i = 0; i < state->positions->len; i++) {
+    guint32 pos = g_array_index(state->positions, guint32, i);
+    guint16 op = prog[pos].op;
+    if (op == GLOB_STAR)
+      glob_add(dfa, set, pos);
+    else if (op == GLOB_ANY || op == c)
+      glob_add(dfa, set, pos + 1);
+  }
+
+  bool flushed = false;
+  GlobState *next = glob_intern(dfa, set, &flushed);
+  if (!flushed) // Otherwise state is gone
+    state->next[c] = next;
+  return next;
+}
+
+static int glob_match(GlobDfa *dfa, const char *text) {
+  g_mutex_lock(&dfa->lock);
+  GlobState *state = glob_start(dfa);
+  for (const guchar *p = (const guchar *)text; *p && state->positions->len;
+       p++)
+    state = glob_step(dfa, state, *p);
+  int best = state->accept;
+  g_mutex_unlock(&dfa->lock);
+  return best;
+}
+
+// ---- Compiled rule set ----
+
+typedef struct {
+  GHashTable *exact; // pattern -> GINT_TO_POINTER(rank + 1)
+  AhoCorasick *contains;
+  GlobDfa *globs;
+} FieldMatcher;
+
+typedef struct {
+  gint ref;
+  GPtrArray *rules; // Rule*, indexed by rank
+  FieldMatcher fields[FIELD_COUNT];
+} RuleSet;
+
+static void rule_set_unref(RuleSet *set) {
+  if (!set || !g_atomic_int_dec_and_test(&set->ref))
+    return;
+  for (int f = 0; f < FIELD_COUNT; f++) {
+    g_hash_table_destroy(set->fields[f].exact);
+    ac_free(set->fields[f].contains);
+    glob_free(set->fields[f].globs);
+  }
+  g_ptr_array_unref(set->rules);
+  g_free(set);
+}
+
+static gint compare_rules(gconstpointer a, gconstpointer b) {
+  const Rule *ra = *(Rule *const *)a, *rb = *(Rule *const *)b;
+  if (ra->priority != rb->priority)
+    return ra->priority > rb->priority ? -1 : 1;
+  if (ra->match != rb->match)
+    return ra->match < rb->match ? -1 : 1;
+  return ra->line < rb->line ? -1 : ra->line > rb->line;
+}
+
+static int parse_name(const char *name, const char *const *names, int count) {
+  for (int i = 0; i < count; i++)
+    if (g_ascii_strcasecmp(name, names[i]) == 0)
+      return i;
+  return -1;
+}
+
+// Runs of tabs count as one, so columns can be aligned
+static Rule *parse_rule(const char *line, guint line_no, const char *path) {
+  char **cols = g_strsplit(line, "\t", -1);
+  GPtrArray *fields = g_ptr_array_new();
+  for (int i = 0; cols[i]; i++)
+    if (*cols[i])
+      g_ptr_array_add(fields, cols[i]);
+
+  Rule *rule = NULL;
+  int field = -1, match = -1;
+  if (fields->len == 4 || fields->len == 5) {
+    field = parse_name(g_ptr_array_index(fields, 0), field_names, FIELD_COUNT);
+    match = parse_name(g_ptr_array_index(fields, 1), match_names,
+                       G_N_ELEMENTS(match_names));
+  }
+  if (field >= 0 && match >= 0) {
+    rule = g_new0(Rule, 1);
+    rule->field = field;
+    rule->match = match;
+    rule->pattern = g_ascii_strdown(g_ptr_array_index(fields, 2), -1);
+    rule->sheet = g_strdup(g_ptr_array_index(fields, 3));
+    rule->line = line_no;
+    if (fields->len == 5)
+      rule->priority = atoi(g_ptr_array_index(fields, 4));
+  } else {
+    LOG_WARN("%s:%u: expected FIELD MATCH PATTERN SHEET [PRIORITY]", path,
+             line_no);
+  }
+
+  g_ptr_array_unref(fields);
+  g_strfreev(cols);
+  return rule;
+}
+
+static RuleSet *rule_set_compile(const char *path) {
+  RuleSet *set = g_new0(RuleSet, 1);
+  set->ref = 1;
+  set->rules = g_ptr_array_new_with_free_func(rule_free);
+  for (int f = 0; f < FIELD_COUNT; f++)
+    set->fields[f].exact = g_hash_table_new(g_str_hash, g_str_equal);
+
+  char *contents = NULL;
+  if (g_file_get_contents(path, &contents, NULL, NULL)) {
+    char **lines = g_strsplit(contents, "\n", -1);
+    for (int i = 0; lines[i]; i++) {
+      char *line = g_strstrip(lines[i]);
+      if (!*line || *line == '#')
+        continue;
+      Rule *rule = parse_rule(line, i + 1, path);
+      if (rule)
+        g_ptr_array_add(set->rules, rule);
+    }
+    g_strfreev(lines);
+    g_free(contents);
+  }
+  g_ptr_array_sort(set->rules, compare_rules);
+
+  gint64 start = g_get_monotonic_time();
+  for (guint rank = 0; rank < set->rules->len; rank++) {
+    Rule *rule = g_ptr_array_index(set->rules, rank);
+    FieldMatcher *fm = &set->fields[rule->field];
+    switch (rule->match) {
+    case MATCH_EXACT:
+      // Sorted, so the first rule for a key is the best one
+      if (!g_hash_table_contains(fm->exact, rule->pattern))
+        g_hash_table_insert(fm->exact, rule->pattern,
+                            GINT_TO_POINTER(rank + 1));
+      break;
+    case MATCH_CONTAINS:
+      if (!fm->contains)
+        fm->contains = ac_new();
+      ac_insert(fm->contains, rule->pattern, rank);
+      break;
+    case MATCH_GLOB:
+      if (!fm->globs)
+        fm->globs = glob_new();
+      glob_insert(fm->globs, rule->pattern, rank);
+      break;
+    }
+  }
+  for (int f = 0; f < FIELD_COUNT; f++) {
+    if (set->fields[f].contains)
+      ac_build(set->fields[f].contains);
+    if (set->fields[f].globs)
+      glob_build(set->fields[f].globs);
+  }
+
+  LOG_INFO("Compiled %u sheet rules from %s in %" G_GINT64_FORMAT " us",
+           set->rules->len, path, g_get_monotonic_time() - start);
+  return set;
+}
+
+static int field_match(FieldMatcher *fm, const char *value) {
+  int best = NO_RULE;
+  gpointer exact = g_hash_table_lookup(fm->exact, value);
+  if (exact)
+    best = GPOINTER_TO_INT(exact) - 1;
+  if (fm->globs)
+    best = MIN(best, glob_match(fm->globs, value));
+  if (fm->contains)
+    best = MIN(best, ac_match(fm->contains, value));
+  return best;
+}
+
+// ---- Engine ----
+
+struct RuleEngine {
+  char *path;
+  GFileMonitor *monitor;
+  guint reload_source;
+
+  GMutex lock; // Guards current
+  RuleSet *current;
+};
+
+static void rule_engine_reload(RuleEngine *engine) {
+  RuleSet *set = rule_set_compile(engine->path);
+  g_mutex_lock(&engine->lock);
+  RuleSet *old = engine->current;
+  engine->current = set;
+  g_mutex_unlock(&engine->lock);
+  // Matches in flight hold their own reference
+  rule_set_unref(old);
+}
+
+static gboolean on_reload_timeout(gpointer user_data) {
+  RuleEngine *engine = (RuleEngine *)user_data;
+  engine->reload_source = 0;
+  rule_engine_reload(engine);
+  return G_SOURCE_REMOVE;
+}
+
+static void on_rules_changed(GFileMonitor *monitor, GFile *file,
+                             GFile *other_file, GFileMonitorEvent event,
+                             gpointer user_data) {
+  (void)monitor;
+  (void)file;
+  (void)other_file;
+  RuleEngine *engine = (RuleEngine *)user_data;
+  if (event == G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED)
+    return;
+  if (engine->reload_source)
+    g_source_remove(engine->reload_source);
+  engine->reload_source =
+      g_timeout_add(RELOAD_DELAY_MS, on_reload_timeout, engine);
+}
+
+RuleEngine *cheeter_rules_new(const char *path) {
+  RuleEngine *engine = g_new0(RuleEngine, 1);
+  engine->path = g_strdup(path);
+  g_mutex_init(&engine->lock);
+  engine->current = rule_set_compile(path);
+
+  GFile *file = g_file_new_for_path(path);
+  engine->monitor =
+      g_file_monitor_file(file, G_FILE_MONITOR_WATCH_MOVES, NULL, NULL);
+  g_object_unref(file);
+  if (engine->monitor)
+    g_signal_connect(engine->monitor, "changed", G_CALLBACK(on_rules_changed),
+                     engine);
+  return engine;
+}
+
+void cheeter_rules_free(RuleEngine *engine) {
+  if (!engine)
+    return;
+  if (engine->reload_source)
+    g_source_remove(engine->reload_source);
+  if (engine->monitor) {
+    g_signal_handlers_disconnect_by_data(engine->monitor, engine);
+    g_object_unref(engine->monitor);
+  }
+  rule_set_unref(engine->current);
+  g_mutex_clear(&engine->lock);
+  g_free(engine->path);
+  g_free(engine);
+}
+
+char *cheeter_rules_match(RuleEngine *engine, const AppIdentity *id) {
+  if (!engine || !id)
+    return NULL;
+
+  g_mutex_lock(&engine->lock);
+  RuleSet *set = engine->current;
+  if (set)
+    g_atomic_int_inc(&set->ref);
+  g_mutex_unlock(&engine->lock);
+  if (!set)
+    return NULL;
+
+  char *exe = id->exe_path ? g_path_get_basename(id->exe_path) : NULL;
+  const char *values[FIELD_COUNT] = {id->desktop_id, id->wm_class, exe,
+                                     id->title};
+  int best = NO_RULE;
+  for (int f = 0; f < FIELD_COUNT && set->rules->len; f++) {
+    if (!values[f])
+      continue;
+    char *value = g_ascii_strdown(values[f], -1);
+    best = MIN(best, field_match(&set->fields[f], value));
+    g_free(value);
+  }
+  g_free(exe);
+
+  char *sheet = NULL;
+  if (best != NO_RULE) {
+    Rule *rule = g_ptr_array_index(set->rules, best);
+    LOG_DEBUG("Rule on line %u (%s %s \"%s\") matched -> %s", rule->line,
+              field_names[rule->field], match_names[rule->match],
+              rule->pattern, rule->sheet);
+    sheet = g_strdup(rule->sheet);
+  }
+  rule_set_unref(set);
+  return sheet;
+}
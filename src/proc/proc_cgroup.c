@@ -0,0 +1,171 @@
+#include "cheeter/log.h"
+#include "cheeter/proc.h"
+#include <glib.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+// Length of the UUID snapd appends to scope names
+#define SNAP_UUID_LEN 36
+
+// Prefixes launchers put between "app-" and the application id
+static const char *const unit_launchers[] = {"flatpak", "gnome", "kde",
+                                             "dbus", "glib", NULL};
+
+// systemd escapes '-' and other bytes in unit names as \xNN
+static char *unit_unescape(const char *s, size_t len) {
+  GString *out = g_string_sized_new(len);
+  for (size_t i = 0; i < len; i++) {
+    if (s[i] == '\\' && i + 3 < len && s[i + 1] == 'x' &&
+        g_ascii_isxdigit(s[i + 2]) && g_ascii_isxdigit(s[i + 3])) {
+      g_string_append_c(out, (char)(g_ascii_xdigit_value(s[i + 2]) << 4 |
+                                    g_ascii_xdigit_value(s[i + 3])));
+      i += 3;
+    } else {
+      g_string_append_c(out, s[i]);
+    }
+  }
+  return g_string_free(out, FALSE);
+}
+
+// Length of name without suffix, or 0 if it doesn't end in suffix
+static size_t strip_suffix(const char *name, size_t len, const char *suffix) {
+  size_t slen = strlen(suffix);
+  if (len <= slen || strncmp(name + len - slen, suffix, slen) != 0)
+    return 0;
+  return len - slen;
+}
+
+// Application id from one cgroup path component, following the XDG/systemd
+// naming scheme:
+//   app[-<launcher>]-<id>-<random>.scope
+//   app[-<launcher>]-<id>[@<random>].service
+//   snap.<snap>.<app>-<uuid>.scope, snap.<snap>.<app>.service
+static char *app_id_from_unit(const char *unit, size_t len, bool *sandboxed) {
+  size_t body_len;
+  bool scope = true;
+  if (!(body_len = strip_suffix(unit, len, ".scope"))) {
+    if (!(body_len = strip_suffix(unit, len, ".service")))
+      return NULL;
+    scope = false;
+  }
+
+  if (body_len > 5 && g_str_has_prefix(unit, "snap.")) {
+    const char *snap = unit + 5;
+    size_t snap_len = body_len - 5;
+    // Scopes end in a UUID, joined by '-' or '.' depending on snapd version
+    if (scope && snap_len > SNAP_UUID_LEN + 1 &&
+        strchr("-.", snap[snap_len - SNAP_UUID_LEN - 1]))
+      snap_len -= SNAP_UUID_LEN + 1;
+    // Snap desktop files are named <snap>_<app>.desktop
+    char *id = g_strndup(snap, snap_len);
+    char *dot = strchr(id, '.');
+    if (!dot || strchr(dot + 1, '.')) {
+      g_free(id);
+      return NULL;
+    }
+    *dot = '_';
+    *sandboxed = true;
+    return id;
+  }
+
+  if (body_len <= 4 || !g_str_has_prefix(unit, "app-"))
+    return NULL;
+  const char *body = unit + 4;
+  body_len -= 4;
+
+  if (scope) {
+    const char *end = g_strrstr_len(body, body_len, "-");
+    if (!end)
+      return NULL;
+    body_len = end - body;
+  } else {
+    const char *at = memchr(body, '@', body_len);
+    if (at)
+      body_len = at - body;
+  }
+
+  for (const char *const *l = unit_launchers; *l; l++) {
+    size_t llen = strlen(*l);
+    if (body_len > llen + 1 && strncmp(body, *l, llen) == 0 &&
+        body[llen] == '-') {
+      if (strcmp(*l, "flatpak") == 0)
+        *sandboxed = true;
+      body += llen + 1;
+      body_len -= llen + 1;
+      break;
+    }
+  }
+  if (body_len == 0)
+    return NULL;
+
+  char *id = unit_unescape(body, body_len);
+  size_t id_len = strip_suffix(id, strlen(id), ".desktop");
+  if (id_len)
+    id[id_len] = '\0';
+  return id;
+}
+
+// Flatpak apps without a systemd scope still carry their metadata
+static char *flatpak_info_app_id(pid_t pid) {
+  char path[PATH_MAX];
+  cheeter_proc_path(path, sizeof(path), "%d/root/.flatpak-info", pid);
+  GKeyFile *kf = g_key_file_new();
+  char *id = NULL;
+  if (g_key_file_load_from_file(kf, path, G_KEY_FILE_NONE, NULL))
+    id = g_key_file_get_string(kf, "Application", "name", NULL);
+  g_key_file_free(kf);
+  return id;
+}
+
+char *cheeter_proc_read_app_id(pid_t pid, bool *sandboxed) {
+  *sandboxed = false;
+
+  char path[PATH_MAX];
+  cheeter_proc_path(path, sizeof(path), "%d/cgroup", pid);
+  char *contents = cheeter_proc_read_contents(path, NULL);
+  if (!contents)
+    return NULL;
+
+  // The unified hierarchy ("0::") carries the systemd tree; on v1-only
+  // systems the name=systemd controller does, under whatever hierarchy id
+  // it was given
+  const char *cg_path = NULL;
+  char **lines = g_strsplit(contents, "\n", -1);
+  for (char **line = lines; *line; line++) {
+    if (g_str_has_prefix(*line, "0::")) {
+      cg_path = *line + 3;
+      break;
+    }
+    const char *controllers = strchr(*line, ':');
+    if (controllers && g_str_has_prefix(controllers + 1, "name=systemd:"))
+      cg_path = controllers + 1 + strlen("name=systemd:");
+  }
+
+  // Apps may create child cgroups under their scope, so look from the leaf
+  // up for the first component naming an application
+  char *id = NULL;
+  if (cg_path) {
+    const char *end = cg_path + strlen(cg_path);
+    while (!id && end > cg_path) {
+      const char *start = end;
+      while (start > cg_path && start[-1] != '/')
+        start--;
+      if (end > start)
+        id = app_id_from_unit(start, end - start, sandboxed);
+      end = start > cg_path ? start - 1 : cg_path;
+    }
+  }
+  g_strfreev(lines);
+  g_free(contents);
+
+  if (!id) {
+    id = flatpak_info_app_id(pid);
+    if (id)
+      *sandboxed = true;
+  }
+  if (id)
+    LOG_DEBUG("PID %d belongs to app %s%s", pid, id,
+              *sandboxed ? " (sandboxed)" : "");
+  return id;
+}
@@ -0,0 +1,296 @@
+#include "cheeter/log.h"
+#include "cheeter/proc.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <glib-unix.h>
+#include <glib.h>
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Seconds between /proc rescans when no event source is available
+#define PROC_RESCAN_INTERVAL 5
+
+typedef struct ProcNode ProcNode;
+
+struct ProcNode {
+  pid_t pid;
+  ProcNode *parent;
+  ProcNode *first_child;
+  ProcNode *prev_sibling;
+  ProcNode *next_sibling;
+};
+
+struct ProcTree {
+  GMutex lock;       // Events arrive on the main loop, readers may be workers
+  GHashTable *nodes; // pid -> ProcNode*
+  int sock;          // Netlink connector socket, -1 if not permitted
+  guint sock_watch;
+  guint rescan_source;
+  bool resync_pending;
+};
+
+// ---- Tree manipulation ----
+
+static ProcNode *node_get(GHashTable *nodes, pid_t pid) {
+  ProcNode *node = g_hash_table_lookup(nodes, GINT_TO_POINTER(pid));
+  if (!node) {
+    node = g_new0(ProcNode, 1);
+    node->pid = pid;
+    g_hash_table_insert(nodes, GINT_TO_POINTER(pid), node);
+  }
+  return node;
+}
+
+static void node_unlink(ProcNode *node) {
+  if (!node->parent)
+    return;
+  if (node->prev_sibling)
+    node->prev_sibling->next_sibling = node->next_sibling;
+  else
+    node->parent->first_child = node->next_sibling;
+  if (node->next_sibling)
+    node->next_sibling->prev_sibling = node->prev_sibling;
+  node->parent = NULL;
+  node->prev_sibling = NULL;
+  node->next_sibling = NULL;
+}
+
+static void node_set_parent(GHashTable *nodes, ProcNode *node, pid_t ppid) {
+  node_unlink(node);
+  if (ppid <= 0 || ppid == node->pid)
+    return;
+  ProcNode *parent = node_get(nodes, ppid);
+  node->parent = parent;
+  node->next_sibling = parent->first_child;
+  if (parent->first_child)
+    parent->first_child->prev_sibling = node;
+  parent->first_child = node;
+}
+
+static void node_remove(GHashTable *nodes, pid_t pid) {
+  ProcNode *node = g_hash_table_lookup(nodes, GINT_TO_POINTER(pid));
+  if (!node)
+    return;
+  // The kernel reparents orphans to a subreaper we get no event for. Nobody
+  // resolves from above them, so leave them detached until the next rescan.
+  while (node->first_child)
+    node_unlink(node->first_child);
+  node_unlink(node);
+  g_hash_table_remove(nodes, GINT_TO_POINTER(pid));
+}
+
+static GHashTable *nodes_new(void) {
+  return g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+}
+
+// Builds a fresh tree outside the lock and swaps it in, so readers never
+// wait on a full /proc pass
+static void proc_tree_rescan(ProcTree *tree) {
+  gint64 start = g_get_monotonic_time();
+
+  DIR *proc = cheeter_proc_opendir(cheeter_proc_get_root());
+  if (!proc) {
+    LOG_WARN("Could not open %s (errno: %d)", cheeter_proc_get_root(), errno);
+    return;
+  }
+  GHashTable *nodes = nodes_new();
+  struct dirent *ent;
+  while ((ent = readdir(proc))) {
+    if (!isdigit((unsigned char)*ent->d_name))
+      continue;
+    ProcStat st;
+    if (cheeter_proc_read_stat(atoi(ent->d_name), &st))
+      node_set_parent(nodes, node_get(nodes, st.pid), st.ppid);
+  }
+  closedir(proc);
+
+  g_mutex_lock(&tree->lock);
+  GHashTable *old = tree->nodes;
+  tree->nodes = nodes;
+  g_mutex_unlock(&tree->lock);
+  g_hash_table_destroy(old);
+
+  LOG_DEBUG("Process tree rescanned: %u processes in %.1f ms",
+            g_hash_table_size(nodes),
+            (g_get_monotonic_time() - start) / 1000.0);
+}
+
+// ---- Netlink proc connector ----
+
+static int connector_open(void) {
+  int sock = socket(PF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                    NETLINK_CONNECTOR);
+  if (sock < 0)
+    return -1;
+
+  struct sockaddr_nl addr = {0};
+  addr.nl_family = AF_NETLINK;
+  addr.nl_groups = CN_IDX_PROC;
+  // Joining the proc multicast group needs CAP_NET_ADMIN
+  if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    LOG_DEBUG("proc connector bind failed (errno: %d)", errno);
+    close(sock);
+    return -1;
+  }
+
+  struct __attribute__((aligned(NLMSG_ALIGNTO))) {
+    struct nlmsghdr hdr;
+    struct __attribute__((__packed__)) {
+      struct cn_msg msg;
+      enum proc_cn_mcast_op op;
+    } cn;
+  } req;
+  memset(&req, 0, sizeof(req));
+  req.hdr.nlmsg_len = sizeof(req);
+  req.hdr.nlmsg_type = NLMSG_DONE;
+  req.cn.msg.id.idx = CN_IDX_PROC;
+  req.cn.msg.id.val = CN_VAL_PROC;
+  req.cn.msg.len = sizeof(enum proc_cn_mcast_op);
+  req.cn.op = PROC_CN_MCAST_LISTEN;
+
+  if (send(sock, &req, sizeof(req), 0) < 0) {
+    LOG_DEBUG("proc connector subscribe failed (errno: %d)", errno);
+    close(sock);
+    return -1;
+  }
+  return sock;
+}
+
+static void handle_proc_event(ProcTree *tree, const struct proc_event *ev) {
+  switch (ev->what) {
+  case PROC_EVENT_FORK:
+    // Threads share the tgid and don't form new processes
+    if (ev->event_data.fork.child_pid != ev->event_data.fork.child_tgid)
+      break;
+    node_set_parent(tree->nodes,
+                    node_get(tree->nodes, ev->event_data.fork.child_tgid),
+                    ev->event_data.fork.parent_tgid);
+    break;
+  case PROC_EVENT_EXIT:
+    if (ev->event_data.exit.process_pid != ev->event_data.exit.process_tgid)
+      break;
+    node_remove(tree->nodes, ev->event_data.exit.process_tgid);
+    break;
+  default:
+    break;
+  }
+}
+
+static gboolean on_resync_idle(gpointer user_data) {
+  ProcTree *tree = user_data;
+  tree->resync_pending = false;
+  proc_tree_rescan(tree);
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean on_connector_readable(gint fd, GIOCondition condition,
+                                      gpointer user_data) {
+  (void)condition;
+  ProcTree *tree = user_data;
+  char buf[8192] __attribute__((aligned(NLMSG_ALIGNTO)));
+
+  while (1) {
+    ssize_t len = recv(fd, buf, sizeof(buf), 0);
+    if (len < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == ENOBUFS && !tree->resync_pending) {
+        // Events were dropped under load; the tree can't be trusted until
+        // it is rebuilt from /proc.
+        LOG_DEBUG("proc connector overrun, scheduling rescan");
+        tree->resync_pending = true;
+        g_idle_add(on_resync_idle, tree);
+        continue;
+      }
+      break; // EAGAIN: drained
+    }
+    if (len == 0)
+      break;
+
+    for (struct nlmsghdr *hdr = (struct nlmsghdr *)buf; NLMSG_OK(hdr, len);
+         hdr = NLMSG_NEXT(hdr, len)) {
+      if (hdr->nlmsg_type == NLMSG_ERROR || hdr->nlmsg_type == NLMSG_NOOP)
+        continue;
+      struct cn_msg *msg = NLMSG_DATA(hdr);
+      if (msg->id.idx != CN_IDX_PROC || msg->id.val != CN_VAL_PROC)
+        continue;
+      g_mutex_lock(&tree->lock);
+      handle_proc_event(tree, (const struct proc_event *)msg->data);
+      g_mutex_unlock(&tree->lock);
+    }
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean on_rescan_timeout(gpointer user_data) {
+  proc_tree_rescan((ProcTree *)user_data);
+  return G_SOURCE_CONTINUE;
+}
+
+// ---- Public API ----
+
+ProcTree *cheeter_proc_tree_new(void) {
+  ProcTree *tree = g_new0(ProcTree, 1);
+  g_mutex_init(&tree->lock);
+  tree->nodes = nodes_new();
+
+  tree->sock = connector_open();
+  if (tree->sock >= 0) {
+    // Subscribe before the initial scan so nothing forked in between is
+    // missed.
+    tree->sock_watch =
+        g_unix_fd_add(tree->sock, G_IO_IN, on_connector_readable, tree);
+    proc_tree_rescan(tree);
+    LOG_INFO("Tracking processes via netlink proc connector");
+  } else if (!cheeter_proc_children_files_supported()) {
+    proc_tree_rescan(tree);
+    tree->rescan_source =
+        g_timeout_add_seconds(PROC_RESCAN_INTERVAL, on_rescan_timeout, tree);
+    LOG_INFO("proc connector not permitted, rescanning /proc every %ds",
+             PROC_RESCAN_INTERVAL);
+  } else {
+    // Per-task children files are bounded and always fresh; a periodically
+    // rescanned tree would be neither.
+    LOG_INFO("proc connector not permitted, using /proc children files");
+  }
+  return tree;
+}
+
+void cheeter_proc_tree_free(ProcTree *tree) {
+  if (!tree)
+    return;
+  if (tree->sock_watch)
+    g_source_remove(tree->sock_watch);
+  if (tree->rescan_source)
+    g_source_remove(tree->rescan_source);
+  g_idle_remove_by_data(tree);
+  if (tree->sock >= 0)
+    close(tree->sock);
+  g_hash_table_destroy(tree->nodes);
+  g_mutex_clear(&tree->lock);
+  g_free(tree);
+}
+
+bool cheeter_proc_tree_is_tracking(ProcTree *tree) {
+  return tree && (tree->sock >= 0 || tree->rescan_source);
+}
+
+GArray *cheeter_proc_tree_get_children(ProcTree *tree, pid_t pid) {
+  GArray *children = NULL;
+  g_mutex_lock(&tree->lock);
+  ProcNode *node = g_hash_table_lookup(tree->nodes, GINT_TO_POINTER(pid));
+  if (node) {
+    children = g_array_new(FALSE, FALSE, sizeof(pid_t));
+    for (ProcNode *child = node->first_child; child;
+         child = child->next_sibling)
+      g_array_append_val(children, child->pid);
+  }
+  g_mutex_unlock(&tree->lock);
+  return children;
+}
@@ -0,0 +1,133 @@
+#include "cheeter/log.h"
+#include "cheeter/proc.h"
+#include <fcntl.h>
+#include <glib.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static char *g_proc_root = NULL; // NULL means "/proc"
+static int g_children_supported = -1;
+
+static gint g_io_opens = 0;
+static gint g_io_reads = 0;
+static gint g_io_readlinks = 0;
+static gint g_io_opendirs = 0;
+
+void cheeter_proc_set_root(const char *root) {
+  g_free(g_proc_root);
+  g_proc_root = root ? g_strdup(root) : NULL;
+  g_children_supported = -1;
+}
+
+const char *cheeter_proc_get_root(void) {
+  return g_proc_root ? g_proc_root : "/proc";
+}
+
+int cheeter_proc_path(char *buf, size_t size, const char *fmt, ...) {
+  int n = snprintf(buf, size, "%s/", cheeter_proc_get_root());
+  if (n < 0 || (size_t)n >= size)
+    return n;
+  va_list args;
+  va_start(args, fmt);
+  int m = vsnprintf(buf + n, size - n, fmt, args);
+  va_end(args);
+  return m < 0 ? m : n + m;
+}
+
+static int proc_open(const char *path) {
+  g_atomic_int_inc(&g_io_opens);
+  return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+static ssize_t proc_read(int fd, char *buf, size_t size) {
+  g_atomic_int_inc(&g_io_reads);
+  return read(fd, buf, size);
+}
+
+ssize_t cheeter_proc_read_file(const char *path, char *buf, size_t size) {
+  int fd = proc_open(path);
+  if (fd < 0)
+    return -1;
+  ssize_t n = proc_read(fd, buf, size);
+  close(fd);
+  return n;
+}
+
+ssize_t cheeter_proc_read_file_full(const char *path, char *buf, size_t size) {
+  int fd = proc_open(path);
+  if (fd < 0)
+    return -1;
+  size_t total = 0;
+  while (total < size) {
+    ssize_t n = proc_read(fd, buf + total, size - total);
+    if (n <= 0)
+      break;
+    total += n;
+  }
+  close(fd);
+  return total;
+}
+
+char *cheeter_proc_read_contents(const char *path, gsize *len) {
+  int fd = proc_open(path);
+  if (fd < 0)
+    return NULL;
+  GString *out = g_string_sized_new(4096);
+  char buf[4096];
+  ssize_t n;
+  while ((n = proc_read(fd, buf, sizeof(buf))) > 0)
+    g_string_append_len(out, buf, n);
+  close(fd);
+  if (len)
+    *len = out->len;
+  return g_string_free(out, FALSE);
+}
+
+char *cheeter_proc_read_exe(pid_t pid) {
+  char path[PATH_MAX];
+  cheeter_proc_path(path, sizeof(path), "%d/exe", pid);
+  char exe_buf[1024];
+  g_atomic_int_inc(&g_io_readlinks);
+  ssize_t len = readlink(path, exe_buf, sizeof(exe_buf) - 1);
+  if (len == -1) {
+    LOG_WARN("readlink failed for %s", path);
+    return NULL;
+  }
+  exe_buf[len] = '\0';
+  return g_strdup(exe_buf);
+}
+
+DIR *cheeter_proc_opendir(const char *path) {
+  g_atomic_int_inc(&g_io_opendirs);
+  return opendir(path);
+}
+
+bool cheeter_proc_children_files_supported(void) {
+  if (g_children_supported < 0) {
+    // Readable by everyone, and pid 1 always exists
+    char path[PATH_MAX];
+    cheeter_proc_path(path, sizeof(path), "1/task/1/children");
+    g_children_supported = access(path, R_OK) == 0;
+    if (!g_children_supported)
+      LOG_INFO("Kernel has no /proc/<pid>/task/<tid>/children, falling back "
+               "to full /proc snapshots");
+  }
+  return g_children_supported;
+}
+
+void cheeter_proc_get_io_stats(ProcIoStats *out) {
+  out->opens = g_atomic_int_get(&g_io_opens);
+  out->reads = g_atomic_int_get(&g_io_reads);
+  out->readlinks = g_atomic_int_get(&g_io_readlinks);
+  out->opendirs = g_atomic_int_get(&g_io_opendirs);
+}
+
+void cheeter_proc_reset_io_stats(void) {
+  g_atomic_int_set(&g_io_opens, 0);
+  g_atomic_int_set(&g_io_reads, 0);
+  g_atomic_int_set(&g_io_readlinks, 0);
+  g_atomic_int_set(&g_io_opendirs, 0);
+}
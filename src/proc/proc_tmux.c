@@ -0,0 +1,400 @@
+#include "cheeter/log.h"
+#include "cheeter/proc.h"
+#include "cheeter/tmux.h"
+#include <gio/gio.h>
+#include <glib.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// Seconds before reattaching to a server whose connection failed or closed
+#define TMUX_RETRY_INTERVAL 10
+
+#define TMUX_LIST_CLIENTS "list-clients -F '#{client_pid} #{pane_pid}'\n"
+
+// What a command's %begin/%end block answers
+typedef enum { BLOCK_OTHER = 1, BLOCK_LIST_CLIENTS } TmuxBlock;
+
+typedef struct {
+  TmuxTracker *tracker;
+  char *socket_path;
+  GSubprocess *proc;
+  GOutputStream *in; // Owned by proc
+  GDataInputStream *out;
+  GCancellable *cancellable;
+  GHashTable *clients; // client pid -> pane pid, guarded by tracker->lock
+  GHashTable *rows;    // list-clients block being read
+  bool in_block;
+  GQueue *blocks;      // TmuxBlock per command not yet answered, in order
+  bool refresh_wanted; // A lookup missed; guarded by tracker->lock
+  guint refresh_source;
+} TmuxConnection;
+
+struct TmuxTracker {
+  GMutex lock;             // Guards the fields below and each conn->clients
+  GHashTable *connections; // socket path -> TmuxConnection*
+  GHashTable *retry_after; // socket path -> monotonic time (gint64*)
+  GPtrArray *to_start;     // Socket paths waiting for the main loop
+  guint idle_source;       // Runs to_start and refresh_wanted
+};
+
+static void tmux_read_next(TmuxConnection *conn);
+
+// ---- Finding the server ----
+
+static char *read_cmdline(pid_t pid, gsize *len) {
+  char path[PATH_MAX];
+  cheeter_proc_path(path, sizeof(path), "%d/cmdline", pid);
+  return cheeter_proc_read_contents(path, len);
+}
+
+bool cheeter_tmux_is_client(pid_t pid) {
+  char *exe = cheeter_proc_read_exe(pid);
+  if (!exe)
+    return false;
+  char *base = g_path_get_basename(exe);
+  bool tmux = strcmp(base, "tmux") == 0;
+  g_free(base);
+  g_free(exe);
+  if (!tmux)
+    return false;
+
+  // The server is a tmux binary too, but never has a terminal's shell as
+  // its parent; callers only reach it through its proctitle
+  gsize cmd_len = 0;
+  char *cmdline = read_cmdline(pid, &cmd_len);
+  bool server = cmdline && g_str_has_prefix(cmdline, "tmux: server");
+  g_free(cmdline);
+  return !server;
+}
+
+// Server socket a tmux client talks to. tmux retitles its processes as
+// "tmux: client (<socket>)"; older versions leave argv alone, so fall back
+// to -S/-L and the default location.
+static char *tmux_client_socket(pid_t pid) {
+  gsize len = 0;
+  char *cmdline = read_cmdline(pid, &len);
+  if (!cmdline)
+    return NULL;
+
+  char *socket_path = NULL;
+  if (g_str_has_prefix(cmdline, "tmux: client (")) {
+    const char *start = cmdline + strlen("tmux: client (");
+    const char *end = strrchr(start, ')');
+    if (end)
+      socket_path = g_strndup(start, end - start);
+    g_free(cmdline);
+    return socket_path;
+  }
+
+  // argv is NUL separated; options come before the command
+  GPtrArray *argv = g_ptr_array_new();
+  for (gsize pos = 0; pos < len; pos += strlen(cmdline + pos) + 1)
+    g_ptr_array_add(argv, cmdline + pos);
+
+  const char *label = "default";
+  for (guint i = 1; i < argv->len; i++) {
+    const char *arg = g_ptr_array_index(argv, i);
+    if (arg[0] != '-')
+      break;
+    if (arg[1] != 'S' && arg[1] != 'L')
+      continue;
+    const char *value = arg[2] ? arg + 2 : NULL;
+    if (!value && i + 1 < argv->len)
+      value = g_ptr_array_index(argv, ++i);
+    if (!value)
+      break;
+    if (arg[1] == 'S') {
+      g_free(socket_path);
+      socket_path = g_strdup(value);
+    } else {
+      label = value;
+    }
+  }
+
+  // Assumes the client shares our TMUX_TMPDIR
+  if (!socket_path) {
+    const char *tmpdir = g_getenv("TMUX_TMPDIR");
+    socket_path = g_strdup_printf("%s/tmux-%u/%s",
+                                  tmpdir && *tmpdir ? tmpdir : "/tmp",
+                                  (unsigned)getuid(), label);
+  }
+  g_ptr_array_unref(argv);
+  g_free(cmdline);
+  return socket_path;
+}
+
+// ---- Control-mode connection ----
+
+static void tmux_send(TmuxConnection *conn, const char *command) {
+  GError *error = NULL;
+  if (!g_output_stream_write_all(conn->in, command, strlen(command), NULL,
+                                 conn->cancellable, &error)) {
+    LOG_DEBUG("tmux control write failed: %s", error->message);
+    g_error_free(error);
+    return;
+  }
+  TmuxBlock block = strcmp(command, TMUX_LIST_CLIENTS) == 0
+                        ? BLOCK_LIST_CLIENTS
+                        : BLOCK_OTHER;
+  g_queue_push_tail(conn->blocks, GINT_TO_POINTER(block));
+}
+
+static gboolean on_refresh_idle(gpointer user_data) {
+  TmuxConnection *conn = user_data;
+  conn->refresh_source = 0;
+  tmux_send(conn, TMUX_LIST_CLIENTS);
+  return G_SOURCE_REMOVE;
+}
+
+// Coalesces a burst of notifications into one list-clients
+static void tmux_queue_refresh(TmuxConnection *conn) {
+  if (!conn->refresh_source)
+    conn->refresh_source = g_idle_add(on_refresh_idle, conn);
+}
+
+static void tmux_connection_free(TmuxConnection *conn) {
+  if (conn->refresh_source)
+    g_source_remove(conn->refresh_source);
+  g_cancellable_cancel(conn->cancellable);
+  g_subprocess_force_exit(conn->proc);
+  g_object_unref(conn->out);
+  g_object_unref(conn->proc);
+  g_object_unref(conn->cancellable);
+  g_hash_table_destroy(conn->clients);
+  g_hash_table_destroy(conn->rows);
+  g_queue_free(conn->blocks);
+  g_free(conn->socket_path);
+  g_free(conn);
+}
+
+static void tmux_set_retry(TmuxTracker *tracker, const char *socket_path) {
+  gint64 *when = g_new(gint64, 1);
+  *when = g_get_monotonic_time() + TMUX_RETRY_INTERVAL * G_USEC_PER_SEC;
+  g_hash_table_replace(tracker->retry_after, g_strdup(socket_path), when);
+}
+
+// Called on EOF: the server exited or refused us
+static void tmux_connection_drop(TmuxConnection *conn) {
+  TmuxTracker *tracker = conn->tracker;
+  LOG_DEBUG("tmux control connection to %s closed", conn->socket_path);
+  g_mutex_lock(&tracker->lock);
+  tmux_set_retry(tracker, conn->socket_path);
+  g_hash_table_steal(tracker->connections, conn->socket_path);
+  g_mutex_unlock(&tracker->lock);
+  tmux_connection_free(conn);
+}
+
+static void tmux_handle_line(TmuxConnection *conn, const char *line) {
+  // Command output arrives between %begin and %end/%error, one block per
+  // command in the order sent. A list-clients block replaces the client map
+  // even when empty: the last client has detached.
+  if (g_str_has_prefix(line, "%begin")) {
+    conn->in_block = true;
+    g_hash_table_remove_all(conn->rows);
+    return;
+  }
+  if (g_str_has_prefix(line, "%end") || g_str_has_prefix(line, "%error")) {
+    TmuxBlock block = GPOINTER_TO_INT(g_queue_pop_head(conn->blocks));
+    if (g_str_has_prefix(line, "%end") && block == BLOCK_LIST_CLIENTS) {
+      g_mutex_lock(&conn->tracker->lock);
+      GHashTable *old = conn->clients;
+      conn->clients = conn->rows;
+      conn->rows = old;
+      g_mutex_unlock(&conn->tracker->lock);
+    }
+    conn->in_block = false;
+    g_hash_table_remove_all(conn->rows);
+    return;
+  }
+  if (conn->in_block) {
+    int client_pid, pane_pid;
+    if (sscanf(line, "%d %d", &client_pid, &pane_pid) == 2)
+      g_hash_table_insert(conn->rows, GINT_TO_POINTER(client_pid),
+                          GINT_TO_POINTER(pane_pid));
+    return;
+  }
+
+  // Anything that can change which pane a client shows
+  static const char *const triggers[] = {
+      "%window-pane-changed",  "%session-window-changed",
+      "%client-session-changed", "%session-changed",
+      "%sessions-changed",     "%window-close",
+      "%unlinked-window-close", "%client-detached",
+      NULL};
+  for (const char *const *t = triggers; *t; t++) {
+    if (g_str_has_prefix(line, *t)) {
+      tmux_queue_refresh(conn);
+      return;
+    }
+  }
+}
+
+static void on_tmux_line(GObject *source_object, GAsyncResult *res,
+                         gpointer user_data) {
+  GError *error = NULL;
+  char *line = g_data_input_stream_read_line_finish(
+      G_DATA_INPUT_STREAM(source_object), res, NULL, &error);
+  if (!line) {
+    // Cancelled means the connection was already freed
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+      g_error_free(error);
+      return;
+    }
+    g_clear_error(&error);
+    tmux_connection_drop((TmuxConnection *)user_data);
+    return;
+  }
+
+  TmuxConnection *conn = user_data;
+  tmux_handle_line(conn, line);
+  g_free(line);
+  tmux_read_next(conn);
+}
+
+static void tmux_read_next(TmuxConnection *conn) {
+  g_data_input_stream_read_line_async(conn->out, G_PRIORITY_DEFAULT,
+                                      conn->cancellable, on_tmux_line, conn);
+}
+
+static void tmux_connection_start(TmuxTracker *tracker,
+                                  const char *socket_path) {
+  GError *error = NULL;
+  GSubprocess *proc = g_subprocess_new(
+      G_SUBPROCESS_FLAGS_STDIN_PIPE | G_SUBPROCESS_FLAGS_STDOUT_PIPE |
+          G_SUBPROCESS_FLAGS_STDERR_SILENCE,
+      &error, "tmux", "-S", socket_path, "-C", "attach-session", NULL);
+  if (!proc) {
+    LOG_WARN("Could not start tmux control client: %s", error->message);
+    g_error_free(error);
+    g_mutex_lock(&tracker->lock);
+    tmux_set_retry(tracker, socket_path);
+    g_mutex_unlock(&tracker->lock);
+    return;
+  }
+
+  TmuxConnection *conn = g_new0(TmuxConnection, 1);
+  conn->tracker = tracker;
+  conn->socket_path = g_strdup(socket_path);
+  conn->proc = proc;
+  conn->in = g_subprocess_get_stdin_pipe(proc);
+  conn->out = g_data_input_stream_new(g_subprocess_get_stdout_pipe(proc));
+  conn->cancellable = g_cancellable_new();
+  conn->clients = g_hash_table_new(g_direct_hash, g_direct_equal);
+  conn->rows = g_hash_table_new(g_direct_hash, g_direct_equal);
+  conn->blocks = g_queue_new();
+  // The attach-session on the command line is answered with a block too
+  g_queue_push_tail(conn->blocks, GINT_TO_POINTER(BLOCK_OTHER));
+
+  g_mutex_lock(&tracker->lock);
+  g_hash_table_insert(tracker->connections, conn->socket_path, conn);
+  g_mutex_unlock(&tracker->lock);
+
+  // Pane output would otherwise be streamed to us; a control client must not
+  // resize the user's windows either. Older tmux rejects the flags, harmlessly.
+  tmux_send(conn, "refresh-client -f no-output,read-only,ignore-size\n");
+  tmux_send(conn, TMUX_LIST_CLIENTS);
+  tmux_read_next(conn);
+  LOG_INFO("Following tmux server %s in control mode", socket_path);
+}
+
+// Lookups run on worker threads; anything touching a connection is handed
+// to the main loop through here
+static gboolean on_tracker_idle(gpointer user_data) {
+  TmuxTracker *tracker = user_data;
+  g_mutex_lock(&tracker->lock);
+  tracker->idle_source = 0;
+  GPtrArray *to_start = tracker->to_start;
+  tracker->to_start = g_ptr_array_new_with_free_func(g_free);
+
+  GHashTableIter iter;
+  gpointer value;
+  g_hash_table_iter_init(&iter, tracker->connections);
+  while (g_hash_table_iter_next(&iter, NULL, &value)) {
+    TmuxConnection *conn = value;
+    if (conn->refresh_wanted) {
+      conn->refresh_wanted = false;
+      tmux_queue_refresh(conn);
+    }
+  }
+  g_mutex_unlock(&tracker->lock);
+
+  for (guint i = 0; i < to_start->len; i++)
+    tmux_connection_start(tracker, g_ptr_array_index(to_start, i));
+  g_ptr_array_unref(to_start);
+  return G_SOURCE_REMOVE;
+}
+
+// Caller holds tracker->lock
+static void tmux_tracker_wake(TmuxTracker *tracker) {
+  if (!tracker->idle_source)
+    tracker->idle_source = g_idle_add(on_tracker_idle, tracker);
+}
+
+// ---- Public API ----
+
+TmuxTracker *cheeter_tmux_tracker_new(void) {
+  TmuxTracker *tracker = g_new0(TmuxTracker, 1);
+  g_mutex_init(&tracker->lock);
+  tracker->connections = g_hash_table_new(g_str_hash, g_str_equal);
+  tracker->retry_after =
+      g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  tracker->to_start = g_ptr_array_new_with_free_func(g_free);
+  return tracker;
+}
+
+void cheeter_tmux_tracker_free(TmuxTracker *tracker) {
+  if (!tracker)
+    return;
+  if (tracker->idle_source)
+    g_source_remove(tracker->idle_source);
+
+  GHashTableIter iter;
+  gpointer value;
+  g_hash_table_iter_init(&iter, tracker->connections);
+  while (g_hash_table_iter_next(&iter, NULL, &value))
+    tmux_connection_free(value);
+  g_hash_table_destroy(tracker->connections);
+  g_hash_table_destroy(tracker->retry_after);
+  g_ptr_array_unref(tracker->to_start);
+  g_mutex_clear(&tracker->lock);
+  g_free(tracker);
+}
+
+pid_t cheeter_tmux_tracker_active_pane(TmuxTracker *tracker,
+                                       pid_t client_pid) {
+  char *socket_path = tmux_client_socket(client_pid);
+  if (!socket_path)
+    return 0;
+
+  pid_t pane = 0;
+  g_mutex_lock(&tracker->lock);
+  TmuxConnection *conn = g_hash_table_lookup(tracker->connections, socket_path);
+  if (conn) {
+    pane = GPOINTER_TO_INT(
+        g_hash_table_lookup(conn->clients, GINT_TO_POINTER(client_pid)));
+    // Attaching a new client sends no notification, so the first lookup
+    // for it asks for the list again
+    if (!pane) {
+      conn->refresh_wanted = true;
+      tmux_tracker_wake(tracker);
+    }
+  } else {
+    gint64 *retry = g_hash_table_lookup(tracker->retry_after, socket_path);
+    bool queued = false;
+    for (guint i = 0; i < tracker->to_start->len; i++)
+      queued |= strcmp(g_ptr_array_index(tracker->to_start, i),
+                       socket_path) == 0;
+    if (!queued && (!retry || g_get_monotonic_time() >= *retry)) {
+      g_ptr_array_add(tracker->to_start, g_strdup(socket_path));
+      tmux_tracker_wake(tracker);
+    }
+  }
+  g_mutex_unlock(&tracker->lock);
+
+  if (pane)
+    LOG_DEBUG("tmux client %d shows pane %d", client_pid, pane);
+  g_free(socket_path);
+  return pane;
+}
@@ -0,0 +1,348 @@
+#include "cheeter/log.h"
+#include "cheeter/proc.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <glib.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Guard against ppid cycles in a racy snapshot
+#define MAX_TREE_DEPTH 64
+// Flush the environ cache once it holds this many processes
+#define ENVIRON_CACHE_MAX 4096
+// WINDOWID is set by the terminal before exec, so it sits near the start of
+// environ. Don't read arbitrarily large environments looking for it.
+#define ENVIRON_READ_MAX (64 * 1024)
+
+typedef struct {
+  pid_t pid;
+  unsigned long long starttime;
+  unsigned long window_id; // Value of WINDOWID, 0 if unset or unreadable
+} EnvironCacheEntry;
+
+struct ProcResolver {
+  GHashTable *environ_cache; // EnvironCacheEntry* (key == value)
+  ProcTree *tree;            // Not owned
+};
+
+// ---- procfs helpers ----
+
+bool cheeter_proc_read_stat(pid_t pid, ProcStat *out) {
+  char path[PATH_MAX];
+  cheeter_proc_path(path, sizeof(path), "%d/stat", pid);
+
+  char buf[1024];
+  ssize_t n = cheeter_proc_read_file(path, buf, sizeof(buf) - 1);
+  if (n <= 0)
+    return false;
+  buf[n] = '\0';
+
+  // comm may contain spaces and parens, so fields resume after the last ')'
+  char *rparen = strrchr(buf, ')');
+  if (!rparen || rparen[1] == '\0')
+    return false;
+
+  ProcStat st = {0};
+  char state;
+  st.pid = pid;
+  // state ppid pgrp session tty_nr tpgid, 13 fields we skip, starttime
+  if (sscanf(rparen + 2,
+             "%c %d %d %*s %d %d %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s "
+             "%*s %*s %*s %llu",
+             &state, &st.ppid, &st.pgrp, &st.tty_nr, &st.tpgid,
+             &st.starttime) != 6)
+    return false;
+
+  *out = st;
+  return true;
+}
+
+// Appends the pids in a space separated children file. A number cut off by
+// a full buffer is dropped rather than misread.
+static void parse_children(const char *buf, size_t len, GArray *out) {
+  size_t pos = 0;
+  while (pos < len) {
+    while (pos < len && !isdigit((unsigned char)buf[pos]))
+      pos++;
+    size_t start = pos;
+    pid_t pid = 0;
+    while (pos < len && isdigit((unsigned char)buf[pos]))
+      pid = pid * 10 + (buf[pos++] - '0');
+    if (pos > start && pos < len)
+      g_array_append_val(out, pid);
+  }
+}
+
+GArray *cheeter_proc_list_children(pid_t pid) {
+  if (!cheeter_proc_children_files_supported())
+    return NULL;
+
+  // Children are listed under the thread that forked them, so a
+  // multi-threaded terminal needs every task checked.
+  char path[PATH_MAX];
+  cheeter_proc_path(path, sizeof(path), "%d/task", pid);
+  DIR *tasks = cheeter_proc_opendir(path);
+  if (!tasks)
+    return NULL;
+
+  GArray *children = g_array_new(FALSE, FALSE, sizeof(pid_t));
+  struct dirent *ent;
+  while ((ent = readdir(tasks))) {
+    if (!isdigit((unsigned char)*ent->d_name))
+      continue;
+    char children_path[PATH_MAX];
+    cheeter_proc_path(children_path, sizeof(children_path),
+                      "%d/task/%s/children", pid, ent->d_name);
+    char buf[8192];
+    ssize_t n = cheeter_proc_read_file_full(children_path, buf, sizeof(buf));
+    if (n > 0)
+      parse_children(buf, n, children);
+  }
+  closedir(tasks);
+  return children;
+}
+
+// One pass over /proc building ppid -> children, for kernels without
+// children files. Built at most once per resolution.
+static GHashTable *build_children_snapshot(void) {
+  GHashTable *by_ppid = g_hash_table_new_full(
+      g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)g_array_unref);
+
+  DIR *proc = cheeter_proc_opendir(cheeter_proc_get_root());
+  if (!proc) {
+    LOG_WARN("Could not open %s (errno: %d)", cheeter_proc_get_root(), errno);
+    return by_ppid;
+  }
+
+  struct dirent *ent;
+  while ((ent = readdir(proc))) {
+    if (!isdigit((unsigned char)*ent->d_name))
+      continue;
+    ProcStat st;
+    if (!cheeter_proc_read_stat(atoi(ent->d_name), &st))
+      continue;
+    GArray *children =
+        g_hash_table_lookup(by_ppid, GINT_TO_POINTER(st.ppid));
+    if (!children) {
+      children = g_array_new(FALSE, FALSE, sizeof(pid_t));
+      g_hash_table_insert(by_ppid, GINT_TO_POINTER(st.ppid), children);
+    }
+    g_array_append_val(children, st.pid);
+  }
+  closedir(proc);
+  return by_ppid;
+}
+
+// Returns a reference the caller must g_array_unref(), or NULL
+static GArray *children_of(ProcResolver *resolver, pid_t pid,
+                           GHashTable **snapshot) {
+  if (cheeter_proc_tree_is_tracking(resolver->tree)) {
+    GArray *children = cheeter_proc_tree_get_children(resolver->tree, pid);
+    if (children)
+      return children;
+    // Not in the tree yet (event still queued); ask the kernel
+  }
+
+  if (cheeter_proc_children_files_supported())
+    return cheeter_proc_list_children(pid);
+
+  if (!*snapshot)
+    *snapshot = build_children_snapshot();
+  GArray *children = g_hash_table_lookup(*snapshot, GINT_TO_POINTER(pid));
+  return children ? g_array_ref(children) : NULL;
+}
+
+// ---- WINDOWID matching ----
+
+static unsigned long read_environ_window_id(pid_t pid) {
+  char path[PATH_MAX];
+  cheeter_proc_path(path, sizeof(path), "%d/environ", pid);
+
+  char *buf = g_malloc(ENVIRON_READ_MAX);
+  ssize_t bytes = cheeter_proc_read_file_full(path, buf, ENVIRON_READ_MAX);
+  unsigned long window_id = 0;
+
+  // Entries are "VAR=VAL\0VAR=VAL\0..."
+  static const char needle[] = "WINDOWID=";
+  ssize_t pos = 0;
+  while (pos < bytes) {
+    const char *entry = buf + pos;
+    size_t len = strnlen(entry, bytes - pos);
+    if (len > sizeof(needle) - 1 && pos + (ssize_t)len < bytes &&
+        strncmp(entry, needle, sizeof(needle) - 1) == 0) {
+      window_id = strtoul(entry + sizeof(needle) - 1, NULL, 10);
+      break;
+    }
+    pos += len + 1;
+  }
+
+  g_free(buf);
+  return window_id;
+}
+
+static guint environ_entry_hash(gconstpointer key) {
+  const EnvironCacheEntry *e = key;
+  return (guint)e->pid ^ (guint)(e->starttime * 2654435761u);
+}
+
+static gboolean environ_entry_equal(gconstpointer a, gconstpointer b) {
+  const EnvironCacheEntry *ea = a, *eb = b;
+  return ea->pid == eb->pid && ea->starttime == eb->starttime;
+}
+
+// WINDOWID of pid. environ is fixed once the process is running, so the
+// answer is cached for the lifetime of (pid, starttime).
+static unsigned long environ_window_id(ProcResolver *resolver, pid_t pid) {
+  ProcStat st;
+  if (!cheeter_proc_read_stat(pid, &st))
+    return 0;
+
+  EnvironCacheEntry key = {pid, st.starttime, 0};
+  EnvironCacheEntry *entry = g_hash_table_lookup(resolver->environ_cache, &key);
+  if (entry)
+    return entry->window_id;
+
+  // Entries for dead processes are never looked up again; drop them all
+  // rather than tracking liveness.
+  if (g_hash_table_size(resolver->environ_cache) >= ENVIRON_CACHE_MAX)
+    g_hash_table_remove_all(resolver->environ_cache);
+
+  entry = g_new(EnvironCacheEntry, 1);
+  *entry = key;
+  entry->window_id = read_environ_window_id(pid);
+  g_hash_table_add(resolver->environ_cache, entry);
+  return entry->window_id;
+}
+
+// ---- Controlling terminal ----
+
+static bool is_descendant(pid_t pid, pid_t ancestor) {
+  for (int depth = 0; depth < MAX_TREE_DEPTH && pid > 1; depth++) {
+    ProcStat st;
+    if (!cheeter_proc_read_stat(pid, &st))
+      return false;
+    if (st.ppid == ancestor)
+      return true;
+    pid = st.ppid;
+  }
+  return false;
+}
+
+// The leader must run inside pid: a GUI app started from a shell shares the
+// shell's terminal, but the job in front of that shell has nothing to do
+// with the app.
+pid_t cheeter_proc_foreground_job(pid_t pid, pid_t *fg_pgrp) {
+  ProcStat st;
+  if (!cheeter_proc_read_stat(pid, &st) || st.tty_nr == 0 || st.tpgid <= 0)
+    return 0;
+  if (st.tpgid == st.pgrp) {
+    if (fg_pgrp)
+      *fg_pgrp = st.tpgid;
+    return pid;
+  }
+
+  ProcStat leader;
+  if (!cheeter_proc_read_stat(st.tpgid, &leader) ||
+      leader.pgrp != st.tpgid || leader.tty_nr != st.tty_nr ||
+      !is_descendant(st.tpgid, pid))
+    return 0;
+  if (fg_pgrp)
+    *fg_pgrp = st.tpgid;
+  return st.tpgid;
+}
+
+static bool in_pgrp(pid_t pid, pid_t pgrp) {
+  ProcStat st;
+  return cheeter_proc_read_stat(pid, &st) && st.pgrp == pgrp;
+}
+
+// ---- Resolver ----
+
+ProcResolver *cheeter_proc_resolver_new(void) {
+  ProcResolver *resolver = g_new0(ProcResolver, 1);
+  resolver->environ_cache = g_hash_table_new_full(
+      environ_entry_hash, environ_entry_equal, g_free, NULL);
+  return resolver;
+}
+
+void cheeter_proc_resolver_set_tree(ProcResolver *resolver, ProcTree *tree) {
+  resolver->tree = tree;
+}
+
+void cheeter_proc_resolver_free(ProcResolver *resolver) {
+  if (!resolver)
+    return;
+  g_hash_table_destroy(resolver->environ_cache);
+  g_free(resolver);
+}
+
+pid_t cheeter_proc_resolver_deepest_child(ProcResolver *resolver,
+                                          pid_t start_pid,
+                                          unsigned long window_id) {
+  GHashTable *snapshot = NULL;
+  pid_t self = getpid();
+  pid_t current_pid = start_pid;
+  // Set once we find a child claiming the window; from then on we only
+  // descend that branch.
+  bool branch_locked = false;
+  // Set once the walk reaches a terminal; from then on only its foreground
+  // job is followed, never background jobs.
+  pid_t fg_pgrp = 0;
+
+  for (int depth = 0; depth < MAX_TREE_DEPTH; depth++) {
+    GArray *children = children_of(resolver, current_pid, &snapshot);
+    if (!children)
+      break;
+
+    pid_t found_child = 0;
+    for (guint i = 0; i < children->len; i++) {
+      pid_t pid = g_array_index(children, pid_t, i);
+      if (pid == self)
+        continue;
+
+      if (fg_pgrp) {
+        if (in_pgrp(pid, fg_pgrp)) {
+          found_child = pid;
+          break;
+        }
+        continue;
+      }
+
+      if (!branch_locked && window_id != 0 &&
+          environ_window_id(resolver, pid) == window_id) {
+        LOG_DEBUG("Child %d matches WINDOWID %lu", pid, window_id);
+        found_child = pid;
+        branch_locked = true;
+        break;
+      }
+
+      if (!found_child)
+        found_child = pid;
+      // Without a window to match, the first child is as good as any
+      if (branch_locked || window_id == 0)
+        break;
+    }
+    g_array_unref(children);
+
+    if (!found_child)
+      break;
+    current_pid = found_child;
+
+    if (!fg_pgrp) {
+      pid_t leader = cheeter_proc_foreground_job(current_pid, &fg_pgrp);
+      if (leader && leader != current_pid) {
+        LOG_DEBUG("PID %d is on a terminal, foreground job is %d", current_pid,
+                  leader);
+        current_pid = leader;
+      }
+    }
+  }
+
+  if (snapshot)
+    g_hash_table_destroy(snapshot);
+  return (current_pid == start_pid) ? 0 : current_pid;
+}
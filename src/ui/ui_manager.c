@@ -1,3 +1,4 @@
+#include "cheeter/bundle.h"
 #include "cheeter/log.h"
 #include "cheeter/ui.h"
 #include <gtk/gtk.h>
@@ -5,6 +6,7 @@
 static GtkWidget *g_window = NULL;
 static GtkWidget *g_viewer = NULL;
 static double g_zoom_level = 1.0;
+static char *g_sheet_path = NULL; // Sheet last shown
 
 void cheeter_ui_set_zoom_level(double zoom) {
   if (zoom > 0.1)
@@ -70,95 +72,153 @@ static void ensure_window(void) {
   gtk_widget_realize(g_window);
 }
 
+gboolean cheeter_ui_is_visible(void) {
+  return g_window && gtk_widget_get_visible(g_window);
+}
+
+void cheeter_ui_hide(void) {
+  if (!cheeter_ui_is_visible())
+    return;
+  gtk_widget_hide(g_window);
+  LOG_INFO("UI Hidden");
+}
+
+void cheeter_ui_sheet_changed(const char *sheet_path) {
+  if (!cheeter_ui_is_visible() || g_strcmp0(sheet_path, g_sheet_path) != 0)
+    return;
+  // A sheet deleted from under us stays up until hidden
+  SheetBundle *bundle;
+  guint index;
+  if (cheeter_bundle_lookup(sheet_path, &bundle, &index))
+    cheeter_bundle_unref(bundle);
+  else if (!g_file_test(sheet_path, G_FILE_TEST_IS_REGULAR))
+    return;
+  LOG_INFO("Sheet on screen changed, reloading: %s", sheet_path);
+  // Showing again sizes the window for the new content
+  char *path = g_strdup(sheet_path);
+  gtk_widget_hide(g_window);
+  cheeter_ui_show(path);
+  g_free(path);
+}
+
 void cheeter_ui_toggle(const char *sheet_path) {
-  ensure_window();
+  if (cheeter_ui_is_visible()) {
+    cheeter_ui_hide();
+  } else {
+    cheeter_ui_show(sheet_path);
+  }
+}
 
-  if (gtk_widget_get_visible(g_window)) {
-    // Hide
-    gtk_widget_hide(g_window);
-    LOG_INFO("UI Hidden");
+// Sizes, places and maps the window for a first page of page_w x page_h,
+// and sets the viewer's scale to match
+static void present_window(const char *sheet_path, double page_w,
+                           double page_h) {
+  // Get monitor dimensions
+  GdkScreen *screen = gtk_window_get_screen(GTK_WINDOW(g_window));
+  GdkDisplay *display = gdk_screen_get_display(screen);
+  GdkMonitor *monitor = gdk_display_get_primary_monitor(display);
+  if (!monitor) {
+    monitor = gdk_display_get_monitor(display, 0);
+  }
+
+  GdkRectangle monitor_rect;
+  gdk_monitor_get_geometry(monitor, &monitor_rect);
+  int mon_w = monitor_rect.width;
+  int mon_h = monitor_rect.height;
+
+  // PDF is in points (72 DPI). Scale up to display resolution.
+  double system_dpi = gdk_screen_get_resolution(screen);
+  if (system_dpi <= 0) {
+    system_dpi = 96.0; // Fallback if detecting DPI fails
+    LOG_WARN("Could not detect system DPI, falling back to %.1f", system_dpi);
   } else {
-    // Load the sheet first so we can get its dimensions
-    if (sheet_path) {
-      cheeter_viewer_load_file(g_viewer, sheet_path);
-    } else {
-      cheeter_viewer_load_file(g_viewer, NULL);
-    }
+    LOG_DEBUG("Detected system DPI: %.1f", system_dpi);
+  }
 
-    // Get monitor dimensions
-    GdkScreen *screen = gtk_window_get_screen(GTK_WINDOW(g_window));
-    GdkDisplay *display = gdk_screen_get_display(screen);
-    GdkMonitor *monitor = gdk_display_get_primary_monitor(display);
-    if (!monitor) {
-      monitor = gdk_display_get_monitor(display, 0);
-    }
+  // Base scale: convert 72 DPI points to system DPI pixels
+  // Note: gdk_screen_get_resolution typically includes the scaling factor
+  // logic for fonts but for physical pixel mapping on some backends (Wayland
+  // vs X11) it might vary. Generally: scale = system_dpi / 72.0
+  double dpi_scale = system_dpi / 72.0;
 
-    GdkRectangle monitor_rect;
-    gdk_monitor_get_geometry(monitor, &monitor_rect);
-    int mon_w = monitor_rect.width;
-    int mon_h = monitor_rect.height;
+  // Apply user zoom preference
+  dpi_scale *= g_zoom_level;
 
-    // Get PDF page dimensions (in points, 72 points/inch)
-    double page_w = 800, page_h = 600; // Default fallback
-    if (cheeter_viewer_get_page_size(g_viewer, &page_w, &page_h)) {
-      LOG_DEBUG("PDF page size (points): %.0f x %.0f", page_w, page_h);
-    }
+  double scaled_w = page_w * dpi_scale;
+  double scaled_h = page_h * dpi_scale;
 
-    // PDF is in points (72 DPI). Scale up to display resolution.
-    double system_dpi = gdk_screen_get_resolution(screen);
-    if (system_dpi <= 0) {
-      system_dpi = 96.0; // Fallback if detecting DPI fails
-      LOG_WARN("Could not detect system DPI, falling back to %.1f", system_dpi);
-    } else {
-      LOG_DEBUG("Detected system DPI: %.1f", system_dpi);
-    }
+  LOG_DEBUG(
+      "Scaled size: %.0f x %.0f (dpi_scale=%.2f, system_dpi=%.1f, zoom=%.2f)",
+      scaled_w, scaled_h, dpi_scale, system_dpi, g_zoom_level);
 
-    // Base scale: convert 72 DPI points to system DPI pixels
-    // Note: gdk_screen_get_resolution typically includes the scaling factor
-    // logic for fonts but for physical pixel mapping on some backends (Wayland
-    // vs X11) it might vary. Generally: scale = system_dpi / 72.0
-    double dpi_scale = system_dpi / 72.0;
+  // Cap at 90% of monitor if still too large
+  double max_w = mon_w * 0.9;
+  double max_h = mon_h * 0.9;
+  double final_scale = 1.0;
 
-    // Apply user zoom preference
-    dpi_scale *= g_zoom_level;
+  if (scaled_w > max_w || scaled_h > max_h) {
+    double scale_w = max_w / scaled_w;
+    double scale_h = max_h / scaled_h;
+    final_scale = (scale_w < scale_h) ? scale_w : scale_h;
+  }
 
-    double scaled_w = page_w * dpi_scale;
-    double scaled_h = page_h * dpi_scale;
+  int win_w = (int)(scaled_w * final_scale);
+  int win_h = (int)(scaled_h * final_scale);
 
-    LOG_DEBUG(
-        "Scaled size: %.0f x %.0f (dpi_scale=%.2f, system_dpi=%.1f, zoom=%.2f)",
-        scaled_w, scaled_h, dpi_scale, system_dpi, g_zoom_level);
+  // Tell the viewer what scale to use for rendering
+  double render_scale = dpi_scale * final_scale;
+  cheeter_viewer_set_scale(g_viewer, render_scale);
 
-    // Cap at 90% of monitor if still too large
-    double max_w = mon_w * 0.9;
-    double max_h = mon_h * 0.9;
-    double final_scale = 1.0;
+  // Center the window on the monitor
+  int win_x = monitor_rect.x + (mon_w - win_w) / 2;
+  int win_y = monitor_rect.y + (mon_h - win_h) / 2;
 
-    if (scaled_w > max_w || scaled_h > max_h) {
-      double scale_w = max_w / scaled_w;
-      double scale_h = max_h / scaled_h;
-      final_scale = (scale_w < scale_h) ? scale_w : scale_h;
-    }
+  gtk_window_resize(GTK_WINDOW(g_window), win_w, win_h);
+  gtk_window_move(GTK_WINDOW(g_window), win_x, win_y);
+
+  LOG_INFO("Window: %dx%d at (%d,%d), render_scale=%.2f", win_w, win_h, win_x,
+           win_y, render_scale);
+
+  gtk_widget_show_all(g_window);
+  gtk_window_present(GTK_WINDOW(g_window));
+  LOG_INFO("UI Shown: %s", sheet_path ? sheet_path : "(none)");
+}
+
+void cheeter_ui_show(const char *sheet_path) {
+  ensure_window();
 
-    int win_w = (int)(scaled_w * final_scale);
-    int win_h = (int)(scaled_h * final_scale);
+  if (!gtk_widget_get_visible(g_window)) {
+    g_free(g_sheet_path);
+    g_sheet_path = g_strdup(sheet_path);
 
-    // Tell the viewer what scale to use for rendering
-    double render_scale = dpi_scale * final_scale;
-    cheeter_viewer_set_scale(g_viewer, render_scale);
+    // Load the sheet first so we can get its dimensions
+    cheeter_viewer_load_file(g_viewer, sheet_path);
 
-    // Center the window on the monitor
-    int win_x = monitor_rect.x + (mon_w - win_w) / 2;
-    int win_y = monitor_rect.y + (mon_h - win_h) / 2;
+    // Get PDF page dimensions (in points, 72 points/inch)
+    double page_w = 800, page_h = 600; // Default fallback
+    if (cheeter_viewer_get_page_size(g_viewer, &page_w, &page_h)) {
+      LOG_DEBUG("PDF page size (points): %.0f x %.0f", page_w, page_h);
+    }
+    present_window(sheet_path, page_w, page_h);
+  }
+}
 
-    gtk_window_resize(GTK_WINDOW(g_window), win_w, win_h);
-    gtk_window_move(GTK_WINDOW(g_window), win_x, win_y);
+void cheeter_ui_show_sized(const char *sheet_path, double page_width,
+                           double page_height) {
+  if (!sheet_path || page_width <= 0 || page_height <= 0) {
+    cheeter_ui_show(sheet_path);
+    return;
+  }
+  ensure_window();
 
-    LOG_INFO("Window: %dx%d at (%d,%d), render_scale=%.2f", win_w, win_h, win_x,
-             win_y, render_scale);
+  if (!gtk_widget_get_visible(g_window)) {
+    g_free(g_sheet_path);
+    g_sheet_path = g_strdup(sheet_path);
 
-    gtk_widget_show_all(g_window);
-    gtk_window_present(GTK_WINDOW(g_window));
-    LOG_INFO("UI Shown: %s", sheet_path ? sheet_path : "(none)");
+    // The size came from the index, so parsing the sheet can overlap with
+    // mapping the window
+    LOG_DEBUG("Indexed page size: %.0f x %.0f", page_width, page_height);
+    cheeter_viewer_load_file_async(g_viewer, sheet_path);
+    present_window(sheet_path, page_width, page_height);
   }
 }
@@ -1,6 +1,8 @@
+#include "cheeter/bundle.h"
 #include "cheeter/log.h"
 #include "cheeter/ui.h"
 #include <gtk/gtk.h>
+#include <math.h>
 #include <poppler.h>
 
 // Simple viewer widget: A GtkScrolledWindow containing a GtkDrawingArea
@@ -14,12 +16,85 @@ typedef struct {
   double scale;
   int current_page;
   int n_pages;
+  GCancellable *loading; // Set while a load runs in the background
+  // The shown page or image rasterized once, at surface_scale and
+  // surface_factor (the monitor's scale factor), so draws only blit it
+  cairo_surface_t *surface;
+  double surface_scale;
+  int surface_factor;
 } ViewerData;
 
+// A sheet read from disk, ready to be shown
+typedef struct {
+  PopplerDocument *doc;
+  PopplerPage *page; // First page
+  GdkPixbuf *image;
+} LoadedSheet;
+
+// Largest raster kept, at 4 bytes a pixel: an A3 page fits up to 2x zoom on
+// a 2x display. Past it, draws render straight into their clip.
+#define SURFACE_MAX_BYTES (64 * 1024 * 1024)
+// Largest side cairo makes an image surface with
+#define SURFACE_MAX_SIDE 32767
+
+// Forgets the rasterized page, for when the page or its scale changes
+static void viewer_drop_surface(ViewerData *data) {
+  g_clear_pointer(&data->surface, cairo_surface_destroy);
+}
+
+static void content_size(ViewerData *data, double *w, double *h) {
+  if (data->image) {
+    *w = gdk_pixbuf_get_width(data->image);
+    *h = gdk_pixbuf_get_height(data->image);
+  } else {
+    poppler_page_get_size(data->page, w, h);
+  }
+}
+
+// Rasterizes the page or image at the current scale, in device pixels.
+// NULL if that would take more than SURFACE_MAX_BYTES.
+static cairo_surface_t *render_surface(ViewerData *data, int factor) {
+  double w, h;
+  content_size(data, &w, &h);
+  double device = data->scale * factor;
+  double width_px = ceil(w * device);
+  double height_px = ceil(h * device);
+  if (width_px < 1 || height_px < 1 || width_px > SURFACE_MAX_SIDE ||
+      height_px > SURFACE_MAX_SIDE ||
+      width_px * height_px * 4 > SURFACE_MAX_BYTES)
+    return NULL;
+  int width = (int)width_px;
+  int height = (int)height_px;
+
+  cairo_surface_t *surface =
+      cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
+  if (cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+    cairo_surface_destroy(surface);
+    return NULL;
+  }
+  cairo_t *cr = cairo_create(surface);
+  cairo_set_source_rgb(cr, 1, 1, 1);
+  cairo_paint(cr);
+  cairo_scale(cr, device, device);
+  if (data->image) {
+    gdk_cairo_set_source_pixbuf(cr, data->image, 0, 0);
+    cairo_paint(cr);
+  } else {
+    poppler_page_render(data->page, cr);
+  }
+  cairo_destroy(cr);
+  cairo_surface_set_device_scale(surface, factor, factor);
+  return surface;
+}
+
 static gboolean on_draw(GtkWidget *widget, cairo_t *cr, gpointer user_data) {
   ViewerData *data = (ViewerData *)user_data;
   if (!data->page && !data->image) {
-    // Draw nothing or placeholder
+    // Blank page while the sheet loads, so the window doesn't flash
+    if (data->loading) {
+      cairo_set_source_rgb(cr, 1, 1, 1);
+      cairo_paint(cr);
+    }
     return FALSE;
   }
 
@@ -30,9 +105,24 @@ static gboolean on_draw(GtkWidget *widget, cairo_t *cr, gpointer user_data) {
   cairo_rectangle(cr, 0, 0, alloc.width, alloc.height);
   cairo_fill(cr);
 
-  // Apply scale
-  cairo_scale(cr, data->scale, data->scale);
+  // Rasterized once per page and scale; scrolling only blits it
+  int factor = gtk_widget_get_scale_factor(widget);
+  if (data->surface && (data->surface_scale != data->scale ||
+                        data->surface_factor != factor))
+    viewer_drop_surface(data);
+  if (!data->surface) {
+    data->surface = render_surface(data, factor);
+    data->surface_scale = data->scale;
+    data->surface_factor = factor;
+  }
+  if (data->surface) {
+    cairo_set_source_surface(cr, data->surface, 0, 0);
+    cairo_paint(cr);
+    return FALSE;
+  }
 
+  // Too large to keep: render straight into the clip
+  cairo_scale(cr, data->scale, data->scale);
   if (data->image) {
     gdk_cairo_set_source_pixbuf(cr, data->image, 0, 0);
     cairo_paint(cr);
@@ -45,14 +135,91 @@ static gboolean on_draw(GtkWidget *widget, cairo_t *cr, gpointer user_data) {
 
 static void free_viewer_data(gpointer user_data) {
   ViewerData *data = (ViewerData *)user_data;
+  if (data->loading) {
+    g_cancellable_cancel(data->loading);
+    g_object_unref(data->loading);
+  }
   if (data->page)
     g_object_unref(data->page);
-  g_object_unref(data->doc);
+  if (data->doc)
+    g_object_unref(data->doc);
   if (data->image)
     g_object_unref(data->image);
+  viewer_drop_surface(data);
   g_free(data);
 }
 
+static void loaded_sheet_free(gpointer user_data) {
+  LoadedSheet *sheet = (LoadedSheet *)user_data;
+  if (sheet->page)
+    g_object_unref(sheet->page);
+  if (sheet->doc)
+    g_object_unref(sheet->doc);
+  if (sheet->image)
+    g_object_unref(sheet->image);
+  g_free(sheet);
+}
+
+// A sheet packed in a bundle, read straight from the bundle's mapping. The
+// document or image keeps the bytes, and with them the mapping, alive.
+static LoadedSheet *load_bundle_sheet(SheetBundle *bundle, guint i,
+                                      GError **error) {
+  LoadedSheet *sheet = g_new0(LoadedSheet, 1);
+  BundleSheet info;
+  cheeter_bundle_get_sheet(bundle, i, &info);
+  GBytes *bytes = cheeter_bundle_get_bytes(bundle, i);
+
+  if (g_str_has_suffix(info.name, ".pdf")) {
+    sheet->doc = poppler_document_new_from_bytes(bytes, NULL, error);
+  } else {
+    GInputStream *stream = g_memory_input_stream_new_from_bytes(bytes);
+    sheet->image = gdk_pixbuf_new_from_stream(stream, NULL, error);
+    g_object_unref(stream);
+  }
+  g_bytes_unref(bytes);
+
+  if (!sheet->doc && !sheet->image) {
+    loaded_sheet_free(sheet);
+    return NULL;
+  }
+  if (sheet->doc && poppler_document_get_n_pages(sheet->doc) > 0)
+    sheet->page = poppler_document_get_page(sheet->doc, 0);
+  return sheet;
+}
+
+// Reads the sheet at path as an image, or else as a PDF. Touches no
+// widgets, so it can run on a worker thread.
+static LoadedSheet *load_sheet(const char *path, GError **error) {
+  SheetBundle *bundle;
+  guint index;
+  if (cheeter_bundle_lookup(path, &bundle, &index)) {
+    LoadedSheet *sheet = load_bundle_sheet(bundle, index, error);
+    cheeter_bundle_unref(bundle);
+    return sheet;
+  }
+
+  LoadedSheet *sheet = g_new0(LoadedSheet, 1);
+  GError *image_error = NULL;
+
+  // Try loading as image first using gdk-pixbuf
+  sheet->image = gdk_pixbuf_new_from_file(path, &image_error);
+  if (sheet->image)
+    return sheet;
+  // Not an image (or failed): the PDF error is the one worth reporting
+  g_clear_error(&image_error);
+
+  char *uri = g_filename_to_uri(path, NULL, error);
+  sheet->doc = uri ? poppler_document_new_from_file(uri, NULL, error) : NULL;
+  g_free(uri);
+  if (!sheet->doc) {
+    loaded_sheet_free(sheet);
+    return NULL;
+  }
+  if (poppler_document_get_n_pages(sheet->doc) > 0)
+    sheet->page = poppler_document_get_page(sheet->doc, 0);
+  return sheet;
+}
+
 GtkWidget *cheeter_viewer_new(void) {
   GtkWidget *scroll = gtk_scrolled_window_new(NULL, NULL);
   gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scroll),
@@ -79,6 +246,7 @@ static void load_page(ViewerData *data, int page_index) {
   if (data->page) {
     g_object_unref(data->page);
   }
+  viewer_drop_surface(data);
 
   data->current_page = page_index;
   data->page = poppler_document_get_page(data->doc, page_index);
@@ -94,12 +262,12 @@ static void load_page(ViewerData *data, int page_index) {
   gtk_widget_queue_draw(data->drawing_area);
 }
 
-void cheeter_viewer_load_file(GtkWidget *viewer, const char *path) {
-  ViewerData *data =
-      (ViewerData *)g_object_get_data(G_OBJECT(viewer), "viewer-data");
-  if (!data)
-    return;
-
+// Drops whatever is loaded, and any load still running
+static void viewer_clear(ViewerData *data) {
+  if (data->loading) {
+    g_cancellable_cancel(data->loading);
+    g_clear_object(&data->loading);
+  }
   if (data->page) {
     g_object_unref(data->page);
     data->page = NULL;
@@ -112,19 +280,16 @@ void cheeter_viewer_load_file(GtkWidget *viewer, const char *path) {
     g_object_unref(data->image);
     data->image = NULL;
   }
+  viewer_drop_surface(data);
   data->current_page = 0;
   data->n_pages = 0;
+}
 
-  if (!path) {
-    gtk_widget_queue_draw(data->drawing_area);
-    return;
-  }
-
-  GError *error = NULL;
-
-  // Try loading as image first using gdk-pixbuf
-  data->image = gdk_pixbuf_new_from_file(path, &error);
-  if (data->image) {
+// Shows sheet, taking over its contents
+static void viewer_take(ViewerData *data, LoadedSheet *sheet,
+                        const char *path) {
+  if (sheet->image) {
+    data->image = g_steal_pointer(&sheet->image);
     LOG_INFO("Loaded image: %s", path);
     data->n_pages = 1;
 
@@ -137,32 +302,104 @@ void cheeter_viewer_load_file(GtkWidget *viewer, const char *path) {
     return;
   }
 
-  // If not an image (or failed), try PDF
-  if (error) {
-    // Clear error from image load attempt so we can reuse for PDF
-    // or maybe we just ignore it and trust PDF load to fail if it's not a PDF
-    // either. But strictly speaking, gdk_pixbuf might set error.
-    g_clear_error(&error);
+  data->doc = g_steal_pointer(&sheet->doc);
+  data->n_pages = poppler_document_get_n_pages(data->doc);
+  LOG_DEBUG("Loaded PDF with %d pages", data->n_pages);
+
+  // Page 0 was read along with the document
+  data->current_page = 0;
+  data->page = g_steal_pointer(&sheet->page);
+  if (data->page) {
+    double w, h;
+    poppler_page_get_size(data->page, &w, &h);
+    gtk_widget_set_size_request(data->drawing_area, (int)(w * data->scale),
+                                (int)(h * data->scale));
   }
+  gtk_widget_queue_draw(data->drawing_area);
+}
 
-  char *uri = g_filename_to_uri(path, NULL, NULL);
-  data->doc = poppler_document_new_from_file(uri, NULL, &error);
-  g_free(uri);
+void cheeter_viewer_load_file(GtkWidget *viewer, const char *path) {
+  ViewerData *data =
+      (ViewerData *)g_object_get_data(G_OBJECT(viewer), "viewer-data");
+  if (!data)
+    return;
 
-  if (!data->doc) {
+  viewer_clear(data);
+  if (!path) {
+    gtk_widget_queue_draw(data->drawing_area);
+    return;
+  }
+
+  GError *error = NULL;
+  LoadedSheet *sheet = load_sheet(path, &error);
+  if (!sheet) {
     LOG_WARN("Failed to load as Image or PDF %s: %s", path,
              error ? error->message : "unknown");
-    if (error)
-      g_error_free(error);
+    g_clear_error(&error);
     gtk_widget_queue_draw(data->drawing_area);
     return;
   }
+  viewer_take(data, sheet, path);
+  loaded_sheet_free(sheet);
+}
 
-  data->n_pages = poppler_document_get_n_pages(data->doc);
-  LOG_DEBUG("Loaded PDF with %d pages", data->n_pages);
+static void load_thread(GTask *task, gpointer source_object,
+                        gpointer task_data, GCancellable *cancellable) {
+  (void)source_object;
+  (void)cancellable;
+  GError *error = NULL;
+  LoadedSheet *sheet = load_sheet((const char *)task_data, &error);
+  if (sheet)
+    g_task_return_pointer(task, sheet, loaded_sheet_free);
+  else
+    g_task_return_error(task, error);
+}
+
+static void on_load_done(GObject *source_object, GAsyncResult *res,
+                         gpointer user_data) {
+  (void)user_data;
+  GTask *task = G_TASK(res);
+  const char *path = (const char *)g_task_get_task_data(task);
+  // Superseded by another load, or the viewer is going away
+  if (g_cancellable_is_cancelled(g_task_get_cancellable(task)))
+    return;
+  ViewerData *data =
+      (ViewerData *)g_object_get_data(source_object, "viewer-data");
+  if (!data)
+    return;
+  g_clear_object(&data->loading);
+
+  GError *error = NULL;
+  LoadedSheet *sheet = g_task_propagate_pointer(task, &error);
+  if (!sheet) {
+    LOG_WARN("Failed to load as Image or PDF %s: %s", path, error->message);
+    g_error_free(error);
+    gtk_widget_queue_draw(data->drawing_area);
+    return;
+  }
+  viewer_take(data, sheet, path);
+  loaded_sheet_free(sheet);
+}
+
+void cheeter_viewer_load_file_async(GtkWidget *viewer, const char *path) {
+  ViewerData *data =
+      (ViewerData *)g_object_get_data(G_OBJECT(viewer), "viewer-data");
+  if (!data)
+    return;
 
-  // Load page 0
-  load_page(data, 0);
+  viewer_clear(data);
+  if (!path) {
+    gtk_widget_queue_draw(data->drawing_area);
+    return;
+  }
+
+  // The task holds the viewer, so it outlives the load
+  data->loading = g_cancellable_new();
+  GTask *task = g_task_new(viewer, data->loading, on_load_done, NULL);
+  g_task_set_task_data(task, g_strdup(path), g_free);
+  g_task_run_in_thread(task, load_thread);
+  g_object_unref(task);
+  gtk_widget_queue_draw(data->drawing_area);
 }
 
 gboolean cheeter_viewer_get_page_size(GtkWidget *viewer, double *width,
@@ -191,6 +428,8 @@ void cheeter_viewer_set_scale(GtkWidget *viewer, double scale) {
   if (!data)
     return;
 
+  if (scale != data->scale)
+    viewer_drop_surface(data);
   data->scale = scale;
 
   // Update drawing area size for new scale
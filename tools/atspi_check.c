@@ -0,0 +1,266 @@
+// Checks the Wayland backend against a stub AT-SPI application, on the bus
+// AT_SPI_BUS_ADDRESS names. tools/atspi_check.sh sets up a private one.
+//
+//   atspi_check                  start a stub and follow it
+//   atspi_check --legacy         same, the stub sending the older
+//                                (siiv(so)) event body
+//   atspi_check --stub [--legacy]
+//                                be the stub: the registry, plus one
+//                                application that activates a window as soon
+//                                as somebody registers for window events
+//
+// Passes if the backend reports the stub's name, toolkit, window title and
+// executable, both through the active app callback and from the hotkey's
+// cached read.
+
+#include "cheeter/backend.h"
+#include "cheeter/log.h"
+#include <gio/gio.h>
+#include <glib.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define STUB_NAME "cheeter-stub"
+#define STUB_TOOLKIT "StubKit"
+#define STUB_TITLE "Stub Window"
+#define TIMEOUT_MS 5000
+
+#define ATSPI_ROOT_PATH "/org/a11y/atspi/accessible/root"
+#define ATSPI_REGISTRY_NAME "org.a11y.atspi.Registry"
+#define ATSPI_REGISTRY_PATH "/org/a11y/atspi/registry"
+
+static GDBusConnection *bus_connect(void) {
+  const char *address = g_getenv("AT_SPI_BUS_ADDRESS");
+  if (!address || !*address) {
+    fprintf(stderr, "AT_SPI_BUS_ADDRESS is not set; run atspi_check.sh\n");
+    return NULL;
+  }
+  GError *error = NULL;
+  GDBusConnection *bus = g_dbus_connection_new_for_address_sync(
+      address,
+      G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+          G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+      NULL, NULL, &error);
+  if (!bus) {
+    fprintf(stderr, "%s: %s\n", address, error->message);
+    g_error_free(error);
+  }
+  return bus;
+}
+
+// ---- The stub ----
+
+static const char stub_xml[] =
+    "<node>"
+    "  <interface name='org.a11y.atspi.Registry'>"
+    "    <method name='RegisterEvent'><arg type='s' direction='in'/></method>"
+    "  </interface>"
+    "  <interface name='org.a11y.atspi.Accessible'>"
+    "    <property name='Name' type='s' access='read'/>"
+    "  </interface>"
+    "  <interface name='org.a11y.atspi.Application'>"
+    "    <property name='ToolkitName' type='s' access='read'/>"
+    "  </interface>"
+    "</node>";
+
+static bool stub_legacy;
+
+static void stub_activate(GDBusConnection *bus) {
+  GVariant *title = g_variant_new_string(STUB_TITLE);
+  GVariant *params =
+      stub_legacy
+          ? g_variant_new("(siiv(so))", "", 0, 0, title,
+                          g_dbus_connection_get_unique_name(bus),
+                          ATSPI_ROOT_PATH)
+          : g_variant_new("(siiv@a{sv})", "", 0, 0, title,
+                          g_variant_new_array(G_VARIANT_TYPE("{sv}"), NULL,
+                                              0));
+  g_dbus_connection_emit_signal(bus, NULL, ATSPI_ROOT_PATH,
+                                "org.a11y.atspi.Event.Window", "Activate",
+                                params, NULL);
+}
+
+static void on_stub_call(GDBusConnection *bus, const char *sender,
+                         const char *path, const char *interface,
+                         const char *method, GVariant *params,
+                         GDBusMethodInvocation *invocation,
+                         gpointer user_data) {
+  (void)sender;
+  (void)path;
+  (void)interface;
+  (void)method;
+  (void)user_data;
+  const char *event = NULL;
+  g_variant_get(params, "(&s)", &event);
+  bool activate = strcmp(event, "window:activate") == 0;
+  g_dbus_method_invocation_return_value(invocation, NULL);
+  // The listener subscribed before registering, so it sees this
+  if (activate)
+    stub_activate(bus);
+}
+
+static GVariant *on_stub_get_property(GDBusConnection *bus,
+                                      const char *sender, const char *path,
+                                      const char *interface,
+                                      const char *property, GError **error,
+                                      gpointer user_data) {
+  (void)bus;
+  (void)sender;
+  (void)path;
+  (void)interface;
+  (void)error;
+  (void)user_data;
+  return g_variant_new_string(strcmp(property, "Name") == 0 ? STUB_NAME
+                                                             : STUB_TOOLKIT);
+}
+
+static const GDBusInterfaceVTable stub_vtable = {on_stub_call,
+                                                 on_stub_get_property, NULL,
+                                                 {0}};
+
+static int run_stub(void) {
+  GDBusConnection *bus = bus_connect();
+  if (!bus)
+    return 1;
+  GDBusNodeInfo *info = g_dbus_node_info_new_for_xml(stub_xml, NULL);
+  g_dbus_connection_register_object(bus, ATSPI_REGISTRY_PATH,
+                                    info->interfaces[0], &stub_vtable, NULL,
+                                    NULL, NULL);
+  for (int i = 1; i <= 2; i++)
+    g_dbus_connection_register_object(bus, ATSPI_ROOT_PATH,
+                                      info->interfaces[i], &stub_vtable, NULL,
+                                      NULL, NULL);
+  g_bus_own_name_on_connection(bus, ATSPI_REGISTRY_NAME,
+                               G_BUS_NAME_OWNER_FLAGS_NONE, NULL, NULL, NULL,
+                               NULL);
+  // Until the check kills us
+  g_main_loop_run(g_main_loop_new(NULL, FALSE));
+  return 0;
+}
+
+// ---- The check ----
+
+#ifdef CHEETER_HAVE_ATSPI
+
+typedef struct {
+  GMainLoop *loop;
+  char *exe;
+  bool passed;
+} Check;
+
+static bool identity_matches(const AppIdentity *id, const char *exe) {
+  return g_strcmp0(id->wm_class, STUB_NAME) == 0 &&
+         g_strcmp0(id->toolkit, STUB_TOOLKIT) == 0 &&
+         g_strcmp0(id->title, STUB_TITLE) == 0 &&
+         g_strcmp0(id->exe_path, exe) == 0;
+}
+
+static void on_active_app(AppIdentity *id, void *user_data) {
+  Check *check = (Check *)user_data;
+  printf("active app: name=%s toolkit=%s title=%s exe=%s\n", id->wm_class,
+         id->toolkit, id->title, id->exe_path);
+  check->passed = identity_matches(id, check->exe);
+  g_main_loop_quit(check->loop);
+}
+
+static gboolean on_timeout(gpointer user_data) {
+  Check *check = (Check *)user_data;
+  printf("no active app within %d ms\n", TIMEOUT_MS);
+  g_main_loop_quit(check->loop);
+  return G_SOURCE_REMOVE;
+}
+
+// Waits for the stub to take the registry's name, so the backend's event
+// registrations reach it
+static bool wait_for_stub(void) {
+  GDBusConnection *bus = bus_connect();
+  if (!bus)
+    return false;
+  bool owned = false;
+  for (int waited = 0; !owned && waited < TIMEOUT_MS; waited += 10) {
+    GVariant *reply = g_dbus_connection_call_sync(
+        bus, "org.freedesktop.DBus", "/org/freedesktop/DBus",
+        "org.freedesktop.DBus", "NameHasOwner",
+        g_variant_new("(s)", ATSPI_REGISTRY_NAME), G_VARIANT_TYPE("(b)"),
+        G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL);
+    if (reply) {
+      gboolean has_owner = FALSE;
+      g_variant_get(reply, "(b)", &has_owner);
+      g_variant_unref(reply);
+      owned = has_owner;
+    }
+    if (!owned)
+      g_usleep(10 * 1000);
+  }
+  g_object_unref(bus);
+  return owned;
+}
+
+static int run_check(void) {
+  char *self = g_file_read_link("/proc/self/exe", NULL);
+  char *stub_argv[] = {self, (char *)"--stub",
+                       stub_legacy ? (char *)"--legacy" : NULL, NULL};
+  GPid stub_pid;
+  GError *error = NULL;
+  if (!g_spawn_async(NULL, stub_argv, NULL, G_SPAWN_DEFAULT, NULL, NULL,
+                     &stub_pid, &error)) {
+    fprintf(stderr, "Could not start the stub: %s\n", error->message);
+    g_error_free(error);
+    g_free(self);
+    return 1;
+  }
+
+  Check check = {g_main_loop_new(NULL, FALSE), self, false};
+  CheeterBackend *backend = cheeter_backend_wayland_new();
+  if (wait_for_stub() && backend->init(backend, NULL, NULL, NULL)) {
+    backend->set_active_app_callback(backend, on_active_app, &check);
+    guint timeout = g_timeout_add(TIMEOUT_MS, on_timeout, &check);
+    g_main_loop_run(check.loop);
+    g_source_remove(timeout);
+  } else {
+    printf("could not reach the stub on the AT-SPI bus\n");
+  }
+
+  // What the hotkey would see: a read of what the event left behind
+  if (check.passed) {
+    AppIdentity *id = backend->get_active_app(backend);
+    check.passed = id && identity_matches(id, self);
+    if (!check.passed)
+      printf("cached identity differs from the one reported\n");
+    cheeter_app_identity_free(id);
+  }
+  backend->cleanup(backend);
+  g_free(backend);
+
+  kill(stub_pid, SIGTERM);
+  g_spawn_close_pid(stub_pid);
+  g_main_loop_unref(check.loop);
+  g_free(self);
+  printf("%s (%s events)\n", check.passed ? "PASS" : "FAIL",
+         stub_legacy ? "(siiv(so))" : "(siiva{sv})");
+  return check.passed ? 0 : 1;
+}
+#else
+static int run_check(void) {
+  fprintf(stderr, "Built without AT-SPI support\n");
+  return 1;
+}
+#endif
+
+int main(int argc, char *argv[]) {
+  cheeter_log_init(g_getenv("CHEETER_DEBUG") != NULL);
+  bool stub = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--stub") == 0) {
+      stub = true;
+    } else if (strcmp(argv[i], "--legacy") == 0) {
+      stub_legacy = true;
+    } else {
+      fprintf(stderr, "Usage: %s [--stub] [--legacy]\n", argv[0]);
+      return 2;
+    }
+  }
+  return stub ? run_stub() : run_check();
+}
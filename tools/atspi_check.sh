@@ -0,0 +1,11 @@
+#!/bin/sh
+# Runs atspi_check on a private session bus standing in for the
+# accessibility bus, once for each form of event body.
+#
+#   tools/atspi_check.sh [PATH-TO-atspi_check]
+
+check=${1:-./atspi_check}
+exec dbus-run-session -- sh -c '
+  export AT_SPI_BUS_ADDRESS="$DBUS_SESSION_BUS_ADDRESS"
+  "$0" && "$0" --legacy
+' "$check"
@@ -0,0 +1,236 @@
+// Benchmarks the sheet index against a synthetic tree of empty sheets.
+//
+//   index_bench              index 100k sheets and report
+//   index_bench N            index N sheets instead
+//
+// Sheets are spread over SHEETS_PER_DIR-sized directories, and one in
+// SHADOW_EVERY repeats a name from the directory before, so elections and
+// shadowed entries are part of the picture.
+//
+// The scan writes the index cache, which is then loaded CACHE_RUNS times
+// into a fresh index: cold, with the file's pages dropped from the page
+// cache first, and warm. The tree is deleted before, so a load that fell
+// back to scanning would find nothing and be reported.
+//
+// Only the public cheeter_index_* API is used, so the same file builds
+// against older trees: `make bench-index-baseline` compares with the index
+// as it was before the entry array.
+
+#define _XOPEN_SOURCE 700
+#include "cheeter/index.h"
+#include "cheeter/log.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <glib.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define DEFAULT_SHEETS 100000
+#define SHEETS_PER_DIR 1000
+#define SHADOW_EVERY 10
+#define LOOKUP_RUNS 1000000
+#define CACHE_RUNS 20
+
+// Whether the i'th sheet written repeats the name of one in the directory
+// before, instead of bringing a name of its own
+static bool shadows(int i) {
+  return i % SHADOW_EVERY == 0 && i >= SHEETS_PER_DIR;
+}
+
+static bool write_tree(const char *root, int n) {
+  char path[4096];
+  for (int i = 0; i < n; i++) {
+    int dir = i / SHEETS_PER_DIR;
+    if (i % SHEETS_PER_DIR == 0) {
+      snprintf(path, sizeof(path), "%s/group-%04d", root, dir);
+      if (g_mkdir_with_parents(path, 0755) < 0) {
+        fprintf(stderr, "mkdir %s: %s\n", path, g_strerror(errno));
+        return false;
+      }
+    }
+    int name = shadows(i) ? i - SHEETS_PER_DIR : i;
+    snprintf(path, sizeof(path), "%s/group-%04d/tool-%06d.pdf", root, dir,
+             name);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      fprintf(stderr, "%s: %s\n", path, g_strerror(errno));
+      return false;
+    }
+    close(fd);
+  }
+  return true;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag,
+                        struct FTW *ftw) {
+  (void)st;
+  (void)flag;
+  (void)ftw;
+  return remove(path);
+}
+
+static size_t heap_in_use(void) {
+  return mallinfo2().uordblks;
+}
+
+// Writes back and evicts path's pages, so the next read comes from disk
+static void drop_page_cache(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return;
+  fdatasync(fd);
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  close(fd);
+}
+
+// Mean us to start an index over root from the cache at cache_path. *loaded
+// is false if some start didn't come from the cache.
+static double bench_cache_load(const char *root, const char *cache_path,
+                               bool cold, bool *loaded) {
+  const char *roots[] = {root, NULL};
+  gint64 total = 0;
+  *loaded = true;
+  for (int i = 0; i < CACHE_RUNS; i++) {
+    if (cold)
+      drop_page_cache(cache_path);
+    gint64 start = g_get_monotonic_time();
+    SheetIndex *index = cheeter_index_new();
+    cheeter_index_set_cache(index, cache_path);
+    cheeter_index_scan_roots(index, roots);
+    total += g_get_monotonic_time() - start;
+
+    char *path = cheeter_index_lookup(index, "tool-000000");
+    *loaded = *loaded && path;
+    g_free(path);
+    cheeter_index_free(index);
+  }
+  return (double)total / CACHE_RUNS;
+}
+
+// Looks every name written up; *expected gets how many there are
+static int count_visible(SheetIndex *index, int n, int *expected) {
+  int visible = 0;
+  *expected = 0;
+  for (int i = 0; i < n; i++) {
+    if (shadows(i))
+      continue;
+    (*expected)++;
+    char *name = g_strdup_printf("tool-%06d", i);
+    char *path = cheeter_index_lookup(index, name);
+    if (path)
+      visible++;
+    g_free(path);
+    g_free(name);
+  }
+  return visible;
+}
+
+// Mean ns per lookup of names, cycling through them
+static double bench_lookups(SheetIndex *index, char **names, int n_names,
+                            int *found) {
+  *found = 0;
+  gint64 start = g_get_monotonic_time();
+  for (int i = 0; i < LOOKUP_RUNS; i++) {
+    char *path = cheeter_index_lookup(index, names[i % n_names]);
+    if (path)
+      (*found)++;
+    g_free(path);
+  }
+  return (g_get_monotonic_time() - start) * 1000.0 / LOOKUP_RUNS;
+}
+
+int main(int argc, char *argv[]) {
+  cheeter_log_init(0);
+  // One arena, so the scan threads' allocations are counted too
+  mallopt(M_ARENA_MAX, 1);
+
+  int n = argc > 1 ? atoi(argv[1]) : DEFAULT_SHEETS;
+  if (argc > 2 || n <= 0) {
+    fprintf(stderr, "Usage: %s [N]\n", argv[0]);
+    return 2;
+  }
+
+  char *tmp = g_dir_make_tmp("cheeter-index-XXXXXX", NULL);
+  if (!tmp) {
+    fprintf(stderr, "Could not create a temporary directory\n");
+    return 1;
+  }
+  char *root = g_build_filename(tmp, "sheets", NULL);
+  char *cache_path = g_build_filename(tmp, "sheets.idx", NULL);
+  const char *roots[] = {root, NULL};
+  bool ok = write_tree(root, n);
+
+  if (ok) {
+    size_t before = heap_in_use();
+    gint64 start = g_get_monotonic_time();
+    SheetIndex *index = cheeter_index_new();
+    cheeter_index_set_cache(index, cache_path);
+    cheeter_index_scan_roots(index, roots);
+    double scan_ms = (g_get_monotonic_time() - start) / 1000.0;
+    size_t heap = heap_in_use() - before;
+    int expected;
+    int visible = count_visible(index, n, &expected);
+
+    int n_names = MAX(n / 2, 1);
+    char **hits = g_new(char *, n_names);
+    char **misses = g_new(char *, n_names);
+    GRand *rand = g_rand_new_with_seed(n);
+    for (int i = 0; i < n_names; i++) {
+      // Names that were replaced by a shadowing one don't exist
+      int name = g_rand_int_range(rand, 0, MAX(n - 1, 1));
+      if (shadows(name))
+        name++;
+      hits[i] = g_strdup_printf("tool-%06d", name);
+      misses[i] = g_strdup_printf("tool-%06d-x", i);
+    }
+    int found_hits, found_misses;
+    double hit_ns = bench_lookups(index, hits, n_names, &found_hits);
+    double miss_ns = bench_lookups(index, misses, n_names, &found_misses);
+
+    printf("%8s  %8s  %10s  %10s  %10s  %10s  %10s\n", "sheets", "visible",
+           "scan ms", "heap KiB", "B/sheet", "hit ns", "miss ns");
+    printf("%8d  %8d  %10.1f  %10zu  %10.1f  %10.1f  %10.1f\n", n, visible,
+           scan_ms, heap / 1024, (double)heap / n, hit_ns, miss_ns);
+    ok = visible == expected && found_hits == LOOKUP_RUNS && found_misses == 0;
+    if (!ok)
+      printf("WRONG: %d of %d names resolved, %d of %d hits and %d misses "
+             "found\n",
+             visible, expected, found_hits, LOOKUP_RUNS, found_misses);
+
+    for (int i = 0; i < n_names; i++) {
+      g_free(hits[i]);
+      g_free(misses[i]);
+    }
+    g_free(hits);
+    g_free(misses);
+    g_rand_free(rand);
+    cheeter_index_free(index);
+  }
+
+  if (ok) {
+    nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    bool cold_loaded, warm_loaded;
+    double cold_us = bench_cache_load(root, cache_path, true, &cold_loaded);
+    double warm_us = bench_cache_load(root, cache_path, false, &warm_loaded);
+    struct stat st;
+    off_t cache_size = stat(cache_path, &st) == 0 ? st.st_size : 0;
+    printf("\n%10s  %10s  %10s\n", "cache KiB", "cold us", "warm us");
+    printf("%10jd  %10.1f  %10.1f\n", (intmax_t)cache_size / 1024, cold_us,
+           warm_us);
+    ok = cold_loaded && warm_loaded;
+    if (!ok)
+      printf("WRONG: the cache was not loaded, the index was rescanned\n");
+  }
+
+  nftw(tmp, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+  g_free(cache_path);
+  g_free(root);
+  g_free(tmp);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,328 @@
+// Benchmarks window-process resolution against synthetic procfs trees.
+//
+//   proc_bench                         run the 1k/10k/50k matrix
+//   proc_bench generate DIR N DEPTH    write one tree and keep it
+//
+// A tree has a terminal (the window's process) running a handful of shells.
+// The shell whose WINDOWID matches runs a foreground job nested DEPTH deep
+// plus a background job; everything else hangs off init as random subtrees.
+
+#define _XOPEN_SOURCE 700
+#include "cheeter/log.h"
+#include "cheeter/proc.h"
+#include <errno.h>
+#include <ftw.h>
+#include <glib.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FAKE_TTY 34816 // pts/0
+#define FAKE_WINDOW_ID 4194311UL
+// Above any real pid_max, so no fake pid is ever our own (the resolver skips
+// getpid()). Init stays pid 1.
+#define FAKE_PID_BASE 5000000
+#define TERMINAL_PID (FAKE_PID_BASE + 1)
+#define SHELL_COUNT 4
+#define BENCH_DEPTH 8
+// Each measurement repeats for BENCH_RUNS or BENCH_BUDGET_US, whichever
+// comes first (snapshot mode reads every stat file per resolution)
+#define BENCH_RUNS 200
+#define BENCH_BUDGET_US (500 * 1000)
+
+typedef struct {
+  pid_t pid;
+  pid_t ppid;
+  pid_t pgrp;
+  int tty_nr;
+  pid_t tpgid;
+  unsigned long window_id;
+  const char *comm;
+  GArray *children;
+} FakeProc;
+
+typedef struct {
+  GPtrArray *procs; // FakeProc*, in pid order
+  pid_t expected;   // What resolution should find
+} FakeTree;
+
+static FakeProc *fake_get(FakeTree *tree, pid_t pid) {
+  guint index = pid == 1 ? 0 : pid - FAKE_PID_BASE;
+  return g_ptr_array_index(tree->procs, index);
+}
+
+static FakeProc *fake_add(FakeTree *tree, pid_t ppid, const char *comm) {
+  FakeProc *p = g_new0(FakeProc, 1);
+  p->pid = tree->procs->len ? FAKE_PID_BASE + tree->procs->len : 1;
+  p->ppid = ppid;
+  p->pgrp = p->pid;
+  p->comm = comm;
+  p->children = g_array_new(FALSE, FALSE, sizeof(pid_t));
+  g_ptr_array_add(tree->procs, p);
+  if (ppid > 0) {
+    FakeProc *parent = fake_get(tree, ppid);
+    g_array_append_val(parent->children, p->pid);
+  }
+  return p;
+}
+
+static void fake_proc_free(gpointer data) {
+  FakeProc *p = data;
+  g_array_unref(p->children);
+  g_free(p);
+}
+
+static FakeTree *fake_tree_build(int n, int depth) {
+  FakeTree *tree = g_new0(FakeTree, 1);
+  tree->procs = g_ptr_array_new_with_free_func(fake_proc_free);
+  GRand *rand = g_rand_new_with_seed(n);
+
+  fake_add(tree, 0, "systemd");
+  fake_add(tree, 1, "xterm");
+
+  // Only the last shell has the window's WINDOWID, so the walk can't get
+  // lucky on the first child
+  for (int i = 0; i < SHELL_COUNT; i++) {
+    FakeProc *shell = fake_add(tree, TERMINAL_PID, "bash");
+    shell->tty_nr = FAKE_TTY + i;
+    shell->tpgid = shell->pgrp;
+    shell->window_id = i == SHELL_COUNT - 1 ? FAKE_WINDOW_ID : 1;
+    if (i < SHELL_COUNT - 1)
+      continue;
+
+    // Background job first, so picking the first child would be wrong
+    FakeProc *bg = fake_add(tree, shell->pid, "sleep");
+    bg->tty_nr = shell->tty_nr;
+    bg->tpgid = 0; // Set below once the foreground job exists
+
+    pid_t parent = shell->pid;
+    pid_t job_pgrp = 0;
+    for (int d = 0; d < depth; d++) {
+      FakeProc *p = fake_add(tree, parent, d == depth - 1 ? "vim" : "make");
+      if (!job_pgrp)
+        job_pgrp = p->pid;
+      p->pgrp = job_pgrp;
+      p->tty_nr = shell->tty_nr;
+      parent = p->pid;
+      tree->expected = p->pid;
+    }
+    if (job_pgrp)
+      shell->tpgid = job_pgrp;
+    else
+      tree->expected = shell->pid;
+  }
+
+  // Fix up tpgid for everything on the active shell's terminal
+  FakeProc *active = fake_get(tree, TERMINAL_PID + SHELL_COUNT);
+  for (guint i = 0; i < tree->procs->len; i++) {
+    FakeProc *p = g_ptr_array_index(tree->procs, i);
+    if (p->tty_nr == active->tty_nr)
+      p->tpgid = active->tpgid;
+  }
+
+  // Filler: random subtrees under init, up to depth levels deep
+  while ((int)tree->procs->len < n) {
+    pid_t parent = 1;
+    if (tree->procs->len > 16 && g_rand_int_range(rand, 0, 3) > 0) {
+      FakeProc *candidate = g_ptr_array_index(
+          tree->procs, g_rand_int_range(rand, 16, tree->procs->len));
+      int level = 0;
+      for (FakeProc *q = candidate; q->ppid > 1 && level <= depth; level++)
+        q = fake_get(tree, q->ppid);
+      if (level < depth)
+        parent = candidate->pid;
+    }
+    fake_add(tree, parent, "worker");
+  }
+
+  g_rand_free(rand);
+  return tree;
+}
+
+static void fake_tree_free(FakeTree *tree) {
+  g_ptr_array_unref(tree->procs);
+  g_free(tree);
+}
+
+static bool write_file(const char *path, const char *data, gssize len) {
+  FILE *f = fopen(path, "w");
+  if (!f) {
+    fprintf(stderr, "%s: %s\n", path, g_strerror(errno));
+    return false;
+  }
+  fwrite(data, 1, len < 0 ? strlen(data) : (size_t)len, f);
+  return fclose(f) == 0;
+}
+
+static bool fake_tree_write(FakeTree *tree, const char *root,
+                            bool children_files) {
+  for (guint i = 0; i < tree->procs->len; i++) {
+    FakeProc *p = g_ptr_array_index(tree->procs, i);
+    char *dir = g_strdup_printf("%s/%d/task/%d", root, p->pid, p->pid);
+    if (g_mkdir_with_parents(dir, 0755) < 0) {
+      fprintf(stderr, "mkdir %s: %s\n", dir, g_strerror(errno));
+      g_free(dir);
+      return false;
+    }
+    g_free(dir);
+
+    char path[PATH_MAX];
+    char *data;
+    bool ok = true;
+
+    // starttime is the 22nd field; pid stands in for it
+    data = g_strdup_printf("%d (%s) S %d %d %d %d %d 4194560 0 0 0 0 0 0 0 0 "
+                           "20 0 1 0 %d 0 0\n",
+                           p->pid, p->comm, p->ppid, p->pgrp, p->pgrp,
+                           p->tty_nr, p->tpgid, p->pid);
+    snprintf(path, sizeof(path), "%s/%d/stat", root, p->pid);
+    ok &= write_file(path, data, -1);
+    g_free(data);
+
+    GString *env = g_string_new("HOME=/home/bench");
+    g_string_append_c(env, '\0');
+    if (p->window_id) {
+      g_string_append_printf(env, "WINDOWID=%lu", p->window_id);
+      g_string_append_c(env, '\0');
+    }
+    snprintf(path, sizeof(path), "%s/%d/environ", root, p->pid);
+    ok &= write_file(path, env->str, env->len);
+    g_string_free(env, TRUE);
+
+    snprintf(path, sizeof(path), "%s/%d/cgroup", root, p->pid);
+    ok &= write_file(path, "0::/user.slice\n", -1);
+
+    char target[64];
+    snprintf(target, sizeof(target), "/usr/bin/%s", p->comm);
+    snprintf(path, sizeof(path), "%s/%d/exe", root, p->pid);
+    if (symlink(target, path) < 0)
+      ok = false;
+
+    if (children_files) {
+      GString *children = g_string_new(NULL);
+      for (guint c = 0; c < p->children->len; c++)
+        g_string_append_printf(children, "%d ",
+                               g_array_index(p->children, pid_t, c));
+      snprintf(path, sizeof(path), "%s/%d/task/%d/children", root, p->pid,
+               p->pid);
+      ok &= write_file(path, children->str, children->len);
+      g_string_free(children, TRUE);
+    }
+    if (!ok)
+      return false;
+  }
+  return true;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag,
+                        struct FTW *ftw) {
+  (void)st;
+  (void)flag;
+  (void)ftw;
+  return remove(path);
+}
+
+typedef struct {
+  double us;
+  double syscalls;
+  bool correct;
+} BenchResult;
+
+static double io_total(void) {
+  ProcIoStats st;
+  cheeter_proc_get_io_stats(&st);
+  return st.opens + st.reads + st.readlinks + st.opendirs;
+}
+
+// warm: one resolver throughout, so the environ cache is hot after the first
+// run, as it is for repeated hotkey presses
+static BenchResult bench_resolve(FakeTree *tree, bool warm) {
+  BenchResult result = {0, 0, true};
+  ProcResolver *resolver = warm ? cheeter_proc_resolver_new() : NULL;
+  if (warm) // Prime the cache outside the measurement
+    cheeter_proc_resolver_deepest_child(resolver, TERMINAL_PID,
+                                        FAKE_WINDOW_ID);
+
+  cheeter_proc_reset_io_stats();
+  gint64 start = g_get_monotonic_time();
+  int runs = 0;
+  while (runs < BENCH_RUNS &&
+         (runs < 3 || g_get_monotonic_time() - start < BENCH_BUDGET_US)) {
+    runs++;
+    ProcResolver *r = warm ? resolver : cheeter_proc_resolver_new();
+    pid_t pid =
+        cheeter_proc_resolver_deepest_child(r, TERMINAL_PID, FAKE_WINDOW_ID);
+    if (pid != tree->expected)
+      result.correct = false;
+    char *exe = cheeter_proc_read_exe(pid);
+    g_free(exe);
+    if (!warm)
+      cheeter_proc_resolver_free(r);
+  }
+  result.us = (g_get_monotonic_time() - start) / (double)runs;
+  result.syscalls = io_total() / runs;
+  cheeter_proc_resolver_free(resolver);
+  return result;
+}
+
+static bool bench_one(int n, bool children_files) {
+  char *root = g_dir_make_tmp("cheeter-proc-XXXXXX", NULL);
+  if (!root) {
+    fprintf(stderr, "Could not create a temporary directory\n");
+    return false;
+  }
+
+  FakeTree *tree = fake_tree_build(n, BENCH_DEPTH);
+  bool ok = fake_tree_write(tree, root, children_files);
+  if (ok) {
+    cheeter_proc_set_root(root);
+    BenchResult cold = bench_resolve(tree, false);
+    BenchResult warm = bench_resolve(tree, true);
+    printf("%6d  %-9s  %10.1f  %8.1f  %10.1f  %8.1f  %s\n", n,
+           children_files ? "children" : "snapshot", cold.us, cold.syscalls,
+           warm.us, warm.syscalls,
+           cold.correct && warm.correct ? "ok" : "WRONG");
+    fflush(stdout);
+    ok = cold.correct && warm.correct;
+    cheeter_proc_set_root(NULL);
+  }
+
+  fake_tree_free(tree);
+  nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+  g_free(root);
+  return ok;
+}
+
+int main(int argc, char *argv[]) {
+  cheeter_log_init(0);
+
+  if (argc == 5 && strcmp(argv[1], "generate") == 0) {
+    FakeTree *tree = fake_tree_build(atoi(argv[3]), atoi(argv[4]));
+    bool ok = fake_tree_write(tree, argv[2], true);
+    printf("Wrote %u processes to %s; resolve from pid %d with WINDOWID "
+           "%lu, expect %d\n",
+           tree->procs->len, argv[2], TERMINAL_PID, FAKE_WINDOW_ID,
+           tree->expected);
+    fake_tree_free(tree);
+    return ok ? 0 : 1;
+  }
+  if (argc != 1) {
+    fprintf(stderr, "Usage: %s [generate DIR N DEPTH]\n", argv[0]);
+    return 2;
+  }
+
+  printf("Resolution from the terminal to a job %d deep, up to %d runs each\n",
+         BENCH_DEPTH, BENCH_RUNS);
+  printf("%6s  %-9s  %10s  %8s  %10s  %8s\n", "procs", "mode", "cold us",
+         "syscalls", "warm us", "syscalls");
+  bool ok = true;
+  int sizes[] = {1000, 10000, 50000};
+  for (guint i = 0; i < G_N_ELEMENTS(sizes); i++) {
+    ok &= bench_one(sizes[i], true);
+    ok &= bench_one(sizes[i], false);
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,98 @@
+// Packs a directory of sheets into one bundle.
+//
+//   cheeter-pack BUNDLE DIR     pack every sheet under DIR into BUNDLE
+//
+// Sheets keep their path relative to DIR as their name in the bundle, and
+// have their page count and size read now, so cheeterd needn't open them
+// to index them. BUNDLE should end in .sheets to be picked up from a sheet
+// root.
+
+#include "cheeter/bundle.h"
+#include "cheeter/log.h"
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+
+bool cheeter_sheet_probe(const char *path, guint *n_pages, double *width,
+                         double *height);
+
+static bool is_sheet(const char *filename) {
+  return g_str_has_suffix(filename, ".pdf") ||
+         g_str_has_suffix(filename, ".png") ||
+         g_str_has_suffix(filename, ".jpg") ||
+         g_str_has_suffix(filename, ".jpeg");
+}
+
+// Adds the sheets under dir, named relative to the top, to files (char*,
+// full paths). Hidden entries are skipped, as the indexer skips them.
+static void collect(const char *dir, GPtrArray *files) {
+  GError *error = NULL;
+  GDir *d = g_dir_open(dir, 0, &error);
+  if (!d) {
+    fprintf(stderr, "%s\n", error->message);
+    g_error_free(error);
+    return;
+  }
+  const char *name;
+  while ((name = g_dir_read_name(d)) != NULL) {
+    if (name[0] == '.')
+      continue;
+    char *path = g_build_filename(dir, name, NULL);
+    if (g_file_test(path, G_FILE_TEST_IS_DIR) &&
+        !g_file_test(path, G_FILE_TEST_IS_SYMLINK)) {
+      collect(path, files);
+      g_free(path);
+    } else if (is_sheet(name) &&
+               g_file_test(path, G_FILE_TEST_IS_REGULAR)) {
+      g_ptr_array_add(files, path);
+    } else {
+      g_free(path);
+    }
+  }
+  g_dir_close(d);
+}
+
+int main(int argc, char *argv[]) {
+  cheeter_log_init(0);
+  if (argc != 3) {
+    fprintf(stderr, "Usage: %s BUNDLE DIR\n", argv[0]);
+    return 2;
+  }
+  const char *out = argv[1];
+  char *top = g_canonicalize_filename(argv[2], NULL);
+
+  GPtrArray *files = g_ptr_array_new_with_free_func(g_free);
+  collect(top, files);
+  if (files->len == 0) {
+    fprintf(stderr, "No sheets found in %s\n", top);
+    g_ptr_array_unref(files);
+    g_free(top);
+    return 1;
+  }
+
+  size_t prefix = strlen(top) + 1;
+  BundleInput *inputs = g_new0(BundleInput, files->len);
+  for (guint i = 0; i < files->len; i++) {
+    BundleInput *in = &inputs[i];
+    in->file = g_ptr_array_index(files, i);
+    in->name = in->file + prefix;
+    // Left at 0 pages, the viewer sizes the sheet once loaded
+    if (!cheeter_sheet_probe(in->file, &in->n_pages, &in->page_width,
+                             &in->page_height))
+      fprintf(stderr, "Could not read pages of %s\n", in->file);
+  }
+
+  GError *error = NULL;
+  bool ok = cheeter_bundle_write(out, inputs, files->len, &error);
+  if (ok) {
+    printf("Packed %u sheets into %s\n", files->len, out);
+  } else {
+    fprintf(stderr, "%s\n", error->message);
+    g_error_free(error);
+  }
+
+  g_free(inputs);
+  g_ptr_array_unref(files);
+  g_free(top);
+  return ok ? 0 : 1;
+}